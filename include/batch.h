@@ -0,0 +1,105 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "core.h"
+#include "movie.h"
+#include "rom.h"
+#include "snapshot.h"
+
+/*
+ * One scenario from a job list and, once it has run, its
+ * result. Each job is only written by the worker running it.
+ */
+typedef struct batch_job_t {
+    // from the job list
+    char                *rom_path;
+    int                 manifest;       // rom_path is a ROM set manifest
+    uint64_t            max_instrs;
+    Engine              engine;
+    int                 line;
+
+    // snapshot to start from instead of reset, or NULL
+    char                *snapshot_path;
+
+    // movie to replay, or NULL; each job has its own copy
+    char                *movie_path;
+    Movie               *movie;
+
+    // index into Batch.roms, shared with every job on the same ROM,
+    // and into Batch.seeds if the job has a snapshot (else -1)
+    size_t              rom;
+    long                seed;
+
+    // results, filled in by batch_run
+    int                 status;         // 0, or -1 if it couldn't run
+    int                 halted;
+    int                 movie_end;      // ran to the end of the movie
+    int                 diverged;       // a movie hash didn't match
+    uint32_t            frames;
+    uint16_t            pc;
+    uint64_t            instructions;
+    uint64_t            cycles;
+    uint64_t            ram_hash;       // FNV-1a of guest memory at the end
+    double              secs;
+    int                 worker;
+} BatchJob;
+
+// a snapshot and the shared image its jobs fork from
+typedef struct batch_seed_t {
+    Snapshot            *snap;
+    RomImage            image;
+} BatchSeed;
+
+typedef struct batch_t {
+    BatchJob            *jobs;
+    size_t              count;
+
+    // each distinct ROM is loaded once; the instances all map
+    // it copy-on-write, so the images are never written
+    RomImage            *roms;
+    size_t              rom_count;
+
+    // likewise for snapshots, one per snapshot and ROM
+    BatchSeed           *seeds;
+    size_t              seed_count;
+} Batch;
+
+
+/*
+ * Reads a job list, one job per line:
+ *
+ *     <rom> <max-instrs> [engine [snapshot [movie]]]
+ *
+ * where a <rom> starting with @ names a ROM set manifest, a job
+ * with a snapshot starts from it rather than from reset, and a job
+ * with a movie replays it, checking its RAM hashes. A snapshot of
+ * "-" is none, and with a movie, a <max-instrs> of 0 is no limit.
+ * Blank lines and # comments are skipped. Loads every ROM and
+ * snapshot the jobs use. Returns 0 on success and -1 on failure.
+ */
+int batch_load(Batch *batch, const char *path);
+
+
+void batch_free(Batch *batch);
+
+
+/*
+ * Runs every job on `threads` workers, each running one
+ * instance at a time from its own share of the jobs and
+ * taking jobs from the others once that runs out.
+ * Returns the wall-clock seconds taken, or -1 if out
+ * of memory.
+ */
+double batch_run(Batch *batch, int threads);
+
+
+/*
+ * Prints one line per job and the totals to `f`
+ */
+void batch_report(const Batch *batch, double secs, FILE *f);
+
+#endif // BATCH_H
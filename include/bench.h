@@ -0,0 +1,82 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "core.h"
+#include "rom.h"
+
+// defaults: emulated cycles per run (10 s at 2 MHz),
+// timed runs per result and untimed runs before them
+#define BENCH_CYCLES    20000000
+#define BENCH_RUNS      5
+#define BENCH_WARMUP    1
+
+/*
+ * A fixed program to time, held as a shared memory image
+ * that every run starts from
+ */
+typedef struct bench_workload_t {
+    const char          *name;
+    RomImage            image;
+    uint16_t            entry;
+
+    // run with the Invaders memory map and video interrupts,
+    // rather than as flat RAM with no interrupts
+    int                 invaders;
+
+    // a CP/M program, set up by cpm_install with its
+    // console output dropped
+    int                 cpm;
+} BenchWorkload;
+
+// the median of a workload's timed runs on one engine
+typedef struct bench_result_t {
+    uint64_t            instructions;
+    uint64_t            cycles;
+    double              secs;
+
+    // (slowest - fastest) / median of the timed runs
+    double              spread;
+} BenchResult;
+
+
+/*
+ * Sets up one of the built-in microkernels: "alu" (8-bit
+ * arithmetic and logic), "branch" (conditional jumps, calls
+ * and returns) or "memory" (loads, stores and the stack).
+ * Returns 0 on success and -1 for an unknown name or failure.
+ */
+int bench_synthetic(BenchWorkload *work, const char *name);
+
+
+/*
+ * Sets up the Invaders ROM (or a ROM set manifest if `rom`
+ * starts with @) running its attract mode. Returns 0 on
+ * success and -1 on failure.
+ */
+int bench_invaders(BenchWorkload *work, const char *rom);
+
+
+/*
+ * Sets up a CP/M CPU exerciser such as CPUDIAG.COM or 8080EXM.COM,
+ * loaded at 0x0100 with its console output dropped. Returns 0 on
+ * success and -1 on failure.
+ */
+int bench_exerciser(BenchWorkload *work, const char *path);
+
+
+void bench_workload_free(BenchWorkload *work);
+
+
+/*
+ * Runs `work` on `engine` `warmup` times untimed, then `runs` times
+ * timed, each time on a fresh instance for up to `cycles` emulated
+ * cycles, and fills in the median run. Returns 0 on success and
+ * -1 if an instance couldn't be set up.
+ */
+int bench_run(const BenchWorkload *work, Engine engine, uint64_t cycles,
+    int warmup, int runs, BenchResult *result);
+
+#endif // BENCH_H
@@ -0,0 +1,135 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "core.h"
+#include "memory.h"
+
+// longest straight-line run kept in one block
+#define BLOCK_MAX_INSTRS    16
+
+// direct-mapped on the start PC; must be a power of 2
+#define BLOCK_SLOTS         4096
+
+// a failed fixed-point check in a row this many times
+// makes an IDLE_LOOP block into an ordinary one
+#define IDLE_MISSES         4
+
+typedef void (*OpHandler)(State8080 *state, uint8_t *opcode);
+
+// one pre-decoded instruction
+typedef struct block_instr_t {
+    OpHandler           handler;
+
+    // the opcode and its operand bytes, copied
+    // out of guest memory when the block was built
+    uint8_t             op[3];
+
+    // length in bytes
+    uint8_t             len;
+
+    // base cycles (see op_cycles)
+    uint8_t             cycles;
+} BlockInstr;
+
+// what a block that jumps back to its own start, with no
+// stores, stack, I/O or interrupt ops on the way, waits on
+typedef enum idle_kind_t {
+    IDLE_NONE = 0,
+    IDLE_LOOP,          // memory or nothing: spins while the registers stay put
+    IDLE_COUNT8,        // DCR r; JNZ
+    IDLE_COUNT16,       // DCX rp; MOV A,hi/lo; ORA lo/hi; JNZ
+} IdleKind;
+
+// a straight-line run of instructions ending at the
+// first one that can branch, halt or toggle interrupts
+typedef struct block_t {
+    uint16_t            start;
+
+    // bytes covered from `start`
+    uint8_t             len;
+
+    // 0 for an empty slot
+    uint8_t             count;
+
+    // base cycles of the whole block
+    uint16_t            cycles;
+
+    // times it has run, up to JIT_THRESHOLD
+    uint16_t            execs;
+
+    // an IdleKind, and the fixed-point checks it has
+    // failed in a row if IDLE_LOOP
+    uint8_t             idle;
+    uint8_t             idle_misses;
+
+    // host code compiled by the JIT, or NULL (see jit.h)
+    void                *code;
+
+    BlockInstr          instrs[BLOCK_MAX_INSTRS];
+} Block;
+
+typedef struct block_cache_t {
+    Block               slots[BLOCK_SLOTS];
+
+    // for each code page, a bit per byte that blocks cover,
+    // so a write to data beside code returns at once; then a
+    // bit per slot holding a block on the page, so a write
+    // to code only looks at those, and a bit per word of
+    // those saying which have any set. Dropped blocks and
+    // reused slots can leave stale bits, which just cost a look.
+    uint64_t            page_bytes[NUM_PAGES][PAGE_SIZE / 64];
+    uint64_t            page_slots[NUM_PAGES][BLOCK_SLOTS / 64];
+    uint64_t            page_words[NUM_PAGES];
+
+    // bumped whenever a block is dropped, so a block
+    // that overwrites its own code can tell
+    uint64_t            generation;
+
+    uint64_t            hits;
+    uint64_t            misses;
+    uint64_t            invalidations;
+
+    // cycles of idle loops fast-forwarded over
+    uint64_t            idle_cycles;
+
+    // code buffer for ENGINE_JIT, allocated on first use
+    struct jit_t        *jit;
+} BlockCache;
+
+_Static_assert(BLOCK_SLOTS / 64 <= 64, "page_words needs a bit per word of page_slots");
+
+
+/*
+ * Allocates an empty cache. Returns NULL on failure.
+ */
+BlockCache* block_cache_new(void);
+
+
+/*
+ * Releases a cache (NULL is fine)
+ */
+void block_cache_free(BlockCache *cache);
+
+
+/*
+ * Drops every block, e.g. after guest memory has been
+ * changed behind mem_write's back
+ */
+void block_cache_flush(BlockCache *cache);
+
+
+/*
+ * Records that `block`, just decoded, covers bytes of
+ * `page`, so writing to them drops it
+ */
+void block_track(BlockCache *cache, const Block *block, uint8_t page);
+
+
+/*
+ * Drops the blocks that cover `addr`. Called by
+ * mem_write_slow on a write to a PAGE_CODE page, which
+ * stops being one once no blocks on it are left.
+ */
+void block_invalidate(State8080 *state, uint16_t addr);
+
+#endif // BLOCK_H
@@ -2,41 +2,111 @@
 #define CORE_H
 
 #include <inttypes.h>
+#include <stddef.h>
 
-typedef struct condition_codes_t {
-    // zero: set if result is 0
-    uint8_t     z:1;  // z occupies 1 bit in the struct
+// bits of the packed flags byte, laid out
+// as the 8080 pushes it with PUSH PSW
+#define FLAG_CY     (1 << 0)
+#define FLAG_ONE    (1 << 1)  // always 1 in the PSW
+#define FLAG_P      (1 << 2)
+#define FLAG_AC     (1 << 4)
+#define FLAG_Z      (1 << 6)
+#define FLAG_S      (1 << 7)
+#define FLAG_ALL    (FLAG_CY | FLAG_P | FLAG_AC | FLAG_Z | FLAG_S)
 
-    // sign: set if result is negative
-    uint8_t     s:1;
+/*
+ * The flags are stored packed in `psw`, so an ALU op can set
+ * several of them with one masked store. The bitfields alias
+ * the same byte for code that reads or writes a single flag.
+ */
+typedef union condition_codes_t {
+    struct {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        uint8_t     s:1;
+        uint8_t     z:1;
+        uint8_t     pad5:1;
+        uint8_t     ac:1;
+        uint8_t     pad3:1;
+        uint8_t     p:1;
+        uint8_t     one:1;
+        uint8_t     cy:1;
+#else
+        // carry: set if last addition operation
+        // resulted in a carry or if the last
+        // subtraction operation required a borrow
+        uint8_t     cy:1; // not to be confused with C register
+
+        // bit 1 of the PSW always reads as 1
+        uint8_t     one:1;
+
+        // parity: set if number of 1 bits in the
+        // result is even
+        uint8_t     p:1;
+
+        uint8_t     pad3:1;
 
-    // parity: set if number of 1 bits in the
-    // result is even
-    uint8_t     p:1;
+        // auxiliary carry: used for binary-coded
+        // decimal arithmetic
+        uint8_t     ac:1;
 
-    // carry: set if last addition operation
-    // resulted in a carry or if the last 
-    // subtraction operation required a borrow
-    uint8_t     cy:1; // not to be confused with C register
+        uint8_t     pad5:1;
 
-    // auxiliary carry: used for binary-coded
-    // decimal arithmetic
-    uint8_t     ac:1;
+        // zero: set if result is 0
+        uint8_t     z:1;
 
-    // padding so that the struct occupies exactly
-    // 8 bits
-    uint8_t     pad:3;
+        // sign: set if result is negative
+        uint8_t     s:1;
+#endif
+    };
+
+    // all of the above as one PSW-format byte
+    uint8_t         psw;
 } ConditionCodes;
 
+// opcode dispatch engines (see core.c)
+typedef enum engine_t {
+    ENGINE_DEFAULT = 0,     // the one picked at build time
+    ENGINE_SWITCH,
+    ENGINE_TABLE,
+    ENGINE_THREADED,        // GCC/Clang only
+    ENGINE_BLOCK,           // replays pre-decoded basic blocks
+    ENGINE_JIT,             // compiles hot blocks, x86-64 only
+    ENGINE_COUNT
+} Engine;
+
+
+/*
+ * A register pair, as one 16-bit value or as its two halves
+ * (`hi` is B, D or H). Pairs are stored so that `w` is what
+ * the 8080 means by BC, DE or HL on either host byte order.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REG_PAIR(w, hi, lo) \
+    union { uint16_t w; struct { uint8_t hi; uint8_t lo; }; }
+#else
+#define REG_PAIR(w, hi, lo) \
+    union { uint16_t w; struct { uint8_t lo; uint8_t hi; }; }
+#endif
+
+
+/*
+ * Laid out for the run loops: everything an instruction reads
+ * or writes on the way through, down to the memory map, is in
+ * the first 64-byte cache line, and the hooks every engine
+ * checks once per instruction or block start the second. The
+ * register halves keep their names (state->b, state->c ...),
+ * so code that works a byte at a time needn't change.
+ */
 typedef struct state8080_t {
-    // registers (7 of them)
+    // registers: B C, D E and H L as pairs, and A
+    _Alignas(64)
+    REG_PAIR(bc, b, c);
+    REG_PAIR(de, d, e);
+    REG_PAIR(hl, h, l);
     uint8_t             a;
-    uint8_t             b;
-    uint8_t             c;
-    uint8_t             d;
-    uint8_t             e;
-    uint8_t             h;
-    uint8_t             l;
+
+    // status flags
+    ConditionCodes      cc;
 
     // stack pointer
     uint16_t            sp;
@@ -44,19 +114,76 @@ typedef struct state8080_t {
     // program counter
     uint16_t            pc;
 
-    uint8_t             *memory;
-
-    // status flags
-    ConditionCodes      cc;
+    // with LAZY_FLAGS, an ALU op only records its result
+    // here; the flags in `lazy_mask` (0 if none) are worked
+    // out from it when read, with AC from bit 4 of the
+    // result XOR `lazy_aux` (see flags_resolve)
+    uint16_t            lazy_result;
+    uint8_t             lazy_mask;
+    uint8_t             lazy_aux;
 
     // 1 if interrupt enabled
     uint8_t             int_enable;
 
-    // I/0
-    void (*input)(uint8_t);
-    uint8_t (*output)(uint8_t);
+    // 1 once a HLT instruction has been executed
+    uint8_t             halted;
+
+    // 1 while an interrupt is latched, waiting
+    // for interrupts to be enabled
+    uint8_t             int_pending;
+
+    // RST number of the latched interrupt
+    uint8_t             int_rst;
+
+    // T-states executed since reset
+    uint64_t            cycles;
+
+    // instructions executed since reset
+    uint64_t            instructions;
+
+    // 64 KiB of guest memory; reads index it directly,
+    // writes go through mem_write and the page attributes
+    uint8_t             *memory;
+    struct memory_map_t *mem_map;
+
+    // 1 + the cycle count EI finished at: while `cycles` + 1
+    // is still this, the instruction after EI hasn't run, and
+    // a latched interrupt has to wait for it (0 for none)
+    uint64_t            ei_shadow;
+
+    // records every instruction when set (see trace.h)
+    _Alignas(64)
+    struct tracer_t     *tracer;
+
+    // counts opcodes and PCs when set (see profile.h)
+    struct profile_t    *profile;
+
+    // breakpoints and watchpoints when set (see debugger.h)
+    struct debugger_t   *debug;
+
+    // decoded basic blocks for ENGINE_BLOCK, allocated
+    // on first use (see block.h)
+    struct block_cache_t *blocks;
+
+    // what the IN/OUT ports are connected to (see io.h)
+    struct io_map_t     *io;
+
+    // dispatch engine this instance runs on
+    Engine              engine;
 } State8080;
 
+_Static_assert(offsetof(State8080, tracer) == 64,
+    "State8080's per-instruction fields must fit one cache line");
+
+
+// why run_cycles/run_instructions returned
+typedef enum run_stop_t {
+    STOP_BUDGET = 0,    // used up the cycle or instruction budget
+    STOP_HALT,          // the CPU is halted
+    STOP_BREAKPOINT,    // PC is on a breakpoint, or a watchpoint was hit
+    STOP_INTERRUPT,     // a latched interrupt can now be taken
+} RunStop;
+
 
 /*
  * Prints out the current state
@@ -64,11 +191,84 @@ typedef struct state8080_t {
 void print_state(State8080 *state);
 
 
+/*
+ * Applies a pending lazy flag update to state->cc; code
+ * outside the core calls it before reading cc directly.
+ * Never has anything to do unless built with LAZY_FLAGS.
+ */
+void flags_resolve(State8080 *state);
+
+
+/*
+ * Returns the flags byte including any pending lazy
+ * update, leaving the state as it is
+ */
+uint8_t flags_psw(const State8080 *state);
+
+
 /*
  * Given the state, emulates the opcode
  * pointed to by the program counter
- * and moves onto the next instruction
+ * and moves onto the next instruction.
+ * Does no I/O of its own; callers that want
+ * a trace disassemble before stepping.
+ * Returns the number of cycles the instruction
+ * took, which is also added to state->cycles.
+ */
+int emulate_op(State8080 *state);
+
+
+/*
+ * Runs instructions until at least `budget` cycles have
+ * gone by, or until a breakpoint, a watchpoint or a latched interrupt
+ * becomes takeable. The whole batch runs inside the core;
+ * the state is written back once. A halted CPU idles
+ * for the rest of the budget and returns STOP_HALT.
+ */
+RunStop run_cycles(State8080 *state, uint64_t budget);
+
+
+/*
+ * Same as run_cycles, but the budget is `count` instructions
+ */
+RunStop run_instructions(State8080 *state, uint64_t count);
+
+
+/*
+ * Name of an engine ("switch", "table"...), with
+ * ENGINE_DEFAULT resolved to the build-time choice
+ */
+const char* engine_name(Engine engine);
+
+
+/*
+ * Looks up an engine by name. Returns 0 on success, -1 if
+ * the name is unknown or the engine isn't built in.
+ */
+int engine_from_name(const char *name, Engine *engine);
+
+
+/*
+ * Returns 1 if `engine` is built in
+ */
+int engine_available(Engine engine);
+
+
+/*
+ * Raises interrupt RST `rst_num` (0-7), as a device
+ * would by putting the RST opcode on the bus. It is only
+ * latched: a run takes it at the next instruction boundary
+ * where interrupts are enabled and not right after EI,
+ * and callers between runs use service_interrupt.
+ */
+void generate_interrupt(State8080 *state, int rst_num);
+
+
+/*
+ * Takes the latched interrupt if interrupts are enabled
+ * and the instruction after an EI has run. Returns the
+ * cycles it took, 0 if none.
  */
-void emulate_op(State8080 *state);
+int service_interrupt(State8080 *state);
 
 #endif
@@ -0,0 +1,92 @@
+#ifndef CPM_H
+#define CPM_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "core.h"
+#include "io.h"
+#include "rom.h"
+
+// where CP/M programs are loaded, and the BDOS stub that CALL 5
+// jumps to; the stub's address is also the top of the TPA
+#define CPM_TPA         0x0100
+#define CPM_BDOS        0xfe00
+
+// the ports the BDOS stub hands a call over on: E, D, then
+// the function number in C, which makes the call
+#define CPM_PORT_CALL   0
+#define CPM_PORT_E      1
+#define CPM_PORT_D      2
+
+// OUT latches RST (A & 7) as an interrupt, so programs can
+// check how they are taken; real CP/M has nothing here
+#define CPM_PORT_INT    3
+
+/*
+ * The console of a CP/M program. The BDOS stub is plain 8080
+ * code that passes C and DE out through I/O ports, so every
+ * engine runs it, and the console functions are carried out
+ * by a port device here.
+ */
+typedef struct cpm_console_t {
+    // where output goes as it is printed, or NULL
+    FILE                *echo;
+
+    // everything printed so far, if `capture` is set
+    int                 capture;
+    char                *text;
+    size_t              len;
+    size_t              capacity;
+
+    // BDOS calls made
+    uint64_t            calls;
+
+    // set by cpm_install
+    const uint8_t       *memory;
+    const IoMap         *io;
+} CpmConsole;
+
+
+/*
+ * Loads a CP/M program (a .COM file) at 0x0100.
+ * Returns 0 on success and -1 on failure.
+ */
+int cpm_load(RomImage *img, const char *path);
+
+
+/*
+ * Sets up `state`, already loaded with emu_load, as a CP/M
+ * machine: flat RAM, warm boot at 0x0000 halts, and CALL 5
+ * goes to the BDOS stub with `console` on its ports, and
+ * OUT CPM_PORT_INT raises an interrupt. The PC is set to
+ * 0x0100.
+ */
+void cpm_install(State8080 *state, CpmConsole *console);
+
+
+/*
+ * Runs until the program warm boots, by BDOS function 0 or a
+ * jump to 0x0000, or after `max_instrs` instructions (0 for
+ * no limit, checked every 16 ms of emulated time), taking
+ * interrupts as they are raised. Returns 1 on a warm boot
+ * and 0 otherwise.
+ */
+int cpm_run(State8080 *state, uint64_t max_instrs);
+
+
+void cpm_console_free(CpmConsole *console);
+
+
+/*
+ * Runs `program` once on each of the `count` engines, echoing
+ * the first run's console and checking every run warm boots,
+ * prints the same output as the first and, if `expect` isn't
+ * NULL, prints `expect` somewhere. Prints a line per engine.
+ * Returns 0 if every run passed and 1 if not.
+ */
+int cpm_run_engines(const RomImage *program, const Engine *engines, int count,
+    uint64_t max_instrs, const char *expect);
+
+#endif // CPM_H
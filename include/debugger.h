@@ -0,0 +1,216 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "core.h"
+#include "memory.h"
+
+#define DEBUG_MAX_BREAKPOINTS   32
+#define DEBUG_MAX_WATCHPOINTS   16
+
+// what a watchpoint watches
+#define DEBUG_READ      (1 << 0)
+#define DEBUG_WRITE     (1 << 1)
+
+// what a breakpoint condition compares
+typedef enum debug_operand_t {
+    DEBUG_ALWAYS = 0,   // no condition
+    DEBUG_REG8,         // a register: `index` is 0-7 for B C D E H L F A
+    DEBUG_REG16,        // a pair: `index` is 0-3 for BC DE HL SP
+    DEBUG_MEM,          // the byte at `index`
+} DebugOperand;
+
+typedef enum debug_compare_t {
+    DEBUG_EQ = 0, DEBUG_NE, DEBUG_LT, DEBUG_LE, DEBUG_GT, DEBUG_GE,
+} DebugCompare;
+
+typedef struct debug_cond_t {
+    DebugOperand        operand;
+    uint16_t            index;
+    DebugCompare        compare;
+    uint16_t            value;
+} DebugCond;
+
+typedef struct breakpoint_t {
+    uint16_t            addr;
+    DebugCond           cond;
+    uint64_t            hits;
+} Breakpoint;
+
+typedef struct watchpoint_t {
+    uint16_t            start;
+    uint32_t            len;
+    uint8_t             kind;       // DEBUG_READ and/or DEBUG_WRITE
+    uint64_t            hits;
+} Watchpoint;
+
+// what stopped the last run
+typedef struct debug_hit_t {
+    // DEBUG_READ or DEBUG_WRITE for a watchpoint, 0 for a breakpoint
+    uint8_t             kind;
+    int                 index;
+
+    // for a watchpoint: the address, and the byte there
+    // before and after a write (or the byte read)
+    uint16_t            addr;
+    uint8_t             old_value;
+    uint8_t             value;
+} DebugHit;
+
+/*
+ * PC breakpoints, conditional breakpoints and memory
+ * watchpoints, attached to one instance. Nothing is checked
+ * unless one is attached; with one attached:
+ *  - the interpreters test one bit per instruction
+ *  - decoded blocks only take the per-instruction path if a
+ *    page they cover has a breakpoint, and the JIT only runs
+ *    compiled code if there are no breakpoints
+ *  - write watchpoints cost nothing until their page is
+ *    written, since the page attribute sends it to the slow path
+ *  - read watchpoints need every instruction's operands
+ *    checked, so they put every engine on the interpreter
+ */
+typedef struct debugger_t {
+    // one bit per address with a breakpoint (bit n of byte a
+    // covers 8 * a + n), and a count per page, so a block can
+    // tell at once that it can't run into one
+    uint8_t             pc_bits[MEM_SIZE / 8];
+    uint8_t             page_breakpoints[NUM_PAGES];
+
+    Breakpoint          breaks[DEBUG_MAX_BREAKPOINTS];
+    int                 break_count;
+
+    Watchpoint          watches[DEBUG_MAX_WATCHPOINTS];
+    int                 watch_count;
+
+    // read watchpoints set
+    int                 reads;
+
+    // set when a watchpoint is hit, until debug_stop
+    uint8_t             pending;
+    DebugHit            hit;
+
+    // the instance it is attached to
+    State8080           *state;
+} Debugger;
+
+
+/*
+ * Returns an empty debugger, or NULL
+ */
+Debugger* debug_new(void);
+
+
+void debug_free(Debugger *debug);
+
+
+/*
+ * Adds a breakpoint from "ADDR" or "ADDR:COND", where COND
+ * is like "a==0x20", "hl>=0x2400" or "[0x20c0]!=0": a register
+ * (a b c d e h l f), a pair (bc de hl sp) or a byte of memory,
+ * ==, !=, <, <=, > or >=, and a number. Returns its index or
+ * -1, with a message, if it can't be parsed or there are too
+ * many.
+ */
+int debug_add_break(Debugger *debug, const char *spec);
+
+
+/*
+ * Adds a watchpoint from "ADDR[+LEN][:r|w|rw]" (a 1-byte write
+ * watchpoint by default). Returns its index or -1, with a
+ * message, if it can't be parsed or there are too many.
+ */
+int debug_add_watch(Debugger *debug, const char *spec);
+
+
+/*
+ * Sets `debug` on `state`, once its memory map is set up,
+ * marking the pages of the write watchpoints so writes to
+ * them take the slow path. Watchpoints added later are
+ * armed as they are added.
+ */
+void debug_attach(Debugger *debug, State8080 *state);
+
+
+/*
+ * Takes `debug` off its instance, disarming its pages
+ */
+void debug_detach(Debugger *debug);
+
+
+/*
+ * Returns 1 if a run has to stop after an instruction that
+ * left PC at `pc`: a breakpoint is set there or a watchpoint
+ * was hit
+ */
+static inline int debug_at_stop(const Debugger *debug, uint16_t pc) {
+    return debug->pending || ((debug->pc_bits[pc >> 3] >> (pc & 7)) & 1);
+}
+
+
+/*
+ * Returns 1 if the `len` bytes of code from `start` (no more
+ * than a page) can run with no checks in between: there is no
+ * debugger, or no breakpoint on their pages and no read
+ * watchpoint
+ */
+static inline int debug_block_clear(const Debugger *debug, uint16_t start, uint16_t len) {
+    return debug == NULL
+        || (!debug->reads && !debug->page_breakpoints[start >> PAGE_SHIFT]
+            && !debug->page_breakpoints[(uint16_t) (start + len - 1) >> PAGE_SHIFT]);
+}
+
+
+/*
+ * Returns 1 if compiled code, which chains from block to
+ * block without coming back, can run: nothing but write
+ * watchpoints is set
+ */
+static inline int debug_chain_clear(const Debugger *debug) {
+    return debug == NULL || (!debug->break_count && !debug->reads);
+}
+
+
+/*
+ * Checks the memory the instruction at PC is about to read
+ * against the read watchpoints
+ */
+void debug_check_reads(Debugger *debug, State8080 *state);
+
+
+/*
+ * Called before the instruction at PC runs
+ */
+static inline void debug_step(Debugger *debug, State8080 *state) {
+    if (debug->reads) {
+        debug_check_reads(debug, state);
+    }
+}
+
+
+/*
+ * Called by mem_write_slow before `val` is written to `addr`
+ * on a page with PAGE_WATCH set
+ */
+void debug_check_write(State8080 *state, uint16_t addr, uint8_t val);
+
+
+/*
+ * Called when a run stopped with STOP_BREAKPOINT: works out
+ * what stopped it, counts the hit and fills in debug->hit.
+ * Returns 1 if the caller should stop, or 0 if it was only a
+ * breakpoint whose condition doesn't hold (the next run steps
+ * over it).
+ */
+int debug_stop(Debugger *debug, const State8080 *state);
+
+
+/*
+ * Prints what stopped the last run and the instruction
+ * at PC
+ */
+void debug_print_hit(const Debugger *debug, const State8080 *state);
+
+#endif // DEBUGGER_H
@@ -1,14 +1,160 @@
 #ifndef DISASSEMBLER_H
 #define DISASSEMBLER_H
 
+#include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+// every 8080 mnemonic; the undocumented opcodes decode as NOP
+#define DIS_MNEMONICS(X) \
+    X(NOP)  X(LXI)  X(STAX) X(INX)  X(INR)  X(DCR)  X(MVI)  X(RLC)  \
+    X(DAD)  X(LDAX) X(DCX)  X(RRC)  X(RAL)  X(RAR)  X(SHLD) X(DAA)  \
+    X(LHLD) X(CMA)  X(STA)  X(STC)  X(LDA)  X(CMC)  X(MOV)  X(HLT)  \
+    X(ADD)  X(ADC)  X(SUB)  X(SBB)  X(ANA)  X(XRA)  X(ORA)  X(CMP)  \
+    X(RNZ)  X(POP)  X(JNZ)  X(JMP)  X(CNZ)  X(PUSH) X(ADI)  X(RST)  \
+    X(RZ)   X(RET)  X(JZ)   X(CZ)   X(CALL) X(ACI)  X(RNC)  X(JNC)  \
+    X(OUT)  X(CNC)  X(SUI)  X(RC)   X(JC)   X(IN)   X(CC)   X(SBI)  \
+    X(RPO)  X(JPO)  X(XTHL) X(CPO)  X(ANI)  X(RPE)  X(PCHL) X(JPE)  \
+    X(XCHG) X(CPE)  X(XRI)  X(RP)   X(JP)   X(DI)   X(CP)   X(ORI)  \
+    X(RM)   X(SPHL) X(JM)   X(EI)   X(CM)   X(CPI)
+
+#define DIS_ENUM(name)  DIS_##name,
+typedef enum dis_mnemonic_t {
+    DIS_MNEMONICS(DIS_ENUM)
+    DIS_MNEMONIC_COUNT
+} DisMnemonic;
+#undef DIS_ENUM
+
+// what follows the opcode
+typedef enum dis_operand_t {
+    DIS_NONE = 0,       // nothing: registers are part of `args`
+    DIS_D8,             // an immediate byte (or a port)
+    DIS_D16,            // an immediate word
+    DIS_ADDR,           // an address
+} DisOperand;
+
+// how an instruction changes the flow of control
+#define DIS_FLOW_JUMP       (1 << 0)    // can go to `target`
+#define DIS_FLOW_CALL       (1 << 1)    // ... as a call (CALL, Ccc, RST)
+#define DIS_FLOW_RETURN     (1 << 2)    // can return (RET, Rcc)
+#define DIS_FLOW_COND       (1 << 3)    // only if a condition holds
+#define DIS_FLOW_END        (1 << 4)    // never goes on to the next instruction
+
+// longest text dis_format writes, with its terminator
+#define DIS_TEXT_MAX    24
+
+/*
+ * One decoded instruction, with nothing formatted
+ */
+typedef struct dis_instr_t {
+    uint16_t            pc;
+    uint8_t             op;
+    uint8_t             len;
+    DisMnemonic         mnemonic;
+
+    // the registers, as written ("A,B", "SP", "PSW"...)
+    const char          *args;
+
+    // the byte or word after the opcode, as `kind` says
+    DisOperand          kind;
+    uint16_t            operand;
+
+    // DIS_FLOW_* bits, and where a jump or call goes
+    uint8_t             flow;
+    uint16_t            target;
+} DisInstr;
+
+/*
+ * Text accumulated for one big write
+ */
+typedef struct dis_buffer_t {
+    char                *text;
+    size_t              len;
+    size_t              capacity;
+} DisBuffer;
+
+// marks for dis_trace_flow: bytes reached as code
+#define DIS_MARK_OPCODE     1
+#define DIS_MARK_OPERAND    2
+
+
+/*
+ * Decodes the instruction at address `pc`, whose bytes are at
+ * `bytes` (three must be readable, whatever its length). Keeps
+ * no state, so it can run anywhere. Returns its length.
+ */
+int dis_decode(const uint8_t *bytes, uint16_t pc, DisInstr *instr);
+
+
+const char* dis_mnemonic_name(DisMnemonic mnemonic);
+
+
+/*
+ * Writes the instruction as text ("MVI    B,#$10") to `text`,
+ * which holds DIS_TEXT_MAX bytes. Returns the length.
+ */
+int dis_format(const DisInstr *instr, char *text);
+
+
+/*
+ * Writes `digits` hex digits of `value` to `text`, with no
+ * terminator, and returns the end
+ */
+char* dis_put_hex(char *text, unsigned value, int digits);
+
+
+/*
+ * Appends `len` bytes, or an "<address> <instruction>" line,
+ * to `out`. Return 0 on success and -1 if out of memory.
+ */
+int dis_buffer_append(DisBuffer *out, const char *text, size_t len);
+int dis_buffer_line(DisBuffer *out, const DisInstr *instr);
+
+
+/*
+ * Writes out everything held with a single fwrite and empties
+ * the buffer. Returns 0 on success and -1 on failure.
+ */
+int dis_buffer_flush(DisBuffer *out, FILE *f);
+
+
+void dis_buffer_free(DisBuffer *out);
+
+
+/*
+ * Recursive descent: marks (see DIS_MARK_*) the `size` bytes of
+ * `code` reached by following every branch from the `count`
+ * addresses in `entries`. Jumps through PCHL and RET can't be
+ * followed, so code only reached that way needs an entry. `marks`
+ * holds `size` bytes and is cleared first. Returns 0 on success
+ * and -1 if out of memory.
+ */
+int dis_trace_flow(const uint8_t *code, size_t size,
+    const uint16_t *entries, int count, uint8_t *marks);
+
+
+/*
+ * Lists `size` bytes of `code` (at most 64K) into `out`: every byte marked as
+ * an opcode is disassembled and the rest are listed as DB data,
+ * or with `marks` NULL, the whole range is swept as code. Up to
+ * two bytes past `size` must be readable. Returns 0 on success
+ * and -1 if out of memory.
+ */
+int dis_list(const uint8_t *code, size_t size, const uint8_t *marks, DisBuffer *out);
+
+
 /*
  * Disassembles a single op and prints it to stdout
  */
 int disassemble8080op(unsigned char *codebuffer, int pc);
 
 /*
- * Disassembles 8080 machine code and prints it to stdout
+ * Disassembles 8080 machine code and prints it to stdout. With
+ * `recursive`, only what is reached from `entries` (or from the
+ * reset and Invaders interrupt vectors if `count` is 0) is
+ * disassembled, and the rest is listed as data.
  */
-int disassemble8080file(char* filename);
+int disassemble8080file(const char *filename, int recursive,
+    const uint16_t *entries, int count);
 
 #endif
@@ -1,6 +1,108 @@
 #ifndef EMU8080_H
 #define EMU8080_H
 
-int load_and_run(char *filename);
+#include <stddef.h>
+
+#include "core.h"
+#include "debugger.h"
+#include "rom.h"
+
+// the Invaders CPU runs at 2 MHz with a 60 Hz display
+#define CPU_HZ              2000000
+#define FRAME_HZ            60
+#define CYCLES_PER_FRAME    (CPU_HZ / FRAME_HZ)
+
+/*
+ * Resets the registers and flags and maps a private
+ * copy-on-write view of the ROM image as guest memory,
+ * with the Invaders memory map. Returns the end address
+ * of the ROM, or -1 on failure.
+ */
+int emu_load(State8080 *state, const RomImage *rom);
+
+
+/*
+ * Releases what emu_load set up
+ */
+void emu_unload(State8080 *state);
+
+
+/*
+ * Steps through the ROM image interactively, printing
+ * the state and disassembly of every instruction. At the
+ * prompt, "c" runs at full speed on `engine` until a
+ * breakpoint or watchpoint of `debug` (which may be NULL)
+ * is hit, and "b SPEC" and "w SPEC" add one.
+ */
+int load_and_run(const RomImage *rom, Engine engine, Debugger *debug);
+
+// settings for run_headless
+typedef struct headless_opts_t {
+    Engine              engine;
+
+    // instructions to run (0 for no limit, checked once per frame)
+    size_t              max_instrs;
+
+    // binary trace file, with only the last `trace_last`
+    // instructions written at exit if that is non-zero
+    const char          *trace_path;
+    size_t              trace_last;
+
+    // snapshot files to start from and to save the final state to
+    const char          *load_snapshot;
+    const char          *save_snapshot;
+
+    // frames of rewind history to keep (0 for none), and how
+    // many of them to step back through before exiting
+    size_t              rewind_frames;
+    size_t              rewind_back;
+
+    // convert the screen at every VBlank and write the last
+    // frame to this file, as a PGM if it ends in .pgm and
+    // a PPM otherwise
+    const char          *screenshot;
+
+    // mix the sound into this WAV file, from the samples in
+    // `sound_samples`/0.wav to 8.wav (or plain tones)
+    const char          *sound;
+    const char          *sound_samples;
+
+    // movie to record, with the buttons pressed by `input_script`
+    // (or none) and a RAM hash every `movie_checks` frames, or to
+    // replay, checking its hashes and stopping at the end
+    const char          *record_movie;
+    const char          *input_script;
+    uint32_t            movie_checks;
+    const char          *play_movie;
+
+    // profile the run (forcing the per-instruction path), sampling
+    // the PC every `profile_period` instructions (0 or 1: exact),
+    // print a hot-spot report named from `profile_symbols` (or
+    // none) and write the counters to this file, as JSON if it
+    // ends in .json and CSV otherwise
+    const char          *profile;
+    uint32_t            profile_period;
+    const char          *profile_symbols;
+
+    // run no faster than the real machine: sleep after each
+    // frame until its time comes round, drawing every frame,
+    // and report the frame timing
+    int                 realtime;
+
+    // breakpoints and watchpoints that end the run when hit,
+    // printing what was hit, or NULL
+    Debugger            *debug;
+} HeadlessOpts;
+
+
+/*
+ * Runs the ROM image with no per-instruction I/O, delivering the
+ * Invaders video interrupts, until a HLT with interrupts disabled,
+ * the instruction limit, a breakpoint or watchpoint, or Ctrl-C, then
+ * reports instructions/sec.
+ * Returns 0, or -1 if a snapshot, screenshot, sound file, movie or
+ * profile couldn't be read or written, or if a replayed movie diverged.
+ */
+int run_headless(const RomImage *rom, const HeadlessOpts *opts);
 
 #endif // EMU8080_H
@@ -0,0 +1,88 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "core.h"
+#include "io.h"
+#include "memory.h"
+#include "profile.h"
+
+// an input is a FUZZ_HEADER-byte header (see fuzz_run) and
+// then up to FUZZ_MAX_CODE bytes of code, put at FUZZ_ORIGIN
+#define FUZZ_HEADER     16
+#define FUZZ_MAX_CODE   4096
+#define FUZZ_ORIGIN     0x0100
+
+// random bytes that memory and the input ports start out as,
+// from an offset the input picks
+#define FUZZ_POOL_SIZE  (2 * MEM_SIZE)
+
+// coverage features: how many times (in one of FUZZ_BUCKETS
+// ranges, 1, 2, 3, 4-7 ... 128 and up) each opcode ran, then
+// each PC in the input's code. Random memory soon takes every
+// PC outside it, so those aren't counted.
+#define FUZZ_BUCKETS    8
+#define FUZZ_FEATURES   ((256 + FUZZ_MAX_CODE) * FUZZ_BUCKETS)
+
+/*
+ * One instance under test, with a flat 64K of RAM and
+ * latched ports
+ */
+typedef struct fuzz_machine_t {
+    State8080           state;
+    MemoryMap           mem_map;
+    IoMap               io;
+} FuzzMachine;
+
+/*
+ * Runs inputs on the switch engine and on `engine` side by
+ * side and compares them. The reference is profiled, so its
+ * opcode and PC counters say what each input reached; the
+ * other runs as a headless run would, fast paths and all.
+ */
+typedef struct fuzzer_t {
+    Engine              engine;
+    FuzzMachine         ref;
+    FuzzMachine         test;
+    Profile             *profile;
+    uint8_t             *pool;
+
+    // features reached by any input so far
+    uint8_t             seen[FUZZ_FEATURES / 8];
+    uint64_t            features;
+
+    // if set, every feature the last input reached is set to
+    // 1 here (FUZZ_FEATURES bytes), e.g. libFuzzer's counters
+    uint8_t             *counters;
+
+    uint64_t            runs;
+} Fuzzer;
+
+
+/*
+ * Sets up both machines and the random pool from `seed`.
+ * Returns 0, or -1 if `engine` isn't built in or memory runs out.
+ */
+int fuzz_init(Fuzzer *fuzz, Engine engine, uint64_t seed);
+
+
+void fuzz_free(Fuzzer *fuzz);
+
+
+/*
+ * Runs one input. Its header holds, in order: A B C D E H L
+ * and the PSW; SP (2 bytes, little-endian); a byte with bit 0
+ * set to enable interrupts and bit 1 to latch the RST in bits
+ * 2-4; an offset into the pool for memory and the ports (2
+ * bytes); the burst length in cycles, less 16 (2 bytes); and
+ * one spare byte. Shorter inputs are padded with zeros. Both
+ * machines start there with PC at FUZZ_ORIGIN and run one
+ * burst. Returns the number of features no input had reached
+ * before, or -1 if the machines ended up different, printing
+ * how.
+ */
+int fuzz_run(Fuzzer *fuzz, const uint8_t *data, size_t size);
+
+#endif // FUZZ_H
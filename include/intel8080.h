@@ -0,0 +1,201 @@
+#ifndef INTEL8080_H
+#define INTEL8080_H
+
+/*
+ * libintel8080: the emulator as a library. Everything goes
+ * through an opaque handle, and nothing here depends on the
+ * emulator's own headers, so its internals can change without
+ * breaking callers. Handles share nothing, so each one can run
+ * on its own thread.
+ */
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// bumped whenever a declaration here changes incompatibly
+#define I8080_API_VERSION   1
+
+typedef struct i8080_t I8080;
+
+// dispatch engines, as for --engine
+typedef enum i8080_engine_t {
+    I8080_ENGINE_DEFAULT = 0,   // the one picked at build time
+    I8080_ENGINE_SWITCH,
+    I8080_ENGINE_TABLE,
+    I8080_ENGINE_THREADED,      // GCC/Clang builds only
+    I8080_ENGINE_BLOCK,
+    I8080_ENGINE_JIT,           // x86-64 builds only
+} I8080Engine;
+
+// why i8080_run returned
+typedef enum i8080_stop_t {
+    I8080_STOP_BUDGET = 0,      // ran all the cycles asked for
+    I8080_STOP_HALT,            // halted, and no interrupt can wake it
+    I8080_STOP_BREAKPOINT,      // reserved for breakpoints and watchpoints
+    I8080_STOP_INTERRUPT,       // a latched interrupt can now be taken
+} I8080Stop;
+
+// i8080_create flags
+#define I8080_INVADERS      (1 << 0)    // Space Invaders memory map, ports and interrupts
+#define I8080_PROFILE       (1 << 1)    // count every opcode and PC
+
+// flag bits of `psw`
+#define I8080_FLAG_CY       (1 << 0)
+#define I8080_FLAG_P        (1 << 2)
+#define I8080_FLAG_AC       (1 << 4)
+#define I8080_FLAG_Z        (1 << 6)
+#define I8080_FLAG_S        (1 << 7)
+
+typedef struct i8080_regs_t {
+    uint8_t             a;
+    uint8_t             b;
+    uint8_t             c;
+    uint8_t             d;
+    uint8_t             e;
+    uint8_t             h;
+    uint8_t             l;
+    uint8_t             psw;        // the flags, as PUSH PSW stores them
+    uint16_t            sp;
+    uint16_t            pc;
+    uint8_t             int_enable;
+    uint8_t             halted;
+    uint64_t            cycles;
+    uint64_t            instructions;
+} I8080Regs;
+
+typedef uint8_t (*I8080PortIn)(void *ctx, uint8_t port);
+typedef void (*I8080PortOut)(void *ctx, uint8_t port, uint8_t val);
+
+
+/*
+ * Returns the I8080_API_VERSION the library was built with
+ */
+int i8080_version(void);
+
+
+/*
+ * Creates a machine with all 64K as RAM and the ports
+ * disconnected, or with I8080_INVADERS, the Space Invaders
+ * board with its video interrupts scheduled. The state,
+ * memory, decoded-block cache and (with I8080_PROFILE) the
+ * profile counters are all in one allocation; only code the
+ * JIT compiles lives elsewhere, in executable memory. Returns
+ * NULL if `engine` isn't built in or memory runs out.
+ */
+I8080* i8080_create(I8080Engine engine, unsigned flags);
+
+
+void i8080_destroy(I8080 *m);
+
+
+/*
+ * Copies `size` bytes to guest memory at `addr`, making them
+ * read-only to the guest if `rom` is set. Protection is by
+ * 256-byte page, so a page they only partly cover stays
+ * writable. Returns 0, or -1 if they run past the end of
+ * memory.
+ */
+int i8080_load(I8080 *m, uint16_t addr, const void *data, size_t size, int rom);
+
+
+/*
+ * Loads a ROM file at address 0, or the ROM set listed in a
+ * file ending in .manifest (see --manifest), as read-only
+ * memory. Returns 0, or -1 with a message on stderr.
+ */
+int i8080_load_file(I8080 *m, const char *path);
+
+
+/*
+ * Runs one instruction, or takes a latched interrupt that is
+ * enabled, or idles for 4 cycles if halted. Returns the
+ * cycles it took.
+ */
+int i8080_step(I8080 *m);
+
+
+/*
+ * Runs for at least `cycles` cycles, delivering the scheduled
+ * interrupts, and returns why it stopped
+ */
+I8080Stop i8080_run(I8080 *m, uint64_t cycles);
+
+
+/*
+ * Latches RST `rst` (0-7) as an interrupt. The next i8080_step
+ * or i8080_run takes it as soon as interrupts are enabled,
+ * though never before the instruction after an EI.
+ */
+void i8080_interrupt(I8080 *m, int rst);
+
+
+void i8080_get_regs(const I8080 *m, I8080Regs *regs);
+void i8080_set_regs(I8080 *m, const I8080Regs *regs);
+
+
+/*
+ * Reads a byte of guest memory, or writes one the way the
+ * guest would (so ROM is left as it is)
+ */
+uint8_t i8080_read(const I8080 *m, uint16_t addr);
+void i8080_write(I8080 *m, uint16_t addr, uint8_t val);
+
+
+/*
+ * The 64K of guest memory, read-only: write with i8080_write
+ * or i8080_load, which keep decoded code up to date
+ */
+const uint8_t* i8080_memory(const I8080 *m);
+
+
+/*
+ * Sets what a latched input port reads, and returns the last
+ * byte written to a latched output port
+ */
+void i8080_set_input(I8080 *m, uint8_t port, uint8_t val);
+uint8_t i8080_output(const I8080 *m, uint8_t port);
+
+
+/*
+ * Connects `port` to handlers called with `ctx`, either of
+ * which may be NULL to leave that direction as it was
+ */
+void i8080_attach_port(I8080 *m, uint8_t port, I8080PortIn in, I8080PortOut out, void *ctx);
+
+
+/*
+ * The CPU's cycle count, from inside a port handler
+ */
+uint64_t i8080_port_cycles(const I8080 *m);
+
+
+/*
+ * Snapshots hold the CPU, the port latches, the interrupt
+ * schedule and all of memory, in i8080_snapshot_size() bytes
+ * that can be kept or written to disk (they are the same as
+ * --save-snapshot files). Restore returns 0, or -1 if `snap`
+ * isn't a snapshot of this version.
+ */
+size_t i8080_snapshot_size(void);
+
+// `snap` must be aligned for a uint64_t, as malloc's are
+void i8080_snapshot(const I8080 *m, void *snap);
+int i8080_restore(I8080 *m, const void *snap);
+
+
+/*
+ * Copies out the profile counters, if the machine was created
+ * with I8080_PROFILE: executions and cycles of each opcode
+ * (256 entries each) and executions at each PC (65536). Any
+ * of them may be NULL. Returns 0, or -1 with no profile.
+ */
+int i8080_profile(const I8080 *m, uint64_t *op_counts, uint64_t *op_cycles,
+    uint64_t *pc_counts);
+
+
+/*
+ * Clears the profile counters
+ */
+void i8080_profile_reset(I8080 *m);
+
+#endif // INTEL8080_H
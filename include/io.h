@@ -0,0 +1,153 @@
+#ifndef IO_H
+#define IO_H
+
+#include "core.h"
+
+#define NUM_PORTS       256
+
+// what a port does on IN (in_kind) or OUT (out_kind); the
+// built-in kinds are handled inline, PORT_DEVICE calls out
+#define PORT_NONE       0   // IN reads 0, OUT is dropped
+#define PORT_VALUE      1   // IN reads in_value, OUT stores out_value
+#define PORT_SHIFT      2   // IN reads the shift register, OUT shifts into it
+#define PORT_SHIFT_OFFSET 3 // OUT sets the shift register's offset
+#define PORT_DEVICE     4   // the port's device handlers
+#define PORT_INTERRUPT  5   // OUT latches RST (val & 7) as an interrupt
+
+// Invaders input port 1
+#define INV1_COIN       (1 << 0)
+#define INV1_P2_START   (1 << 1)
+#define INV1_P1_START   (1 << 2)
+#define INV1_ALWAYS     (1 << 3)
+#define INV1_P1_SHOT    (1 << 4)
+#define INV1_P1_LEFT    (1 << 5)
+#define INV1_P1_RIGHT   (1 << 6)
+
+// Invaders input port 2: DIP switches and player 2
+#define INV2_SHIPS      (3 << 0)  // 3 + n ships
+#define INV2_TILT       (1 << 2)
+#define INV2_EXTRA_SHIP (1 << 3)  // at 1000 rather than 1500 points
+#define INV2_P2_SHOT    (1 << 4)
+#define INV2_P2_LEFT    (1 << 5)
+#define INV2_P2_RIGHT   (1 << 6)
+#define INV2_NO_COIN_INFO (1 << 7)
+
+typedef uint8_t (*PortIn)(void *ctx, uint8_t port);
+typedef void (*PortOut)(void *ctx, uint8_t port, uint8_t val);
+
+typedef struct io_device_t {
+    PortIn              in;
+    PortOut             out;
+    void                *ctx;
+} IoDevice;
+
+/*
+ * Maps the 256 I/O ports to what they do. Input latches,
+ * output latches and the shift register are plain data the
+ * CPU handles inline; anything else attaches a device.
+ */
+typedef struct io_map_t {
+    uint8_t             in_kind[NUM_PORTS];
+    uint8_t             out_kind[NUM_PORTS];
+
+    // what a PORT_VALUE port reads, and what was last
+    // written to one (e.g. the sound and watchdog ports)
+    uint8_t             in_value[NUM_PORTS];
+    uint8_t             out_value[NUM_PORTS];
+
+    // Invaders shift register: OUT 4 shifts a byte in from the
+    // top, OUT 2 sets the offset and IN 3 reads 8 bits at it
+    uint16_t            shift;
+    uint8_t             shift_offset;
+
+    IoDevice            devices[NUM_PORTS];
+
+    // the CPU's cycle count during a device handler call,
+    // for devices that need to know when they were accessed
+    uint64_t            cycles;
+} IoMap;
+
+
+/*
+ * Leaves every port unconnected
+ */
+void io_map_init(IoMap *io);
+
+
+/*
+ * Space Invaders ports: inputs on 0-2, the shift register on
+ * 2/3/4, sound on 3/5 and the watchdog on 6, with player 1
+ * idle and the DIP switches at their defaults
+ */
+void io_map_invaders(IoMap *io);
+
+
+/*
+ * Connects a device to `port`; either handler may be NULL
+ * to leave that direction as it was
+ */
+void io_attach(IoMap *io, uint8_t port, PortIn in, PortOut out, void *ctx);
+
+
+/*
+ * Sets (`pressed`) or clears the `mask` bits that
+ * a PORT_VALUE input port reads
+ */
+void io_set_input(IoMap *io, uint8_t port, uint8_t mask, int pressed);
+
+
+/*
+ * IN port: the latches and the shift register are
+ * read inline, only devices cost a call. Without an
+ * IoMap every port is unconnected.
+ */
+static inline uint8_t io_in(State8080 *state, uint8_t port) {
+    IoMap *io = state->io;
+    if (io == NULL) {
+        return 0;
+    }
+    switch (io->in_kind[port]) {
+        case PORT_VALUE:
+            return io->in_value[port];
+        case PORT_SHIFT:
+            return (uint8_t) (io->shift >> (8 - io->shift_offset));
+        case PORT_DEVICE:
+            io->cycles = state->cycles;
+            return io->devices[port].in(io->devices[port].ctx, port);
+        default:
+            return 0;
+    }
+}
+
+
+/*
+ * OUT port, handled inline like io_in
+ */
+static inline void io_out(State8080 *state, uint8_t port, uint8_t val) {
+    IoMap *io = state->io;
+    if (io == NULL) {
+        return;
+    }
+    switch (io->out_kind[port]) {
+        case PORT_VALUE:
+            io->out_value[port] = val;
+            break;
+        case PORT_SHIFT:
+            io->shift = (val << 8) | (io->shift >> 8);
+            break;
+        case PORT_SHIFT_OFFSET:
+            io->shift_offset = val & 7;
+            break;
+        case PORT_DEVICE:
+            io->cycles = state->cycles;
+            io->devices[port].out(io->devices[port].ctx, port, val);
+            break;
+        case PORT_INTERRUPT:
+            // on the engine's own copy of the state, which
+            // a device handler never sees
+            generate_interrupt(state, val);
+            break;
+    }
+}
+
+#endif // IO_H
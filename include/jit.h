@@ -0,0 +1,77 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+
+#include "block.h"
+#include "core.h"
+
+// only an x86-64 backend so far; build with
+// -DNO_JIT to leave it out
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(NO_JIT)
+#define HAVE_JIT
+#endif
+
+// runs through the interpreter before a block is compiled
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD   16
+#endif
+
+// host code buffer per instance; when it fills up
+// every block is dropped and compiled again
+#ifndef JIT_CODE_SIZE
+#define JIT_CODE_SIZE   (4 << 20)
+#endif
+
+// how much of the buffer is made writable to compile a
+// block into, far more than any block's code needs
+#ifndef JIT_BLOCK_ROOM
+#define JIT_BLOCK_ROOM  (16 << 10)
+#endif
+
+typedef struct jit_t {
+    uint8_t             *code;
+    size_t              used;
+
+    // host page size, what mprotect works in
+    size_t              page;
+
+    // entry/exit stubs at the start of the buffer,
+    // which survive a reset
+    size_t              stubs_end;
+    void                (*enter)(State8080 *state, void *code, uint64_t end);
+    uint8_t             *exit;
+    uint8_t             *chain;
+
+    uint64_t            compiled;
+    uint64_t            resets;
+} Jit;
+
+
+/*
+ * Compiles `block` to host code, setting block->code.
+ * Blocks ending in HLT, EI or DI are left to the
+ * interpreter, so a compiled run never ends on one.
+ * Returns 0 on success, -1 if the block can't be compiled
+ * or the code buffer can't be set up.
+ */
+int jit_compile(BlockCache *cache, Block *block);
+
+
+/*
+ * Runs the compiled `block` and whatever compiled blocks
+ * it chains to, while each of them fits before `end`
+ * cycles and no interrupt can be taken. The caller must
+ * check that `block` itself fits, with no trace,
+ * profile, breakpoints or read watchpoints set; PC
+ * and the counters are up to date on return.
+ */
+void jit_run(State8080 *state, Block *block, uint64_t end);
+
+
+/*
+ * Releases a code buffer (NULL is fine)
+ */
+void jit_free(Jit *jit);
+
+#endif // JIT_H
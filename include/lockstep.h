@@ -0,0 +1,34 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <inttypes.h>
+
+#include "core.h"
+#include "rom.h"
+
+/*
+ * Runs the ROM on `engine` alongside a recorded reference
+ * trace, comparing the state before every instruction, and
+ * stops at the first divergence or after `max_instrs`
+ * instructions (0 for the whole trace).
+ * Returns 0 if they matched, 1 on a divergence, -1 on error.
+ */
+int lockstep_trace(const RomImage *rom, Engine engine,
+    const char *trace_path, uint64_t max_instrs);
+
+
+/*
+ * Runs two instances of the ROM, one on each engine, one
+ * instruction at a time, comparing registers and flags after
+ * every instruction and all of memory periodically.
+ * With a nonzero `batch` they run `batch` cycles at a time
+ * instead, the way a headless run does, so engines that only
+ * speed up long runs (ENGINE_JIT) are checked too, and
+ * memory is compared after every batch.
+ * Runs `max_instrs` instructions, or until HLT if 0.
+ * Returns 0 if they matched, 1 on a divergence, -1 on error.
+ */
+int lockstep_engines(const RomImage *rom, Engine a, Engine b,
+    uint64_t max_instrs, uint64_t batch);
+
+#endif // LOCKSTEP_H
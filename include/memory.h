@@ -0,0 +1,142 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stddef.h>
+
+#include "core.h"
+
+// 16-bit addresses cover 64 KiB
+#define MEM_SIZE        0x10000
+
+// instruction fetches read up to two bytes past the
+// opcode, so the backing store has a little slack
+#define MEM_GUARD       2
+
+#define PAGE_SHIFT      8
+#define PAGE_SIZE       (1 << PAGE_SHIFT)
+#define NUM_PAGES       (MEM_SIZE / PAGE_SIZE)
+
+// page attributes; plain RAM is 0 so the write
+// fast path only has to test for zero
+#define PAGE_RAM        0
+#define PAGE_ROM        (1 << 0)  // writes are dropped
+#define PAGE_MMIO       (1 << 1)  // writes go to the map's mmio_write
+#define PAGE_MIRROR     (1 << 2)  // writes go to every copy of the page
+#define PAGE_CODE       (1 << 3)  // writes drop the decoded blocks they hit
+#define PAGE_TRACK      (1 << 4)  // the next write marks the page dirty
+#define PAGE_WATCH      (1 << 5)  // writes are checked against the watchpoints
+
+typedef void (*MmioWrite)(void *ctx, uint16_t addr, uint8_t val);
+
+typedef struct memory_map_t {
+    // attributes of each 256-byte page
+    uint8_t             attr[NUM_PAGES];
+
+    // for a mirrored page, the next page in the ring of
+    // pages that hold the same bytes
+    uint8_t             mirror_next[NUM_PAGES];
+
+    // pages written since the last mem_track_reset, 1 each; a
+    // write to a mirrored page marks the lowest page of its ring
+    uint8_t             dirty[NUM_PAGES];
+
+    MmioWrite           mmio_write;
+    void                *mmio_ctx;
+} MemoryMap;
+
+
+/*
+ * Allocates a zeroed 64 KiB backing store (MEM_SIZE + MEM_GUARD
+ * bytes). Pages are only committed once they are written.
+ */
+uint8_t* mem_alloc(void);
+
+
+/*
+ * Releases a backing store from mem_alloc or rom_image_map
+ */
+void mem_free(uint8_t *memory);
+
+
+/*
+ * Returns the 64-bit FNV-1a hash of the 64 KiB of guest memory
+ */
+uint64_t mem_hash(const uint8_t *memory);
+
+
+/*
+ * Marks every page as plain RAM
+ */
+void mem_map_init(MemoryMap *map);
+
+
+/*
+ * Sets the attributes of the pages covering
+ * `len` bytes from `start` (which should be page aligned)
+ */
+void mem_set_attr(MemoryMap *map, uint16_t start, size_t len, uint8_t attr);
+
+
+/*
+ * Write-protects the pages lying wholly within `len` bytes
+ * from `start`. A partial page at either end is shared with
+ * whatever else is there, so it stays writable.
+ */
+void mem_protect(MemoryMap *map, uint16_t start, size_t len);
+
+
+/*
+ * Makes the `len` bytes at `dst` a mirror of those at `src`:
+ * a write to either lands in both. Reads stay a plain index,
+ * so every copy is kept up to date on write.
+ */
+void mem_mirror(MemoryMap *map, uint16_t src, uint16_t dst, size_t len);
+
+
+/*
+ * Space Invaders layout: RAM at 0x2000-0x3fff mirrored at
+ * 0x4000-0x5fff (the ROM pages are protected by the loader)
+ */
+void mem_map_invaders(MemoryMap *map);
+
+
+/*
+ * Returns the page that stands for `page` in the dirty
+ * pages: the lowest one of its mirror ring
+ */
+uint8_t mem_canonical_page(const MemoryMap *map, uint8_t page);
+
+
+/*
+ * Starts a new interval of write tracking: clears the dirty
+ * pages and sets PAGE_TRACK on every writable one, so the first
+ * write to each takes the slow path once and marks it dirty
+ */
+void mem_track_reset(MemoryMap *map);
+
+
+/*
+ * Stops write tracking, putting RAM back on the fast path
+ */
+void mem_track_stop(MemoryMap *map);
+
+
+/*
+ * Handles writes to pages with any attribute set
+ */
+void mem_write_slow(State8080 *state, uint16_t addr, uint8_t val);
+
+
+/*
+ * Writes `val` to guest memory. Plain RAM takes one table
+ * lookup; everything else goes through mem_write_slow.
+ */
+static inline void mem_write(State8080 *state, uint16_t addr, uint8_t val) {
+    if (state->mem_map->attr[addr >> PAGE_SHIFT] == PAGE_RAM) {
+        state->memory[addr] = val;
+    } else {
+        mem_write_slow(state, addr, val);
+    }
+}
+
+#endif // MEMORY_H
@@ -0,0 +1,148 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "io.h"
+
+#define MOVIE_MAGIC     0x4d303849  // "I80M" little-endian
+#define MOVIE_VERSION   1
+
+// frames between the RAM hashes taken while recording
+#define MOVIE_CHECK_INTERVAL 60
+
+/*
+ * Frame numbers count the frames run so far: something "at
+ * frame f" happens after f frames, just before frame f runs.
+ */
+
+// input port `port` reads `value` from frame `frame` on
+typedef struct movie_input_t {
+    uint32_t            frame;
+    uint8_t             port;
+    uint8_t             value;
+    uint16_t            pad;
+} MovieInput;
+
+// guest memory hashes to `ram_hash` at frame `frame`
+typedef struct movie_check_t {
+    uint32_t            frame;
+    uint32_t            pad;
+    uint64_t            ram_hash;
+} MovieCheck;
+
+/*
+ * On disk, a MovieHeader is followed by the inputs and then
+ * the checks, each in frame order and written as is
+ */
+typedef struct movie_header_t {
+    uint32_t            magic;
+    uint16_t            version;
+    uint16_t            pad;
+    uint32_t            frames;
+    uint32_t            input_count;
+    uint32_t            check_count;
+    uint32_t            pad2;
+} MovieHeader;
+
+/*
+ * A recording of the input ports, kept only as the changes from
+ * one frame to the next, plus hashes of guest memory to check a
+ * replay against
+ */
+typedef struct movie_t {
+    uint32_t            frames;
+
+    MovieInput          *inputs;
+    size_t              input_count;
+    size_t              input_capacity;
+
+    MovieCheck          *checks;
+    size_t              check_count;
+    size_t              check_capacity;
+
+    // replay: the next input and check due
+    size_t              next_input;
+    size_t              next_check;
+
+    // recording: what the input ports read at the last frame
+    uint8_t             last[NUM_PORTS];
+} Movie;
+
+// a button press or release, from an input script
+typedef struct movie_press_t {
+    uint32_t            frame;
+    uint8_t             port;
+    uint8_t             mask;
+    uint8_t             pressed;
+} MoviePress;
+
+typedef struct movie_script_t {
+    MoviePress          *presses;
+    size_t              count;
+    size_t              next;
+} MovieScript;
+
+
+/*
+ * Returns an empty movie that starts with the ports of `io`
+ * (which may be NULL for all zeros), or NULL
+ */
+Movie* movie_new(const IoMap *io);
+
+
+void movie_free(Movie *movie);
+
+
+/*
+ * Recording: adds the input ports that changed since the last
+ * frame, and the hash of `memory`, at `frame`. Returns 0 on
+ * success and -1 if out of memory.
+ */
+int movie_record_inputs(Movie *movie, uint32_t frame, const IoMap *io);
+int movie_record_check(Movie *movie, uint32_t frame, const uint8_t *memory);
+
+
+/*
+ * Replay: sets the input ports to what they read at `frame`
+ */
+void movie_apply(Movie *movie, uint32_t frame, IoMap *io);
+
+
+/*
+ * Replay: if there is a check at `frame`, hashes `memory`
+ * against it. Returns 0 if it matches or there is no check,
+ * and -1, setting `expected`, if it doesn't.
+ */
+int movie_check(Movie *movie, uint32_t frame, const uint8_t *memory,
+    uint64_t *expected);
+
+
+/*
+ * Writes `movie` to `path`, or reads one written by movie_write
+ * (NULL on failure). movie_write returns 0 on success and -1 on
+ * failure.
+ */
+int movie_write(const Movie *movie, const char *path);
+Movie* movie_read(const char *path);
+
+
+/*
+ * Reads an input script of "<frame> press|release <button>"
+ * lines, in frame order, where the buttons are coin, tilt and
+ * p1/p2 start, shot, left and right. Blank lines and # comments
+ * are skipped. Returns 0 on success and -1 on failure.
+ */
+int movie_script_read(MovieScript *script, const char *path);
+
+
+void movie_script_free(MovieScript *script);
+
+
+/*
+ * Presses and releases the buttons due at `frame`
+ */
+void movie_script_apply(MovieScript *script, uint32_t frame, IoMap *io);
+
+#endif // MOVIE_H
@@ -0,0 +1,69 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <inttypes.h>
+#include <time.h>
+
+/*
+ * Keeps a run at the speed of the real machine by sleeping
+ * between frames. Deadlines come from the emulated cycle count,
+ * not a tally of frame periods, so overshooting a frame or
+ * waking late never adds up to drift: each frame sleeps until
+ * the wall clock catches up with the CPU.
+ */
+typedef struct pacer_t {
+    // emulated clock, and the wall and cycle counts it started at
+    uint64_t            hz;
+    struct timespec     start;
+    uint64_t            start_cycles;
+
+    // frames paced, and those that were still running at
+    // their deadline (the host couldn't keep up)
+    uint64_t            frames;
+    uint64_t            overruns;
+
+    // frames that fell more than `resync_ns` behind and
+    // restarted the clock rather than racing to catch up
+    uint64_t            resyncs;
+    uint64_t            resync_ns;
+
+    // how late each of the `sleeps` woke up past its deadline, in ns
+    uint64_t            sleeps;
+    double              late_sum;
+    double              late_sq_sum;
+    uint64_t            late_max;
+
+    // time spent emulating and drawing, between sleeps
+    double              busy_sum;
+    uint64_t            busy_max;
+    struct timespec     woke;
+
+    // wall and process CPU time when pacing started
+    struct timespec     began;
+    struct timespec     began_cpu;
+} Pacer;
+
+
+/*
+ * Starts pacing a CPU running at `hz` from `cycles`, now.
+ * A frame that finishes more than `resync_ns` late (such as
+ * after a stall) restarts the clock from it.
+ */
+void pacer_init(Pacer *pacer, uint64_t hz, uint64_t cycles, uint64_t resync_ns);
+
+
+/*
+ * Sleeps until the wall clock reaches the time of `cycles`
+ * on the emulated clock, with an absolute deadline on the
+ * monotonic clock. Returns early if a signal comes in.
+ */
+void pacer_wait(Pacer *pacer, uint64_t cycles);
+
+
+/*
+ * Prints the wake-up jitter, busy time, overruns and
+ * the CPU used since pacing started
+ */
+void pacer_report(const Pacer *pacer);
+
+#endif // PACER_H
@@ -0,0 +1,119 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "core.h"
+#include "memory.h"
+
+// hot spots and opcodes listed by profile_report
+#define PROFILE_TOP     20
+
+/*
+ * Where guest time goes, counted by the instance that owns it,
+ * so nothing is shared or locked. Per-opcode counts are exact;
+ * the PC histogram can be sampled to keep it out of the cache.
+ */
+typedef struct profile_t {
+    // executions of each opcode, and the cycles charged to it:
+    // from its fetch until the next fetch or the end of the run
+    uint64_t            op_count[256];
+    uint64_t            op_cycles[256];
+
+    // PC histogram, taking one sample every `period`
+    // instructions (1 to count every one)
+    uint64_t            pc_count[MEM_SIZE];
+    uint32_t            period;
+    uint32_t            countdown;
+    uint64_t            samples;
+
+    // the instruction being timed, if `timing` is set
+    uint64_t            start_cycles;
+    uint8_t             last_op;
+    uint8_t             timing;
+} Profile;
+
+// names for guest addresses, sorted by address
+typedef struct profile_symbol_t {
+    uint16_t            addr;
+    char                name[32];
+} ProfileSymbol;
+
+typedef struct profile_symbols_t {
+    ProfileSymbol       *syms;
+    size_t              count;
+} ProfileSymbols;
+
+
+/*
+ * Returns an empty profile that samples the PC every
+ * `period` instructions (0 or 1 for every one), or NULL
+ */
+Profile* profile_new(uint32_t period);
+
+
+void profile_free(Profile *profile);
+
+
+/*
+ * Counts `op`, the instruction at PC, which is about to run
+ */
+static inline void profile_step(Profile *profile, const State8080 *state, uint8_t op) {
+    if (profile->timing) {
+        profile->op_cycles[profile->last_op] += state->cycles - profile->start_cycles;
+    }
+    profile->op_count[op]++;
+    profile->last_op = op;
+    profile->start_cycles = state->cycles;
+    profile->timing = 1;
+
+    if (--profile->countdown == 0) {
+        profile->countdown = profile->period;
+        profile->pc_count[state->pc]++;
+        profile->samples++;
+    }
+}
+
+
+/*
+ * Charges the last instruction of a run. Halted time and
+ * interrupt entry, which happen between runs, aren't charged.
+ */
+static inline void profile_close(Profile *profile, const State8080 *state) {
+    if (profile->timing) {
+        profile->op_cycles[profile->last_op] += state->cycles - profile->start_cycles;
+        profile->timing = 0;
+    }
+}
+
+
+/*
+ * Writes the non-zero counters to `path`, as JSON if it ends
+ * in .json and CSV otherwise. Returns 0 on success and -1 on
+ * failure.
+ */
+int profile_write(const Profile *profile, const char *path);
+
+
+/*
+ * Reads "<address> <name>" lines (hex addresses, # comments)
+ * to name the hot spots in a report. Returns 0 on success and
+ * -1 on failure.
+ */
+int profile_symbols_read(ProfileSymbols *syms, const char *path);
+
+
+void profile_symbols_free(ProfileSymbols *syms);
+
+
+/*
+ * Prints the `top` opcodes by cycles and the `top` hottest
+ * PCs, disassembled from `memory` and named after the closest
+ * symbol at or below them, then the time per symbol. `syms`
+ * may be NULL.
+ */
+void profile_report(const Profile *profile, uint8_t *memory,
+    const ProfileSymbols *syms, int top);
+
+#endif // PROFILE_H
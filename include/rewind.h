@@ -0,0 +1,88 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "core.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "snapshot.h"
+
+// a full copy of memory once a second at one push per frame
+#define REWIND_KEYFRAME_INTERVAL    60
+
+/*
+ * One point in the rewind history. A keyframe holds every
+ * writable page; any other frame holds just the pages written
+ * since the frame before it.
+ */
+typedef struct rewind_frame_t {
+    SnapshotCpu         cpu;
+    SnapshotIo          io;
+    uint64_t            deadlines[MAX_EVENTS];
+
+    int                 keyframe;
+    int                 page_count;
+
+    // page numbers (lowest page of each mirror ring), ascending,
+    // and their contents, PAGE_SIZE bytes each
+    uint8_t             pages[NUM_PAGES];
+    uint8_t             *data;
+} RewindFrame;
+
+/*
+ * A bounded delta chain of frames, kept as a ring. When it fills
+ * up, the oldest frame is folded into the one after it, which
+ * becomes a keyframe, so every frame can still be rebuilt.
+ */
+typedef struct rewind_t {
+    RewindFrame         *frames;
+    size_t              capacity;
+    size_t              first;          // oldest frame
+    size_t              count;
+
+    int                 keyframe_interval;
+    int                 since_keyframe;
+
+    // page data held, and how many of the frames are keyframes
+    size_t              bytes;
+    size_t              keyframes;
+} Rewind;
+
+
+/*
+ * Returns a history of up to `frames` frames with a keyframe
+ * every `keyframe_interval` pushes, or NULL
+ */
+Rewind* rewind_new(size_t frames, int keyframe_interval);
+
+
+void rewind_free(Rewind *rewind);
+
+
+/*
+ * Records the current state as the newest frame, storing only
+ * the pages written since the last push, and starts tracking
+ * writes for the next one. The first push, and any push after
+ * rewind_clear, is a keyframe. Returns 0 on success, -1 if out
+ * of memory.
+ */
+int rewind_push(Rewind *rewind, State8080 *state, const Scheduler *sched);
+
+
+/*
+ * Puts the machine back as it was `frames` pushes before the
+ * newest one (0 for the newest) and drops the frames after
+ * that. Returns 0 on success, -1 if there aren't that many.
+ */
+int rewind_back(Rewind *rewind, State8080 *state, Scheduler *sched, size_t frames);
+
+
+/*
+ * Drops every frame, e.g. after memory was replaced by
+ * snapshot_load, so the next push is a keyframe
+ */
+void rewind_clear(Rewind *rewind);
+
+#endif // REWIND_H
@@ -0,0 +1,98 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "memory.h"
+
+#define ROM_MAX_PARTS 16
+
+// one file of a ROM set and where it's loaded
+typedef struct rom_part_t {
+    char                *filename;
+    uint16_t            addr;
+} RomPart;
+
+// a byte range of guest memory that holds ROM
+typedef struct rom_range_t {
+    uint16_t            addr;
+    size_t              size;
+} RomRange;
+
+/*
+ * A complete initial memory image (ROM set plus zeroed RAM)
+ * held in a shared memory object. Every instance maps it
+ * privately, so all of them share the same physical pages
+ * until they write to one.
+ */
+typedef struct rom_image_t {
+    int                 fd;
+
+    RomRange            ranges[ROM_MAX_PARTS];
+    int                 count;
+
+    // one past the highest ROM byte
+    size_t              end;
+} RomImage;
+
+
+/*
+ * Maps `filename` read-only and returns its contents,
+ * storing its size in `size`. Returns NULL on failure.
+ * Free with rom_unmap_file.
+ */
+const uint8_t* rom_map_file(const char *filename, size_t *size);
+
+
+void rom_unmap_file(const uint8_t *data, size_t size);
+
+
+/*
+ * Builds an image from `count` files loaded at their addresses.
+ * Returns 0 on success and -1 on failure.
+ */
+int rom_image_load(RomImage *img, const RomPart *parts, int count);
+
+
+/*
+ * Builds an image holding a copy of `memory` (MEM_SIZE bytes),
+ * with the same ROM ranges as `rom`, e.g. to start every
+ * instance from a snapshot. Returns 0 on success and -1 on failure.
+ */
+int rom_image_from_memory(RomImage *img, const RomImage *rom, const uint8_t *memory);
+
+
+/*
+ * Builds an image from a single file loaded at 0x0000
+ */
+int rom_image_load_file(RomImage *img, const char *filename);
+
+
+/*
+ * Builds an image from a manifest: one "<file> <address>" pair
+ * per line, with paths relative to the manifest and # comments.
+ * Returns 0 on success and -1 on failure.
+ */
+int rom_image_load_manifest(RomImage *img, const char *path);
+
+
+/*
+ * Returns a copy-on-write mapping of the image to use as an
+ * instance's guest memory (MEM_SIZE + MEM_GUARD bytes), or
+ * NULL on failure. Release it with mem_free.
+ */
+uint8_t* rom_image_map(const RomImage *img);
+
+
+/*
+ * Write-protects the image's ROM ranges in `map`, page by
+ * page: a page a range only partly covers stays writable,
+ * so RAM sharing it still works
+ */
+void rom_image_protect(const RomImage *img, MemoryMap *map);
+
+
+void rom_image_free(RomImage *img);
+
+#endif // ROM_H
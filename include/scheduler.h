@@ -0,0 +1,77 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "core.h"
+
+#define MAX_EVENTS 8
+
+typedef void (*EventHandler)(State8080 *state, void *ctx);
+
+typedef struct event_t {
+    // cycle count at which the event next fires
+    uint64_t            deadline;
+
+    // cycles between firings, 0 for a one-shot event
+    uint64_t            period;
+
+    EventHandler        fire;
+    void                *ctx;
+} Event;
+
+typedef struct scheduler_t {
+    Event               events[MAX_EVENTS];
+    int                 count;
+
+    // earliest deadline of all the events, so a batch
+    // only has to be checked against one number
+    uint64_t            next_deadline;
+} Scheduler;
+
+
+/*
+ * Clears the scheduler
+ */
+void sched_init(Scheduler *sched);
+
+
+/*
+ * Adds an event that first fires once the cycle counter
+ * reaches `deadline` and then every `period` cycles.
+ * Returns the index of the event, or -1 if full.
+ */
+int sched_add(Scheduler *sched, uint64_t deadline, uint64_t period,
+    EventHandler fire, void *ctx);
+
+
+/*
+ * Moves event `index` to fire next at `deadline`
+ * (UINT64_MAX for never)
+ */
+void sched_set_deadline(Scheduler *sched, int index, uint64_t deadline);
+
+
+/*
+ * Fires every event whose deadline has passed
+ */
+void sched_fire_due(Scheduler *sched, State8080 *state);
+
+
+/*
+ * Runs `cycles` cycles, splitting the run at each event
+ * deadline and taking latched interrupts at the first
+ * instruction boundary that allows them.
+ * Stops early on a breakpoint or watchpoint (stepping
+ * over breakpoints whose condition doesn't hold) or on
+ * a HLT that no interrupt can end.
+ */
+RunStop sched_run(Scheduler *sched, State8080 *state, uint64_t cycles);
+
+
+/*
+ * Schedules the two Space Invaders video interrupts:
+ * RST 1 when the beam reaches mid-screen and RST 2
+ * at VBlank, each once per 60 Hz frame
+ */
+void invaders_schedule_interrupts(Scheduler *sched, uint64_t now);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,134 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <inttypes.h>
+
+#include "core.h"
+#include "io.h"
+#include "memory.h"
+#include "rom.h"
+#include "scheduler.h"
+
+#define SNAPSHOT_MAGIC      0x53303849  // "I80S" little-endian
+#define SNAPSHOT_VERSION    3
+
+/*
+ * CPU state of a snapshot, with the flags as a PSW byte
+ */
+typedef struct snapshot_cpu_t {
+    uint64_t            cycles;
+    uint64_t            instructions;
+
+    // State8080.ei_shadow: nonzero straight after EI
+    uint64_t            ei_shadow;
+    uint16_t            sp;
+    uint16_t            pc;
+
+    uint8_t             a;
+    uint8_t             b;
+    uint8_t             c;
+    uint8_t             d;
+    uint8_t             e;
+    uint8_t             h;
+    uint8_t             l;
+    uint8_t             psw;
+
+    uint8_t             int_enable;
+    uint8_t             halted;
+    uint8_t             int_pending;
+    uint8_t             int_rst;
+} SnapshotCpu;
+
+/*
+ * Device state of a snapshot: the port latches and the shift
+ * register (attached devices keep their own state)
+ */
+typedef struct snapshot_io_t {
+    uint8_t             in_value[NUM_PORTS];
+    uint8_t             out_value[NUM_PORTS];
+    uint16_t            shift;
+    uint8_t             shift_offset;
+    uint8_t             pad[5];
+} SnapshotIo;
+
+/*
+ * Everything needed to resume a machine: the CPU, the devices,
+ * the scheduler's event deadlines and all of guest memory.
+ * Fixed size, and written to disk as is.
+ */
+typedef struct snapshot_t {
+    uint32_t            magic;
+    uint16_t            version;
+    uint16_t            event_count;
+    uint32_t            size;           // sizeof(Snapshot)
+    uint32_t            pad;
+
+    SnapshotCpu         cpu;
+    SnapshotIo          io;
+
+    // when each scheduler event next fires (UINT64_MAX
+    // for a spent one-shot event)
+    uint64_t            deadlines[MAX_EVENTS];
+
+    uint8_t             memory[MEM_SIZE];
+} Snapshot;
+
+
+/*
+ * Captures or restores just the CPU or the device part of a snapshot
+ */
+void snapshot_save_cpu(SnapshotCpu *cpu, const State8080 *state);
+void snapshot_load_cpu(State8080 *state, const SnapshotCpu *cpu);
+void snapshot_save_io(SnapshotIo *snap_io, const IoMap *io);
+void snapshot_load_io(IoMap *io, const SnapshotIo *snap_io);
+
+
+/*
+ * Captures `state` and the deadlines of `sched`
+ * (which may be NULL) into `snap`
+ */
+void snapshot_save(Snapshot *snap, const State8080 *state, const Scheduler *sched);
+
+
+/*
+ * Puts `state`, an instance set up by emu_load with the same ROM,
+ * and `sched` (which may be NULL, otherwise set up with the same
+ * events as when the snapshot was taken) back as `snap` has them.
+ * The RAM pages that differ are copied over, leaving ROM and
+ * unchanged pages unwritten, and decoded blocks are dropped if
+ * any were.
+ */
+void snapshot_load(State8080 *state, Scheduler *sched, const Snapshot *snap);
+
+
+/*
+ * Builds a shared image of the snapshot's memory, keeping the
+ * ROM ranges of `rom`, for snapshot_fork to map. Returns 0
+ * on success and -1 on failure. Free with rom_image_free.
+ */
+int snapshot_share(RomImage *img, const Snapshot *snap, const RomImage *rom);
+
+
+/*
+ * Sets up a new instance like emu_load, but starting from `snap`
+ * with `img` (from snapshot_share) mapped copy-on-write as its
+ * memory, so it only copies the pages it writes. Returns 0 on
+ * success and -1 on failure; release with emu_unload.
+ */
+int snapshot_fork(State8080 *state, Scheduler *sched, const Snapshot *snap,
+    const RomImage *img);
+
+
+/*
+ * Writes `snap` to `path`. Returns 0 on success and -1 on failure.
+ */
+int snapshot_write(const Snapshot *snap, const char *path);
+
+
+/*
+ * Reads a snapshot written by snapshot_write, checking its
+ * magic, version and size. Returns 0 on success and -1 on failure.
+ */
+int snapshot_read(Snapshot *snap, const char *path);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,126 @@
+#ifndef SOUND_H
+#define SOUND_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "io.h"
+
+#define SOUND_RATE          44100
+
+// port writes in flight to the audio thread, and mixed
+// samples waiting to be played (both powers of 2)
+#define SOUND_QUEUE_SIZE    4096
+#define SOUND_RING_SIZE     16384
+
+// the Invaders board's sounds, numbered as the
+// usual sample sets name them (0.wav to 8.wav)
+#define SOUND_COUNT         9
+
+// keeps each side's counters out of the other's cache line
+#define SOUND_CACHE_LINE    64
+
+// an event on no port: only tells the mixer how far
+// the CPU has got
+#define SOUND_MARK          0
+
+/*
+ * A write to a sound port, stamped with the CPU's cycle count
+ */
+typedef struct sound_event_t {
+    uint64_t            cycles;
+    uint8_t             port;
+    uint8_t             value;
+} SoundEvent;
+
+typedef struct sound_sample_t {
+    int16_t             *data;
+    uint32_t            len;
+} SoundSample;
+
+/*
+ * Invaders sound. The OUT 3 and OUT 5 handlers push each
+ * write, with its cycle count, onto a single-producer,
+ * single-consumer queue and never wait: if the queue is full
+ * the write is dropped and counted. An audio thread takes
+ * them off, mixes the samples they start into a ring of
+ * SOUND_RATE samples, on the emulated clock, and writes
+ * them out to a WAV file. Without a file, whoever plays the
+ * ring takes samples off with sound_read.
+ */
+typedef struct sound_t {
+    // written by the CPU thread: the next event goes in
+    // queue[head], and `tail_seen` is its last look at `tail`
+    _Alignas(SOUND_CACHE_LINE) _Atomic uint64_t head;
+    uint64_t            tail_seen;
+    uint64_t            events;
+    uint64_t            dropped;
+    IoMap               *io;
+
+    // written by the audio thread: events taken off the queue
+    _Alignas(SOUND_CACHE_LINE) _Atomic uint64_t tail;
+
+    // samples mixed into the ring, and played from it
+    _Alignas(SOUND_CACHE_LINE) _Atomic uint64_t mixed;
+    _Alignas(SOUND_CACHE_LINE) _Atomic uint64_t played;
+
+    SoundEvent          queue[SOUND_QUEUE_SIZE];
+    int16_t             ring[SOUND_RING_SIZE];
+
+    // the rest belongs to the audio thread: the samples,
+    // where each one playing is up to (or -1), and the
+    // last byte seen on OUT 3 and OUT 5
+    SoundSample         samples[SOUND_COUNT];
+    int64_t             voices[SOUND_COUNT];
+    uint8_t             latches[2];
+
+    // emulated clock, and the cycle count at sample 0
+    uint64_t            hz;
+    uint64_t            start_cycles;
+
+    FILE                *wav;
+    pthread_t           thread;
+    int                 started;
+    _Atomic int         closing;
+} Sound;
+
+
+/*
+ * Starts mixing for a CPU running at `hz` from `cycles`, and
+ * connects OUT 3 and OUT 5 of `io` to it (keeping their
+ * latches). Samples are read from `samples_dir`/0.wav to 8.wav
+ * (8 or 16-bit PCM); those missing, or all of them with
+ * `samples_dir` NULL, are replaced by plain tones. Mixed
+ * audio goes to `wav_path` if it is set. Returns NULL on
+ * failure.
+ */
+Sound* sound_new(IoMap *io, uint64_t hz, uint64_t cycles,
+    const char *samples_dir, const char *wav_path);
+
+
+/*
+ * Tells the mixer the CPU has got to `cycles`, so it can mix
+ * up to there. Called once a frame from the CPU thread.
+ */
+void sound_frame(Sound *sound, uint64_t cycles);
+
+
+/*
+ * Takes up to `max` mixed samples off the ring, for whoever
+ * plays them when there is no WAV file. Returns how many.
+ */
+size_t sound_read(Sound *sound, int16_t *out, size_t max);
+
+
+/*
+ * Mixes whatever is still queued, stops the audio thread
+ * and finishes the WAV file. Returns 0 on success and -1
+ * if the file couldn't be written.
+ */
+int sound_finish(Sound *sound);
+
+
+void sound_free(Sound *sound);
+
+#endif // SOUND_H
@@ -0,0 +1,158 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "core.h"
+
+#define TRACE_MAGIC     0x54303849  // "I80T" little-endian
+#define TRACE_VERSION   1
+
+// records are handed to the flush thread this many at a time
+#define TRACE_CHUNK     4096
+
+/*
+ * State before one instruction executes. Fixed size and
+ * written to disk as is, after a TraceHeader.
+ */
+typedef struct trace_record_t {
+    uint64_t            cycles;
+    uint16_t            pc;
+    uint16_t            sp;
+
+    // the opcode and its (up to two) operand bytes
+    uint8_t             op[3];
+
+    uint8_t             a;
+    uint8_t             b;
+    uint8_t             c;
+    uint8_t             d;
+    uint8_t             e;
+    uint8_t             h;
+    uint8_t             l;
+    uint8_t             psw;
+    uint8_t             pad;
+} TraceRecord;
+
+typedef struct trace_header_t {
+    uint32_t            magic;
+    uint16_t            version;
+    uint16_t            record_size;
+} TraceHeader;
+
+typedef struct tracer_t {
+    // preallocated ring of `capacity` (a power of 2) records
+    TraceRecord         *ring;
+    uint64_t            mask;
+
+    // records written since the tracer was opened
+    uint64_t            head;
+
+    // streaming to a file: the flush thread writes out
+    // [flushed, ready) while the CPU keeps filling the ring
+    FILE                *file;
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      more;
+    pthread_cond_t      space;
+    uint64_t            ready;
+    uint64_t            flushed;
+    int                 closing;
+} Tracer;
+
+
+/*
+ * Opens a tracer that streams every record to `path`,
+ * flushing from a background thread. The CPU only waits
+ * if it gets a whole ring ahead of the disk.
+ * Returns NULL on failure.
+ */
+Tracer* trace_open_stream(const char *path);
+
+
+/*
+ * Opens an in-memory tracer that keeps the last
+ * `count` records (rounded up to a power of 2)
+ */
+Tracer* trace_open_ring(size_t count);
+
+
+/*
+ * Writes the last `count` records (or as many as are held)
+ * to `path` in the trace file format. Returns 0 on success.
+ */
+int trace_dump(const Tracer *tracer, const char *path, size_t count);
+
+
+/*
+ * Flushes a streaming tracer and frees it
+ */
+void trace_close(Tracer *tracer);
+
+
+/*
+ * Prints a trace file as text, one line per instruction,
+ * with the registers and the disassembly.
+ * Returns 0 on success.
+ */
+int trace_decode(const char *path);
+
+
+/*
+ * Prints one record in the trace_decode format
+ */
+void trace_print_record(const TraceRecord *rec);
+
+
+/*
+ * Maps a trace file read-only and returns its records, storing
+ * how many there are in `count`. Returns NULL on failure.
+ * Release with trace_unmap.
+ */
+const TraceRecord* trace_map(const char *path, size_t *count);
+
+
+void trace_unmap(const TraceRecord *records, size_t count);
+
+
+/*
+ * Called by trace_step every TRACE_CHUNK records
+ */
+void trace_chunk_done(Tracer *tracer);
+
+
+/*
+ * Fills `rec` from the state before the instruction at PC runs
+ */
+static inline void trace_capture(TraceRecord *rec, const State8080 *state) {
+    const uint8_t *code = &state->memory[state->pc];
+    rec->cycles = state->cycles;
+    rec->pc = state->pc;
+    rec->sp = state->sp;
+    rec->op[0] = code[0];
+    rec->op[1] = code[1];
+    rec->op[2] = code[2];
+    rec->a = state->a;
+    rec->b = state->b;
+    rec->c = state->c;
+    rec->d = state->d;
+    rec->e = state->e;
+    rec->h = state->h;
+    rec->l = state->l;
+    rec->psw = state->lazy_mask ? flags_psw(state) : state->cc.psw;
+    rec->pad = 0;
+}
+
+
+/*
+ * Records the state before the instruction at PC runs
+ */
+static inline void trace_step(Tracer *tracer, const State8080 *state) {
+    trace_capture(&tracer->ring[tracer->head & tracer->mask], state);
+    if ((++tracer->head & (TRACE_CHUNK - 1)) == 0) {
+        trace_chunk_done(tracer);
+    }
+}
+
+#endif // TRACE_H
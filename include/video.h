@@ -0,0 +1,90 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// Invaders video RAM: 224 rows of 256 pixels, 1 bit each,
+// lowest bit leftmost, on a monitor turned 90 degrees
+#define VIDEO_RAM       0x2400
+#define VIDEO_RAM_SIZE  0x1c00
+#define VIDEO_ROW_BYTES 32
+
+// the picture the way it is seen, upright
+#define VIDEO_WIDTH     224
+#define VIDEO_HEIGHT    256
+
+// VRAM is converted in tiles of 8x8 pixels; a strip of 28 across
+// is one 256-byte page of VRAM and a column of the picture
+#define VIDEO_TILE      8
+#define VIDEO_STRIPS    (VIDEO_WIDTH / VIDEO_TILE)
+
+typedef enum video_format_t {
+    VIDEO_GRAY = 0,     // 1 byte per pixel
+    VIDEO_RGBA,         // 4 bytes per pixel, R G B A in memory
+} VideoFormat;
+
+/*
+ * An upright framebuffer of the Invaders screen, converted from
+ * VRAM. A copy of VRAM as it was last converted lets each update
+ * redraw just the tiles whose bytes changed since.
+ */
+typedef struct video_t {
+    VideoFormat         format;
+
+    // VIDEO_HEIGHT rows of `pitch` bytes, top row first
+    uint8_t             *pixels;
+    size_t              pitch;
+
+    // lit and unlit pixels: gray levels in the low byte, or
+    // RGBA colours as their 4 bytes in memory order
+    uint32_t            fg;
+    uint32_t            bg;
+
+    // VRAM as of the last update, and whether the pixels match it
+    uint8_t             shadow[VIDEO_RAM_SIZE];
+    int                 valid;
+
+    // updates done, and tiles they redrew
+    uint64_t            frames;
+    uint64_t            tiles;
+} Video;
+
+
+/*
+ * Returns a black framebuffer with white pixels, or NULL
+ */
+Video* video_new(VideoFormat format);
+
+
+void video_free(Video *video);
+
+
+/*
+ * Redraws the tiles whose VRAM bytes in `memory` (the whole
+ * 64 KiB guest memory) changed since the last update, or every
+ * tile after video_invalidate. Returns the tiles redrawn.
+ */
+int video_update(Video *video, const uint8_t *memory);
+
+
+/*
+ * Has the next update redraw everything, e.g. after changing
+ * the colours
+ */
+void video_invalidate(Video *video);
+
+
+/*
+ * Writes the framebuffer to `path` as a binary PGM (gray) or
+ * PPM (RGBA, without alpha). Returns 0 on success and -1 on failure.
+ */
+int video_write(const Video *video, const char *path);
+
+
+/*
+ * Name of the bit-expansion kernels built in: sse2, neon or scalar
+ */
+const char* video_kernel_name(void);
+
+#endif // VIDEO_H
@@ -0,0 +1,464 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batch.h"
+#include "emu.h"
+#include "memory.h"
+#include "scheduler.h"
+
+#define CACHE_LINE      64
+
+struct pool_t;
+
+/*
+ * A worker thread and the instance it runs jobs on. The state
+ * and the job queue sit on cache lines of their own, so one
+ * worker stealing from another doesn't slow down its emulation.
+ */
+typedef struct worker_t {
+    _Alignas(CACHE_LINE) State8080 state;
+
+    // jobs [head, tail) are still queued; the owner takes
+    // from the tail and thieves from the head
+    _Alignas(CACHE_LINE) pthread_mutex_t lock;
+    size_t              head;
+    size_t              tail;
+
+    int                 id;
+    pthread_t           thread;
+    struct pool_t       *pool;
+} Worker;
+
+typedef struct pool_t {
+    Worker              *workers;
+    int                 count;
+    Batch               *batch;
+} Pool;
+
+
+/*
+ * Returns the seconds elapsed since `start`
+ */
+static double elapsed_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)
+        + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+/*
+ * Loads `path` unless an earlier job already did,
+ * setting job->rom. Returns 0 on success.
+ */
+static int load_rom(Batch *batch, BatchJob *job) {
+    for (size_t i = 0; i < batch->count; i++) {
+        BatchJob *other = &batch->jobs[i];
+        if (other == job) {
+            break;
+        }
+        if (other->manifest == job->manifest
+                && strcmp(other->rom_path, job->rom_path) == 0) {
+            job->rom = other->rom;
+            return 0;
+        }
+    }
+
+    RomImage *rom = &batch->roms[batch->rom_count];
+    int loaded = job->manifest
+        ? rom_image_load_manifest(rom, job->rom_path)
+        : rom_image_load_file(rom, job->rom_path);
+    if (loaded < 0) {
+        return -1;
+    }
+    job->rom = batch->rom_count++;
+    return 0;
+}
+
+
+/*
+ * Reads the job's snapshot and shares it as an image unless an
+ * earlier job on the same ROM already did, setting job->seed.
+ * Returns 0 on success.
+ */
+static int load_seed(Batch *batch, BatchJob *job) {
+    job->seed = -1;
+    if (job->snapshot_path == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < batch->count; i++) {
+        BatchJob *other = &batch->jobs[i];
+        if (other == job) {
+            break;
+        }
+        if (other->seed >= 0 && other->rom == job->rom
+                && strcmp(other->snapshot_path, job->snapshot_path) == 0) {
+            job->seed = other->seed;
+            return 0;
+        }
+    }
+
+    BatchSeed *seed = &batch->seeds[batch->seed_count];
+    seed->snap = malloc(sizeof(Snapshot));
+    if (seed->snap == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        return -1;
+    }
+    if (snapshot_read(seed->snap, job->snapshot_path) < 0
+            || snapshot_share(&seed->image, seed->snap, &batch->roms[job->rom]) < 0) {
+        free(seed->snap);
+        return -1;
+    }
+    job->seed = batch->seed_count++;
+    return 0;
+}
+
+
+/*
+ * Parses one job list line into `job`. Returns 1 for a job,
+ * 0 for a blank or comment line, -1 on a bad line and -2 if
+ * out of memory.
+ */
+static int parse_job(char *line, BatchJob *job) {
+    char *hash = strchr(line, '#');
+    if (hash) {
+        *hash = '\0';
+    }
+
+    char rom[4096], engine[32], snapshot[4096], movie[4096];
+    unsigned long long max_instrs;
+    int fields = sscanf(line, "%4095s %llu %31s %4095s %4095s",
+        rom, &max_instrs, engine, snapshot, movie);
+    if (fields <= 0) {
+        return 0;
+    }
+    // only a movie ends a run that has no instruction limit
+    if (fields < 2 || (max_instrs == 0 && fields < 5)) {
+        return -1;
+    }
+
+    memset(job, 0, sizeof(*job));
+    job->manifest = rom[0] == '@';
+    job->rom_path = strdup(rom + job->manifest);
+    if (job->rom_path == NULL) {
+        return -2;
+    }
+    job->max_instrs = max_instrs;
+    job->engine = ENGINE_DEFAULT;
+    if (fields >= 3 && (engine_from_name(engine, &job->engine) < 0
+            || !engine_available(job->engine))) {
+        free(job->rom_path);
+        return -1;
+    }
+    if (fields >= 4 && strcmp(snapshot, "-") != 0) {
+        job->snapshot_path = strdup(snapshot);
+        if (job->snapshot_path == NULL) {
+            free(job->rom_path);
+            return -2;
+        }
+    }
+    if (fields == 5) {
+        job->movie_path = strdup(movie);
+        if (job->movie_path == NULL) {
+            free(job->rom_path);
+            free(job->snapshot_path);
+            return -2;
+        }
+    }
+    return 1;
+}
+
+
+int batch_load(Batch *batch, const char *path) {
+    memset(batch, 0, sizeof(*batch));
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return -1;
+    }
+
+    size_t capacity = 0;
+    char line[8192];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        BatchJob job;
+        int parsed = parse_job(line, &job);
+        if (parsed == -2) {
+            fprintf(stderr, "Error: out of memory\n");
+            fclose(f);
+            batch_free(batch);
+            return -1;
+        }
+        if (parsed < 0) {
+            fprintf(stderr, "Error: %s:%d: expected "
+                "<rom> <max-instrs> [engine [snapshot [movie]]]\n", path, lineno);
+            fclose(f);
+            batch_free(batch);
+            return -1;
+        }
+        if (parsed == 0) {
+            continue;
+        }
+        if (batch->count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            BatchJob *grown = realloc(batch->jobs, capacity * sizeof(BatchJob));
+            if (grown == NULL) {
+                fprintf(stderr, "Error: out of memory\n");
+                free(job.rom_path);
+                free(job.snapshot_path);
+                free(job.movie_path);
+                fclose(f);
+                batch_free(batch);
+                return -1;
+            }
+            batch->jobs = grown;
+        }
+        job.line = lineno;
+        batch->jobs[batch->count++] = job;
+    }
+    fclose(f);
+
+    // at most one image and one snapshot per job
+    batch->roms = calloc(batch->count ? batch->count : 1, sizeof(RomImage));
+    batch->seeds = calloc(batch->count ? batch->count : 1, sizeof(BatchSeed));
+    if (batch->roms == NULL || batch->seeds == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        batch_free(batch);
+        return -1;
+    }
+    for (size_t i = 0; i < batch->count; i++) {
+        BatchJob *job = &batch->jobs[i];
+        if (job->movie_path) {
+            job->movie = movie_read(job->movie_path);
+        }
+        if (load_rom(batch, job) < 0 || load_seed(batch, job) < 0
+                || (job->movie_path && job->movie == NULL)) {
+            fprintf(stderr, "Error: %s:%d: couldn't set up the job\n", path, job->line);
+            batch_free(batch);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+void batch_free(Batch *batch) {
+    for (size_t i = 0; i < batch->count; i++) {
+        free(batch->jobs[i].rom_path);
+        free(batch->jobs[i].snapshot_path);
+        free(batch->jobs[i].movie_path);
+        movie_free(batch->jobs[i].movie);
+    }
+    for (size_t i = 0; i < batch->rom_count; i++) {
+        rom_image_free(&batch->roms[i]);
+    }
+    for (size_t i = 0; i < batch->seed_count; i++) {
+        rom_image_free(&batch->seeds[i].image);
+        free(batch->seeds[i].snap);
+    }
+    free(batch->jobs);
+    free(batch->roms);
+    free(batch->seeds);
+    memset(batch, 0, sizeof(*batch));
+}
+
+
+/*
+ * Runs `job` on the worker's instance, the same way
+ * run_headless does but with no output. A job with a
+ * snapshot forks from its shared image, so it only
+ * copies the pages it writes. A job with a movie feeds
+ * it the recorded inputs and stops at the end of it or
+ * at the first hash that doesn't match.
+ */
+static void run_job(Worker *worker, BatchJob *job) {
+    Batch *batch = worker->pool->batch;
+    State8080 *state = &worker->state;
+    job->worker = worker->id;
+
+    Scheduler sched;
+    sched_init(&sched);
+    invaders_schedule_interrupts(&sched, 0);
+
+    int loaded = job->seed >= 0
+        ? snapshot_fork(state, &sched, batch->seeds[job->seed].snap,
+            &batch->seeds[job->seed].image)
+        : emu_load(state, &batch->roms[job->rom]);
+    if (loaded < 0) {
+        job->status = -1;
+        return;
+    }
+    state->engine = job->engine;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // counts are for this run, not from reset
+    uint64_t start_instrs = state->instructions;
+    uint64_t start_cycles = state->cycles;
+    uint64_t end = job->max_instrs ? start_instrs + job->max_instrs : UINT64_MAX;
+    Movie *movie = job->movie;
+    uint64_t expected;
+    uint32_t frame = 0;
+    while (state->instructions < end) {
+        if (movie) {
+            if (movie_check(movie, frame, state->memory, &expected) < 0) {
+                job->diverged = 1;
+                break;
+            }
+            if (frame == movie->frames) {
+                job->movie_end = 1;
+                break;
+            }
+            movie_apply(movie, frame, state->io);
+        }
+        frame++;
+        if (sched_run(&sched, state, CYCLES_PER_FRAME) == STOP_HALT) {
+            break;
+        }
+    }
+    if (movie && !job->diverged
+            && movie_check(movie, frame, state->memory, &expected) < 0) {
+        job->diverged = 1;
+    }
+
+    job->secs = elapsed_since(&start);
+    job->status = 0;
+    job->halted = state->halted;
+    job->frames = frame;
+    job->pc = state->pc;
+    job->instructions = state->instructions - start_instrs;
+    job->cycles = state->cycles - start_cycles;
+    job->ram_hash = mem_hash(state->memory);
+    emu_unload(state);
+}
+
+
+/*
+ * Takes the next job from the worker's own queue, or
+ * steals the oldest one from another worker. Returns
+ * NULL once every queue is empty; no job is ever added,
+ * so nothing can turn up after that.
+ */
+static BatchJob* next_job(Worker *self) {
+    Pool *pool = self->pool;
+    BatchJob *job = NULL;
+
+    pthread_mutex_lock(&self->lock);
+    if (self->head < self->tail) {
+        job = &pool->batch->jobs[--self->tail];
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    for (int i = 1; job == NULL && i < pool->count; i++) {
+        Worker *victim = &pool->workers[(self->id + i) % pool->count];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) {
+            job = &pool->batch->jobs[victim->head++];
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return job;
+}
+
+
+static void* worker_thread(void *arg) {
+    Worker *worker = arg;
+    BatchJob *job;
+    while ((job = next_job(worker)) != NULL) {
+        run_job(worker, job);
+    }
+    return NULL;
+}
+
+
+double batch_run(Batch *batch, int threads) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    if ((size_t) threads > batch->count) {
+        threads = batch->count ? (int) batch->count : 1;
+    }
+
+    Pool pool;
+    pool.count = threads;
+    pool.batch = batch;
+    pool.workers = aligned_alloc(CACHE_LINE, threads * sizeof(Worker));
+    if (pool.workers == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        return -1;
+    }
+    memset(pool.workers, 0, threads * sizeof(Worker));
+
+    // each worker starts with a contiguous share of the jobs
+    for (int i = 0; i < threads; i++) {
+        Worker *worker = &pool.workers[i];
+        worker->id = i;
+        worker->pool = &pool;
+        worker->head = batch->count * i / threads;
+        worker->tail = batch->count * (i + 1) / threads;
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&pool.workers[i].thread, NULL, worker_thread, &pool.workers[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(pool.workers[i].thread, NULL);
+    }
+    double secs = elapsed_since(&start);
+
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_destroy(&pool.workers[i].lock);
+    }
+    free(pool.workers);
+    return secs;
+}
+
+
+void batch_report(const Batch *batch, double secs, FILE *f) {
+    uint64_t instructions = 0;
+    double busy = 0;
+    size_t failed = 0;
+    size_t diverged = 0;
+
+    fprintf(f, "%-6s %-8s %-5s %12s %12s %-6s %-16s %8s %12s  %s\n",
+        "line", "engine", "stop", "instrs", "cycles", "pc", "ram hash",
+        "secs", "instr/s", "rom");
+    for (size_t i = 0; i < batch->count; i++) {
+        const BatchJob *job = &batch->jobs[i];
+        if (job->status < 0) {
+            fprintf(f, "%-6d %-8s %-5s %12s %12s %-6s %-16s %8s %12s  %s\n",
+                job->line, engine_name(job->engine), "fail", "-", "-", "-", "-",
+                "-", "-", job->rom_path);
+            failed++;
+            continue;
+        }
+        instructions += job->instructions;
+        busy += job->secs;
+        diverged += job->diverged;
+        const char *stop = job->diverged ? "diff"
+            : job->halted ? "halt"
+            : job->movie_end ? "end"
+            : "limit";
+        fprintf(f, "%-6d %-8s %-5s %12" PRIu64 " %12" PRIu64 " 0x%04x %016" PRIx64
+            " %8.3f %12.0f  %s\n",
+            job->line, engine_name(job->engine), stop,
+            job->instructions, job->cycles, job->pc, job->ram_hash, job->secs,
+            job->secs > 0 ? job->instructions / job->secs : 0, job->rom_path);
+    }
+
+    fprintf(f, "Jobs: %zu, %zu failed, %zu diverged from their movie\n",
+        batch->count, failed, diverged);
+    fprintf(f, "Instructions executed: %" PRIu64 "\n", instructions);
+    fprintf(f, "Elapsed time: %.3f s (%.3f s of emulation)\n", secs, busy);
+    if (secs > 0) {
+        fprintf(f, "Instructions/sec: %.0f\n", instructions / secs);
+    }
+}
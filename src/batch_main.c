@@ -0,0 +1,71 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "batch.h"
+
+
+static void usage(char *prog) {
+    printf("Usage: %s [options] <job list>\n", prog);
+    printf("Runs every job in the list headless and reports the results.\n");
+    printf("Each line of the list is\n");
+    printf("\"<rom> <max-instrs> [engine [snapshot|- [movie]]]\", where a <rom>\n");
+    printf("starting with @ is a ROM set manifest and a movie is replayed\n");
+    printf("and checked against its RAM hashes.\n");
+    printf("  -j, --threads N       run N instances at a time (default: one\n");
+    printf("                        per online CPU)\n");
+    printf("  -h, --help            show this message\n");
+}
+
+
+int main(int argc, char **argv) {
+    static struct option long_opts[] = {
+        {"threads",     required_argument, NULL, 'j'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'j':
+                threads = strtol(optarg, NULL, 0);
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Batch batch;
+    if (batch_load(&batch, argv[optind]) < 0) {
+        return 1;
+    }
+
+    double secs = batch_run(&batch, threads > 0 ? (int) threads : 1);
+    if (secs < 0) {
+        batch_free(&batch);
+        return 1;
+    }
+    batch_report(&batch, secs, stdout);
+
+    int status = 0;
+    for (size_t i = 0; i < batch.count; i++) {
+        if (batch.jobs[i].status < 0 || batch.jobs[i].diverged) {
+            status = 1;
+        }
+    }
+    batch_free(&batch);
+    return status;
+}
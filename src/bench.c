@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "cpm.h"
+#include "emu.h"
+#include "memory.h"
+#include "scheduler.h"
+
+// ALU: a mix of register and immediate arithmetic, logic,
+// rotates, INR/DCR and DAA in a DCR/JNZ loop
+static const uint8_t alu_kernel[] = {
+    0x31, 0x00, 0xf0,       // LXI SP,0xf000
+    0x06, 0x00,             // MVI B,0
+    0x0e, 0x00,             // MVI C,0
+    0x16, 0x37,             // MVI D,0x37
+    0x1e, 0x5a,             // MVI E,0x5a
+    0x80,                   // loop: ADD B
+    0x89,                   // ADC C
+    0x92,                   // SUB D
+    0x9b,                   // SBB E
+    0xa2,                   // ANA D
+    0xb3,                   // ORA E
+    0xaa,                   // XRA D
+    0xbb,                   // CMP E
+    0x07,                   // RLC
+    0x1f,                   // RAR
+    0x3c,                   // INR A
+    0x14,                   // INR D
+    0x1d,                   // DCR E
+    0xc6, 0x13,             // ADI 0x13
+    0xee, 0x5c,             // XRI 0x5c
+    0x27,                   // DAA
+    0x0d,                   // DCR C
+    0xc2, 0x0b, 0x00,       // JNZ loop
+    0x05,                   // DCR B
+    0xc3, 0x0b, 0x00,       // JMP loop
+};
+
+// branches: a counter picks between two paths, with taken
+// and untaken conditional jumps, calls and returns
+static const uint8_t branch_kernel[] = {
+    0x31, 0x00, 0xf0,       // LXI SP,0xf000
+    0x21, 0x00, 0x00,       // LXI H,0
+    0x23,                   // loop: INX H
+    0x7d,                   // MOV A,L
+    0xe6, 0x01,             // ANI 1
+    0xca, 0x13, 0x00,       // JZ even
+    0xcd, 0x20, 0x00,       // CALL sub
+    0xc3, 0x06, 0x00,       // JMP loop
+    0x7c,                   // even: MOV A,H
+    0xe6, 0x03,             // ANI 3
+    0xc2, 0x1d, 0x00,       // JNZ skip
+    0xcd, 0x20, 0x00,       // CALL sub
+    0x00,                   // NOP
+    0xc3, 0x06, 0x00,       // skip: JMP loop
+    0x3d,                   // sub: DCR A
+    0xd8,                   // RC
+    0xfe, 0x80,             // CPI 0x80
+    0xd0,                   // RNC
+    0xc9,                   // RET
+};
+
+// memory: copies 4 KiB with LDAX/STAX, then works over 2 KiB
+// with MOV M, PUSH/POP and SHLD/LHLD
+static const uint8_t memory_kernel[] = {
+    0x31, 0x00, 0xf0,       // LXI SP,0xf000
+    0x01, 0x00, 0x40,       // outer: LXI B,0x4000
+    0x11, 0x00, 0x60,       // LXI D,0x6000
+    0x0a,                   // copy: LDAX B
+    0x3c,                   // INR A
+    0x12,                   // STAX D
+    0x03,                   // INX B
+    0x13,                   // INX D
+    0x7a,                   // MOV A,D
+    0xfe, 0x70,             // CPI 0x70
+    0xc2, 0x09, 0x00,       // JNZ copy
+    0x21, 0x00, 0x50,       // LXI H,0x5000
+    0x70,                   // fill: MOV M,B
+    0x7e,                   // MOV A,M
+    0x86,                   // ADD M
+    0x77,                   // MOV M,A
+    0xe5,                   // PUSH H
+    0x22, 0x00, 0xe0,       // SHLD 0xe000
+    0x2a, 0x00, 0xe0,       // LHLD 0xe000
+    0xe1,                   // POP H
+    0x23,                   // INX H
+    0x7c,                   // MOV A,H
+    0xfe, 0x58,             // CPI 0x58
+    0xc2, 0x17, 0x00,       // JNZ fill
+    0xc3, 0x03, 0x00,       // JMP outer
+};
+
+static const struct {
+    const char          *name;
+    const uint8_t       *code;
+    size_t              size;
+} kernels[] = {
+    {"alu",     alu_kernel,     sizeof(alu_kernel)},
+    {"branch",  branch_kernel,  sizeof(branch_kernel)},
+    {"memory",  memory_kernel,  sizeof(memory_kernel)},
+};
+
+
+/*
+ * Returns the seconds elapsed since `start`
+ */
+static double elapsed_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)
+        + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+int bench_synthetic(BenchWorkload *work, const char *name) {
+    memset(work, 0, sizeof(*work));
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (strcmp(name, kernels[i].name) != 0) {
+            continue;
+        }
+        uint8_t *memory = calloc(MEM_SIZE, 1);
+        if (memory == NULL) {
+            return -1;
+        }
+        memcpy(memory, kernels[i].code, kernels[i].size);
+
+        // all of memory is RAM
+        RomImage none;
+        memset(&none, 0, sizeof(none));
+        int made = rom_image_from_memory(&work->image, &none, memory);
+        free(memory);
+        if (made < 0) {
+            return -1;
+        }
+        work->name = kernels[i].name;
+        return 0;
+    }
+    return -1;
+}
+
+
+int bench_invaders(BenchWorkload *work, const char *rom) {
+    memset(work, 0, sizeof(*work));
+    int loaded = rom[0] == '@'
+        ? rom_image_load_manifest(&work->image, rom + 1)
+        : rom_image_load_file(&work->image, rom);
+    if (loaded < 0) {
+        return -1;
+    }
+    work->name = "invaders";
+    work->invaders = 1;
+    return 0;
+}
+
+
+int bench_exerciser(BenchWorkload *work, const char *path) {
+    memset(work, 0, sizeof(*work));
+    if (cpm_load(&work->image, path) < 0) {
+        return -1;
+    }
+    work->name = "exerciser";
+    work->entry = CPM_TPA;
+    work->cpm = 1;
+    return 0;
+}
+
+
+void bench_workload_free(BenchWorkload *work) {
+    rom_image_free(&work->image);
+}
+
+
+/*
+ * Sets up a fresh instance of `work` and runs it for up to
+ * `cycles` cycles, filling in `result`. Returns 0 on success.
+ */
+static int run_once(const BenchWorkload *work, Engine engine, uint64_t cycles,
+        BenchResult *result) {
+    State8080 state;
+    if (emu_load(&state, &work->image) < 0) {
+        return -1;
+    }
+    state.engine = engine;
+    state.pc = work->entry;
+
+    Scheduler sched;
+    sched_init(&sched);
+    CpmConsole console;
+    memset(&console, 0, sizeof(console));
+    if (work->invaders) {
+        invaders_schedule_interrupts(&sched, state.cycles);
+    } else if (work->cpm) {
+        // the console goes nowhere
+        cpm_install(&state, &console);
+    } else {
+        mem_map_init(state.mem_map);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // a frame at a time, the same as a headless run
+    while (state.cycles < cycles) {
+        uint64_t left = cycles - state.cycles;
+        if (sched_run(&sched, &state, left < CYCLES_PER_FRAME ? left : CYCLES_PER_FRAME)
+                == STOP_HALT) {
+            break;
+        }
+    }
+
+    result->secs = elapsed_since(&start);
+    result->instructions = state.instructions;
+    result->cycles = state.cycles;
+    emu_unload(&state);
+    return 0;
+}
+
+
+static int compare_secs(const void *a, const void *b) {
+    double x = ((const BenchResult *) a)->secs;
+    double y = ((const BenchResult *) b)->secs;
+    return (x > y) - (x < y);
+}
+
+
+int bench_run(const BenchWorkload *work, Engine engine, uint64_t cycles,
+        int warmup, int runs, BenchResult *result) {
+    if (runs < 1) {
+        runs = 1;
+    }
+    BenchResult *timed = calloc(runs, sizeof(BenchResult));
+    if (timed == NULL) {
+        return -1;
+    }
+
+    BenchResult scratch;
+    for (int i = 0; i < warmup; i++) {
+        if (run_once(work, engine, cycles, &scratch) < 0) {
+            free(timed);
+            return -1;
+        }
+    }
+    for (int i = 0; i < runs; i++) {
+        if (run_once(work, engine, cycles, &timed[i]) < 0) {
+            free(timed);
+            return -1;
+        }
+    }
+
+    qsort(timed, runs, sizeof(BenchResult), compare_secs);
+    *result = timed[runs / 2];
+    result->spread = result->secs > 0
+        ? (timed[runs - 1].secs - timed[0].secs) / result->secs
+        : 0;
+    free(timed);
+    return 0;
+}
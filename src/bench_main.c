@@ -0,0 +1,171 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#define MAX_WORKLOADS   8
+
+// long options with no short form
+enum {
+    OPT_INVADERS = 256,
+    OPT_EXERCISER,
+};
+
+
+static void usage(char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("Times fixed workloads on every engine and reports the median run.\n");
+    printf("  -c, --cycles N        emulated cycles per run (default %d)\n", BENCH_CYCLES);
+    printf("  -r, --runs N          timed runs per result (default %d)\n", BENCH_RUNS);
+    printf("  -w, --warmup N        untimed runs before them (default %d)\n", BENCH_WARMUP);
+    printf("  -e, --engines LIST    comma-separated engines to time (default: all\n");
+    printf("                        that are built for this host)\n");
+    printf("  -l, --workloads LIST  comma-separated workloads out of alu, branch,\n");
+    printf("                        memory, invaders and exerciser (default: all\n");
+    printf("                        that are set up)\n");
+    printf("      --invaders ROM    the Invaders ROM, or @manifest for a ROM set\n");
+    printf("      --exerciser FILE  a CP/M CPU exerciser, e.g. CPUDIAG.COM or 8080EXM.COM\n");
+    printf("  -h, --help            show this message\n");
+}
+
+
+/*
+ * Returns 1 if `name` is in the comma-separated `list`,
+ * or if there is no list
+ */
+static int listed(const char *list, const char *name) {
+    if (list == NULL) {
+        return 1;
+    }
+    size_t len = strlen(name);
+    for (const char *p = list; p; p = strchr(p, ',') ? strchr(p, ',') + 1 : NULL) {
+        if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    static struct option long_opts[] = {
+        {"cycles",      required_argument, NULL, 'c'},
+        {"runs",        required_argument, NULL, 'r'},
+        {"warmup",      required_argument, NULL, 'w'},
+        {"engines",     required_argument, NULL, 'e'},
+        {"workloads",   required_argument, NULL, 'l'},
+        {"invaders",    required_argument, NULL, OPT_INVADERS},
+        {"exerciser",   required_argument, NULL, OPT_EXERCISER},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    uint64_t cycles = BENCH_CYCLES;
+    int runs = BENCH_RUNS;
+    int warmup = BENCH_WARMUP;
+    char *engines = NULL;
+    char *workloads = NULL;
+    char *invaders = NULL;
+    char *exerciser = NULL;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:r:w:e:l:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                cycles = strtoull(optarg, NULL, 0);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 'w':
+                warmup = atoi(optarg);
+                break;
+            case 'e':
+                engines = optarg;
+                break;
+            case 'l':
+                workloads = optarg;
+                break;
+            case OPT_INVADERS:
+                invaders = optarg;
+                break;
+            case OPT_EXERCISER:
+                exerciser = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    for (const char *p = engines; p; p = strchr(p, ',') ? strchr(p, ',') + 1 : NULL) {
+        char name[32];
+        Engine engine;
+        snprintf(name, sizeof(name), "%.*s", (int) strcspn(p, ","), p);
+        if (engine_from_name(name, &engine) < 0 || !engine_available(engine)) {
+            fprintf(stderr, "Error: engine %s isn't available\n", name);
+            return 1;
+        }
+    }
+
+    BenchWorkload work[MAX_WORKLOADS];
+    int count = 0;
+    static const char *synthetic[] = {"alu", "branch", "memory"};
+    for (size_t i = 0; i < sizeof(synthetic) / sizeof(synthetic[0]); i++) {
+        if (listed(workloads, synthetic[i]) && bench_synthetic(&work[count], synthetic[i]) == 0) {
+            count++;
+        }
+    }
+    if (listed(workloads, "invaders")) {
+        if (invaders == NULL) {
+            printf("Skipping invaders: no --invaders ROM\n");
+        } else if (bench_invaders(&work[count], invaders) == 0) {
+            count++;
+        } else {
+            return 1;
+        }
+    }
+    if (listed(workloads, "exerciser")) {
+        if (exerciser == NULL) {
+            printf("Skipping exerciser: no --exerciser program\n");
+        } else if (bench_exerciser(&work[count], exerciser) == 0) {
+            count++;
+        } else {
+            return 1;
+        }
+    }
+
+    printf("%" PRIu64 " cycles per run, median of %d runs after %d warm-up\n\n",
+        cycles, runs, warmup);
+    printf("%-10s %-9s %10s %10s %10s %10s %8s\n",
+        "workload", "engine", "instrs", "MIPS", "ns/instr", "MHz", "spread");
+
+    int status = 0;
+    for (int w = 0; w < count; w++) {
+        for (Engine engine = ENGINE_DEFAULT + 1; engine < ENGINE_COUNT; engine++) {
+            if (!engine_available(engine) || !listed(engines, engine_name(engine))) {
+                continue;
+            }
+            BenchResult result;
+            if (bench_run(&work[w], engine, cycles, warmup, runs, &result) < 0) {
+                fprintf(stderr, "Error: couldn't run %s on %s\n",
+                    work[w].name, engine_name(engine));
+                status = 1;
+                continue;
+            }
+            double secs = result.secs > 0 ? result.secs : 1e-9;
+            printf("%-10s %-9s %10" PRIu64 " %10.1f %10.2f %10.1f %7.1f%%\n",
+                work[w].name, engine_name(engine), result.instructions,
+                result.instructions / secs / 1e6,
+                result.instructions ? secs * 1e9 / result.instructions : 0,
+                result.cycles / secs / 1e6, result.spread * 100);
+        }
+        bench_workload_free(&work[w]);
+    }
+    return status;
+}
@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "block.h"
+#include "jit.h"
+#include "memory.h"
+
+
+BlockCache* block_cache_new(void) {
+    // large enough that calloc maps fresh zero pages,
+    // so only the slots that get used are committed
+    return calloc(1, sizeof(BlockCache));
+}
+
+
+void block_cache_free(BlockCache *cache) {
+    if (cache) {
+        jit_free(cache->jit);
+    }
+    free(cache);
+}
+
+
+void block_cache_flush(BlockCache *cache) {
+    for (int i = 0; i < BLOCK_SLOTS; i++) {
+        cache->slots[i].count = 0;
+    }
+    memset(cache->page_bytes, 0, sizeof(cache->page_bytes));
+    memset(cache->page_slots, 0, sizeof(cache->page_slots));
+    memset(cache->page_words, 0, sizeof(cache->page_words));
+    cache->generation++;
+}
+
+
+/*
+ * Sets the bits of `page_bytes` for the bytes of `block` on `page`
+ */
+static void mark_bytes(uint64_t *page_bytes, const Block *block, uint8_t page) {
+    unsigned first = page << PAGE_SHIFT;
+    unsigned from = block->start > first ? block->start - first : 0;
+    unsigned to = block->start + block->len - first;
+    if (to > PAGE_SIZE) {
+        to = PAGE_SIZE;
+    }
+    for (unsigned i = from; i < to; i++) {
+        page_bytes[i / 64] |= 1ULL << (i % 64);
+    }
+}
+
+
+void block_track(BlockCache *cache, const Block *block, uint8_t page) {
+    unsigned slot = block - cache->slots;
+    mark_bytes(cache->page_bytes[page], block, page);
+    cache->page_slots[page][slot / 64] |= 1ULL << (slot % 64);
+    cache->page_words[page] |= 1ULL << (slot / 64);
+}
+
+
+void block_invalidate(State8080 *state, uint16_t addr) {
+    uint8_t page = addr >> PAGE_SHIFT;
+    BlockCache *cache = state->blocks;
+    if (cache == NULL) {
+        state->mem_map->attr[page] &= ~PAGE_CODE;
+        return;
+    }
+    uint64_t *bytes = cache->page_bytes[page];
+    unsigned offset = addr & (PAGE_SIZE - 1);
+    if (!(bytes[offset / 64] & (1ULL << (offset % 64)))) {
+        // data beside the code, or nothing left since a flush
+        if (!cache->page_words[page]) {
+            state->mem_map->attr[page] &= ~PAGE_CODE;
+        }
+        return;
+    }
+
+    // drop the blocks covering `addr`, and mark the bytes
+    // of the ones left afresh
+    memset(bytes, 0, sizeof(cache->page_bytes[page]));
+    unsigned first = page << PAGE_SHIFT;
+    unsigned last = first + PAGE_SIZE - 1;
+    uint64_t *bits = cache->page_slots[page];
+    int dropped = 0, left = 0;
+    for (uint64_t words = cache->page_words[page]; words; words &= words - 1) {
+        int word = __builtin_ctzll(words);
+        for (uint64_t rest = bits[word]; rest; rest &= rest - 1) {
+            int bit = __builtin_ctzll(rest);
+            Block *block = &cache->slots[word * 64 + bit];
+            // in unsigned, like first and last
+            unsigned start = block->start;
+            unsigned end = start + block->len - 1;
+            if (!block->count || start > last || end < first) {
+                // the slot has been reused for a block elsewhere
+                bits[word] &= ~(1ULL << bit);
+            } else if (start <= addr && addr <= end) {
+                block->count = 0;
+                bits[word] &= ~(1ULL << bit);
+                dropped = 1;
+            } else {
+                mark_bytes(bytes, block, page);
+                left = 1;
+            }
+        }
+        if (!bits[word]) {
+            cache->page_words[page] &= ~(1ULL << word);
+        }
+    }
+    if (!left) {
+        state->mem_map->attr[page] &= ~PAGE_CODE;
+    }
+    if (dropped) {
+        cache->generation++;
+        cache->invalidations++;
+    }
+}
@@ -1,8 +1,15 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "block.h"
 #include "core.h"
-#include "disassembler.h"
+#include "debugger.h"
+#include "io.h"
+#include "jit.h"
+#include "memory.h"
+#include "profile.h"
+#include "trace.h"
 
 
 /*
@@ -22,6 +29,7 @@ void print_state(State8080 *state) {
     printf("\n");
     printf("----------------------------------\n");
     printf(" Z S P CY AC \n");
+    flags_resolve(state);
     printf(" %d", state->cc.z);
     printf(" %d", state->cc.s);
     printf(" %d", state->cc.p);
@@ -31,19 +39,13 @@ void print_state(State8080 *state) {
     printf(" SP: 0x%04x\n", state->sp);
     printf(" PC: 0x%04x\n", state->pc);
     printf(" Interrupt enable: %d\n", state->int_enable);
+    printf(" Cycles: %" PRIu64 "\n", state->cycles);
     printf("----------------------------------\n");
     printf("\n");
 }
 
 
-void unimplemented_instr(State8080 *state) {
-    uint8_t opcode = state->memory[state->pc];
-    printf("Error: Unimplemented instruction %x\n", opcode);
-    exit(1);
-}
-
-
-void unused_opcode(State8080 *state) {
+static void unused_opcode(State8080 *state) {
     // uint8_t opcode = state->memory[state->pc];
     // printf("Error: unused opcode 0x%x\n", opcode);
     // printf("State at failure:\n");
@@ -54,153 +56,201 @@ void unused_opcode(State8080 *state) {
 
 // Flags ----------------------------------
 
-uint8_t zero(uint16_t answer) {
-    // set to 1 if answer is 0, 0 otherwise
-    return ((answer & 0xff) == 0);
+// Z, S and P flags for every 8-bit result, built
+// by the preprocessor so there's no setup at runtime
+#define ZSP_Z(n)    (((n) & 0xff) == 0 ? FLAG_Z : 0)
+#define ZSP_S(n)    ((n) & FLAG_S)
+#define ZSP_P(n)    ((((n) ^ ((n) >> 1) ^ ((n) >> 2) ^ ((n) >> 3) \
+                    ^ ((n) >> 4) ^ ((n) >> 5) ^ ((n) >> 6) \
+                    ^ ((n) >> 7)) & 1) ? 0 : FLAG_P)
+#define ZSP(n)      (ZSP_Z(n) | ZSP_S(n) | ZSP_P(n))
+#define ZSP4(n)     ZSP(n), ZSP((n) + 1), ZSP((n) + 2), ZSP((n) + 3)
+#define ZSP16(n)    ZSP4(n), ZSP4((n) + 4), ZSP4((n) + 8), ZSP4((n) + 12)
+#define ZSP64(n)    ZSP16(n), ZSP16((n) + 16), ZSP16((n) + 32), ZSP16((n) + 48)
+
+static const uint8_t zsp_table[256] = {
+    ZSP64(0), ZSP64(64), ZSP64(128), ZSP64(192)
+};
+
+
+// combine with bitwise OR
+// to set flags
+#define SET_Z_FLAG  FLAG_Z
+#define SET_S_FLAG  FLAG_S
+#define SET_P_FLAG  FLAG_P
+#define SET_CY_FLAG FLAG_CY
+#define SET_AC_FLAG FLAG_AC
+#define SET_ALL_FLAGS FLAG_ALL
+
+
+/*
+ * Replaces the flags selected by `mask` with those in `flags`
+ */
+static inline void update_flags(State8080 *state, uint8_t flags, uint8_t mask) {
+    state->cc.psw = (state->cc.psw & ~mask) | (flags & mask);
+}
+
+
+/*
+ * Flags of the pending lazy update, worked out from its result
+ * the same way set_arith_flags/set_logic_flags do
+ */
+static inline uint8_t pending_flags(const State8080 *state) {
+    uint16_t answer = state->lazy_result;
+    uint8_t flags = zsp_table[answer & 0xff]
+        | ((state->lazy_aux ^ answer) & FLAG_AC);
+    if (answer > 0xff) {
+        flags |= FLAG_CY;
+    }
+    return flags;
+}
+
+
+/*
+ * Applies the pending lazy update, if any, to state->cc
+ */
+static inline void resolve_flags(State8080 *state) {
+    if (state->lazy_mask) {
+        update_flags(state, pending_flags(state), state->lazy_mask);
+        state->lazy_mask = 0;
+    }
+}
+
+
+void flags_resolve(State8080 *state) {
+    resolve_flags(state);
 }
 
 
-uint8_t sign(uint16_t answer) {
-    // set to 1 when bit 7 of the math instruction is set
-    return ((answer & 0x80) == 0x80);
+uint8_t flags_psw(const State8080 *state) {
+    return (state->cc.psw & ~state->lazy_mask)
+        | (pending_flags(state) & state->lazy_mask);
 }
 
 
 /*
- * Returns 1 if number of set bits is even and 0 o.w.
- * (only for lower 8 bits)
+ * Returns 1 if `flag` (one FLAG_* bit) is set. A pending
+ * lazy update is tested directly rather than applied, so
+ * a DCR/JNZ loop never builds the flags byte at all.
  */
-uint8_t parity(uint16_t answer) {
-    // uint8_t p = 0;
-    // uint8_t ans8bit = answer & 0xff;
-    // while (ans8bit) {
-    //     p = !p;
-    //     ans8bit = ans8bit & (ans8bit - 1);
-    // }
-    // return !p;
-    //
-    uint8_t x = answer & 0xff;
-    int size = 8;
-    int i;
-    int p = 0;
-    x = (x & ((1 << size) - 1));
-    for (i = 0; i < size; i++) {
-        if (x & 0x1) {
-            p++;
+static inline uint8_t get_flag(const State8080 *state, uint8_t flag) {
+#ifdef LAZY_FLAGS
+    if (state->lazy_mask & flag) {
+        uint16_t answer = state->lazy_result;
+        switch (flag) {
+            case FLAG_Z:
+                return (answer & 0xff) == 0;
+            case FLAG_S:
+                return (answer >> 7) & 1;
+            case FLAG_P:
+                return (zsp_table[answer & 0xff] & FLAG_P) != 0;
+            case FLAG_CY:
+                return answer > 0xff;
+            default:
+                return ((state->lazy_aux ^ answer) & FLAG_AC) != 0;
         }
-        x = x >> 1;
     }
-    return (0 == (p & 0x1));
+#endif
+    return (state->cc.psw & flag) != 0;
 }
 
 
 /*
- * Returns 1 when instruction resulted 
- * in a carry or borrow into the high order bit
+ * Sets `flag` (one FLAG_* bit) to `on`, taking it out
+ * of any pending lazy update
  */
-uint8_t carry(uint16_t answer) {
-    return (answer > 0xff); 
+static inline void set_flag(State8080 *state, uint8_t flag, int on) {
+    state->lazy_mask &= ~flag;
+    update_flags(state, on ? flag : 0, flag);
 }
 
 
-uint8_t auxcarry(uint16_t answer) {
-    // From the manual:
-    // If the instruction caused a
-    // carry out of bit 3 and into
-    // bit 4 of the resulting value,
-    // the auxiliary carry is set;
-    // otherwise it is reset. This
-    // flag is affected by single
-    // precision additions,
-    // subtractions, increments,
-    // decrements, comparisons, and
-    // logical operations, but is
-    // principally used with
-    // additions and increments
-    // preceding a DAA (Decimal
-    // Adjust Accumulator)
-    // instruction.
-    uint8_t last8, cleaned;
-    last8 = answer & 0xff;
-    // zero out first three bits
-    //                  76543210
-    cleaned = last8 & 0b00011111; 
-    return cleaned > 0xf;  
+/*
+ * The flags byte as PUSH PSW stores it
+ */
+static inline uint8_t get_psw(State8080 *state) {
+    resolve_flags(state);
+    return (state->cc.psw & FLAG_ALL) | FLAG_ONE;
 }
 
 
-// combine with bitwise OR
-// to set flags 
-#define SET_Z_FLAG  (1 << 7)
-#define SET_S_FLAG  (1 << 6)
-#define SET_P_FLAG  (1 << 5)
-#define SET_CY_FLAG (1 << 4)
-#define SET_AC_FLAG (1 << 3)
-#define SET_ALL_FLAGS (SET_Z_FLAG | SET_S_FLAG | SET_P_FLAG | SET_CY_FLAG | SET_AC_FLAG)
+/*
+ * Loads the flags from a byte popped by POP PSW
+ */
+static inline void set_psw(State8080 *state, uint8_t psw) {
+    state->lazy_mask = 0;
+    state->cc.psw = (psw & FLAG_ALL) | FLAG_ONE;
+}
+
+
+#ifdef LAZY_FLAGS
+/*
+ * Records a flag update to be applied when something
+ * reads the flags. Only the latest update is kept, so
+ * one that sets flags this one leaves alone (an ADD
+ * before an INR) is applied first.
+ */
+static inline void record_flags(State8080 *state, uint16_t answer,
+        uint8_t carries, uint8_t flagstoset) {
+    if (state->lazy_mask & ~flagstoset) {
+        resolve_flags(state);
+    }
+    state->lazy_result = answer;
+    state->lazy_mask = flagstoset;
+    state->lazy_aux = carries;
+}
+#endif
 
 
 /*
  * Set the specified flags according to the answer received by
  * arithmetic
- * flagstoset - from left to right, the z, s, p, cy, 
- * and ac flags (should set flag if set to 1)
+ * carries - the two numbers added, XORed together
+ * flagstoset - mask of SET_*_FLAG bits to update
+ *
+ * Z, S and P come from one table lookup. CY is set when the
+ * answer doesn't fit in 8 bits. AC is the carry into bit 4,
+ * which is bit 4 of the answer XOR both numbers added; FLAG_AC
+ * sits at bit 4, so it is masked straight out.
+ *
+ * The 8080 subtracts by adding the complement, so a subtraction
+ * passes ~(a ^ x): its AC is the carry of that add, while CY is
+ * the borrow, which is when a - x wraps past 0xff.
  */
-void set_arith_flags(State8080 *state, uint16_t answer, uint8_t flagstoset) {
-    // remove trailing bits
-    uint8_t cleaned = flagstoset & 0b11111000;
-    if (cleaned & SET_Z_FLAG) {
-        state->cc.z = zero(answer);
-    }
-    if (cleaned & SET_S_FLAG) {
-        state->cc.s = sign(answer);
-    }
-    if (cleaned & SET_P_FLAG) {
-        state->cc.p = parity(answer);
+static void set_arith_flags(State8080 *state, uint16_t answer, uint8_t carries,
+        uint8_t flagstoset) {
+#ifdef LAZY_FLAGS
+    record_flags(state, answer, carries, flagstoset);
+#else
+    uint8_t flags = zsp_table[answer & 0xff] | ((carries ^ answer) & FLAG_AC);
+    if (answer > 0xff) {
+        flags |= FLAG_CY;
     }
-    if (cleaned & SET_CY_FLAG) {
-        state->cc.cy = carry(answer);
-    }
-    if (cleaned & SET_AC_FLAG) {
-        state->cc.ac = auxcarry(answer); 
-  }
+    update_flags(state, flags, flagstoset);
+#endif
 }
 
 
 /*
  * Sets flags from a logic operation response
+ * (carry is zero, and aux carry is `ac`: ANA sets it
+ * to bit 3 of either operand, XRA and ORA clear it)
  */
-void set_logic_flags(State8080 *state, uint8_t res, uint8_t flagstoset) {
-    // remove trailing bits
-    uint8_t cleaned = flagstoset & 0b11111000;
-    uint16_t answer = (uint16_t) res;
-    if (cleaned & SET_Z_FLAG) {
-        state->cc.z = zero(answer);
-    }
-    if (cleaned & SET_S_FLAG) {
-        state->cc.s = sign(answer);
-    }
-    if (cleaned & SET_P_FLAG) {
-        state->cc.p = parity(answer);
-    }
-
-    // carry and aux carry flags are zero
-    if (cleaned & SET_CY_FLAG) {
-        state->cc.cy = 0;
-    }
-    if (cleaned & SET_AC_FLAG) {
-        state->cc.ac = 0; 
-  }
+static void set_logic_flags(State8080 *state, uint8_t res, int ac, uint8_t flagstoset) {
+#ifdef LAZY_FLAGS
+    record_flags(state, res, res ^ (ac ? FLAG_AC : 0), flagstoset);
+#else
+    update_flags(state, zsp_table[res] | (ac ? FLAG_AC : 0), flagstoset);
+#endif
 }
 
 
 /*
- * Combines two 8 bit values into a single
- * 16 bit value
+ * Returns the 16-bit operand in bytes 2 (low)
+ * and 3 (high) of an instruction
  */
-uint16_t makeword(uint8_t left, uint8_t right) {
-    uint16_t result;
-    result = (left << 8) | right;
-    return result;
+static inline uint16_t op_word(const uint8_t *opcode) {
+    return opcode[1] | (opcode[2] << 8);
 }
 
 
@@ -208,7 +258,7 @@ uint16_t makeword(uint8_t left, uint8_t right) {
  * JMP to address specified
  * in bytes 2 and 3
  */
-void jmp(State8080 *state, uint16_t adr) {
+static void jmp(State8080 *state, uint16_t adr) {
     state->pc = adr;
 }
 
@@ -216,7 +266,7 @@ void jmp(State8080 *state, uint16_t adr) {
 /*
  * If cond, JMP adr
  */
-void jmp_cond(State8080 *state, uint16_t adr, uint8_t cond) {
+static void jmp_cond(State8080 *state, uint16_t adr, uint8_t cond) {
     if (cond) {
         jmp(state, adr);
     } else {
@@ -227,9 +277,9 @@ void jmp_cond(State8080 *state, uint16_t adr, uint8_t cond) {
 
 
 /*
- * Call specified target address (need for RST)
+ * CALL adr, with PC on the operand bytes
  */
-void call_adr(State8080 *state, uint16_t adr) {
+static void call_adr(State8080 *state, uint16_t adr) {
     // get return address
     // to pick up where left
     // off
@@ -244,8 +294,8 @@ void call_adr(State8080 *state, uint16_t adr) {
     lo_addr = ret_addr & 0xff;
 
     // push return address onto the stack
-    state->memory[sp_addr - 1] = hi_addr; 
-    state->memory[sp_addr - 2] = lo_addr;
+    mem_write(state, sp_addr - 1, hi_addr);
+    mem_write(state, sp_addr - 2, lo_addr);
 
     // decrement stack pointer
     state->sp -= 2;
@@ -260,9 +310,11 @@ void call_adr(State8080 *state, uint16_t adr) {
  * CALL conditionally
  * If cond is TRUE, then CALL subr
  */
-void call_cond(State8080 *state, uint16_t subr, uint8_t cond) {
+static void call_cond(State8080 *state, uint16_t subr, uint8_t cond) {
     if (cond) {
         call_adr(state, subr);
+        // a taken call costs 6 more cycles
+        state->cycles += 6;
     } else {
         // otherwise, move onto
         // next instruction
@@ -274,56 +326,73 @@ void call_cond(State8080 *state, uint16_t subr, uint8_t cond) {
 /*
  * RET instruction
  */
-void ret(State8080 *state) {
-    uint16_t sp_addr = state->sp;
-    uint8_t hi_addr, lo_addr;
-    lo_addr = state->memory[sp_addr];
-    hi_addr = state->memory[sp_addr + 1];
+static void ret(State8080 *state) {
     // set pc to return address pointed
     // to by stack
-    uint16_t target_addr = makeword(hi_addr, lo_addr);
-    state->pc = target_addr;
-    
+    uint16_t sp_addr = state->sp;
+    state->pc = state->memory[sp_addr] | (state->memory[(uint16_t) (sp_addr + 1)] << 8);
+
     // increment stack pointer
     state->sp += 2;
 }
 
 
 /*
- * Pops content off the stack into 
- * registers `hi` and `lo`.
+ * If cond, RET
  */
-void pop(State8080 *state, uint8_t *hi, uint8_t *lo) {
-    uint16_t sp_addr;
-    sp_addr = state->sp;
-    *lo = state->memory[sp_addr];
-    *hi = state->memory[sp_addr + 1];
+static void ret_cond(State8080 *state, uint8_t cond) {
+    if (cond) {
+        ret(state);
+        // a taken return costs 6 more cycles
+        state->cycles += 6;
+    }
+}
+
+
+/*
+ * Pops a register pair off the stack
+ */
+static uint16_t pop(State8080 *state) {
+    uint16_t sp_addr = state->sp;
+    uint16_t val = state->memory[sp_addr] | (state->memory[(uint16_t) (sp_addr + 1)] << 8);
 
     // increment stack pointer
     state->sp += 2;
+    return val;
 }
 
 
 /*
- * Pushes contents onto the stack.
+ * Pushes a register pair onto the stack
  */
-void push_x(State8080 *state, uint8_t hi, uint8_t lo) {
+static void push(State8080 *state, uint16_t val) {
     uint16_t sp_addr = state->sp;
-    state->memory[sp_addr - 1] = hi;
-    state->memory[sp_addr - 2] = lo;
+    mem_write(state, sp_addr - 1, val >> 8);
+    mem_write(state, sp_addr - 2, val & 0xff);
     state->sp -= 2;
 }
 
 
+/*
+ * RST n: pushes the address of the next instruction
+ * (PC has already moved past the opcode) and jumps
+ * to 8 * n
+ */
+static void rst(State8080 *state, uint8_t n) {
+    push(state, state->pc);
+    state->pc = 8 * n;
+}
+
+
 /*
  * Performs an add and stores the result in A
  * ADD X: A <- A + X
  * (instructions 0x80 to 0x87)
  */
-void add_x(State8080 *state, uint8_t x) {
+static void add_x(State8080 *state, uint8_t x) {
     uint16_t a = (uint16_t) state->a;
     uint16_t answer = a + (uint16_t) x;
-    set_arith_flags(state, answer, SET_ALL_FLAGS);
+    set_arith_flags(state, answer, a ^ x, SET_ALL_FLAGS);
     state->a = answer & 0xff;
 }
 
@@ -332,13 +401,13 @@ void add_x(State8080 *state, uint8_t x) {
  * Performs an add carry
  * ADC X: A <- A + X + CY
  */
-void adc_x(State8080 *state, uint8_t x) {
+static void adc_x(State8080 *state, uint8_t x) {
     uint16_t a, cy, x16, answer;
     a = (uint16_t) state->a;
-    cy = (uint16_t) state->cc.cy;
+    cy = (uint16_t) get_flag(state, FLAG_CY);
     x16 = (uint16_t) x;
     answer = a + cy + x16;
-    set_arith_flags(state, answer, SET_ALL_FLAGS);
+    set_arith_flags(state, answer, a ^ x16, SET_ALL_FLAGS);
     state->a = answer & 0xff;
 }
 
@@ -347,14 +416,12 @@ void adc_x(State8080 *state, uint8_t x) {
  * Performs a sub and stores the result in A
  * SUB X: A <- A - X
  */
-void sub_x(State8080 *state, uint8_t x) {
+static void sub_x(State8080 *state, uint8_t x) {
     uint16_t a = (uint16_t) state->a;
     uint16_t answer = a - (uint16_t) x;
-    set_arith_flags(state, answer, 
-        SET_ALL_FLAGS ^ SET_CY_FLAG);
-    if (x > state->a) {
-        state->cc.cy = 1;
-    }
+    // CY is the borrow: the answer wraps
+    // past 0xff when x is the larger one
+    set_arith_flags(state, answer, ~(a ^ x), SET_ALL_FLAGS);
     state->a = answer & 0xff;
 }
 
@@ -363,17 +430,13 @@ void sub_x(State8080 *state, uint8_t x) {
  * Performs a sub carry
  * SBB X: A <- A - X - CY
  */
-void sbb_x(State8080 *state, uint8_t x) {
+static void sbb_x(State8080 *state, uint8_t x) {
     uint16_t a, cy, x16, answer;
     a = (uint16_t) state->a;
-    cy = (uint16_t) state->cc.cy;
+    cy = (uint16_t) get_flag(state, FLAG_CY);
     x16 = (uint16_t) x;
     answer = a - x16 - cy;
-    set_arith_flags(state, answer, 
-        SET_ALL_FLAGS ^ SET_CY_FLAG);
-    if (x16 + cy > a) {
-        state->cc.cy = 1;
-    }
+    set_arith_flags(state, answer, ~(a ^ x16), SET_ALL_FLAGS);
     state->a = answer & 0xff;
 }
 
@@ -382,12 +445,10 @@ void sbb_x(State8080 *state, uint8_t x) {
  * Bitwise AND
  * ANA X: A <- A & X
  */
-void ana_x(State8080 *state, uint8_t x) {
-    // using 16 bits, even though
-    // bitwise AND shouldn't add a bit
+static void ana_x(State8080 *state, uint8_t x) {
     uint8_t answer;
     answer = state->a & x;
-    set_logic_flags(state, answer, SET_ALL_FLAGS);
+    set_logic_flags(state, answer, ((state->a | x) & 0x08) != 0, SET_ALL_FLAGS);
     state->a = answer & 0xff;
 }
 
@@ -396,9 +457,9 @@ void ana_x(State8080 *state, uint8_t x) {
  * Bitwise XOR
  * XRA X: A <- A ^ X
  */
-void xra_x(State8080 *state, uint8_t x) {
+static void xra_x(State8080 *state, uint8_t x) {
     uint8_t answer = state->a ^ x;
-    set_logic_flags(state, answer, SET_ALL_FLAGS);
+    set_logic_flags(state, answer, 0, SET_ALL_FLAGS);
     state->a = answer & 0xff;
 }
 
@@ -407,24 +468,13 @@ void xra_x(State8080 *state, uint8_t x) {
  * Bitwise OR
  * ORA X: A <- A | X
  */
-void ora_x(State8080 *state, uint8_t x) {
+static void ora_x(State8080 *state, uint8_t x) {
     uint8_t answer = state->a | x;
-    set_logic_flags(state, answer, SET_ALL_FLAGS);
+    set_logic_flags(state, answer, 0, SET_ALL_FLAGS);
     state->a = answer & 0xff;
 }
 
 
-/*
- * Swaps p1 with p2
- */
-void swp_ptrs(uint8_t *p1, uint8_t *p2) {
-    uint8_t tmp;
-    tmp = *p1;
-    *p1 = *p2;
-    *p2 = tmp;
-}
-
-
 /*
  * Compare register
  * (A) - (r)
@@ -433,36 +483,12 @@ void swp_ptrs(uint8_t *p1, uint8_t *p2) {
  * The accumulator remains unchanged. All flags are set.
  * Z flag is set to 1 if (A) = (r). CY set to 1 if (A) < (r).
  */
-void cmp_x(State8080 *state, uint8_t x) {
+static void cmp_x(State8080 *state, uint8_t x) {
     uint16_t answer;
     answer = (uint16_t) state->a - (uint16_t) x;
-    set_arith_flags(state, answer, SET_ALL_FLAGS ^ SET_CY_FLAG);
-    state->cc.cy = state->a < x;
-}
-
-
-/*
- * Adds the `val` to the 16-bit number stored by `left_ptr`
- * and `right_ptr` collectively and stores it back in
- * the two pointers. Also returns the result as 32 bits.
- */
-uint32_t tworeg_add(uint8_t *left_ptr, uint8_t *right_ptr, uint16_t val) {
-    // get values pointed to by pointers
-    uint8_t left, right;
-    left = *left_ptr;
-    right = *right_ptr;
-
-    // combine into summand
-    uint16_t summand;
-    summand = makeword(left, right);
-
-    // sum
-    uint32_t result = summand + val;
-
-    // store
-    *left_ptr = (result & 0xff00) >> 8;
-    *right_ptr = result & 0xff;
-    return result;
+    // (A) < (r) is when the answer wraps past 0xff,
+    // so CY comes out of set_arith_flags as well
+    set_arith_flags(state, answer, ~(state->a ^ x), SET_ALL_FLAGS);
 }
 
 
@@ -470,10 +496,10 @@ uint32_t tworeg_add(uint8_t *left_ptr, uint8_t *right_ptr, uint16_t val) {
  * Emulates INR (increment register) instruction
  * INR X: X <- X + 1
  */
-void inr_x(State8080 *state, uint8_t *ptr) {
+static void inr_x(State8080 *state, uint8_t *ptr) {
     uint16_t answer = (uint16_t) *ptr + 1;
     uint8_t flags = SET_Z_FLAG | SET_S_FLAG | SET_P_FLAG | SET_AC_FLAG;
-    set_arith_flags(state, answer, flags);
+    set_arith_flags(state, answer, *ptr ^ 1, flags);
     *ptr = answer & 0xff;
 }
 
@@ -482,1565 +508,854 @@ void inr_x(State8080 *state, uint8_t *ptr) {
  * Emulates DCR (decrement register) instruction
  * DCR X: X <- X - 1
  */
-void dcr_x(State8080 *state, uint8_t *ptr) {
+static void dcr_x(State8080 *state, uint8_t *ptr) {
     uint16_t answer = (uint16_t) (*ptr - 1);
     uint8_t flags = SET_Z_FLAG | SET_S_FLAG | SET_P_FLAG | SET_AC_FLAG;
-    set_arith_flags(state, answer, flags);
+    set_arith_flags(state, answer, ~(*ptr ^ 1), flags);
     *ptr = answer & 0xff;
 }
 
 
 /*
- * INX XY: XY <- XY + 1
+ * DAD: HL <- HL + `val`
+ * and sets CY flag to 1 if result needs carry
  */
-void inx_xy(uint8_t *left_ptr, uint8_t *right_ptr) {
-    //tworeg_add(left_ptr, right_ptr, 1);
-    // INX does not set the carry bit
-    (*right_ptr)++;
-    if (*right_ptr == 0) {
-        (*left_ptr)++;
-    }
+static void dad(State8080 *state, uint16_t val) {
+    uint32_t result = (uint32_t) state->hl + val;
+    state->hl = result;
+    set_flag(state, FLAG_CY, result > 0xffff);
 }
 
 
 /*
- * DCX XY: XY <- XY - 1
+ * Reads the value in memory pointed to by
+ * the HL register pair
  */
-void dcx_xy(uint8_t *left_ptr, uint8_t *right_ptr) {
-    tworeg_add(left_ptr, right_ptr, -1);
-    // DCX does not set the carry bit
+static uint8_t read_hl(State8080 *state) {
+    // Note: the addend is the byte pointed to by the address stored
+    // in the HL register pair
+
+    return state->memory[state->hl];
 }
 
 
 /*
- * DAD XY: HL <- HL + XY
- * and sets CY flag to 1 if result needs carry
+ * Sets the memory addressed by HL to `val`
  */
-void dad_xy(State8080 *state, uint8_t *x, uint8_t *y) {
-    uint16_t val_to_add;
-    val_to_add = makeword(*x, *y);
-    uint32_t result = tworeg_add(
-        &state->h, &state->l, val_to_add);
-    state->cc.cy = ((result & 0xffff0000) != 0);
+static void set_hl(State8080 *state, uint8_t val) {
+    mem_write(state, state->hl, val);
 }
 
 
-/*
- * Returns the address stored in HL register
- * pair
- */
-uint16_t read_hl_addr(State8080 *state) {
-    return makeword(state->h, state->l);
-}
+// Dispatch engines ------------------------
+//
+// The opcode bodies live in ops.inc; each engine
+// below wraps them differently. All of them are
+// built in and state->engine picks one per instance;
+// ENGINE_DEFAULT means the one chosen at build time
+// with -DCORE_ENGINE=... (see ENGINE in the Makefile).
+
+#ifndef CORE_ENGINE
+#define CORE_ENGINE ENGINE_SWITCH
+#endif
+
+// computed goto is a GCC/Clang extension
+#if defined(__GNUC__)
+#define HAVE_THREADED 1
+#endif
 
 
 /*
- * Reads the value in memory pointed to by
- * the HL register pair
+ * Cycles (T-states) taken by each opcode. Conditional
+ * CALLs and RETs are listed with their not-taken time;
+ * call_cond/ret_cond add the extra 6 when taken.
  */
-uint8_t read_hl(State8080 *state) {
-    // Note: the addend is the byte pointed to by the address stored
-    // in the HL register pair
+static const uint8_t op_cycles[256] = {
+//  0   1   2   3   4   5   6   7   8   9   a   b   c   d   e   f
+    4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,  // 0
+    4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,  // 1
+    4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4,  // 2
+    4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4,  // 3
+    5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,  // 4
+    5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,  // 5
+    5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,  // 6
+    7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5,  // 7
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 8
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 9
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // a
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // b
+    5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11,  // c
+    5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11,  // d
+    5, 10, 10, 18, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11,  // e
+    5, 10, 10,  4, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11   // f
+};
+
+
+// instruction lengths in bytes, matching how far
+// each body in ops.inc moves PC past its operands
+static const uint8_t op_length[256] = {
+//  0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  // 0
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,  // 1
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,  // 2
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,  // 3
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 4
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 5
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 6
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 7
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 8
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 9
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // a
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // b
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,  // c
+    1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 1, 2, 1,  // d
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,  // e
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1   // f
+};
 
-    // get the address
-    uint16_t offset = read_hl_addr(state);
-
-    // get value in memory
-    uint8_t m = state->memory[offset];
-    return m;
+/*
+ * Returns 1 if a latched interrupt can be taken after
+ * `opcode`. EI only takes effect after the instruction
+ * that follows it, so an ISR ending in EI; RET returns
+ * before the next interrupt comes in.
+ */
+static inline int interrupt_ready(const State8080 *state, const uint8_t *opcode) {
+    return state->int_pending && state->int_enable && *opcode != 0xfb;
 }
 
 
 /*
- * Sets the memory addressed by HL to `val`
+ * Returns 1 if there is a breakpoint on the current PC
+ * or a watchpoint has been hit
  */
-void set_hl(State8080 *state, uint8_t val) {
-    uint16_t offset = read_hl_addr(state);
-    state->memory[offset] = val;
+static inline int at_breakpoint(const State8080 *state) {
+    return state->debug && debug_at_stop(state->debug, state->pc);
 }
 
 
-void emulate_op(State8080 *state) {
-    unsigned char *opcode = &state->memory[state->pc];
-    state->pc += 1;
+// Each engine provides run_engine(), which runs until `budget`
+// cycles or `count` instructions have gone by, or until HLT,
+// a breakpoint, a watchpoint or a takeable interrupt. It works on a local copy of the state so the
+// compiler can keep PC, SP and the registers in host registers,
+// and writes the copy back once on the way out. Breakpoints are
+// checked after each instruction, so a run that starts on one
+// steps over it; watchpoints are noted as they are hit and stop
+// the run after the instruction.
+
+// record a trace and profile if they are open, check
+// read watchpoints, fetch the opcode at PC and charge its
+// base cycles
+#define FETCH()                                 \
+    if (state->tracer) {                        \
+        trace_step(state->tracer, state);       \
+    }                                           \
+    if (state->profile) {                       \
+        profile_step(state->profile, state,     \
+            state->memory[state->pc]);          \
+    }                                           \
+    if (state->debug) {                         \
+        debug_step(state->debug, state);        \
+    }                                           \
+    opcode = &state->memory[state->pc];         \
+    state->pc += 1;                             \
+    state->cycles += op_cycles[*opcode];        \
+    state->instructions++
 
-    // print out current instruction
-    disassemble8080op(state->memory, state->pc);
 
-    switch(*opcode) {
-        case 0x00:  // NOP
-            break;
-        case 0x01:  // LXI B,D16
-        {
-            state->c = opcode[1];  // c <- byte 2
-            state->b = opcode[2];  // b <- byte 3
-            state->pc += 2;  // advance two more bytes
-        }
-            break;
-        case 0x02:  // STAX B: (BC) <- A
-        {
-            // set the value of memory with address formed by
-            // register pair BC to A
-            uint16_t offset = makeword(state->b, state->c);
-            state->memory[offset] = state->a;
-        }
-            break;
-        case 0x03:   // INX B
-        {
-            // BC <- BC + 1 
-            inx_xy(&state->b, &state->c);
+/*
+ * One big switch: the compiler builds the jump table
+ */
+static RunStop run_switch(State8080 *machine, uint64_t budget, uint64_t count) {
+    State8080 local = *machine;
+    State8080 *state = &local;
+    uint64_t end = state->cycles + budget;
+    if (end < state->cycles) {
+        end = UINT64_MAX;
+    }
+    RunStop stop = state->halted ? STOP_HALT : STOP_BUDGET;
+
+    while (stop == STOP_BUDGET && count-- && state->cycles < end) {
+        uint8_t *opcode;
+        FETCH();
+
+#define OP(code)    case code:
+#define END_OP      break;
+        switch(*opcode) {
+#include "ops.inc"
         }
-            break;
-        case 0x04: 
-        {
-            inr_x(state, &state->b);
+#undef OP
+#undef END_OP
+
+        if (state->halted) {
+            stop = STOP_HALT;
+        } else if (interrupt_ready(state, opcode)) {
+            stop = STOP_INTERRUPT;
+        } else if (at_breakpoint(state)) {
+            stop = STOP_BREAKPOINT;
         }
-            break;
+    }
 
-        case 0x05:
-        {
-            dcr_x(state, &state->b); 
-        }           
-            break;
+    *machine = local;
+    return stop;
+}
 
-        case 0x06: 
-        {
-            state->b = opcode[1];  // b <- byte 2
-            state->pc += 1;
-        }           
-            break;
+/*
+ * Every opcode is a small handler function and
+ * dispatch is a single indirect call through a
+ * 256-entry table (OpHandler is in block.h)
+ */
+#define OP(code)    static void op_##code(State8080 *state, uint8_t *opcode) {
+#define END_OP      }
+#include "ops.inc"
+#undef OP
+#undef END_OP
+
+#define OPS16(hi) \
+    op_0x##hi##0, op_0x##hi##1, op_0x##hi##2, op_0x##hi##3, \
+    op_0x##hi##4, op_0x##hi##5, op_0x##hi##6, op_0x##hi##7, \
+    op_0x##hi##8, op_0x##hi##9, op_0x##hi##a, op_0x##hi##b, \
+    op_0x##hi##c, op_0x##hi##d, op_0x##hi##e, op_0x##hi##f
+
+static const OpHandler op_table[256] = {
+    OPS16(0), OPS16(1), OPS16(2), OPS16(3),
+    OPS16(4), OPS16(5), OPS16(6), OPS16(7),
+    OPS16(8), OPS16(9), OPS16(a), OPS16(b),
+    OPS16(c), OPS16(d), OPS16(e), OPS16(f)
+};
+
+static RunStop run_table(State8080 *machine, uint64_t budget, uint64_t count) {
+    State8080 local = *machine;
+    State8080 *state = &local;
+    uint64_t end = state->cycles + budget;
+    if (end < state->cycles) {
+        end = UINT64_MAX;
+    }
+    RunStop stop = state->halted ? STOP_HALT : STOP_BUDGET;
+
+    while (stop == STOP_BUDGET && count-- && state->cycles < end) {
+        uint8_t *opcode;
+        FETCH();
+        op_table[*opcode](state, opcode);
 
-        case 0x07:  // RLC: A = A << 1; bit 0 = prev bit 7; CY = prev bit 7
-        {
-            // get left-most bit
-            uint8_t leftmost = state->a >> 7;
-            state->cc.cy = leftmost;
-            // set right-most bit to whatever the left-most bit was
-            state->a = (state->a << 1) | leftmost;
+        if (state->halted) {
+            stop = STOP_HALT;
+        } else if (interrupt_ready(state, opcode)) {
+            stop = STOP_INTERRUPT;
+        } else if (at_breakpoint(state)) {
+            stop = STOP_BREAKPOINT;
         }
-            break;
+    }
 
-        case 0x08:
-            unused_opcode(state);
-            break;
-        case 0x09:  // DAD B: HL = HL + BC
-        {
-            dad_xy(state, &state->b, &state->c);
+    *machine = local;
+    return stop;
+}
+
+#ifdef HAVE_THREADED
+
+/*
+ * Threaded code: every opcode body is a label and ends
+ * with its own copy of the dispatch, a computed goto
+ * through a table of label addresses
+ */
+#define LABELS16(hi) \
+    &&L_0x##hi##0, &&L_0x##hi##1, &&L_0x##hi##2, &&L_0x##hi##3, \
+    &&L_0x##hi##4, &&L_0x##hi##5, &&L_0x##hi##6, &&L_0x##hi##7, \
+    &&L_0x##hi##8, &&L_0x##hi##9, &&L_0x##hi##a, &&L_0x##hi##b, \
+    &&L_0x##hi##c, &&L_0x##hi##d, &&L_0x##hi##e, &&L_0x##hi##f
+
+static RunStop run_threaded(State8080 *machine, uint64_t budget, uint64_t count) {
+    static void *const labels[256] = {
+        LABELS16(0), LABELS16(1), LABELS16(2), LABELS16(3),
+        LABELS16(4), LABELS16(5), LABELS16(6), LABELS16(7),
+        LABELS16(8), LABELS16(9), LABELS16(a), LABELS16(b),
+        LABELS16(c), LABELS16(d), LABELS16(e), LABELS16(f)
+    };
+
+    State8080 local = *machine;
+    State8080 *state = &local;
+    uint64_t end = state->cycles + budget;
+    if (end < state->cycles) {
+        end = UINT64_MAX;
+    }
+    RunStop stop = state->halted ? STOP_HALT : STOP_BUDGET;
+    uint8_t *opcode;
+
+    if (stop != STOP_BUDGET || !count-- || state->cycles >= end) {
+        goto out;
+    }
+    FETCH();
+    goto *labels[*opcode];
+
+#define DISPATCH()                                          \
+    if (state->halted) {                                    \
+        stop = STOP_HALT;                                   \
+        goto out;                                           \
+    }                                                       \
+    if (interrupt_ready(state, opcode)) {                   \
+        stop = STOP_INTERRUPT;                              \
+        goto out;                                           \
+    }                                                       \
+    if (at_breakpoint(state)) {                             \
+        stop = STOP_BREAKPOINT;                             \
+        goto out;                                           \
+    }                                                       \
+    if (!count-- || state->cycles >= end) {                 \
+        goto out;                                           \
+    }                                                       \
+    FETCH();                                                \
+    goto *labels[*opcode]
+
+#define OP(code)    L_##code: {
+#define END_OP      } DISPATCH();
+#include "ops.inc"
+#undef OP
+#undef END_OP
+#undef DISPATCH
+
+out:
+    *machine = local;
+    return stop;
+}
+
+#endif // HAVE_THREADED
+
+/*
+ * Decoded blocks: each straight-line run of instructions is
+ * decoded once into its handlers and operand bytes, then
+ * replayed without going back to guest memory or the tables.
+ * A block that the budget, a trace, a breakpoint on its
+ * pages, a read watchpoint or an interrupt can't cut short
+ * runs with no per-instruction checks; otherwise (or when
+ * profiling) it is stepped like the other engines. A write
+ * watchpoint ends it early the way a write to its own
+ * code does.
+ */
+
+/*
+ * Returns 1 if `op` can jump, halt or enable or
+ * disable interrupts, which ends a block
+ */
+static inline int ends_block(uint8_t op) {
+    if (op >= 0xc0) {
+        switch (op & 7) {
+            case 0:     // Rcc
+            case 2:     // Jcc
+            case 4:     // Ccc
+            case 7:     // RST
+                return 1;
         }
-            break;
-        case 0x0a:  // LDAX B: A <- (BC)
-        {
-            uint16_t offset = makeword(state->b, state->c);
-            uint8_t memval = state->memory[offset];
-            state->a = memval;
+    }
+    return op == 0xc3 || op == 0xc9 || op == 0xcd || op == 0xe9  // JMP RET CALL PCHL
+        || op == 0x76 || op == 0xf3 || op == 0xfb;                // HLT DI EI
+}
+
+
+/*
+ * Returns 1 if `op` only reads memory and moves or works on
+ * registers, so running it again on the same registers and
+ * memory does the same thing
+ */
+static inline int idle_safe(uint8_t op) {
+    if (op >= 0x40 && op < 0x80) {
+        return op < 0x70 || op > 0x77;      // MOV, but not to M (or HLT)
+    } else if (op >= 0x80 && op < 0xc0) {
+        return 1;                           // ALU ops on a register or M
+    } else if (op >= 0xc0) {
+        return (op & 7) == 6 || op == 0xeb || op == 0xf9;  // ALU immediates XCHG SPHL
+    }
+    switch (op & 7) {
+        case 0:
+            return op == 0x00;              // NOP
+        case 2:
+            return op & 8;                  // LDAX LHLD LDA, not the stores
+        case 4:
+        case 5:
+        case 6:
+            return (op & 0x38) != 0x30;     // INR DCR MVI, but not on M
+        default:
+            return 1;                       // LXI DAD INX DCX rotates DAA CMA STC CMC
+    }
+}
+
+
+/*
+ * Returns the IdleKind of a freshly decoded block
+ */
+static uint8_t idle_kind(const Block *block) {
+    const BlockInstr *last = &block->instrs[block->count - 1];
+    uint8_t op = last->op[0];
+    if ((op != 0xc3 && (op & 0xc7) != 0xc2)
+            || (last->op[1] | (last->op[2] << 8)) != block->start) {
+        return IDLE_NONE;
+    }
+    for (const BlockInstr *instr = block->instrs; instr < last; instr++) {
+        if (!idle_safe(instr->op[0])) {
+            return IDLE_NONE;
         }
-            break;
-        case 0x0b:  // DCX B: BC <- BC - 1
-        {
-            dcx_xy(&state->b, &state->c);
+    }
+
+    uint8_t first = block->instrs[0].op[0];
+    if (op == 0xc2 && block->count == 2 && (first & 0xc7) == 0x05 && first != 0x35) {
+        return IDLE_COUNT8;
+    }
+    if (op == 0xc2 && block->count == 4 && (first & 0xcf) == 0x0b && first != 0x3b) {
+        // register numbers of the pair's high and low halves
+        uint8_t hi = (first >> 3) & 6;
+        uint8_t lo = hi + 1;
+        uint8_t mov = block->instrs[1].op[0];
+        uint8_t ora = block->instrs[2].op[0];
+        if ((mov == (0x78 | hi) && ora == (0xb0 | lo))
+                || (mov == (0x78 | lo) && ora == (0xb0 | hi))) {
+            return IDLE_COUNT16;
         }
+    }
+    return IDLE_LOOP;
+}
+
+
+/*
+ * Decodes the block at PC into `block` and marks the RAM
+ * pages it covers as code, so writing to them drops it.
+ * Returns NULL if the first instruction runs past 0xffff.
+ */
+static Block* decode_block(State8080 *state, Block *block) {
+    unsigned addr = state->pc;
+    uint16_t cycles = 0;
+    int count = 0;
+
+    while (count < BLOCK_MAX_INSTRS) {
+        uint8_t op = state->memory[addr];
+        if (addr + op_length[op] > MEM_SIZE) {
             break;
-        case 0x0c:  // INR C
-        {
-            inr_x(state, &state->c);
         }
-            
+        BlockInstr *instr = &block->instrs[count++];
+        instr->handler = op_table[op];
+        // MEM_GUARD covers the bytes past 0xffff
+        memcpy(instr->op, &state->memory[addr], sizeof(instr->op));
+        instr->len = op_length[op];
+        instr->cycles = op_cycles[op];
+        cycles += instr->cycles;
+        addr += op_length[op];
+        if (ends_block(op)) {
             break;
-        case 0x0d:  // DCR C
-        {
-            dcr_x(state, &state->c);
         }
-            break;
-        case 0x0e:  // MVI C,D8: C <- byte 2
-        {
-            state->c = opcode[1];
-            state->pc += 1;
+    }
+    if (count == 0) {
+        return NULL;
+    }
+
+    block->start = state->pc;
+    block->len = addr - state->pc;
+    block->count = count;
+    block->cycles = cycles;
+    block->execs = 0;
+    block->idle = idle_kind(block);
+    block->idle_misses = 0;
+    block->code = NULL;
+
+    // ROM can't change and MMIO writes don't reach memory
+    MemoryMap *map = state->mem_map;
+    for (unsigned page = state->pc >> PAGE_SHIFT; page <= (addr - 1) >> PAGE_SHIFT; page++) {
+        if (!(map->attr[page] & (PAGE_ROM | PAGE_MMIO))) {
+            map->attr[page] |= PAGE_CODE;
+            block_track(state->blocks, block, page);
         }
-            break;
-        case 0x0f:  // RRC: A = A >> 1; bit 7 = prev bit 0; CY = prev bit 0
-        {
-            // rotating bits right
-            // e.g. 10011000 => 01001100
-            uint8_t rightmost = state->a & 1;
-            // and set CY flag
-            state->cc.cy = rightmost == 1;
-            // set left-most bit to what the right-most bit was
-            state->a = (state->a >> 1) | (rightmost << 7);
+    }
+    return block;
+}
+
+
+/*
+ * Returns the block starting at PC, decoding it on a miss
+ */
+static inline Block* lookup_block(State8080 *state) {
+    BlockCache *cache = state->blocks;
+    Block *block = &cache->slots[state->pc & (BLOCK_SLOTS - 1)];
+    if (block->count && block->start == state->pc) {
+        cache->hits++;
+        return block;
+    }
+    cache->misses++;
+    return decode_block(state, block);
+}
+
+
+/*
+ * Why a run has to stop after `opcode`, if it does
+ */
+static inline RunStop check_stop(const State8080 *state, const uint8_t *opcode) {
+    if (state->halted) {
+        return STOP_HALT;
+    } else if (interrupt_ready(state, opcode)) {
+        return STOP_INTERRUPT;
+    } else if (at_breakpoint(state)) {
+        return STOP_BREAKPOINT;
+    }
+    return STOP_BUDGET;
+}
+
+
+/*
+ * A, B, C, D, E, H, L and the flags, packed for comparing
+ */
+static inline uint64_t idle_regs(const State8080 *state) {
+    return (uint64_t) state->a | (uint64_t) state->b << 8 | (uint64_t) state->c << 16
+        | (uint64_t) state->d << 24 | (uint64_t) state->e << 32
+        | (uint64_t) state->h << 40 | (uint64_t) state->l << 48
+        | (uint64_t) flags_psw(state) << 56;
+}
+
+
+/*
+ * Register `r` as numbered in opcodes (B C D E H L - A)
+ */
+static inline uint8_t* idle_reg(State8080 *state, uint8_t r) {
+    switch (r) {
+        case 0:     return &state->b;
+        case 1:     return &state->c;
+        case 2:     return &state->d;
+        case 3:     return &state->e;
+        case 4:     return &state->h;
+        case 5:     return &state->l;
+        default:    return &state->a;
+    }
+}
+
+
+/*
+ * Called when `block`, an idle loop (see IdleKind), has just
+ * run once in full and is about to go round again, with
+ * `regs` and `sp` what they were before it did. Memory only
+ * changes under the CPU, and sched_run ends each run at the
+ * next event, so a loop that left them as they were spins
+ * the same way until its budget runs out: it is moved on over
+ * every pass that fits. A counting loop is moved on to one
+ * pass short of the budget or its last, so that pass runs
+ * for real and leaves A and the flags as they would be.
+ */
+static void idle_skip(State8080 *state, Block *block, uint64_t regs, uint16_t sp,
+        uint64_t *count, uint64_t end) {
+    uint64_t passes = (end - state->cycles) / block->cycles;
+    if (passes > *count / block->count) {
+        passes = *count / block->count;
+    }
+
+    uint8_t op = block->instrs[0].op[0];
+    if (block->idle == IDLE_LOOP) {
+        if (idle_regs(state) != regs || state->sp != sp) {
+            if (++block->idle_misses == IDLE_MISSES) {
+                block->idle = IDLE_NONE;
+            }
+            return;
         }
-            break;
-        case 0x10: 
-            unused_opcode(state);
-            break;
-        case 0x11:  // D <- byte 3, E <- byte 2
-        { 
-            state->d = opcode[2];
-            state->e = opcode[1];
-            state->pc += 2;
+        block->idle_misses = 0;
+    } else if (block->idle == IDLE_COUNT8) {
+        uint8_t *counter = idle_reg(state, (op >> 3) & 7);
+        if (passes > *counter) {
+            passes = *counter;
         }
-            break;
-        case 0x12:  // STAX D: (DE) <- A
-        {
-            uint16_t offset = makeword(state->d, state->e);
-            state->memory[offset] = state->a;
+        passes = passes ? passes - 1 : 0;
+        *counter -= passes;
+    } else {
+        uint8_t *hi = idle_reg(state, (op >> 3) & 6);
+        uint8_t *lo = idle_reg(state, ((op >> 3) & 6) + 1);
+        uint16_t counter = (*hi << 8) | *lo;
+        if (passes > counter) {
+            passes = counter;
+        }
+        passes = passes ? passes - 1 : 0;
+        counter -= passes;
+        *hi = counter >> 8;
+        *lo = counter;
+    }
+
+    state->cycles += passes * block->cycles;
+    state->instructions += passes * block->count;
+    *count -= passes * block->count;
+    state->blocks->idle_cycles += passes * block->cycles;
+}
+
+
+/*
+ * Runs `block`, or the instruction at PC if it is NULL,
+ * taking what it ran off `count`. Returns why the run
+ * has to stop, if it does.
+ */
+static inline RunStop step_block(State8080 *state, Block *block,
+        uint64_t *count, uint64_t end) {
+    BlockCache *cache = state->blocks;
+    uint64_t generation = cache->generation;
+    RunStop stop = STOP_BUDGET;
+    uint8_t *opcode;
+
+    if (block == NULL) {
+        // wraps around the end of memory
+        FETCH();
+        op_table[*opcode](state, opcode);
+        (*count)--;
+        stop = check_stop(state, opcode);
+    } else if (!state->tracer && !state->profile
+            && debug_block_clear(state->debug, block->start, block->len)
+            && !(state->int_pending && state->int_enable)
+            && *count >= block->count && block->cycles <= end - state->cycles) {
+        // nothing can stop the run before the end of the
+        // block, unless it overwrites its own code
+        uint64_t regs = block->idle ? idle_regs(state) : 0;
+        uint16_t sp = state->sp;
+        BlockInstr *instr = block->instrs;
+        BlockInstr *last = instr + block->count;
+        do {
+            state->pc += 1;
+            state->cycles += instr->cycles;
+            instr->handler(state, instr->op);
+        } while (++instr < last && cache->generation == generation);
+
+        *count -= instr - block->instrs;
+        state->instructions += instr - block->instrs;
+        stop = check_stop(state, instr[-1].op);
+        if (block->idle && stop == STOP_BUDGET && state->pc == block->start
+                && cache->generation == generation) {
+            idle_skip(state, block, regs, sp, count, end);
         }
-            break;
-        case 0x13:
-        {
-            // pointers to registers
-            inx_xy(&state->d, &state->e);
+    } else {
+        BlockInstr *last = block->instrs + block->count;
+        for (BlockInstr *instr = block->instrs; instr < last; instr++) {
+            if (state->tracer) {
+                trace_step(state->tracer, state);
+            }
+            if (state->profile) {
+                profile_step(state->profile, state, instr->op[0]);
+            }
+            if (state->debug) {
+                debug_step(state->debug, state);
+            }
+            state->pc += 1;
+            state->cycles += instr->cycles;
+            state->instructions++;
+            instr->handler(state, instr->op);
+            (*count)--;
+
+            stop = check_stop(state, instr->op);
+            if (stop != STOP_BUDGET || !*count || state->cycles >= end
+                    || cache->generation != generation) {
+                break;
+            }
         }
-            break;
-        case 0x14:  // INR D
-        {
-            inr_x(state, &state->d);
+    }
+    return stop;
+}
+
+
+static RunStop run_block(State8080 *machine, uint64_t budget, uint64_t count) {
+    if (machine->blocks == NULL) {
+        machine->blocks = block_cache_new();
+        if (machine->blocks == NULL) {
+            return run_table(machine, budget, count);
         }
-            break;
-        case 0x15:
-        {
-            dcr_x(state, &state->d);
+    }
+
+    State8080 local = *machine;
+    State8080 *state = &local;
+    uint64_t end = state->cycles + budget;
+    if (end < state->cycles) {
+        end = UINT64_MAX;
+    }
+    RunStop stop = state->halted ? STOP_HALT : STOP_BUDGET;
+
+    while (stop == STOP_BUDGET && count && state->cycles < end) {
+        stop = step_block(state, lookup_block(state), &count, end);
+    }
+
+    *machine = local;
+    return stop;
+}
+
+#ifdef HAVE_JIT
+
+/*
+ * The block engine, except that a block which has run
+ * JIT_THRESHOLD times is compiled to host code and
+ * from then on runs compiled, chained to the blocks
+ * after it (see jit.h)
+ */
+static RunStop run_jit(State8080 *machine, uint64_t budget, uint64_t count) {
+    // compiled code only stops between blocks, so
+    // budgets counted in instructions are interpreted
+    if (count != UINT64_MAX || machine->blocks == NULL) {
+        return run_block(machine, budget, count);
+    }
+
+    State8080 local = *machine;
+    State8080 *state = &local;
+    uint64_t end = state->cycles + budget;
+    if (end < state->cycles) {
+        end = UINT64_MAX;
+    }
+    RunStop stop = state->halted ? STOP_HALT : STOP_BUDGET;
+
+    while (stop == STOP_BUDGET && state->cycles < end) {
+        Block *block = lookup_block(state);
+        if (block && !state->tracer && !state->profile && debug_chain_clear(state->debug)
+                && !(state->int_pending && state->int_enable)
+                && block->cycles <= end - state->cycles) {
+            // idle loops stay interpreted, where they can
+            // be fast-forwarded
+            if (block->code == NULL && !block->idle && block->execs < JIT_THRESHOLD
+                    && ++block->execs == JIT_THRESHOLD) {
+                jit_compile(state->blocks, block);
+            }
+            if (block->code) {
+                // compiled blocks never end in EI, so it
+                // doesn't matter which opcode is checked
+                static uint8_t nop = 0x00;
+                jit_run(state, block, end);
+                stop = check_stop(state, &nop);
+                continue;
+            }
         }
+        stop = step_block(state, block, &count, end);
+    }
+
+    *machine = local;
+    return stop;
+}
+
+#endif // HAVE_JIT
+
+#undef FETCH
+
+
+static RunStop run_engine(State8080 *state, uint64_t budget, uint64_t count) {
+    Engine engine = state->engine == ENGINE_DEFAULT ? CORE_ENGINE : state->engine;
+    RunStop stop;
+    switch (engine) {
+        case ENGINE_TABLE:
+            stop = run_table(state, budget, count);
             break;
-        case 0x16:  // MVI D,D8: D <- byte 2
-        {
-            state->d = opcode[1];
-            state->pc += 1;
-        }
+        case ENGINE_BLOCK:
+            stop = run_block(state, budget, count);
             break;
-        case 0x17:  // RAL: A = A << 1; bit 0 = prev CY; CY = prev bit 7
-        {
-            // Rotate Accumulator Left Through Carry
-            // CY A
-            // 0  10110101
-            // =>
-            // CY A
-            // 1  01101010
-            uint8_t leftmost = state->a >> 7;
-            uint8_t prev_cy = state->cc.cy;
-
-            state->cc.cy = leftmost;
-            state->a = (state->a << 1) | prev_cy;
-        }
+#ifdef HAVE_JIT
+        case ENGINE_JIT:
+            stop = run_jit(state, budget, count);
             break;
-        case 0x18:
-            unused_opcode(state);
+#endif
+#ifdef HAVE_THREADED
+        case ENGINE_THREADED:
+            stop = run_threaded(state, budget, count);
             break;
-        case 0x19:  // DAD D: HL = HL + DE
-        {
-            dad_xy(state, &state->d, &state->e);
-        }
-            break;
-        case 0x1a:  // LDAX D
-        {
-            uint16_t offset = makeword(state->d, state->e);
-            uint8_t memval = state->memory[offset];
-            state->a = memval;
-        }
-            break;
-        case 0x1b:
-        {
-            dcx_xy(&state->d, &state->e);
-        }
-            break;
-        case 0x1c:
-        {
-            inr_x(state, &state->e);
-        }
-            break;
-        case 0x1d:
-        {
-            dcr_x(state, &state->e);
-        }
-            break;
-        case 0x1e:  // E <- byte 2
-        {
-            state->e = opcode[1];
-            state->pc += 1;
-        }
-            break;
-        case 0x1f:  // RAR
-        {
-            // Rotate Accumulator Right Through Carry
-            // A        CY
-            // 01101010 1
-            // =>
-            // A        CY
-            // 10110101 0
-            uint8_t rightmost = state->a & 1;
-            uint8_t prev_cy = state->cc.cy;
-            state->cc.cy = rightmost;
-            state->a = (state->a >> 1) | (prev_cy << 7);
-        }
-            break;
-        case 0x20:
-            unused_opcode(state);
-            break;
-        case 0x21:  // LXI H,D16: H <- byte 3, L <- byte 2
-        {
-            state->h = opcode[2];
-            state->l = opcode[1];
-            state->pc += 2;
-        }
-            break;
-        case 0x22:  // SHLD adr: (adr) <-L; (adr+1)<-H
-        {
-            // the following two opcodes form an address
-            // when put together
-            uint16_t addr = makeword(opcode[2], opcode[1]);
-            state->memory[addr] = state->l;
-            state->memory[addr + 1] = state->h;
-            state->pc += 2;
-        }
-            break;
-        case 0x23:  // INX H
-        {
-            inx_xy(&state->h, &state->l);
-        }
-            break;
-        case 0x24:  // INR H
-        {
-            inr_x(state, &state->h);
-        }
-            break;
-        case 0x25:
-        {
-            dcr_x(state, &state->h);
-        }
-            break;
-        case 0x26:  // MVI H,D8
-        {
-            state->h = opcode[1];
-            state->pc += 1;
-        }
-            break;
-        case 0x27:  // DAA - decimal adjust accumulator
-        // The eight-bit number in the accumulator
-        // is adjusted to form two four-bi 
-        // Binary-Coded-Decimal digits by the
-        // following process:
-        // 1. If the value of the least significant
-        // 4 bits of the accumulator is greater
-        // than 9 or if the AC flag is set, 6 is
-        // added to the accumulator.
-        // 2. If the value of the most significant
-        // 4 bits of the accumulator is now greater
-        // than 9, or if the CY flag is set, 6 is
-        // added to the most significant 4 bits
-        // of the accumulator.
-        {
-            uint8_t least4, most4;
-            uint16_t answer;
-            // 1.
-            least4 = state->a & 0xf;
-            if (least4 > 9 || state->cc.ac) {
-                answer = state->a + 6;
-                // set flags of intermediate result
-                set_arith_flags(state, answer, SET_ALL_FLAGS);
-                state->a = answer & 0xff;
-            }
-            // 2.
-            most4 = state->a >> 4;
-            if (most4 > 9 || state->cc.cy) {
-                most4 += 6;
-            }
-            // put most and least sig. 4 digits back
-            // together
-            answer = (most4 << 4) | least4;
-            set_arith_flags(state, answer, SET_ALL_FLAGS);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x28: 
-            unused_opcode(state); 
-            break;
-        case 0x29:  // DAD H
-        {
-            dad_xy(state, &state->h, &state->l);
-        }
-            break;
-        case 0x2a:  // LHLD adr
-        {
-            // get address (16 bits)
-            uint16_t addr = makeword(opcode[2], opcode[1]);
-            uint8_t lo, hi;
-            lo = state->memory[addr];
-            hi = state->memory[addr + 1]; 
-            state->l = lo;
-            state->h = hi;
-            state->pc += 2;
-        }
-            break;
-        // page 4-8 of the manual
-        case 0x2b:  // DCX H: HL <- HL - 1
-        {
-            dcx_xy(&state->h, &state->l);
-        }
-            break;
-        case 0x2c:  // INR L
-        {
-            inr_x(state, &state->l);
-        }
-            break;
-        case 0x2d:
-        {
-            dcr_x(state, &state->l);
-        }
-            break;
-        case 0x2e:  // MVI L,D8
-        {
-            // L <- byte 2
-            state->l = opcode[1];
-            state->pc += 1;
-        }
-            break;
-        case 0x2f:  // CMA: A <- !A
-        {
-            // complement accumulator
-            state->a = ~state->a;
-            // no flags affected
-        }
-            break;
-        case 0x30:
-            unused_opcode(state);
-            break;
-        case 0x31:  // LXI SP, D16
-        {
-            // SP.hi <- byte 3, SP>lo <- byte 2
-            // SP is 16 bits
-            // I think hi = most significant bits
-            uint8_t byte2, byte3;
-            byte3 = opcode[2];
-            byte2 = opcode[1];
-            state->sp = makeword(byte3, byte2);
-            state->pc += 2;
-        }
-            break;
-        case 0x32:  // STA adr
-        {
-            // (adr) <- A
-            // store accumulator direct
-            uint16_t addr = makeword(opcode[2], opcode[1]);
-            state->memory[addr] = state->a;
-            state->pc += 2;
-        }
-            break;
-        case 0x33:  // INX SP: SP <- SP + 1
-        {
-            // stack pointer is already 16 bits
-            state->sp = state->sp + 1; 
-        }
-            break;
-        case 0x34:  // INR M
-        {
-            // need to get the pointer
-            // to update memory in correct place
-            uint16_t offset = read_hl_addr(state);
-            uint8_t *m_ptr = &state->memory[offset];
-            inr_x(state, m_ptr);
-        }
-            break;
-        case 0x35:  // DCR M
-        {
-            uint16_t offset = read_hl_addr(state);
-            uint8_t *m_ptr = &state->memory[offset];
-            dcr_x(state, m_ptr);
-        }
-            break;
-        case 0x36:  // (HL) <- byte 2
-        {
-            uint8_t byte2 = opcode[1];
-            set_hl(state, byte2);
-            state->pc += 1;
-        }
-            break;
-        case 0x37:  // STC
-        {
-            // set carry flag to 1
-            state->cc.cy = 1;
-        }
-            break;
-        case 0x38: 
-            unused_opcode(state); 
-            break;
-        case 0x39:  // DAD SP
-        {
-            // uglier implementation
-            uint32_t answer;
-            answer = tworeg_add(
-                &state->h, &state->l, state->sp);
-            state->cc.cy = ((answer & 0xffff0000) != 0);
-        }
-            break;
-        case 0x3a:  // LDA adr
-        {
-            // A <- (adr)
-            uint16_t addr = makeword(opcode[2], opcode[1]);
-            uint8_t val = state->memory[addr];
-            state->a = val;
-            state->pc += 2;
-        }
-            break;
-        case 0x3b:  // DCX SP
-        {
-            uint16_t curr_sp = state->sp;
-            state->sp = curr_sp - 1;
-            // no flags set
-        }
-            break;
-        case 0x3c:  // INR A
-        {
-            inr_x(state, &state->a);
-        }
-            break;
-        case 0x3d:
-        {
-            dcr_x(state, &state->a);
-        }
-            break;
-        case 0x3e:  // MVI A,D8
-        {
-            // A <- byte 2
-            uint8_t byte2 = opcode[1];
-            state->a = byte2;
-            state->pc += 1;
-        }
-            break;
-        case 0x3f:  // CMC: CY = !CY
-        {
-            state->cc.cy = ~state->cc.cy;
-        }
-            break;
-        case 0x40:  // MOV B,B
-            // I think this is redundant, but including
-            // it here anyway
-            state->b = state->b;
-            break;
-        case 0x41:  // MOV B,C
-            state->b = state->c; 
-            break;
-        case 0x42:  // MOV B,D
-            state->b = state->d; 
-            break;
-        case 0x43:  // MOV B,E
-            state->b = state->e; 
-            break;
-        case 0x44:  // etc.
-            state->b = state->h;
-            break;
-        case 0x45: 
-            state->b = state->l;
-            break;
-        case 0x46:  // B <- (HL)
-            state->b = read_hl(state);
-            break;
-        case 0x47: 
-            state->b = state->a;
-            break;
-        case 0x48:
-            state->c = state->b;
-            break;
-        case 0x49:
-            state->c = state->c;
-            break;
-        case 0x4a:
-            state->c = state->d;
-            break;
-        case 0x4b:
-            state->c = state->e;
-            break;
-        case 0x4c:
-            state->c = state->h;
-            break;
-        case 0x4d:
-            state->c = state->l;
-            break;
-        case 0x4e:
-            state->c = read_hl(state);
-            break;
-        case 0x4f:
-            state->c = state->a;
-            break;
-        case 0x50:
-            state->d = state->b;
-            break;
-        case 0x51:
-            state->d = state->c;
-            break;
-        case 0x52:
-            state->d = state->d;
-            break;
-        case 0x53:
-            state->d = state->e;
-            break;
-        case 0x54:
-            state->d = state->h;
-            break;
-        case 0x55:
-            state->d = state->l;
-            break;
-        case 0x56:
-            state->d = read_hl(state);
-            break;
-        case 0x57:
-            state->d = state->a;
-            break;
-        case 0x58:  // MOV E,B
-            state->e = state->b;
-            break;
-        case 0x59:
-            state->e = state->c;
-            break;
-        case 0x5a:
-            state->e = state->d;
-            break;
-        case 0x5b:
-            state->e = state->e;
-            break;
-        case 0x5c:
-            state->e = state->h;
-            break;
-        case 0x5d:
-            state->e = state->l;
-            break;
-        case 0x5e:
-            state->e = read_hl(state);
-            break;
-        case 0x5f:
-            state->e = state->a;
-            break;
-        case 0x60:  // MOV H,B
-            state->h = state->b;
-            break;
-        case 0x61:
-            state->h = state->c;
-            break;
-        case 0x62:
-            state->h = state->d;
-            break;
-        case 0x63:
-            state->h = state->e;
-            break;
-        case 0x64:
-            state->h = state->h;
-            break;
-        case 0x65:
-            state->h = state->l;
-            break;
-        case 0x66:
-            state->h = read_hl(state);
-            break;
-        case 0x67:
-            state->h = state->a;
-            break;
-        case 0x68:
-            state->l = state->b;
-            break;
-        case 0x69:
-            state->l = state->c;
-            break;
-        case 0x6a:
-            state->l = state->d;
-            break;
-        case 0x6b:
-            state->l = state->e;
-            break;
-        case 0x6c:
-            state->l = state->h;
-            break;
-        case 0x6d:
-            state->l = state->l;
-            break;
-        case 0x6e:
-            state->l = read_hl(state);
-            break;
-        case 0x6f:
-            state->l = state->a;
-            break;
-        case 0x70: // MOV M,B
-            set_hl(state, state->b);
-            break;
-        case 0x71:
-            set_hl(state, state->c);
-            break;
-        case 0x72:
-            set_hl(state, state->d);
-            break;
-        case 0x73:
-            set_hl(state, state->e);
-            break;
-        case 0x74:
-            set_hl(state, state->h);
-            break;
-        case 0x75:
-            set_hl(state, state->l);
-            break;
-        case 0x76: 
-            // HLT (Halt) instruction
-            printf("Halting execution...\n");
-            exit(0);
-            break;
-        case 0x77:
-            set_hl(state, state->a);
-            break;
-        case 0x78:
-            state->a = state->b;
-            break;
-        case 0x79:
-            state->a = state->c;
-            break;
-        case 0x7a:
-            state->a = state->d;
-            break;
-        case 0x7b:
-            state->a = state->e;
-            break;
-        case 0x7c:
-            state->a = state->h;
-            break;
-        case 0x7d:
-            state->a = state->l;
-            break;
-        case 0x7e:
-            state->a = read_hl(state);
-            break;
-        case 0x7f:  // MOV A,A
-            state->a = state->a;
-            break;
-        case 0x80:  // ADD B
-        {
-            add_x(state, state->b);
-        }            
+#endif
+        default:
+            stop = run_switch(state, budget, count);
             break;
+    }
+    if (state->profile) {
+        profile_close(state->profile, state);
+    }
+    return stop;
+}
 
-        case 0x81:  // ADD C
-        {
-            add_x(state, state->c);
-        }
-            break;
 
-        case 0x82:  // ADD D
-        {
-            add_x(state, state->d);
-        } 
-            break;
+static const char *const engine_names[] = {
+    [ENGINE_DEFAULT] = "default",
+    [ENGINE_SWITCH] = "switch",
+    [ENGINE_TABLE] = "table",
+    [ENGINE_THREADED] = "threaded",
+    [ENGINE_BLOCK] = "block",
+    [ENGINE_JIT] = "jit",
+};
 
-        case 0x83:  // ADD E
-        {
-            add_x(state, state->e);
-        } 
-            break;
-        case 0x84:  // ADD H
-        {
-            add_x(state, state->h);
-        } 
-            break;
-        case 0x85:  // ADD L
-        {
-            add_x(state, state->l);
-        }
-            break;
-        case 0x86:  // ADD M
-        {
-            uint8_t m = read_hl(state);
-            add_x(state, m);
-        }
-            break;
-        case 0x87:  // ADD A
-        {
-            add_x(state, state->a);
-        }
-            break;
-        case 0x88:  // ADC B (A <- A + B + CY)
-        {
-            uint8_t b = state->b;
-            adc_x(state, b);
-        }
-            break;
-        case 0x89:  // ADC C
-        {
-            adc_x(state, state->c);
-        }
-            break;
-        case 0x8a:  // ADC D
-        {
-            adc_x(state, state->d);
-        }
-            break;
-        case 0x8b:  // ADC E
-        {
-            adc_x(state, state->e);
-        }
-            break;
-        case 0x8c:  // ADC H 
-        {
-            adc_x(state, state->h);
-        }
-            break;
-        case 0x8d:  // ADC L
-        {
-            adc_x(state, state->l);
-        }
-            break;
-        case 0x8e:
-        {
-            uint8_t m = read_hl(state);
-            adc_x(state, m);
-        }
-        case 0x8f: 
-        {
-            adc_x(state, state->a);
-        }
-            break;
-        case 0x90:  // SUB B
-        {
-            sub_x(state, state->b);
-        }
-            break;
-        case 0x91:
-        {
-            sub_x(state, state->c);
-        }
-            break;
-        case 0x92:
-        {
-            sub_x(state, state->d);
-        }
-            break;
-        case 0x93:
-        {
-            sub_x(state, state->e);
-        }
-            break;
-        case 0x94:
-        {
-            sub_x(state, state->h);
-        }
-            break;
-        case 0x95:
-        {
-            sub_x(state, state->l);
-        }
-            break;
-        case 0x96:  // SUB (HL)
-        {
-            uint8_t m = read_hl(state);
-            sub_x(state, m);
-        }
-            break;
-        case 0x97:  // SUB A
-        {
-            sub_x(state, state->a);
-        }
-            break;
-        case 0x98:  // SBB B
-        {
-            sbb_x(state, state->b);
-        }
-            break;
-        case 0x99:
-        {
-            sbb_x(state, state->c);
-        }
-            break;
-        case 0x9a:
-        {
-            sbb_x(state, state->d);
-        }
-            break;
-        case 0x9b:
-        {
-            sbb_x(state, state->e);
-        }
-            break;
-        case 0x9c:
-        {
-            sbb_x(state, state->h);
-        }
-            break;
-        case 0x9d:
-        {
-            sbb_x(state, state->l);
-        }
-            break;
-        case 0x9e:
-        {
-            uint8_t m = read_hl(state);
-            sbb_x(state, m);
-        }
-            break;
-        case 0x9f:
-        {
-            sbb_x(state, state->a);
-        }
-            break;
-        case 0xa0:  // ANA B
-        {
-            ana_x(state, state->b);
-        }
-            break;
-        case 0xa1:
-        {
-            ana_x(state, state->c);
-        }
-            break;
-        case 0xa2:
-        {
-            ana_x(state, state->d);
-        }
-            break;
-        case 0xa3:
-        {
-            ana_x(state, state->e);
-        }
-            break;
-        case 0xa4:
-        {
-            ana_x(state, state->h);
-        }
-            break;
-        case 0xa5:
-        {
-            ana_x(state, state->l);
-        }
-            break;
-        case 0xa6:
-        {
-            uint8_t m = read_hl(state);
-            ana_x(state, m);
-        }
-            break;
-        case 0xa7:
-        {
-            ana_x(state, state->a);
-        }
-            break;
-        case 0xa8:
-        {
-            xra_x(state, state->b);
-        }
-            break;
-        case 0xa9:
-        {
-            xra_x(state, state->c);
-        }
-            break;
-        case 0xaa:
-        {
-            xra_x(state, state->d);
-        }
-            break;
-        case 0xab:
-        {
-            xra_x(state, state->e);
-        }
-            break;
-        case 0xac:
-        {
-            xra_x(state, state->h);
-        }
-            break;
-        case 0xad:
-        {
-            xra_x(state, state->l);
-        }
-            break;
-        case 0xae:
-        {
-            uint8_t m = read_hl(state);
-            xra_x(state, m);
-        }
-            break;
-        case 0xaf:
-        {
-            xra_x(state, state->a);
-        }
-            break;
-        case 0xb0:
-        {
-            ora_x(state, state->b);
-        }
-            break;
-        case 0xb1:
-        {
-            ora_x(state, state->c);
-        }
-            break;
-        case 0xb2:
-        {
-            ora_x(state, state->d);
-        }
-            break;
-        case 0xb3:
-        {
-            ora_x(state, state->e);
-        }
-            break;
-        case 0xb4:
-        {
-            ora_x(state, state->h);
-        }
-            break;
-        case 0xb5:
-        {
-            ora_x(state, state->l);
-        }
-            break;
-        case 0xb6:
-        {
-            uint8_t m = read_hl(state);
-            ora_x(state, m);
-        }
-            break;
-        case 0xb7:
-        {
-            ora_x(state, state->a);
-        }
-            break;
-        case 0xb8:  // CMP B
-        {
-            cmp_x(state, state->b);
-        }
-            break;
-        case 0xb9:
-        {
-            cmp_x(state, state->c);
-        }
-            break;
-        case 0xba:
-        {
-            cmp_x(state, state->d);
-        }
-            break;
-        case 0xbb:
-        {
-            cmp_x(state, state->e);
-        }
-            break;
-        case 0xbc:
-        {
-            cmp_x(state, state->h);
-        }
-            break;
-        case 0xbd:
-        {
-            cmp_x(state, state->l);
-        }
-            break;
-        case 0xbe:
-        {
-            cmp_x(state, read_hl(state));
-        }
-            break;
-        case 0xbf:
-        {
-            cmp_x(state, state->a);
-        }
-            break;
-        case 0xc0:  // RNZ
-        {
-            // if NZ, RET
-            uint8_t not_zero = !state->cc.z;
-            if (not_zero) {
-                ret(state);
-            }
-        }
-            break;
-        case 0xc1:  // POP B
-        {
-            // pop the stack into
-            // registers B and C
-            pop(state, &state->b, &state->c);
-        }
-            break;
-        case 0xc2:  // JNZ adr
-        {
-            uint8_t notzero = state->cc.z == 0;
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            jmp_cond(state, adr, notzero);
-        }
-            break;
-        case 0xc3:  // JMP adr
-        {
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            jmp(state, adr);
-        }
-            break;
-        case 0xc4:  // CNZ adr
-        {
-            uint8_t notzero = !state->cc.z; 
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            call_cond(state, adr, notzero);
-        }
-            break;
-        case 0xc5:  // PUSH B
-        {
-            push_x(state, state->b, state->c);
-        }
-            break;
-        case 0xc6:  // ADI D8
-        {
-            // The immediate form is the almost the 
-            // same except the source of the addend 
-            // is the byte after the instruction. 
-            // Since "opcode" is a pointer to the 
-            // current instruction in memory, 
-            // opcode[1] will be the immediately following byte.
-            uint16_t answer;
-            answer = (uint16_t) state->a + (uint16_t) opcode[1];
-            set_arith_flags(state, answer, SET_ALL_FLAGS);
-
-            state->a = (uint8_t) answer;
-            // instruction is of size 2
-            state->pc += 1;
-        }
-            break;
-        case 0xc7:  // RST 0
-        {
-            call_adr(state, 0);
-        }
-            break;
-        case 0xc8:  // RZ
-        {
-            // if Z, RET
-            if (state->cc.z) {
-                ret(state);
-            }
-        }
-            break;
-        case 0xc9:  // RET
-        {
-            ret(state);
-        }
-            break;
-        case 0xca:  // JZ adr
-        {
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            jmp_cond(state, adr, state->cc.z);
-        }
-            break;
-        case 0xcb:
-        {
-            unused_opcode(state);
-        }
-            break;
-        case 0xcc:  // CZ adr
-        {
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            call_cond(state, adr, state->cc.z);
-        }
-            break;
-        case 0xcd:  // CALL adr
-        {
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            call_adr(state, adr); 
-        }
-            break;
-        case 0xce:  // ACI D8: A <- A + data + CY
-        {
-            uint8_t data = opcode[1];
-            uint16_t a, answer;
-            a = (uint16_t) state->a;
-            answer = a + data + state->cc.cy;
-            set_arith_flags(state, answer, SET_ALL_FLAGS);
-            state->a = answer & 0xff;
-            state->pc += 1;
-        }
-            break;
-        case 0xcf: // RST 8
-        {
-            call_adr(state, 8);
-        }
-            break;
-        case 0xd0:  // RNC
-        {
-            // if not carry, return
-            if (!state->cc.cy) {
-                ret(state);
-            }
-        } 
-            break;
-        case 0xd1:
-        {
-            pop(state, &state->d, &state->e);
-        }
-            break;
-        case 0xd2:  // JNC adr
-        {
-            // if not carry, jmp
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            jmp_cond(state, adr, !state->cc.cy);
-        }
-            break;
-        case 0xd3:  // OUT D8
-        {
-            if (state->output) {
-                state->output(opcode[1]);
-            }
-            // skip over data byte
-            state->pc += 1;
-        }
-            break;
-        case 0xd4:
-        {
-            uint8_t nocarry = !state->cc.cy;
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            call_cond(state, adr, nocarry);
-        }
-            break;
-        case 0xd5:  // PUSH D
-        {
-            push_x(state, state->d, state->e);
-        }
-            break;
-        case 0xd6:   // SUI D8
-        {
-            uint8_t byte = opcode[1];
-            uint16_t answer = (uint16_t) state->a - (uint16_t) byte;
-            set_arith_flags(state, answer, 
-                SET_ALL_FLAGS ^ SET_CY_FLAG);
-            if (byte > state->a) {
-                state->cc.cy = 1;
-            }
-            state->a = answer & 0xff;
-            
-            state->pc += 1;
-        } 
-            break;
-        case 0xd7:  // CALL 10 (16 in decimal)
-        {
-            // 0, 8, 16, 24, 32, 40, 48, and 56
-            call_adr(state, 16);
-        }
-            break;
-        case 0xd8:  // RC
-        {
-            if (state->cc.cy) {
-                ret(state);
-            }
-        }
-            break;
-        case 0xd9:
-            unused_opcode(state);
-            break;
-        case 0xda:
-        {
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            jmp_cond(state, adr, state->cc.cy);
-        }
-            break;
-        case 0xdb:  // IN D8
-        {
-            if (state->input) {
-                state->input(opcode[1]);
-            }
-            // skip over data byte
-            state->pc++;
-        }
-            break;
-        case 0xdc:  // CC adr
-        {
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            call_cond(state, adr, state->cc.cy);
-        }
-            break;
-        case 0xdd:
-            unused_opcode(state); 
-            break;
-        case 0xde:  // SBI D8
-        {
-            uint16_t answer, a, cy, byte;
-            a = (uint16_t) state->a;
-            cy = (uint16_t) state->cc.cy;
-            byte = (uint16_t) opcode[1];
-            answer = a - byte - cy;
-            set_arith_flags(state, answer, 
-                SET_ALL_FLAGS ^ SET_CY_FLAG);
-            // set CY if subtracting larger num
-            if (byte + cy > a) {
-                state->cc.cy = 1;
-            }
-            state->a = answer & 0xff;
-            state->pc += 2;
-        }
-            break;
-        case 0xdf:
-        {
-            call_adr(state, 24);
-        }
-            break;
-        case 0xe0:  // RPO
-        {
-            // if parity odd, RET
-            if (!state->cc.p) {
-                ret(state);
-            }
-        }
-            break;
-        case 0xe1:  // POP H
-        {
-            pop(state, &state->h, &state->l);
-        }
-            break;
-        case 0xe2:  // JPO adr
-        {
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            jmp_cond(state, adr, !state->cc.p);
-        }
-            break;
-        case 0xe3:  // XTHL
-        {
-            // L <-> (SP); H <-> (SP+1)
-            uint16_t sp = state->sp;
-            uint8_t *sp_h, *sp_l;
-            sp_h = &state->memory[sp + 1];
-            sp_l = &state->memory[sp]; 
-            swp_ptrs(&state->l, sp_l);
-            swp_ptrs(&state->h, sp_h);
-        }
-            break;
-        case 0xe4:  // CPO adr
-        {
-            uint8_t odd = !state->cc.p;
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            call_cond(state, adr, odd);
-        }
-            break;
-        case 0xe5:  // PUSH H
-        {
-            push_x(state, state->h, state->l);
-        }
-            break;
-        case 0xe6:  // ANI D8
-        {
-            uint8_t answer = state->a & opcode[1];
-            set_logic_flags(state, answer, SET_ALL_FLAGS);
-            state->a = answer & 0xff;
-            state->pc += 1;
-        }
-            break;
-        case 0xe7:
-        {
-            // decimal value = 32
-            call_adr(state, 0x20);
-        }
-            break;
-        case 0xe8:  // RPE
-        {
-            if (state->cc.p) {
-                ret(state);
-            }
-        }
-            break;
-        case 0xe9:  // PCHL
-        {
-            // PC.hi <- H; PC.lo <- L
-            state->pc = makeword(state->h, state->l);
-        }
-            break;
-        case 0xea:  // JPE adr
-        {
-            // jmp if even
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            jmp_cond(state, adr, state->cc.p);
-        }
-            break;
-        case 0xeb:  // XCHG
-        {
-            // H <-> D; L <-> E
-            swp_ptrs(&state->h, &state->d);
-            swp_ptrs(&state->l, &state->e);
-        }
-            break;
-        case 0xec:  // CPE adr
-        {
-            // call address if parity even
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            call_cond(state, adr, state->cc.p);
-        }
-            break;
-        case 0xed:
-            unused_opcode(state);
-            break;
-        case 0xee:  // XRI D8
-        {
-            uint16_t answer;
-            answer = (uint16_t) state->a ^ opcode[1];
-            set_logic_flags(state, answer,
-                SET_ALL_FLAGS);
-            state->a = answer & 0xff;
-            state->pc += 1;
-        }
-            break;
-        case 0xef:  // RST
-        {
-            call_adr(state, 0x28);
-        }
-            break;
-        case 0xf0:  // RP
-        {
-            // if positive, RET
-            if (state->cc.s == 0) {
-                ret(state);
-            }
-        }
-        case 0xf1:  // POP PSW
-        {
-            uint16_t sp_addr = state->sp;
-            uint8_t sp_val = state->memory[sp_addr];
 
-            // (CY) <- ((SP))O
-            state->cc.cy = sp_val & 1;
-
-            // (P) <- ((SP))2
-            state->cc.p = (sp_val & (1 << 2)) > 0;
+const char* engine_name(Engine engine) {
+    if (engine == ENGINE_DEFAULT) {
+        engine = CORE_ENGINE;
+    }
+    if (engine < 0 || engine >= ENGINE_COUNT) {
+        return "unknown";
+    }
+    return engine_names[engine];
+}
 
-            // (AC) <- ((SP))4
-            state->cc.ac = (sp_val & (1 << 4)) > 0;
 
-            // (Z) <- ((SP))6
-            state->cc.z = (sp_val & (1 << 6)) > 0;
+int engine_from_name(const char *name, Engine *engine) {
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        if (strcmp(name, engine_names[i]) == 0) {
+            *engine = i;
+            return engine_available(i) ? 0 : -1;
+        }
+    }
+    return -1;
+}
 
-            // (S) <- ((SP))7
-            state->cc.s = (sp_val & (1 << 7)) > 0;
 
-            // (A) <- ((SP) +1)
-            state->a = state->memory[sp_addr + 1];
+int engine_available(Engine engine) {
+    switch (engine) {
+        case ENGINE_DEFAULT:
+        case ENGINE_SWITCH:
+        case ENGINE_TABLE:
+        case ENGINE_BLOCK:
+            return 1;
+#ifdef HAVE_THREADED
+        case ENGINE_THREADED:
+            return 1;
+#endif
+#ifdef HAVE_JIT
+        case ENGINE_JIT:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
 
-            // (SP) <- (SP) + 2
-            state->sp += 2;
 
-            // below is the implementation from
-            // the site...
-            // uint8_t psw = state->memory[sp_addr];
+RunStop run_cycles(State8080 *state, uint64_t budget) {
+    if (state->halted) {
+        // a halted CPU does nothing until an interrupt
+        // comes in, so the whole budget goes by
+        state->cycles += budget;
+        return STOP_HALT;
+    }
+    return run_engine(state, budget, UINT64_MAX);
+}
 
-            // state->cc.z = (0x01 == (psw & 0x01);
-            // state->cc.s = (0x02 == (psw & 0x02);
-            // state->cc.p = (0x04 == (psw & 0x04);
-            // state->cc.cy = (0x05 == (psw & 0x05);
-            // state->cc.ac = (0x10 == (psw & 0x10);
-            //
-            // I don't think it matters as long as
-            // the flags match when pushed and popped
-        }
-            break;
-        case 0xf2:  // JP adr
-        {
-            // if positive, JMP
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            jmp_cond(state, adr, state->cc.s == 0);
-        }
-            break;
-        case 0xf3:  // DI
-        {
-            // disable interrupts
-            state->int_enable = 0;
-        }
-            break;
-        case 0xf4:   // CP adr
-        {
-            uint8_t pos = !state->cc.s;
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            call_cond(state, adr, pos);
-        }
-            break;
-        case 0xf5:  // PUSH PSW
-        {
-            uint16_t sp_adr = state->sp;
-            
-            // ((SP) - 1) <- A
-            state->memory[sp_adr - 1] = state->a;
 
-            uint8_t sp_flags = 0;
+RunStop run_instructions(State8080 *state, uint64_t count) {
+    return run_engine(state, UINT64_MAX, count);
+}
 
-            // ((SP) - 2)0 <- CY
-            sp_flags |= state->cc.cy; 
 
-            // (........)1 <- 1
-            sp_flags |= (1 << 1);
+int emulate_op(State8080 *state) {
+    uint64_t start = state->cycles;
+    run_engine(state, UINT64_MAX, 1);
+    return (int) (state->cycles - start);
+}
 
-            // (........)2 <- P
-            sp_flags |= (state->cc.p << 2);
 
-            // (........)3 <- 0
- 
-            // (........)4 <- AC
-            sp_flags |= (state->cc.ac << 4);
+void generate_interrupt(State8080 *state, int rst_num) {
+    state->int_pending = 1;
+    state->int_rst = rst_num & 7;
+    if (state->blocks) {
+        // raised by a device mid-run: a block being replayed
+        // stops after this instruction, as the interpreters do
+        state->blocks->generation++;
+    }
+}
 
-            // (........)5 <- 0
 
-            // (........)6 <- Z
-            sp_flags |= (state->cc.z << 6);
+int service_interrupt(State8080 *state) {
+    if (!state->int_pending || !state->int_enable || state->cycles + 1 == state->ei_shadow) {
+        return 0;
+    }
+    state->int_pending = 0;
 
-            // (........)7 <- S
-            sp_flags |= (state->cc.s << 7);
-            state->memory[sp_adr - 2] = sp_flags;
+    // same as executing RST n: push PC and jump
+    // to 8 * n, with further interrupts disabled
+    rst(state, state->int_rst);
+    state->int_enable = 0;
+    state->halted = 0;
 
-            // (SP) <- (SP) - 2
-            state->sp -= 2;
-        } 
-            break;
-        case 0xf6:  // ORI D8
-        {
-            uint16_t answer;
-            answer = (uint16_t) state->a | opcode[1];
-            set_logic_flags(state, answer,
-                SET_ALL_FLAGS);
-            state->a = answer & 0xff;
-            state->pc += 1;
-        }
-            break;
-        case 0xf7:  // RST 6 (CALL $30)
-        {
-            call_adr(state, 0x30);
-        }
-            break;
-        case 0xf8:  // RM
-        {
-            // if minus, RET
-            if (state->cc.s) {
-                ret(state);
-            }
-        }
-            break;
-        case 0xf9:  // SPHL: SP = HL
-        {
-            state->sp = makeword(state->h, state->l);
-        }
-            break;
-        case 0xfa:  // JM
-        {
-            // jump if sign is negative (sign = 1)
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            jmp_cond(state, adr, state->cc.s);
-        }
-            break;
-        case 0xfb:  // EI
-        {
-            // enable interrupts
-            state->int_enable = 1;
-        }
-            break;
-        case 0xfc:  // CM adr
-        {
-            // if minus, call
-            uint8_t minus = state->cc.s;
-            uint16_t adr = makeword(opcode[2], opcode[1]);
-            call_cond(state, adr, minus);
-        }
-            break;
-        case 0xfd:
-            unused_opcode(state);
-            break;
-        case 0xfe:  // CPI byte
-        {
-            cmp_x(state, opcode[1]);
-            state->pc += 1;
-        }
-            break;
-        case 0xff:
-        {
-            call_adr(state, 0x38);
-        }
-            break;
-    }
+    int cycles = op_cycles[0xc7];
+    state->cycles += cycles;
+    return cycles;
 }
-
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpm.h"
+#include "emu.h"
+#include "memory.h"
+#include "scheduler.h"
+
+// BDOS functions carried out on the console
+#define BDOS_PUT_CHAR   2
+#define BDOS_PUT_STRING 9
+
+/*
+ * The BDOS entry at CPM_BDOS. Function 0 jumps to the warm boot
+ * HLT; anything else passes E and D out, then C, which makes the
+ * call. A and the flags are kept for the caller.
+ */
+static const uint8_t bdos_stub[] = {
+    0xf5,                   // PUSH PSW
+    0x79,                   // MOV A,C
+    0xb7,                   // ORA A
+    0xca, 0x00, 0x00,       // JZ 0x0000
+    0x7b,                   // MOV A,E
+    0xd3, CPM_PORT_E,       // OUT CPM_PORT_E
+    0x7a,                   // MOV A,D
+    0xd3, CPM_PORT_D,       // OUT CPM_PORT_D
+    0x79,                   // MOV A,C
+    0xd3, CPM_PORT_CALL,    // OUT CPM_PORT_CALL
+    0xf1,                   // POP PSW
+    0xc9,                   // RET
+};
+
+
+/*
+ * Sends `len` bytes of console output to the echo
+ * stream and the captured text
+ */
+static void console_put(CpmConsole *console, const char *bytes, size_t len) {
+    if (console->echo) {
+        fwrite(bytes, 1, len, console->echo);
+    }
+    if (!console->capture) {
+        return;
+    }
+    if (console->len + len > console->capacity) {
+        size_t bigger = console->capacity ? 2 * console->capacity : 4096;
+        while (bigger < console->len + len) {
+            bigger *= 2;
+        }
+        char *grown = realloc(console->text, bigger);
+        if (grown == NULL) {
+            // keep what fits; the comparison will fail
+            console->capture = 0;
+            return;
+        }
+        console->text = grown;
+        console->capacity = bigger;
+    }
+    memcpy(console->text + console->len, bytes, len);
+    console->len += len;
+}
+
+
+/*
+ * OUT CPM_PORT_CALL: carries out BDOS function `val`
+ * with the DE the stub passed before it
+ */
+static void bdos_call(void *ctx, uint8_t port, uint8_t val) {
+    (void) port;
+    CpmConsole *console = ctx;
+    uint16_t de = (console->io->out_value[CPM_PORT_D] << 8)
+        | console->io->out_value[CPM_PORT_E];
+    console->calls++;
+
+    switch (val) {
+        case BDOS_PUT_CHAR: {
+            char c = de & 0xff;
+            console_put(console, &c, 1);
+            break;
+        }
+        case BDOS_PUT_STRING: {
+            // up to the '$', stopping if it wraps all the way round
+            uint16_t end = de;
+            while (console->memory[end] != '$' && (uint16_t) (end + 1) != de) {
+                end++;
+            }
+            if (end >= de) {
+                console_put(console, (const char *) console->memory + de, end - de);
+            } else {
+                console_put(console, (const char *) console->memory + de, MEM_SIZE - de);
+                console_put(console, (const char *) console->memory, end);
+            }
+            break;
+        }
+    }
+}
+
+
+int cpm_load(RomImage *img, const char *path) {
+    RomPart part = { (char *) path, CPM_TPA };
+    return rom_image_load(img, &part, 1);
+}
+
+
+void cpm_install(State8080 *state, CpmConsole *console) {
+    mem_map_init(state->mem_map);
+
+    // warm boot halts; CALL 5 jumps to the stub
+    state->memory[0x0000] = 0x76;
+    state->memory[0x0005] = 0xc3;
+    state->memory[0x0006] = CPM_BDOS & 0xff;
+    state->memory[0x0007] = CPM_BDOS >> 8;
+    memcpy(state->memory + CPM_BDOS, bdos_stub, sizeof(bdos_stub));
+
+    io_map_init(state->io);
+    state->io->out_kind[CPM_PORT_E] = PORT_VALUE;
+    state->io->out_kind[CPM_PORT_D] = PORT_VALUE;
+    io_attach(state->io, CPM_PORT_CALL, NULL, bdos_call, console);
+    state->io->out_kind[CPM_PORT_INT] = PORT_INTERRUPT;
+    console->memory = state->memory;
+    console->io = state->io;
+
+    state->pc = CPM_TPA;
+}
+
+
+int cpm_run(State8080 *state, uint64_t max_instrs) {
+    uint64_t start = state->instructions;
+    // nothing to schedule, but sched_run takes the interrupts
+    // OUT CPM_PORT_INT raises, a frame's worth at a time
+    Scheduler sched;
+    sched_init(&sched);
+    while (!max_instrs || state->instructions - start < max_instrs) {
+        if (sched_run(&sched, state, CYCLES_PER_FRAME) == STOP_HALT) {
+            break;
+        }
+    }
+    return state->halted && state->pc == 0x0001;
+}
+
+
+void cpm_console_free(CpmConsole *console) {
+    free(console->text);
+    console->text = NULL;
+    console->len = console->capacity = 0;
+}
+
+
+/*
+ * Returns 1 if `len` bytes at `text` contain `expect`
+ */
+static int contains(const char *text, size_t len, const char *expect) {
+    size_t n = strlen(expect);
+    for (size_t i = 0; i + n <= len; i++) {
+        if (memcmp(text + i, expect, n) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+int cpm_run_engines(const RomImage *program, const Engine *engines, int count,
+        uint64_t max_instrs, const char *expect) {
+    CpmConsole first;
+    memset(&first, 0, sizeof(first));
+    uint64_t first_instrs = 0;
+
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        State8080 state;
+        if (emu_load(&state, program) < 0) {
+            cpm_console_free(&first);
+            return 1;
+        }
+        state.engine = engines[i];
+
+        CpmConsole scratch;
+        memset(&scratch, 0, sizeof(scratch));
+        CpmConsole *console = i == 0 ? &first : &scratch;
+        console->echo = i == 0 ? stdout : NULL;
+        console->capture = 1;
+        cpm_install(&state, console);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int booted = cpm_run(&state, max_instrs);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (i == 0) {
+            first_instrs = state.instructions;
+            printf("\n\n");
+        }
+
+        const char *verdict = "ok";
+        if (!booted) {
+            verdict = state.halted ? "halted without a warm boot" : "instruction limit";
+        } else if (expect && !contains(console->text, console->len, expect)) {
+            verdict = "expected output missing";
+        } else if (console->len != first.len
+                || (first.len && memcmp(console->text, first.text, first.len) != 0)
+                || state.instructions != first_instrs) {
+            verdict = "differs from the first engine";
+        }
+        printf("%-9s %12" PRIu64 " instrs %6" PRIu64 " BDOS calls %8.2f s %8.1f MIPS  %s\n",
+            engine_name(engines[i]), state.instructions, console->calls, secs,
+            secs > 0 ? state.instructions / secs / 1e6 : 0, verdict);
+        if (strcmp(verdict, "ok") != 0) {
+            status = 1;
+        }
+
+        if (i != 0) {
+            cpm_console_free(&scratch);
+        }
+        emu_unload(&state);
+    }
+    cpm_console_free(&first);
+    return status;
+}
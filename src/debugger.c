@@ -0,0 +1,415 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block.h"
+#include "debugger.h"
+#include "disassembler.h"
+
+
+Debugger* debug_new(void) {
+    return calloc(1, sizeof(Debugger));
+}
+
+
+void debug_free(Debugger *debug) {
+    if (debug && debug->state) {
+        debug_detach(debug);
+    }
+    free(debug);
+}
+
+
+static const char *const reg8_names[] = { "b", "c", "d", "e", "h", "l", "f", "a" };
+static const char *const reg16_names[] = { "bc", "de", "hl", "sp" };
+static const char *const compare_names[] = { "==", "!=", "<", "<=", ">", ">=" };
+
+
+static const char* skip_spaces(const char *s) {
+    while (isspace((unsigned char) *s)) {
+        s++;
+    }
+    return s;
+}
+
+
+/*
+ * Parses a number (decimal, or hex with 0x) up to `max` at
+ * `*s`, moving `*s` past it. Returns 0 on success and -1 if
+ * there isn't one.
+ */
+static int parse_number(const char **s, unsigned long max, unsigned long *value) {
+    char *end;
+    *s = skip_spaces(*s);
+    *value = strtoul(*s, &end, 0);
+    if (end == *s || *value > max) {
+        return -1;
+    }
+    *s = end;
+    return 0;
+}
+
+
+/*
+ * Parses a condition like "hl>=0x2400" into `cond`.
+ * Returns 0 on success and -1 on failure.
+ */
+static int parse_cond(const char *s, DebugCond *cond) {
+    unsigned long value;
+    s = skip_spaces(s);
+
+    if (*s == '[') {
+        s++;
+        if (parse_number(&s, MEM_SIZE - 1, &value) < 0 || *(s = skip_spaces(s)) != ']') {
+            return -1;
+        }
+        s++;
+        cond->operand = DEBUG_MEM;
+        cond->index = value;
+    } else {
+        char name[3];
+        size_t len = 0;
+        while (isalpha((unsigned char) s[len]) && len < sizeof(name) - 1) {
+            name[len] = tolower((unsigned char) s[len]);
+            len++;
+        }
+        name[len] = '\0';
+        s += len;
+
+        cond->operand = DEBUG_ALWAYS;
+        for (int i = 0; i < 8; i++) {
+            if (strcmp(name, reg8_names[i]) == 0) {
+                cond->operand = DEBUG_REG8;
+                cond->index = i;
+            }
+        }
+        for (int i = 0; i < 4; i++) {
+            if (strcmp(name, reg16_names[i]) == 0) {
+                cond->operand = DEBUG_REG16;
+                cond->index = i;
+            }
+        }
+        if (cond->operand == DEBUG_ALWAYS) {
+            return -1;
+        }
+    }
+
+    // longest operator first, so "<=" isn't read as "<"
+    s = skip_spaces(s);
+    static const DebugCompare by_length[] = {
+        DEBUG_EQ, DEBUG_NE, DEBUG_LE, DEBUG_GE, DEBUG_LT, DEBUG_GT,
+    };
+    int found = 0;
+    for (size_t i = 0; i < sizeof(by_length) / sizeof(by_length[0]) && !found; i++) {
+        const char *op = compare_names[by_length[i]];
+        if (strncmp(s, op, strlen(op)) == 0) {
+            cond->compare = by_length[i];
+            s += strlen(op);
+            found = 1;
+        }
+    }
+    unsigned long max = cond->operand == DEBUG_REG16 ? 0xffff : 0xff;
+    if (!found || parse_number(&s, max, &value) < 0 || *skip_spaces(s) != '\0') {
+        return -1;
+    }
+    cond->value = value;
+    return 0;
+}
+
+
+int debug_add_break(Debugger *debug, const char *spec) {
+    if (debug->break_count == DEBUG_MAX_BREAKPOINTS) {
+        fprintf(stderr, "Error: no more than %d breakpoints\n", DEBUG_MAX_BREAKPOINTS);
+        return -1;
+    }
+
+    Breakpoint bp;
+    memset(&bp, 0, sizeof(bp));
+    const char *s = spec;
+    unsigned long addr;
+    if (parse_number(&s, MEM_SIZE - 1, &addr) < 0
+            || (*s == ':' ? parse_cond(s + 1, &bp.cond) < 0 : *skip_spaces(s) != '\0')) {
+        fprintf(stderr, "Error: bad breakpoint %s, expected ADDR or ADDR:COND\n", spec);
+        return -1;
+    }
+    bp.addr = addr;
+
+    debug->pc_bits[bp.addr >> 3] |= 1 << (bp.addr & 7);
+    debug->page_breakpoints[bp.addr >> PAGE_SHIFT]++;
+    debug->breaks[debug->break_count] = bp;
+    return debug->break_count++;
+}
+
+
+/*
+ * Sets PAGE_WATCH on the pages under the write watchpoint `w`
+ */
+static void arm_watch(MemoryMap *map, const Watchpoint *w) {
+    if (w->kind & DEBUG_WRITE) {
+        unsigned last = (w->start + w->len - 1) >> PAGE_SHIFT;
+        for (unsigned page = w->start >> PAGE_SHIFT; page <= last; page++) {
+            map->attr[page] |= PAGE_WATCH;
+        }
+    }
+}
+
+
+int debug_add_watch(Debugger *debug, const char *spec) {
+    if (debug->watch_count == DEBUG_MAX_WATCHPOINTS) {
+        fprintf(stderr, "Error: no more than %d watchpoints\n", DEBUG_MAX_WATCHPOINTS);
+        return -1;
+    }
+
+    Watchpoint w;
+    memset(&w, 0, sizeof(w));
+    w.len = 1;
+    w.kind = DEBUG_WRITE;
+
+    const char *s = spec;
+    unsigned long addr, len = 1;
+    int ok = parse_number(&s, MEM_SIZE - 1, &addr) == 0;
+    if (ok && *s == '+') {
+        s++;
+        ok = parse_number(&s, MEM_SIZE - addr, &len) == 0 && len > 0;
+    }
+    if (ok && *s == ':') {
+        s++;
+        w.kind = 0;
+        for (; *s == 'r' || *s == 'w'; s++) {
+            w.kind |= *s == 'r' ? DEBUG_READ : DEBUG_WRITE;
+        }
+        ok = w.kind != 0;
+    }
+    if (!ok || *skip_spaces(s) != '\0') {
+        fprintf(stderr, "Error: bad watchpoint %s, expected ADDR[+LEN][:r|w|rw]\n", spec);
+        return -1;
+    }
+    w.start = addr;
+    w.len = len;
+
+    if (w.kind & DEBUG_READ) {
+        debug->reads++;
+    }
+    if (debug->state) {
+        arm_watch(debug->state->mem_map, &w);
+    }
+    debug->watches[debug->watch_count] = w;
+    return debug->watch_count++;
+}
+
+
+void debug_attach(Debugger *debug, State8080 *state) {
+    debug->state = state;
+    debug->pending = 0;
+    state->debug = debug;
+    for (int i = 0; i < debug->watch_count; i++) {
+        arm_watch(state->mem_map, &debug->watches[i]);
+    }
+}
+
+
+void debug_detach(Debugger *debug) {
+    State8080 *state = debug->state;
+    for (int page = 0; page < NUM_PAGES; page++) {
+        state->mem_map->attr[page] &= ~PAGE_WATCH;
+    }
+    state->debug = NULL;
+    debug->state = NULL;
+}
+
+
+/*
+ * Records a hit on watchpoint `index` unless one is already
+ * waiting, and ends a run of decoded or compiled blocks early
+ */
+static void watch_hit(Debugger *debug, State8080 *state, int index,
+        uint8_t kind, uint16_t addr, uint8_t value) {
+    debug->watches[index].hits++;
+    if (debug->pending) {
+        return;
+    }
+    debug->pending = 1;
+    debug->hit.kind = kind;
+    debug->hit.index = index;
+    debug->hit.addr = addr;
+    debug->hit.old_value = state->memory[addr];
+    debug->hit.value = value;
+    if (state->blocks) {
+        // the same signal as a write that drops a block
+        state->blocks->generation++;
+    }
+}
+
+
+/*
+ * Returns the watchpoint of `kind` covering `addr`, or -1
+ */
+static int find_watch(const Debugger *debug, uint8_t kind, uint16_t addr) {
+    for (int i = 0; i < debug->watch_count; i++) {
+        const Watchpoint *w = &debug->watches[i];
+        if ((w->kind & kind) && (uint16_t) (addr - w->start) < w->len) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+void debug_check_write(State8080 *state, uint16_t addr, uint8_t val) {
+    Debugger *debug = state->debug;
+    if (debug == NULL) {
+        return;
+    }
+    int index = find_watch(debug, DEBUG_WRITE, addr);
+    if (index >= 0) {
+        watch_hit(debug, state, index, DEBUG_WRITE, addr, val);
+    }
+}
+
+
+/*
+ * Returns 1 if condition `cc` (0-7 for NZ Z NC C PO PE P M)
+ * of a conditional return holds
+ */
+static int condition_holds(const State8080 *state, int cc) {
+    static const uint8_t flag[4] = { FLAG_Z, FLAG_CY, FLAG_P, FLAG_S };
+    int set = (flags_psw(state) & flag[cc >> 1]) != 0;
+    return (cc & 1) ? set : !set;
+}
+
+
+void debug_check_reads(Debugger *debug, State8080 *state) {
+    const uint8_t *code = &state->memory[state->pc];
+    uint8_t op = code[0];
+    uint16_t addr = 0;
+    int len = 0;
+
+    if (((op & 0xc7) == 0x46 && op != 0x76) || (op & 0xc7) == 0x86
+            || op == 0x34 || op == 0x35) {
+        // MOV r,M, the ALU ops on M, INR M and DCR M
+        addr = state->hl;
+        len = 1;
+    } else if (op == 0x0a || op == 0x1a) {
+        // LDAX B, LDAX D
+        addr = op == 0x0a ? state->bc : state->de;
+        len = 1;
+    } else if (op == 0x3a || op == 0x2a) {
+        // LDA, LHLD
+        addr = (code[2] << 8) | code[1];
+        len = op == 0x3a ? 1 : 2;
+    } else if ((op & 0xcf) == 0xc1 || op == 0xc9 || op == 0xe3
+            || ((op & 0xc7) == 0xc0 && condition_holds(state, (op >> 3) & 7))) {
+        // POP, RET, XTHL and a taken Rcc
+        addr = state->sp;
+        len = 2;
+    }
+
+    for (int i = 0; i < len; i++) {
+        uint16_t at = addr + i;
+        int index = find_watch(debug, DEBUG_READ, at);
+        if (index >= 0) {
+            watch_hit(debug, state, index, DEBUG_READ, at, state->memory[at]);
+            return;
+        }
+    }
+}
+
+
+/*
+ * Returns the value a condition compares
+ */
+static unsigned operand_value(const DebugCond *cond, const State8080 *state) {
+    switch (cond->operand) {
+        case DEBUG_REG8: {
+            const uint8_t regs[8] = {
+                state->b, state->c, state->d, state->e,
+                state->h, state->l, flags_psw(state), state->a,
+            };
+            return regs[cond->index];
+        }
+        case DEBUG_REG16: {
+            const uint16_t pairs[4] = {
+                state->bc, state->de,
+                state->hl, state->sp,
+            };
+            return pairs[cond->index];
+        }
+        case DEBUG_MEM:
+            return state->memory[cond->index];
+        default:
+            return 0;
+    }
+}
+
+
+static int cond_holds(const DebugCond *cond, const State8080 *state) {
+    if (cond->operand == DEBUG_ALWAYS) {
+        return 1;
+    }
+    unsigned value = operand_value(cond, state);
+    switch (cond->compare) {
+        case DEBUG_EQ: return value == cond->value;
+        case DEBUG_NE: return value != cond->value;
+        case DEBUG_LT: return value < cond->value;
+        case DEBUG_LE: return value <= cond->value;
+        case DEBUG_GT: return value > cond->value;
+        case DEBUG_GE: return value >= cond->value;
+    }
+    return 0;
+}
+
+
+int debug_stop(Debugger *debug, const State8080 *state) {
+    if (debug->pending) {
+        debug->pending = 0;
+        return 1;
+    }
+
+    int stop = 0;
+    for (int i = 0; i < debug->break_count; i++) {
+        Breakpoint *bp = &debug->breaks[i];
+        if (bp->addr == state->pc && cond_holds(&bp->cond, state)) {
+            bp->hits++;
+            if (!stop) {
+                memset(&debug->hit, 0, sizeof(debug->hit));
+                debug->hit.index = i;
+                stop = 1;
+            }
+        }
+    }
+    return stop;
+}
+
+
+void debug_print_hit(const Debugger *debug, const State8080 *state) {
+    const DebugHit *hit = &debug->hit;
+    if (hit->kind == 0) {
+        const Breakpoint *bp = &debug->breaks[hit->index];
+        printf("Breakpoint %d at 0x%04x", hit->index, bp->addr);
+        if (bp->cond.operand != DEBUG_ALWAYS) {
+            if (bp->cond.operand == DEBUG_MEM) {
+                printf(" if [0x%04x]", bp->cond.index);
+            } else {
+                printf(" if %s", bp->cond.operand == DEBUG_REG8
+                    ? reg8_names[bp->cond.index] : reg16_names[bp->cond.index]);
+            }
+            printf("%s0x%x", compare_names[bp->cond.compare], bp->cond.value);
+        }
+        printf(", hit %" PRIu64 " time%s\n", bp->hits, bp->hits == 1 ? "" : "s");
+    } else if (hit->kind == DEBUG_WRITE) {
+        printf("Watchpoint %d: write to 0x%04x, 0x%02x -> 0x%02x\n",
+            hit->index, hit->addr, hit->old_value, hit->value);
+    } else {
+        printf("Watchpoint %d: read of 0x%04x, 0x%02x\n", hit->index, hit->addr, hit->value);
+    }
+
+    DisInstr instr;
+    char text[DIS_TEXT_MAX];
+    dis_decode(&state->memory[state->pc], state->pc, &instr);
+    dis_format(&instr, text);
+    printf("  A=%02x BC=%02x%02x DE=%02x%02x HL=%02x%02x SP=%04x F=%02x"
+        " cycle %" PRIu64 "\n  %04x %s\n",
+        state->a, state->b, state->c, state->d, state->e, state->h, state->l,
+        state->sp, flags_psw(state), state->cycles, state->pc, text);
+}
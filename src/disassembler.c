@@ -1,306 +1,569 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "disassembler.h"
+#include "memory.h"
+#include "rom.h"
 
+// the longest line dis_buffer_line writes
+#define DIS_LINE_MAX    (5 + DIS_TEXT_MAX + 1)
 
-int disassemble8080file(char* filename) {
-    FILE *f = fopen(filename, "rb");
-    if (f == NULL)
-    {
-        printf("Error: couldn't open %s\n", filename);
-        exit(1);
+// a row of DB data
+#define DATA_PER_LINE   8
+
+#define DIS_NAME(name)  #name,
+static const char *const mnemonic_names[DIS_MNEMONIC_COUNT] = {
+    DIS_MNEMONICS(DIS_NAME)
+};
+#undef DIS_NAME
+
+typedef struct dis_opcode_t {
+    DisMnemonic         mnemonic;
+    const char          *args;
+    DisOperand          kind;
+    uint8_t             flow;
+} DisOpcode;
+
+/*
+ * Every opcode, decoded ahead of time
+ * http://www.emulator101.com/reference/8080-by-opcode.html
+ */
+static const DisOpcode opcodes[256] = {
+    /* 00 */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* 01 */ { DIS_LXI,  "B",     DIS_D16,   0 },
+    /* 02 */ { DIS_STAX, "B",     DIS_NONE,  0 },
+    /* 03 */ { DIS_INX,  "B",     DIS_NONE,  0 },
+    /* 04 */ { DIS_INR,  "B",     DIS_NONE,  0 },
+    /* 05 */ { DIS_DCR,  "B",     DIS_NONE,  0 },
+    /* 06 */ { DIS_MVI,  "B",     DIS_D8,    0 },
+    /* 07 */ { DIS_RLC,  "",      DIS_NONE,  0 },
+    /* 08 */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* 09 */ { DIS_DAD,  "B",     DIS_NONE,  0 },
+    /* 0a */ { DIS_LDAX, "B",     DIS_NONE,  0 },
+    /* 0b */ { DIS_DCX,  "B",     DIS_NONE,  0 },
+    /* 0c */ { DIS_INR,  "C",     DIS_NONE,  0 },
+    /* 0d */ { DIS_DCR,  "C",     DIS_NONE,  0 },
+    /* 0e */ { DIS_MVI,  "C",     DIS_D8,    0 },
+    /* 0f */ { DIS_RRC,  "",      DIS_NONE,  0 },
+    /* 10 */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* 11 */ { DIS_LXI,  "D",     DIS_D16,   0 },
+    /* 12 */ { DIS_STAX, "D",     DIS_NONE,  0 },
+    /* 13 */ { DIS_INX,  "D",     DIS_NONE,  0 },
+    /* 14 */ { DIS_INR,  "D",     DIS_NONE,  0 },
+    /* 15 */ { DIS_DCR,  "D",     DIS_NONE,  0 },
+    /* 16 */ { DIS_MVI,  "D",     DIS_D8,    0 },
+    /* 17 */ { DIS_RAL,  "",      DIS_NONE,  0 },
+    /* 18 */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* 19 */ { DIS_DAD,  "D",     DIS_NONE,  0 },
+    /* 1a */ { DIS_LDAX, "D",     DIS_NONE,  0 },
+    /* 1b */ { DIS_DCX,  "D",     DIS_NONE,  0 },
+    /* 1c */ { DIS_INR,  "E",     DIS_NONE,  0 },
+    /* 1d */ { DIS_DCR,  "E",     DIS_NONE,  0 },
+    /* 1e */ { DIS_MVI,  "E",     DIS_D8,    0 },
+    /* 1f */ { DIS_RAR,  "",      DIS_NONE,  0 },
+    /* 20 */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* 21 */ { DIS_LXI,  "H",     DIS_D16,   0 },
+    /* 22 */ { DIS_SHLD, "",      DIS_ADDR,  0 },
+    /* 23 */ { DIS_INX,  "H",     DIS_NONE,  0 },
+    /* 24 */ { DIS_INR,  "H",     DIS_NONE,  0 },
+    /* 25 */ { DIS_DCR,  "H",     DIS_NONE,  0 },
+    /* 26 */ { DIS_MVI,  "H",     DIS_D8,    0 },
+    /* 27 */ { DIS_DAA,  "",      DIS_NONE,  0 },
+    /* 28 */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* 29 */ { DIS_DAD,  "H",     DIS_NONE,  0 },
+    /* 2a */ { DIS_LHLD, "",      DIS_ADDR,  0 },
+    /* 2b */ { DIS_DCX,  "H",     DIS_NONE,  0 },
+    /* 2c */ { DIS_INR,  "L",     DIS_NONE,  0 },
+    /* 2d */ { DIS_DCR,  "L",     DIS_NONE,  0 },
+    /* 2e */ { DIS_MVI,  "L",     DIS_D8,    0 },
+    /* 2f */ { DIS_CMA,  "",      DIS_NONE,  0 },
+    /* 30 */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* 31 */ { DIS_LXI,  "SP",    DIS_D16,   0 },
+    /* 32 */ { DIS_STA,  "",      DIS_ADDR,  0 },
+    /* 33 */ { DIS_INX,  "SP",    DIS_NONE,  0 },
+    /* 34 */ { DIS_INR,  "M",     DIS_NONE,  0 },
+    /* 35 */ { DIS_DCR,  "M",     DIS_NONE,  0 },
+    /* 36 */ { DIS_MVI,  "M",     DIS_D8,    0 },
+    /* 37 */ { DIS_STC,  "",      DIS_NONE,  0 },
+    /* 38 */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* 39 */ { DIS_DAD,  "SP",    DIS_NONE,  0 },
+    /* 3a */ { DIS_LDA,  "",      DIS_ADDR,  0 },
+    /* 3b */ { DIS_DCX,  "SP",    DIS_NONE,  0 },
+    /* 3c */ { DIS_INR,  "A",     DIS_NONE,  0 },
+    /* 3d */ { DIS_DCR,  "A",     DIS_NONE,  0 },
+    /* 3e */ { DIS_MVI,  "A",     DIS_D8,    0 },
+    /* 3f */ { DIS_CMC,  "",      DIS_NONE,  0 },
+    /* 40 */ { DIS_MOV,  "B,B",   DIS_NONE,  0 },
+    /* 41 */ { DIS_MOV,  "B,C",   DIS_NONE,  0 },
+    /* 42 */ { DIS_MOV,  "B,D",   DIS_NONE,  0 },
+    /* 43 */ { DIS_MOV,  "B,E",   DIS_NONE,  0 },
+    /* 44 */ { DIS_MOV,  "B,H",   DIS_NONE,  0 },
+    /* 45 */ { DIS_MOV,  "B,L",   DIS_NONE,  0 },
+    /* 46 */ { DIS_MOV,  "B,M",   DIS_NONE,  0 },
+    /* 47 */ { DIS_MOV,  "B,A",   DIS_NONE,  0 },
+    /* 48 */ { DIS_MOV,  "C,B",   DIS_NONE,  0 },
+    /* 49 */ { DIS_MOV,  "C,C",   DIS_NONE,  0 },
+    /* 4a */ { DIS_MOV,  "C,D",   DIS_NONE,  0 },
+    /* 4b */ { DIS_MOV,  "C,E",   DIS_NONE,  0 },
+    /* 4c */ { DIS_MOV,  "C,H",   DIS_NONE,  0 },
+    /* 4d */ { DIS_MOV,  "C,L",   DIS_NONE,  0 },
+    /* 4e */ { DIS_MOV,  "C,M",   DIS_NONE,  0 },
+    /* 4f */ { DIS_MOV,  "C,A",   DIS_NONE,  0 },
+    /* 50 */ { DIS_MOV,  "D,B",   DIS_NONE,  0 },
+    /* 51 */ { DIS_MOV,  "D,C",   DIS_NONE,  0 },
+    /* 52 */ { DIS_MOV,  "D,D",   DIS_NONE,  0 },
+    /* 53 */ { DIS_MOV,  "D,E",   DIS_NONE,  0 },
+    /* 54 */ { DIS_MOV,  "D,H",   DIS_NONE,  0 },
+    /* 55 */ { DIS_MOV,  "D,L",   DIS_NONE,  0 },
+    /* 56 */ { DIS_MOV,  "D,M",   DIS_NONE,  0 },
+    /* 57 */ { DIS_MOV,  "D,A",   DIS_NONE,  0 },
+    /* 58 */ { DIS_MOV,  "E,B",   DIS_NONE,  0 },
+    /* 59 */ { DIS_MOV,  "E,C",   DIS_NONE,  0 },
+    /* 5a */ { DIS_MOV,  "E,D",   DIS_NONE,  0 },
+    /* 5b */ { DIS_MOV,  "E,E",   DIS_NONE,  0 },
+    /* 5c */ { DIS_MOV,  "E,H",   DIS_NONE,  0 },
+    /* 5d */ { DIS_MOV,  "E,L",   DIS_NONE,  0 },
+    /* 5e */ { DIS_MOV,  "E,M",   DIS_NONE,  0 },
+    /* 5f */ { DIS_MOV,  "E,A",   DIS_NONE,  0 },
+    /* 60 */ { DIS_MOV,  "H,B",   DIS_NONE,  0 },
+    /* 61 */ { DIS_MOV,  "H,C",   DIS_NONE,  0 },
+    /* 62 */ { DIS_MOV,  "H,D",   DIS_NONE,  0 },
+    /* 63 */ { DIS_MOV,  "H,E",   DIS_NONE,  0 },
+    /* 64 */ { DIS_MOV,  "H,H",   DIS_NONE,  0 },
+    /* 65 */ { DIS_MOV,  "H,L",   DIS_NONE,  0 },
+    /* 66 */ { DIS_MOV,  "H,M",   DIS_NONE,  0 },
+    /* 67 */ { DIS_MOV,  "H,A",   DIS_NONE,  0 },
+    /* 68 */ { DIS_MOV,  "L,B",   DIS_NONE,  0 },
+    /* 69 */ { DIS_MOV,  "L,C",   DIS_NONE,  0 },
+    /* 6a */ { DIS_MOV,  "L,D",   DIS_NONE,  0 },
+    /* 6b */ { DIS_MOV,  "L,E",   DIS_NONE,  0 },
+    /* 6c */ { DIS_MOV,  "L,H",   DIS_NONE,  0 },
+    /* 6d */ { DIS_MOV,  "L,L",   DIS_NONE,  0 },
+    /* 6e */ { DIS_MOV,  "L,M",   DIS_NONE,  0 },
+    /* 6f */ { DIS_MOV,  "L,A",   DIS_NONE,  0 },
+    /* 70 */ { DIS_MOV,  "M,B",   DIS_NONE,  0 },
+    /* 71 */ { DIS_MOV,  "M,C",   DIS_NONE,  0 },
+    /* 72 */ { DIS_MOV,  "M,D",   DIS_NONE,  0 },
+    /* 73 */ { DIS_MOV,  "M,E",   DIS_NONE,  0 },
+    /* 74 */ { DIS_MOV,  "M,H",   DIS_NONE,  0 },
+    /* 75 */ { DIS_MOV,  "M,L",   DIS_NONE,  0 },
+    /* 76 */ { DIS_HLT,  "",      DIS_NONE,  0 },
+    /* 77 */ { DIS_MOV,  "M,A",   DIS_NONE,  0 },
+    /* 78 */ { DIS_MOV,  "A,B",   DIS_NONE,  0 },
+    /* 79 */ { DIS_MOV,  "A,C",   DIS_NONE,  0 },
+    /* 7a */ { DIS_MOV,  "A,D",   DIS_NONE,  0 },
+    /* 7b */ { DIS_MOV,  "A,E",   DIS_NONE,  0 },
+    /* 7c */ { DIS_MOV,  "A,H",   DIS_NONE,  0 },
+    /* 7d */ { DIS_MOV,  "A,L",   DIS_NONE,  0 },
+    /* 7e */ { DIS_MOV,  "A,M",   DIS_NONE,  0 },
+    /* 7f */ { DIS_MOV,  "A,A",   DIS_NONE,  0 },
+    /* 80 */ { DIS_ADD,  "B",     DIS_NONE,  0 },
+    /* 81 */ { DIS_ADD,  "C",     DIS_NONE,  0 },
+    /* 82 */ { DIS_ADD,  "D",     DIS_NONE,  0 },
+    /* 83 */ { DIS_ADD,  "E",     DIS_NONE,  0 },
+    /* 84 */ { DIS_ADD,  "H",     DIS_NONE,  0 },
+    /* 85 */ { DIS_ADD,  "L",     DIS_NONE,  0 },
+    /* 86 */ { DIS_ADD,  "M",     DIS_NONE,  0 },
+    /* 87 */ { DIS_ADD,  "A",     DIS_NONE,  0 },
+    /* 88 */ { DIS_ADC,  "B",     DIS_NONE,  0 },
+    /* 89 */ { DIS_ADC,  "C",     DIS_NONE,  0 },
+    /* 8a */ { DIS_ADC,  "D",     DIS_NONE,  0 },
+    /* 8b */ { DIS_ADC,  "E",     DIS_NONE,  0 },
+    /* 8c */ { DIS_ADC,  "H",     DIS_NONE,  0 },
+    /* 8d */ { DIS_ADC,  "L",     DIS_NONE,  0 },
+    /* 8e */ { DIS_ADC,  "M",     DIS_NONE,  0 },
+    /* 8f */ { DIS_ADC,  "A",     DIS_NONE,  0 },
+    /* 90 */ { DIS_SUB,  "B",     DIS_NONE,  0 },
+    /* 91 */ { DIS_SUB,  "C",     DIS_NONE,  0 },
+    /* 92 */ { DIS_SUB,  "D",     DIS_NONE,  0 },
+    /* 93 */ { DIS_SUB,  "E",     DIS_NONE,  0 },
+    /* 94 */ { DIS_SUB,  "H",     DIS_NONE,  0 },
+    /* 95 */ { DIS_SUB,  "L",     DIS_NONE,  0 },
+    /* 96 */ { DIS_SUB,  "M",     DIS_NONE,  0 },
+    /* 97 */ { DIS_SUB,  "A",     DIS_NONE,  0 },
+    /* 98 */ { DIS_SBB,  "B",     DIS_NONE,  0 },
+    /* 99 */ { DIS_SBB,  "C",     DIS_NONE,  0 },
+    /* 9a */ { DIS_SBB,  "D",     DIS_NONE,  0 },
+    /* 9b */ { DIS_SBB,  "E",     DIS_NONE,  0 },
+    /* 9c */ { DIS_SBB,  "H",     DIS_NONE,  0 },
+    /* 9d */ { DIS_SBB,  "L",     DIS_NONE,  0 },
+    /* 9e */ { DIS_SBB,  "M",     DIS_NONE,  0 },
+    /* 9f */ { DIS_SBB,  "A",     DIS_NONE,  0 },
+    /* a0 */ { DIS_ANA,  "B",     DIS_NONE,  0 },
+    /* a1 */ { DIS_ANA,  "C",     DIS_NONE,  0 },
+    /* a2 */ { DIS_ANA,  "D",     DIS_NONE,  0 },
+    /* a3 */ { DIS_ANA,  "E",     DIS_NONE,  0 },
+    /* a4 */ { DIS_ANA,  "H",     DIS_NONE,  0 },
+    /* a5 */ { DIS_ANA,  "L",     DIS_NONE,  0 },
+    /* a6 */ { DIS_ANA,  "M",     DIS_NONE,  0 },
+    /* a7 */ { DIS_ANA,  "A",     DIS_NONE,  0 },
+    /* a8 */ { DIS_XRA,  "B",     DIS_NONE,  0 },
+    /* a9 */ { DIS_XRA,  "C",     DIS_NONE,  0 },
+    /* aa */ { DIS_XRA,  "D",     DIS_NONE,  0 },
+    /* ab */ { DIS_XRA,  "E",     DIS_NONE,  0 },
+    /* ac */ { DIS_XRA,  "H",     DIS_NONE,  0 },
+    /* ad */ { DIS_XRA,  "L",     DIS_NONE,  0 },
+    /* ae */ { DIS_XRA,  "M",     DIS_NONE,  0 },
+    /* af */ { DIS_XRA,  "A",     DIS_NONE,  0 },
+    /* b0 */ { DIS_ORA,  "B",     DIS_NONE,  0 },
+    /* b1 */ { DIS_ORA,  "C",     DIS_NONE,  0 },
+    /* b2 */ { DIS_ORA,  "D",     DIS_NONE,  0 },
+    /* b3 */ { DIS_ORA,  "E",     DIS_NONE,  0 },
+    /* b4 */ { DIS_ORA,  "H",     DIS_NONE,  0 },
+    /* b5 */ { DIS_ORA,  "L",     DIS_NONE,  0 },
+    /* b6 */ { DIS_ORA,  "M",     DIS_NONE,  0 },
+    /* b7 */ { DIS_ORA,  "A",     DIS_NONE,  0 },
+    /* b8 */ { DIS_CMP,  "B",     DIS_NONE,  0 },
+    /* b9 */ { DIS_CMP,  "C",     DIS_NONE,  0 },
+    /* ba */ { DIS_CMP,  "D",     DIS_NONE,  0 },
+    /* bb */ { DIS_CMP,  "E",     DIS_NONE,  0 },
+    /* bc */ { DIS_CMP,  "H",     DIS_NONE,  0 },
+    /* bd */ { DIS_CMP,  "L",     DIS_NONE,  0 },
+    /* be */ { DIS_CMP,  "M",     DIS_NONE,  0 },
+    /* bf */ { DIS_CMP,  "A",     DIS_NONE,  0 },
+    /* c0 */ { DIS_RNZ,  "",      DIS_NONE,  DIS_FLOW_RETURN | DIS_FLOW_COND },
+    /* c1 */ { DIS_POP,  "B",     DIS_NONE,  0 },
+    /* c2 */ { DIS_JNZ,  "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_COND },
+    /* c3 */ { DIS_JMP,  "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_END },
+    /* c4 */ { DIS_CNZ,  "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_CALL | DIS_FLOW_COND },
+    /* c5 */ { DIS_PUSH, "B",     DIS_NONE,  0 },
+    /* c6 */ { DIS_ADI,  "",      DIS_D8,    0 },
+    /* c7 */ { DIS_RST,  "0",     DIS_NONE,  DIS_FLOW_JUMP | DIS_FLOW_CALL },
+    /* c8 */ { DIS_RZ,   "",      DIS_NONE,  DIS_FLOW_RETURN | DIS_FLOW_COND },
+    /* c9 */ { DIS_RET,  "",      DIS_NONE,  DIS_FLOW_RETURN | DIS_FLOW_END },
+    /* ca */ { DIS_JZ,   "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_COND },
+    /* cb */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* cc */ { DIS_CZ,   "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_CALL | DIS_FLOW_COND },
+    /* cd */ { DIS_CALL, "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_CALL },
+    /* ce */ { DIS_ACI,  "",      DIS_D8,    0 },
+    /* cf */ { DIS_RST,  "1",     DIS_NONE,  DIS_FLOW_JUMP | DIS_FLOW_CALL },
+    /* d0 */ { DIS_RNC,  "",      DIS_NONE,  DIS_FLOW_RETURN | DIS_FLOW_COND },
+    /* d1 */ { DIS_POP,  "D",     DIS_NONE,  0 },
+    /* d2 */ { DIS_JNC,  "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_COND },
+    /* d3 */ { DIS_OUT,  "",      DIS_D8,    0 },
+    /* d4 */ { DIS_CNC,  "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_CALL | DIS_FLOW_COND },
+    /* d5 */ { DIS_PUSH, "D",     DIS_NONE,  0 },
+    /* d6 */ { DIS_SUI,  "",      DIS_D8,    0 },
+    /* d7 */ { DIS_RST,  "2",     DIS_NONE,  DIS_FLOW_JUMP | DIS_FLOW_CALL },
+    /* d8 */ { DIS_RC,   "",      DIS_NONE,  DIS_FLOW_RETURN | DIS_FLOW_COND },
+    /* d9 */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* da */ { DIS_JC,   "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_COND },
+    /* db */ { DIS_IN,   "",      DIS_D8,    0 },
+    /* dc */ { DIS_CC,   "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_CALL | DIS_FLOW_COND },
+    /* dd */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* de */ { DIS_SBI,  "",      DIS_D8,    0 },
+    /* df */ { DIS_RST,  "3",     DIS_NONE,  DIS_FLOW_JUMP | DIS_FLOW_CALL },
+    /* e0 */ { DIS_RPO,  "",      DIS_NONE,  DIS_FLOW_RETURN | DIS_FLOW_COND },
+    /* e1 */ { DIS_POP,  "H",     DIS_NONE,  0 },
+    /* e2 */ { DIS_JPO,  "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_COND },
+    /* e3 */ { DIS_XTHL, "",      DIS_NONE,  0 },
+    /* e4 */ { DIS_CPO,  "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_CALL | DIS_FLOW_COND },
+    /* e5 */ { DIS_PUSH, "H",     DIS_NONE,  0 },
+    /* e6 */ { DIS_ANI,  "",      DIS_D8,    0 },
+    /* e7 */ { DIS_RST,  "4",     DIS_NONE,  DIS_FLOW_JUMP | DIS_FLOW_CALL },
+    /* e8 */ { DIS_RPE,  "",      DIS_NONE,  DIS_FLOW_RETURN | DIS_FLOW_COND },
+    /* e9 */ { DIS_PCHL, "",      DIS_NONE,  DIS_FLOW_END },
+    /* ea */ { DIS_JPE,  "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_COND },
+    /* eb */ { DIS_XCHG, "",      DIS_NONE,  0 },
+    /* ec */ { DIS_CPE,  "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_CALL | DIS_FLOW_COND },
+    /* ed */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* ee */ { DIS_XRI,  "",      DIS_D8,    0 },
+    /* ef */ { DIS_RST,  "5",     DIS_NONE,  DIS_FLOW_JUMP | DIS_FLOW_CALL },
+    /* f0 */ { DIS_RP,   "",      DIS_NONE,  DIS_FLOW_RETURN | DIS_FLOW_COND },
+    /* f1 */ { DIS_POP,  "PSW",   DIS_NONE,  0 },
+    /* f2 */ { DIS_JP,   "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_COND },
+    /* f3 */ { DIS_DI,   "",      DIS_NONE,  0 },
+    /* f4 */ { DIS_CP,   "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_CALL | DIS_FLOW_COND },
+    /* f5 */ { DIS_PUSH, "PSW",   DIS_NONE,  0 },
+    /* f6 */ { DIS_ORI,  "",      DIS_D8,    0 },
+    /* f7 */ { DIS_RST,  "6",     DIS_NONE,  DIS_FLOW_JUMP | DIS_FLOW_CALL },
+    /* f8 */ { DIS_RM,   "",      DIS_NONE,  DIS_FLOW_RETURN | DIS_FLOW_COND },
+    /* f9 */ { DIS_SPHL, "",      DIS_NONE,  0 },
+    /* fa */ { DIS_JM,   "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_COND },
+    /* fb */ { DIS_EI,   "",      DIS_NONE,  0 },
+    /* fc */ { DIS_CM,   "",      DIS_ADDR,  DIS_FLOW_JUMP | DIS_FLOW_CALL | DIS_FLOW_COND },
+    /* fd */ { DIS_NOP,  "",      DIS_NONE,  0 },
+    /* fe */ { DIS_CPI,  "",      DIS_D8,    0 },
+    /* ff */ { DIS_RST,  "7",     DIS_NONE,  DIS_FLOW_JUMP | DIS_FLOW_CALL },
+};
+
+static const uint8_t operand_length[] = {
+    [DIS_NONE] = 0, [DIS_D8] = 1, [DIS_D16] = 2, [DIS_ADDR] = 2,
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+
+int dis_decode(const uint8_t *bytes, uint16_t pc, DisInstr *instr) {
+    const DisOpcode *opcode = &opcodes[bytes[0]];
+    instr->pc = pc;
+    instr->op = bytes[0];
+    instr->len = 1 + operand_length[opcode->kind];
+    instr->mnemonic = opcode->mnemonic;
+    instr->args = opcode->args;
+    instr->kind = opcode->kind;
+    instr->operand = opcode->kind == DIS_D8 ? bytes[1] : (bytes[2] << 8) | bytes[1];
+    instr->flow = opcode->flow;
+    // RST n calls n * 8
+    instr->target = opcode->mnemonic == DIS_RST ? bytes[0] & 0x38 : instr->operand;
+    return instr->len;
+}
+
+
+const char* dis_mnemonic_name(DisMnemonic mnemonic) {
+    return mnemonic < DIS_MNEMONIC_COUNT ? mnemonic_names[mnemonic] : "???";
+}
+
+
+char* dis_put_hex(char *text, unsigned value, int digits) {
+    for (int i = digits - 1; i >= 0; i--) {
+        text[i] = hex_digits[value & 0xf];
+        value >>= 4;
+    }
+    return text + digits;
+}
+
+
+int dis_format(const DisInstr *instr, char *text) {
+    char *end = text;
+    for (const char *c = mnemonic_names[instr->mnemonic]; *c; c++) {
+        *end++ = *c;
+    }
+
+    if (instr->args[0] || instr->kind != DIS_NONE) {
+        // operands go in a column
+        while (end < text + 7) {
+            *end++ = ' ';
+        }
+        for (const char *c = instr->args; *c; c++) {
+            *end++ = *c;
+        }
+        if (instr->args[0] && instr->kind != DIS_NONE) {
+            *end++ = ',';
+        }
+        if (instr->kind == DIS_D8 || instr->kind == DIS_D16) {
+            *end++ = '#';
+        }
+        if (instr->kind != DIS_NONE) {
+            *end++ = '$';
+            end = dis_put_hex(end, instr->operand, instr->kind == DIS_D8 ? 2 : 4);
+        }
+    }
+    *end = '\0';
+    return end - text;
+}
+
+
+/*
+ * Makes room for `len` more bytes. Returns 0 on
+ * success and -1 if out of memory.
+ */
+static int reserve(DisBuffer *out, size_t len) {
+    if (out->len + len <= out->capacity) {
+        return 0;
+    }
+    size_t bigger = out->capacity ? 2 * out->capacity : 64 * 1024;
+    while (bigger < out->len + len) {
+        bigger *= 2;
+    }
+    char *grown = realloc(out->text, bigger);
+    if (grown == NULL) {
+        return -1;
+    }
+    out->text = grown;
+    out->capacity = bigger;
+    return 0;
+}
+
+
+int dis_buffer_append(DisBuffer *out, const char *text, size_t len) {
+    if (reserve(out, len) < 0) {
+        return -1;
+    }
+    memcpy(out->text + out->len, text, len);
+    out->len += len;
+    return 0;
+}
+
+
+int dis_buffer_line(DisBuffer *out, const DisInstr *instr) {
+    if (reserve(out, DIS_LINE_MAX) < 0) {
+        return -1;
     }
+    char *line = out->text + out->len;
+    char *end = dis_put_hex(line, instr->pc, 4);
+    *end++ = ' ';
+    end += dis_format(instr, end);
+    *end++ = '\n';
+    out->len = end - out->text;
+    return 0;
+}
+
+
+int dis_buffer_flush(DisBuffer *out, FILE *f) {
+    size_t len = out->len;
+    out->len = 0;
+    return len && fwrite(out->text, 1, len, f) != len ? -1 : 0;
+}
 
-    // get the file size and read it into a memory buffer
-    fseek(f, 0L, SEEK_END);
-    int fsize = ftell(f);
-    fseek(f, 0L, SEEK_SET);
 
-    unsigned char *buffer = malloc(fsize);
+void dis_buffer_free(DisBuffer *out) {
+    free(out->text);
+    memset(out, 0, sizeof(*out));
+}
 
-    fread(buffer, fsize, 1, f);
-    fclose(f);
 
-    int pc = 0;
+int dis_trace_flow(const uint8_t *code, size_t size,
+        const uint16_t *entries, int count, uint8_t *marks) {
+    memset(marks, 0, size);
 
-    while (pc < fsize) {
-        pc += disassemble8080op(buffer, pc);
+    // every instruction pushes at most one target, so
+    // the work list never holds more than this
+    uint16_t *todo = malloc((size + count) * sizeof(uint16_t));
+    if (todo == NULL) {
+        return -1;
+    }
+    size_t pending = 0;
+    for (int i = 0; i < count; i++) {
+        todo[pending++] = entries[i];
     }
 
-    free(buffer);
+    while (pending) {
+        size_t pc = todo[--pending];
+        // run on until something already seen, leaving
+        // code that jumps into an operand to be data
+        while (pc < size && marks[pc] == 0) {
+            DisInstr instr;
+            int len = dis_decode(code + pc, pc, &instr);
+            if (pc + len > size) {
+                break;
+            }
+            marks[pc] = DIS_MARK_OPCODE;
+            for (int i = 1; i < len; i++) {
+                marks[pc + i] = DIS_MARK_OPERAND;
+            }
 
+            if ((instr.flow & DIS_FLOW_JUMP) && instr.target < size
+                    && marks[instr.target] == 0) {
+                todo[pending++] = instr.target;
+            }
+            if (instr.flow & DIS_FLOW_END) {
+                break;
+            }
+            pc += len;
+        }
+    }
+
+    free(todo);
     return 0;
 }
 
 
 /*
- * Prints out the mnemonic
- * Returns the size of the operation in bytes
- * http://www.emulator101.com/reference/8080-by-opcode.html
+ * Appends "<address> DB     $xx,$xx..." for `count`
+ * (at most DATA_PER_LINE) bytes
  */
-int disassemble8080op(unsigned char *codebuffer, int pc) {
-    unsigned char *code = &codebuffer[pc]; // pointer to the pc-th element in the codebuffer array
-    int opbytes = 1;  // size of operation to be returned
-    printf("%04x ", pc); // formatted as hexadecimal integer
-
-    switch(*code) {
-        case 0x00: printf("NOP"); break;    
-        case 0x01: printf("LXI    B,#$%02x%02x", code[2], code[1]); opbytes = 3; break;    
-        case 0x02: printf("STAX   B"); break;    
-        case 0x03: printf("INX    B"); break;    
-        case 0x04: printf("INR    B"); break;    
-        case 0x05: printf("DCR    B"); break;    
-        case 0x06: printf("MVI    B,#$%02x", code[1]); opbytes = 2; break;    
-        case 0x07: printf("RLC"); break;    
-        case 0x08: printf("NOP"); break;    
-        case 0x09: printf("DAD    B"); break;
-        case 0x0a: printf("LDAX   B"); break;
-        case 0x0b: printf("DCX    B"); break;
-        case 0x0c: printf("INR    C"); break;
-        case 0x0d: printf("DCR    C"); break;
-        case 0x0e: printf("MVI    C,#$%02x", code[1]); opbytes = 2; break;
-        case 0x0f: printf("RRC"); break;
-        case 0x10: printf("NOP"); break;    
-        case 0x11: printf("LXI    D, #$%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x12: printf("STAX   D"); break;
-        case 0x13: printf("INX    D"); break;
-        case 0x14: printf("INR    D"); break;
-        case 0x15: printf("DCR    D"); break;
-        case 0x16: printf("MVI    D,#$%02x", code[1]); opbytes = 2; break;
-        case 0x17: printf("RAL"); break;
-        case 0x18: printf("NOP"); break;
-        case 0x19: printf("DAD    D"); break;
-        case 0x1a: printf("LDAX   D"); break;
-        case 0x1b: printf("DCX    D"); break;
-        case 0x1c: printf("INR    E"); break;
-        case 0x1d: printf("DCR    E"); break;
-        case 0x1f: printf("RAR"); break;
-        case 0x20: printf("RIM"); break;
-        case 0x21: printf("LXI    H,#$%02x%02x", code[2], code[1]); opbytes = 3; break;  
-        case 0x22: printf("SHLD   $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x23: printf("INX    H"); break;
-        case 0x24: printf("INR    H"); break;
-        case 0x25: printf("DCR    H"); break;
-        case 0x26: printf("MVI    H,#$%02x", code[1]); break;
-        case 0x27: printf("DAA"); break;
-        case 0x28: printf("NOP"); break;
-        case 0x29: printf("DAD    H"); break;
-        case 0x2a: printf("LHLD   $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x2b: printf("DCX    H"); break;
-        case 0x2c: printf("INR    L"); break;
-        case 0x2d: printf("DCR    L"); break;
-        case 0x2e: printf("MVI    L,#$%02x", code[1]); opbytes = 2; break;
-        case 0x2f: printf("CMA"); break;
-        case 0x30: printf("SIM"); break;
-        case 0x31: printf("LXI    SP, #$%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x32: printf("STA    $%02x%02x", code[2], code[1]); opbytes = 3; break;    
-        case 0x33: printf("INX    SP"); break;
-        case 0x34: printf("INR    M"); break;
-        case 0x35: printf("DCR    M"); break;
-        case 0x36: printf("MVI    M,#$%02x", code[1]); opbytes = 2; break;
-        case 0x37: printf("STC"); break;
-        case 0x38: printf("NOP"); break;
-        case 0x39: printf("DAD    SP"); break;
-        case 0x3a: printf("LDA    $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x3b: printf("DCX    SP"); break;
-        case 0x3c: printf("INR    A"); break;
-        case 0x3d: printf("DCR    A"); break;
-        case 0x3e: printf("MVI    A,#0x%02x", code[1]); opbytes = 2; break;
-        case 0x3f: printf("CMC"); break;
-        case 0x40: printf("MOV    B,B"); break;
-        case 0x41: printf("MOV    B,C"); break;
-        case 0x42: printf("MOV    B,D"); break;
-        case 0x43: printf("MOV    B,E"); break;
-        case 0x44: printf("MOV    B,H"); break;
-        case 0x45: printf("MOV    B,L"); break;
-        case 0x46: printf("MOV    B,M"); break;
-        case 0x47: printf("MOV    B,A"); break;
-        case 0x48: printf("MOV    C,B"); break;
-        case 0x49: printf("MOV    C,C"); break;
-        case 0x4a: printf("MOV    C,D"); break;
-        case 0x4b: printf("MOV    C,E"); break;
-        case 0x4c: printf("MOV    C,H"); break;
-        case 0x4d: printf("MOV    C,L"); break;
-        case 0x4e: printf("MOV    C,M"); break;
-        case 0x4f: printf("MOV    C,A"); break;
-        case 0x50: printf("MOV    D,B"); break;
-        case 0x51: printf("MOV    D,C"); break;
-        case 0x52: printf("MOV    D,D"); break;
-        case 0x53: printf("MOV    D,E"); break;
-        case 0x54: printf("MOV    D,H"); break;
-        case 0x55: printf("MOV    D,L"); break;
-        case 0x56: printf("MOV    D,M"); break;
-        case 0x57: printf("MOV    D,A"); break;
-        case 0x58: printf("MOV    E,B"); break;
-        case 0x59: printf("MOV    E,C"); break;
-        case 0x5a: printf("MOV    E,D"); break;
-        case 0x5b: printf("MOV    E,E"); break;
-        case 0x5c: printf("MOV    E,H"); break;
-        case 0x5d: printf("MOV    E,L"); break;
-        case 0x5e: printf("MOV    E,M"); break;
-        case 0x5f: printf("MOV    E,A"); break;
-        case 0x60: printf("MOV    H,B"); break;
-        case 0x61: printf("MOV    H,C"); break;
-        case 0x62: printf("MOV    H,D"); break;
-        case 0x63: printf("MOV    H,E"); break;
-        case 0x64: printf("MOV    H,H"); break;
-        case 0x65: printf("MOV    H,L"); break;
-        case 0x66: printf("MOV    H,M"); break;
-        case 0x67: printf("MOV    H,A"); break;
-        case 0x68: printf("MOV    L,B"); break;
-        case 0x69: printf("MOV    L,C"); break;
-        case 0x6a: printf("MOV    L,D"); break;
-        case 0x6b: printf("MOV    L,E"); break;
-        case 0x6c: printf("MOV    L,H"); break;
-        case 0x6d: printf("MOV    L,L"); break;
-        case 0x6e: printf("MOV    L,M"); break;
-        case 0x6f: printf("MOV    L,A"); break;
-        case 0x70: printf("MOV    M,B"); break;
-        case 0x71: printf("MOV    M,C"); break;
-        case 0x72: printf("MOV    M,D"); break;
-        case 0x73: printf("MOV    M,E"); break;
-        case 0x74: printf("MOV    M,H"); break;
-        case 0x75: printf("MOV    M,L"); break;
-        case 0x76: printf("HLT"); break;
-        case 0x77: printf("MOV    M,A"); break;
-        case 0x78: printf("MOV    A,B"); break;
-        case 0x79: printf("MOV    A,C"); break;
-        case 0x7a: printf("MOV    A,D"); break;
-        case 0x7b: printf("MOV    A,E"); break;
-        case 0x7c: printf("MOV    A,H"); break;
-        case 0x7d: printf("MOV    A,L"); break;
-        case 0x7e: printf("MOV    A,M"); break;
-        case 0x7f: printf("MOV    A,A"); break;
-        case 0x80: printf("ADD    B"); break;  // A <- A + B
-        case 0x81: printf("ADD    C"); break;
-        case 0x82: printf("ADD    D"); break;
-        case 0x83: printf("ADD    E"); break;
-        case 0x84: printf("ADD    H"); break;
-        case 0x85: printf("ADD    L"); break;
-        case 0x86: printf("ADD    M"); break;
-        case 0x87: printf("ADD    A"); break;
-        case 0x88: printf("ADC    B"); break;
-        case 0x89: printf("ADC    C"); break;
-        case 0x8a: printf("ADC    D"); break;
-        case 0x8b: printf("ADC    E"); break;
-        case 0x8c: printf("ADC    H"); break;
-        case 0x8d: printf("ADC    L"); break;
-        case 0x8e: printf("ADC    M"); break;
-        case 0x8f: printf("ADC    A"); break;
-        case 0x90: printf("SUB    B"); break;
-        case 0x91: printf("SUB    C"); break;
-        case 0x92: printf("SUB    D"); break;
-        case 0x93: printf("SUB    E"); break;
-        case 0x94: printf("SUB    H"); break;
-        case 0x95: printf("SUB    L"); break;
-        case 0x96: printf("SUB    M"); break;
-        case 0x97: printf("SUB    A"); break;
-        case 0x98: printf("SBB    B"); break;
-        case 0x99: printf("SBB    C"); break;
-        case 0x9a: printf("SBB    D"); break;
-        case 0x9b: printf("SBB    E"); break;
-        case 0x9c: printf("SBB    H"); break;
-        case 0x9d: printf("SBB    L"); break;
-        case 0x9e: printf("SBB    M"); break;
-        case 0x9f: printf("SBB    A"); break;
-        case 0xa0: printf("ANA    B"); break;  // A <- A & B
-        case 0xa1: printf("ANA    C"); break;
-        case 0xa2: printf("ANA    D"); break;
-        case 0xa3: printf("ANA    E"); break;
-        case 0xa4: printf("ANA    H"); break;
-        case 0xa5: printf("ANA    L"); break;
-        case 0xa6: printf("ANA    M"); break;
-        case 0xa7: printf("ANA    A"); break;
-        case 0xa8: printf("XRA    B"); break;
-        case 0xa9: printf("XRA    C"); break;
-        case 0xaa: printf("XRA    D"); break;
-        case 0xab: printf("XRA    E"); break;
-        case 0xac: printf("XRA    H"); break;
-        case 0xad: printf("XRA    L"); break;
-        case 0xae: printf("XRA    M"); break;
-        case 0xaf: printf("XRA    A"); break;
-        case 0xb0: printf("ORA    B"); break;  
-        case 0xb1: printf("ORA    C"); break;
-        case 0xb2: printf("ORA    D"); break;
-        case 0xb3: printf("ORA    E"); break;
-        case 0xb4: printf("ORA    H"); break;
-        case 0xb5: printf("ORA    L"); break;
-        case 0xb6: printf("ORA    M"); break;
-        case 0xb7: printf("ORA    A"); break;
-        case 0xb8: printf("CMP    B"); break;
-        case 0xb9: printf("CMP    C"); break;
-        case 0xba: printf("CMP    D"); break;
-        case 0xbb: printf("CMP    E"); break;
-        case 0xbc: printf("CMP    H"); break;
-        case 0xbd: printf("CMP    L"); break;
-        case 0xbe: printf("CMP    M"); break;
-        case 0xbf: printf("CMP    A"); break;
-        case 0xc0: printf("RNZ"); break;
-        case 0xc1: printf("POP    B"); break;
-        case 0xc2: printf("JNZ    $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xc3: printf("JMP    $%02x%02x", code[2], code[1]); opbytes = 3; break;    
-        case 0xc4: printf("CNZ    $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xc5: printf("PUSH   B"); break;
-        case 0xc6: printf("ADI    #$%02x", code[1]); opbytes = 2; break; 
-        case 0xc7: printf("REST   0"); break;
-        case 0xc8: printf("RZ "); break;
-        case 0xc9: printf("RET"); break;
-        case 0xca: printf("JZ     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xcb: printf("NOP"); break;
-        case 0xcc: printf("CZ     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xcd: printf("CALL   $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xcf: printf("RST    1"); break;
-        case 0xd0: printf("RNC"); break;
-        case 0xd1: printf("POP    D"); break;
-        case 0xd2: printf("JNC    $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xd3: printf("OUT    #$%02x", code[1]); opbytes = 2; break;
-        case 0xd4: printf("CNC    $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xd5: printf("PUSH   D"); break;
-        case 0xd6: printf("SUI    #$%02x", code[1]); opbytes = 2; break;
-        case 0xd7: printf("RST    2"); break;
-        case 0xd8: printf("RC "); break;
-        case 0xd9: printf("NOP"); break;
-        case 0xda: printf("JC     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xdb: printf("IN     #$%02x", code[1]); opbytes = 2; break;
-        case 0xdc: printf("CC     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xdd: printf("NOP"); break;
-        case 0xde: printf("SBI    #$%02x", code[1]); opbytes = 2; break;
-        case 0xdf: printf("RST    3"); break;
-        case 0xe0: printf("RPO"); break;
-        case 0xe1: printf("POP    H"); break;
-        case 0xe2: printf("JPO    $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xe3: printf("XTHL   "); break;
-        case 0xe4: printf("CPO    $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xe5: printf("PUSH   H"); break;
-        case 0xe6: printf("ANI    #$%02x", code[1]); opbytes = 2;
-        case 0xe7: printf("RST    4"); break;
-        case 0xe8: printf("RPE"); break;
-        case 0xe9: printf("PCHL   "); break;
-        case 0xea: printf("JPE    $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xeb: printf("XCHG   "); break;
-        case 0xec: printf("CPE    $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xed: printf("NOP"); break;
-        case 0xef: printf("RST    5"); break;
-        case 0xf0: printf("RP "); break;
-        case 0xf1: printf("POP    PSW"); break;
-        case 0xf2: printf("JP     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xf3: printf("DI "); break;
-        case 0xf4: printf("CP     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xf5: printf("PUSH   PSW"); break;
-        case 0xf6: printf("ORI    #$%02x", code[1]); opbytes = 2; break;
-        case 0xf7: printf("RST    6"); break;
-        case 0xf8: printf("RM "); break;
-        case 0xf9: printf("SPHL   "); break;
-        case 0xfa: printf("JM     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xfb: printf("EI "); break;
-        case 0xfc: printf("CM     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xfd: printf("NOP"); break;
-        case 0xfe: printf("CPI    #$%02x", code[1]); opbytes = 2; break;
-        case 0xff: printf("RST    7"); break;
+static int data_line(DisBuffer *out, const uint8_t *bytes, size_t addr, size_t count) {
+    char line[5 + 7 + 4 * DATA_PER_LINE];
+    char *end = dis_put_hex(line, addr, 4);
+    memcpy(end, " DB     ", 8);
+    end += 8;
+    for (size_t i = 0; i < count; i++) {
+        if (i) {
+            *end++ = ',';
+        }
+        *end++ = '$';
+        end = dis_put_hex(end, bytes[i], 2);
+    }
+    *end++ = '\n';
+    return dis_buffer_append(out, line, end - line);
+}
+
+
+int dis_list(const uint8_t *code, size_t size, const uint8_t *marks, DisBuffer *out) {
+    size_t pc = 0;
+    while (pc < size) {
+        if (marks == NULL || marks[pc] == DIS_MARK_OPCODE) {
+            DisInstr instr;
+            pc += dis_decode(code + pc, pc, &instr);
+            if (dis_buffer_line(out, &instr) < 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        size_t count = 0;
+        while (pc + count < size && count < DATA_PER_LINE
+                && marks[pc + count] != DIS_MARK_OPCODE) {
+            count++;
+        }
+        if (data_line(out, code + pc, pc, count) < 0) {
+            return -1;
+        }
+        pc += count;
     }
+    return 0;
+}
+
 
-    printf("\n");
-    return opbytes;
+int disassemble8080op(unsigned char *codebuffer, int pc) {
+    DisInstr instr;
+    char text[DIS_TEXT_MAX];
+    dis_decode(codebuffer + pc, pc, &instr);
+    dis_format(&instr, text);
+    printf("%04x %s\n", pc, text);
+    return instr.len;
 }
 
+
+int disassemble8080file(const char *filename, int recursive,
+        const uint16_t *entries, int count) {
+    // the reset and the two interrupts Space Invaders takes
+    static const uint16_t vectors[] = { 0x0000, 0x0008, 0x0010 };
+
+    size_t mapped;
+    const uint8_t *buffer = rom_map_file(filename, &mapped);
+    if (buffer == NULL) {
+        return 1;
+    }
+    size_t fsize = mapped;
+    if (fsize > MEM_SIZE) {
+        fprintf(stderr, "Warning: %s is over 64K; listing the first 64K\n", filename);
+        fsize = MEM_SIZE;
+    }
+
+    // work on a copy with a little slack, so the
+    // operands of a truncated last instruction read 0
+    uint8_t *code = calloc(fsize + MEM_GUARD, 1);
+    uint8_t *marks = recursive ? malloc(fsize ? fsize : 1) : NULL;
+    if (code == NULL || (recursive && marks == NULL)) {
+        free(code);
+        free(marks);
+        rom_unmap_file(buffer, mapped);
+        return 1;
+    }
+    memcpy(code, buffer, fsize);
+    rom_unmap_file(buffer, mapped);
+
+    if (recursive && count == 0) {
+        entries = vectors;
+        count = sizeof(vectors) / sizeof(vectors[0]);
+    }
+
+    DisBuffer out;
+    memset(&out, 0, sizeof(out));
+    int status = 0;
+    if ((recursive && dis_trace_flow(code, fsize, entries, count, marks) < 0)
+            || dis_list(code, fsize, marks, &out) < 0) {
+        fprintf(stderr, "Error: out of memory\n");
+        status = 1;
+    } else if (dis_buffer_flush(&out, stdout) < 0) {
+        status = 1;
+    }
+
+    dis_buffer_free(&out);
+    free(marks);
+    free(code);
+    return status;
+}
@@ -1,27 +1,27 @@
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "block.h"
 #include "core.h"
+#include "debugger.h"
+#include "disassembler.h"
 #include "emu.h"
-
-State8080* state_alloc(size_t mem_size) {
-    State8080 *state = malloc(sizeof(*state));
-    state->memory = (uint8_t*) calloc(mem_size, sizeof(uint8_t));
-    return state;
-}
-
-void state_free(State8080 *state) {
-    if (state) {
-        if (state->memory) {
-            free(state->memory);
-            state->memory = NULL;
-        }
-        free(state);
-        state = NULL;
-    }
-}
-
+#include "io.h"
+#include "jit.h"
+#include "memory.h"
+#include "movie.h"
+#include "pacer.h"
+#include "sound.h"
+#include "profile.h"
+#include "rewind.h"
+#include "rom.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "video.h"
 
 #define MAX_STEPS 100000
 
@@ -33,89 +33,546 @@ size_t get_num_instrs(char *input) {
     if (strlen(input) == 1) {
         return 1;
     }
-    // If the string starts with an 
-    // alphanumeric character or only 
+    // If the string starts with an
+    // alphanumeric character or only
     // contains alphanumeric characters,
     // 0 is returned.
-    size_t steps = (size_t) atoi(input); 
-    return steps < MAX_STEPS ? steps : MAX_STEPS; 
+    size_t steps = (size_t) atoi(input);
+    return steps < MAX_STEPS ? steps : MAX_STEPS;
 }
 
 
-int load_and_run(char *filename) {
-    FILE *f = fopen(filename, "rb");
-    if (f == NULL)
-    {
-        printf("Error: couldn't open %s\n", filename);
-        exit(1);
+int emu_load(State8080 *state, const RomImage *rom) {
+    // declare ConditionCodes struct with every
+    // flag clear (bit 1 of the PSW is always set)
+    ConditionCodes cc;
+    cc.psw = FLAG_ONE;
+
+    state->a = 0;
+    state->b = 0;
+    state->c = 0;
+    state->d = 0;
+    state->e = 0;
+    state->h = 0;
+    state->l = 0;
+
+    state->sp = 0;
+    state->pc = 0;
+    state->int_enable = 0;
+    state->halted = 0;
+    state->int_pending = 0;
+    state->int_rst = 0;
+    state->ei_shadow = 0;
+    state->cycles = 0;
+    state->instructions = 0;
+    state->debug = NULL;
+    state->tracer = NULL;
+    state->profile = NULL;
+    state->engine = ENGINE_DEFAULT;
+    state->blocks = NULL;
+
+    state->cc = cc;
+    state->lazy_result = 0;
+    state->lazy_mask = 0;
+    state->lazy_aux = 0;
+
+    // 16-bit addresses cover the full 64 KiB
+    state->memory = rom_image_map(rom);
+    if (state->memory == NULL) {
+        fprintf(stderr, "Error: couldn't map guest memory\n");
+        return -1;
     }
 
-    // declare ConditionCodes struct
-    ConditionCodes cc;
-    cc.z = 0;
-    cc.s = 0;
-    cc.p = 0;
-    cc.cy = 0;
-    cc.ac = 0;
+    // the ROM image is write-protected
+    state->mem_map = malloc(sizeof(MemoryMap));
+    if (state->mem_map == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        mem_free(state->memory);
+        state->memory = NULL;
+        return -1;
+    }
+    mem_map_invaders(state->mem_map);
+    rom_image_protect(rom, state->mem_map);
+
+    state->io = malloc(sizeof(IoMap));
+    if (state->io == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        free(state->mem_map);
+        state->mem_map = NULL;
+        mem_free(state->memory);
+        state->memory = NULL;
+        return -1;
+    }
+    io_map_invaders(state->io);
+
+    return rom->end;
+}
+
 
+void emu_unload(State8080 *state) {
+    block_cache_free(state->blocks);
+    state->blocks = NULL;
+    mem_free(state->memory);
+    state->memory = NULL;
+    free(state->mem_map);
+    state->mem_map = NULL;
+    free(state->io);
+    state->io = NULL;
+}
+
+
+// a paced run that falls this far behind (a stalled host)
+// picks up from there rather than racing to catch up
+#define PACE_RESYNC_NS  (4 * 1000000000ULL / FRAME_HZ)
+
+// set by the SIGINT handler so that a headless run, or an
+// interactive continue, can stop cleanly
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signum) {
+    (void) signum;
+    stop_requested = 1;
+}
+
+
+/*
+ * Interactive "c": runs at full speed until a breakpoint or
+ * watchpoint, a HLT nothing can wake, or Ctrl-C
+ */
+static void continue_run(State8080 *state, Scheduler *sched) {
+    stop_requested = 0;
+    signal(SIGINT, request_stop);
+    RunStop stop = STOP_BUDGET;
+    while (!stop_requested && stop != STOP_BREAKPOINT
+            && !(stop == STOP_HALT && !state->int_enable)) {
+        stop = sched_run(sched, state, CYCLES_PER_FRAME);
+    }
+    signal(SIGINT, SIG_DFL);
+
+    if (stop == STOP_BREAKPOINT) {
+        debug_print_hit(state->debug, state);
+    }
+}
+
+
+int load_and_run(const RomImage *rom, Engine engine, Debugger *debug) {
     // declare State8080 struct
     State8080 state;
-    state.a = 0;
-    state.b = 0;
-    state.c = 0;
-    state.d = 0;
-    state.e = 0;
-    state.h = 0;
-    state.l = 0;
-
-    state.sp = 0;
-    state.pc = 0;
-    state.int_enable = 0;
-    // 16-bit address has a maximum of
-    // 2^15 addressable 8-bit chunks
-    size_t max_size = 1 << 15;
-    state.memory = (uint8_t*) malloc(max_size * sizeof(*state.memory));
-
-    state.cc = cc;
-
-    // get the file size and read it into a memory buffer
-    fseek(f, 0L, SEEK_END);
-    int fsize = ftell(f);
-    fseek(f, 0L, SEEK_SET);
-
-    fread(state.memory, fsize, 1, f);
-    fclose(f);
+    int fsize = emu_load(&state, rom);
+    if (fsize < 0) {
+        exit(1);
+    }
+    state.engine = engine;
+
+    Scheduler sched;
+    sched_init(&sched);
+    invaders_schedule_interrupts(&sched, state.cycles);
+
+    // "b" and "w" need somewhere to go
+    Debugger *own_debug = NULL;
+    if (debug == NULL) {
+        debug = own_debug = debug_new();
+    }
+    if (debug) {
+        debug_attach(debug, &state);
+    }
 
     size_t instr_count = 0;
-    char user_in [20];
+    char user_in [80];
 
     size_t instrs_to_advance = 0;
-    while (state.pc < fsize) {
+    while (state.pc < fsize && !(state.halted && !state.int_enable)) {
         printf("Emulator state:\n");
         print_state(&state);
         printf("Instructions executed: %zu\n", instr_count);
 
         if (instrs_to_advance == 0) {
             printf(
-                "Press enter to advance one instruction, or " 
+                "Press enter to advance one instruction, or "
                 "enter number of instructions to advance "
-                "and then press enter: "); 
-            fgets(user_in, 20, stdin);
+                "and then press enter (c to continue, b ADDR[:COND] "
+                "to break, w ADDR[+LEN][:r|w|rw] to watch): ");
+            if (fgets(user_in, sizeof(user_in), stdin) == NULL) {
+                break;
+            }
+            if (debug && (user_in[0] == 'b' || user_in[0] == 'w') && user_in[1] == ' ') {
+                user_in[strcspn(user_in, "\n")] = '\0';
+                if (user_in[0] == 'b') {
+                    debug_add_break(debug, user_in + 2);
+                } else {
+                    debug_add_watch(debug, user_in + 2);
+                }
+                continue;
+            }
+            if (debug && strcmp(user_in, "c\n") == 0) {
+                uint64_t before = state.instructions;
+                continue_run(&state, &sched);
+                instr_count += state.instructions - before;
+                continue;
+            }
             instrs_to_advance = get_num_instrs(user_in);
             if (instrs_to_advance == 0) {
                 continue;
             }
         }
         printf("\n\n");
-        emulate_op(&state);
+        // print out the instruction about to be executed
+        if (state.halted) {
+            // idle until the next interrupt
+            state.cycles = sched.next_deadline;
+        } else {
+            disassemble8080op(state.memory, state.pc);
+            if (debug) {
+                debug_step(debug, &state);
+            }
+            emulate_op(&state);
+        }
+        sched_fire_due(&sched, &state);
+        service_interrupt(&state);
         instr_count++;
         instrs_to_advance--;
+        if (debug && debug_at_stop(debug, state.pc) && debug_stop(debug, &state)) {
+            debug_print_hit(debug, &state);
+            instrs_to_advance = 0;
+        }
+    }
+    if (state.halted) {
+        printf("Halting execution...\n");
     }
     printf("LOOP EXITED.\n");
     print_state(&state);
     printf("fsize: 0x%x\n", fsize);
 
-    free(state.memory);
+    if (debug) {
+        debug_detach(debug);
+    }
+    debug_free(own_debug);
+    emu_unload(&state);
 
     return 0;
 }
+
+
+/*
+ * Returns the seconds elapsed since `start`
+ */
+static double elapsed_since(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)
+        + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+int run_headless(const RomImage *rom, const HeadlessOpts *opts) {
+    State8080 state;
+    if (emu_load(&state, rom) < 0) {
+        exit(1);
+    }
+    state.engine = opts->engine;
+
+    Scheduler sched;
+    sched_init(&sched);
+    invaders_schedule_interrupts(&sched, state.cycles);
+
+    Snapshot *snap = NULL;
+    if (opts->load_snapshot || opts->save_snapshot) {
+        snap = malloc(sizeof(*snap));
+        if (snap == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            emu_unload(&state);
+            return -1;
+        }
+    }
+    if (opts->load_snapshot) {
+        if (snapshot_read(snap, opts->load_snapshot) < 0) {
+            free(snap);
+            emu_unload(&state);
+            return -1;
+        }
+        snapshot_load(&state, &sched, snap);
+    }
+
+    if (opts->trace_path) {
+        state.tracer = opts->trace_last
+            ? trace_open_ring(opts->trace_last)
+            : trace_open_stream(opts->trace_path);
+        if (state.tracer == NULL) {
+            exit(1);
+        }
+    }
+
+    Rewind *rewind = NULL;
+    if (opts->rewind_frames) {
+        rewind = rewind_new(opts->rewind_frames, REWIND_KEYFRAME_INTERVAL);
+        if (rewind == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(1);
+        }
+        rewind_push(rewind, &state, &sched);
+    }
+
+    Movie *play = NULL;
+    Movie *record = NULL;
+    MovieScript script = {0};
+    if (opts->play_movie) {
+        play = movie_read(opts->play_movie);
+    } else if (opts->record_movie) {
+        record = movie_new(state.io);
+        if (record == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(1);
+        }
+    }
+    if (opts->input_script && movie_script_read(&script, opts->input_script) < 0) {
+        exit(1);
+    }
+    if (opts->play_movie && play == NULL) {
+        exit(1);
+    }
+    uint32_t movie_checks = opts->movie_checks ? opts->movie_checks : MOVIE_CHECK_INTERVAL;
+    uint32_t frame = 0;
+    int diverged = 0;
+    uint64_t expected_hash = 0;
+
+    Video *video = NULL;
+    double video_secs = 0;
+    if (opts->screenshot || opts->realtime) {
+        const char *ext = opts->screenshot ? strrchr(opts->screenshot, '.') : NULL;
+        video = video_new(ext && strcmp(ext, ".pgm") == 0 ? VIDEO_GRAY : VIDEO_RGBA);
+        if (video == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(1);
+        }
+        video_update(video, state.memory);
+    }
+
+    Sound *sound = NULL;
+    if (opts->sound) {
+        sound = sound_new(state.io, CPU_HZ, state.cycles, opts->sound_samples, opts->sound);
+        if (sound == NULL) {
+            exit(1);
+        }
+    }
+
+    ProfileSymbols symbols = {0};
+    if (opts->profile) {
+        state.profile = profile_new(opts->profile_period);
+        if (state.profile == NULL) {
+            exit(1);
+        }
+    }
+    if (opts->profile_symbols && profile_symbols_read(&symbols, opts->profile_symbols) < 0) {
+        exit(1);
+    }
+
+    if (opts->debug) {
+        debug_attach(opts->debug, &state);
+    }
+
+    stop_requested = 0;
+    signal(SIGINT, request_stop);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t start_instrs = state.instructions;
+    uint64_t start_cycles = state.cycles;
+
+    Pacer pacer;
+    if (opts->realtime) {
+        pacer_init(&pacer, CPU_HZ, state.cycles, PACE_RESYNC_NS);
+    }
+
+    // no per-instruction I/O: run a frame's worth of
+    // cycles per call, with the video interrupts,
+    // until a HLT nothing can wake, Ctrl-C, or the
+    // instruction limit (0 = none, checked per frame)
+    while (!stop_requested) {
+        if (opts->max_instrs && state.instructions - start_instrs >= opts->max_instrs) {
+            break;
+        }
+        if (play) {
+            if (movie_check(play, frame, state.memory, &expected_hash) < 0) {
+                diverged = 1;
+                break;
+            }
+            if (frame == play->frames) {
+                break;
+            }
+            movie_apply(play, frame, state.io);
+        }
+        movie_script_apply(&script, frame, state.io);
+        if (record) {
+            movie_record_inputs(record, frame, state.io);
+            if (frame % movie_checks == 0) {
+                movie_record_check(record, frame, state.memory);
+            }
+        }
+        frame++;
+        RunStop stop = sched_run(&sched, &state, CYCLES_PER_FRAME);
+        if (stop == STOP_HALT && !state.int_enable) {
+            break;
+        }
+        if (stop == STOP_BREAKPOINT) {
+            debug_print_hit(state.debug, &state);
+            break;
+        }
+        if (rewind) {
+            rewind_push(rewind, &state, &sched);
+        }
+        if (sound) {
+            sound_frame(sound, state.cycles);
+        }
+        if (video) {
+            // frames end at VBlank, when the game is done drawing
+            struct timespec frame;
+            clock_gettime(CLOCK_MONOTONIC, &frame);
+            video_update(video, state.memory);
+            video_secs += elapsed_since(&frame);
+        }
+        if (opts->realtime) {
+            pacer_wait(&pacer, state.cycles);
+        }
+    }
+
+    double secs = elapsed_since(&start);
+    signal(SIGINT, SIG_DFL);
+
+    int status = 0;
+    if (sound) {
+        sound_frame(sound, state.cycles);
+        if (sound_finish(sound) < 0) {
+            fprintf(stderr, "Error: couldn't write %s\n", opts->sound);
+            status = -1;
+        }
+    }
+
+    // the state after the last frame, e.g. when a HLT ended it
+    if (play && !diverged && movie_check(play, frame, state.memory, &expected_hash) < 0) {
+        diverged = 1;
+    }
+    if (record && (record->check_count == 0
+            || record->checks[record->check_count - 1].frame != frame)) {
+        movie_record_check(record, frame, state.memory);
+    }
+
+    if (state.tracer) {
+        if (opts->trace_last) {
+            trace_dump(state.tracer, opts->trace_path, opts->trace_last);
+        }
+        trace_close(state.tracer);
+    }
+
+    if (state.halted) {
+        printf("Halted at PC 0x%04x\n", state.pc - 1);
+    }
+    printf("Engine: %s\n", engine_name(state.engine));
+    printf("Instructions executed: %" PRIu64 "\n", state.instructions - start_instrs);
+    printf("Cycles executed: %" PRIu64 "\n", state.cycles - start_cycles);
+    printf("Elapsed time: %.3f s\n", secs);
+    if (secs > 0) {
+        printf("Instructions/sec: %.0f\n", (state.instructions - start_instrs) / secs);
+        printf("Emulated clock: %.2f MHz\n", (state.cycles - start_cycles) / secs / 1e6);
+    }
+    if (state.blocks) {
+        printf("Block cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " invalidations\n",
+            state.blocks->hits, state.blocks->misses, state.blocks->invalidations);
+        if (state.blocks->idle_cycles) {
+            printf("Idle loops: %" PRIu64 " cycles fast-forwarded\n", state.blocks->idle_cycles);
+        }
+    }
+    if (state.blocks && state.blocks->jit) {
+        printf("JIT: %" PRIu64 " blocks compiled, %zu KiB of code, %" PRIu64 " resets\n",
+            state.blocks->jit->compiled, state.blocks->jit->used / 1024,
+            state.blocks->jit->resets);
+    }
+
+    if (video) {
+        printf("Video: %" PRIu64 " frames, %" PRIu64 " tiles redrawn, %.3f s (%s)\n",
+            video->frames, video->tiles, video_secs, video_kernel_name());
+    }
+    if (opts->realtime) {
+        pacer_report(&pacer);
+    }
+    if (sound) {
+        printf("Sound: %" PRIu64 " port writes, %" PRIu64 " dropped, %.2f s mixed\n",
+            sound->events, sound->dropped, (double) sound->mixed / SOUND_RATE);
+    }
+    if (state.profile) {
+        printf("\n");
+        profile_report(state.profile, state.memory, &symbols, PROFILE_TOP);
+        printf("\n");
+    }
+
+    if (play) {
+        if (diverged) {
+            printf("Movie: diverged at frame %" PRIu32 ", RAM hash %016" PRIx64
+                ", expected %016" PRIx64 "\n",
+                frame, mem_hash(state.memory), expected_hash);
+        } else {
+            printf("Movie: %" PRIu32 " of %" PRIu32 " frames, %zu checks matched\n",
+                frame, play->frames, play->next_check);
+        }
+    }
+    if (record) {
+        record->frames = frame;
+        printf("Movie: %" PRIu32 " frames, %zu input changes, %zu checks\n",
+            record->frames, record->input_count, record->check_count);
+    }
+
+    if (rewind) {
+        printf("Rewind: %zu frames, %zu keyframes, %zu KiB of pages\n",
+            rewind->count, rewind->keyframes, rewind->bytes / 1024);
+        if (opts->rewind_back) {
+            if (rewind_back(rewind, &state, &sched, opts->rewind_back) == 0) {
+                printf("Rewound %zu frames to PC 0x%04x at cycle %" PRIu64 "\n",
+                    opts->rewind_back, state.pc, state.cycles);
+            } else {
+                printf("Rewind: only %zu frames to go back through\n", rewind->count - 1);
+            }
+        }
+        rewind_free(rewind);
+    }
+
+    if (opts->save_snapshot) {
+        snapshot_save(snap, &state, &sched);
+        if (snapshot_write(snap, opts->save_snapshot) < 0) {
+            status = -1;
+        }
+    }
+    free(snap);
+
+    if (record && movie_write(record, opts->record_movie) < 0) {
+        status = -1;
+    }
+    if (diverged) {
+        status = -1;
+    }
+    movie_free(record);
+    movie_free(play);
+    movie_script_free(&script);
+
+    if (video) {
+        if (opts->screenshot && video_write(video, opts->screenshot) < 0) {
+            status = -1;
+        }
+        video_free(video);
+    }
+    sound_free(sound);
+
+    if (state.profile) {
+        if (profile_write(state.profile, opts->profile) < 0) {
+            status = -1;
+        }
+        profile_free(state.profile);
+        state.profile = NULL;
+    }
+    profile_symbols_free(&symbols);
+
+    if (opts->debug) {
+        debug_detach(opts->debug);
+    }
+    emu_unload(&state);
+
+    return status;
+}
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block.h"
+#include "fuzz.h"
+#include "scheduler.h"
+
+// bytes of memory listed when a divergence is printed
+#define FUZZ_REPORT_BYTES   16
+
+
+static int setup_machine(FuzzMachine *m, Engine engine) {
+    memset(m, 0, sizeof(*m));
+    m->state.engine = engine;
+    m->state.mem_map = &m->mem_map;
+    m->state.io = &m->io;
+    m->state.memory = mem_alloc();
+    return m->state.memory ? 0 : -1;
+}
+
+
+static void free_machine(FuzzMachine *m) {
+    block_cache_free(m->state.blocks);
+    m->state.blocks = NULL;
+    mem_free(m->state.memory);
+    m->state.memory = NULL;
+}
+
+
+int fuzz_init(Fuzzer *fuzz, Engine engine, uint64_t seed) {
+    memset(fuzz, 0, sizeof(*fuzz));
+    if (!engine_available(engine)) {
+        return -1;
+    }
+    fuzz->engine = engine;
+    fuzz->profile = profile_new(1);
+    fuzz->pool = malloc(FUZZ_POOL_SIZE);
+    if (fuzz->profile == NULL || fuzz->pool == NULL
+            || setup_machine(&fuzz->ref, ENGINE_SWITCH) < 0
+            || setup_machine(&fuzz->test, engine) < 0) {
+        fuzz_free(fuzz);
+        return -1;
+    }
+    fuzz->ref.state.profile = fuzz->profile;
+
+    // xorshift64*: any fixed, seedable stream will do
+    uint64_t x = seed ? seed : 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < FUZZ_POOL_SIZE; i++) {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        fuzz->pool[i] = (x * 0x2545f4914f6cdd1dULL) >> 56;
+    }
+    return 0;
+}
+
+
+void fuzz_free(Fuzzer *fuzz) {
+    free_machine(&fuzz->ref);
+    free_machine(&fuzz->test);
+    profile_free(fuzz->profile);
+    free(fuzz->pool);
+    memset(fuzz, 0, sizeof(*fuzz));
+}
+
+
+/*
+ * Puts a machine in the state `header` and `code` describe,
+ * which leaves nothing of the last input behind
+ */
+static void reset_machine(FuzzMachine *m, const Fuzzer *fuzz,
+        const uint8_t *header, const uint8_t *code, size_t len) {
+    State8080 *state = &m->state;
+    const uint8_t *pool = fuzz->pool + (header[11] | (header[12] << 8));
+
+    // memory changes behind mem_write's back, so
+    // nothing decoded from the last input can stay
+    memcpy(state->memory, pool, MEM_SIZE);
+    memcpy(state->memory + FUZZ_ORIGIN, code, len);
+    mem_map_init(&m->mem_map);
+    if (state->blocks) {
+        block_cache_flush(state->blocks);
+    }
+
+    // every port reads a byte of the pool and latches writes
+    io_map_init(&m->io);
+    for (int port = 0; port < NUM_PORTS; port++) {
+        m->io.in_kind[port] = PORT_VALUE;
+        m->io.out_kind[port] = PORT_VALUE;
+        m->io.in_value[port] = pool[MEM_SIZE - NUM_PORTS + port];
+    }
+
+    state->a = header[0];
+    state->b = header[1];
+    state->c = header[2];
+    state->d = header[3];
+    state->e = header[4];
+    state->h = header[5];
+    state->l = header[6];
+    state->cc.psw = (header[7] & FLAG_ALL) | FLAG_ONE;
+    state->lazy_mask = 0;
+    state->sp = header[8] | (header[9] << 8);
+    state->pc = FUZZ_ORIGIN;
+    state->int_enable = header[10] & 1;
+    state->int_pending = (header[10] >> 1) & 1;
+    state->int_rst = (header[10] >> 2) & 7;
+    state->halted = 0;
+    state->cycles = 0;
+    state->instructions = 0;
+    state->ei_shadow = 0;
+}
+
+
+static int report_byte(const char *field, uint8_t want, uint8_t got, int verbose) {
+    if (want != got && verbose) {
+        printf("  %-12s switch 0x%02x, got 0x%02x\n", field, want, got);
+    }
+    return want != got;
+}
+
+
+/*
+ * Returns the number of ways the two machines differ,
+ * printing them if `verbose` is set
+ */
+static int compare(const Fuzzer *fuzz, RunStop ref_stop, RunStop test_stop, int verbose) {
+    const State8080 *want = &fuzz->ref.state;
+    const State8080 *got = &fuzz->test.state;
+    int diffs = 0;
+
+    diffs += report_byte("stop", ref_stop, test_stop, verbose);
+    diffs += report_byte("A", want->a, got->a, verbose);
+    diffs += report_byte("B", want->b, got->b, verbose);
+    diffs += report_byte("C", want->c, got->c, verbose);
+    diffs += report_byte("D", want->d, got->d, verbose);
+    diffs += report_byte("E", want->e, got->e, verbose);
+    diffs += report_byte("H", want->h, got->h, verbose);
+    diffs += report_byte("L", want->l, got->l, verbose);
+    diffs += report_byte("PSW", flags_psw(want), flags_psw(got), verbose);
+    diffs += report_byte("SP high", want->sp >> 8, got->sp >> 8, verbose);
+    diffs += report_byte("SP low", want->sp, got->sp, verbose);
+    diffs += report_byte("PC high", want->pc >> 8, got->pc >> 8, verbose);
+    diffs += report_byte("PC low", want->pc, got->pc, verbose);
+    diffs += report_byte("int_enable", want->int_enable, got->int_enable, verbose);
+    diffs += report_byte("int_pending", want->int_pending, got->int_pending, verbose);
+    diffs += report_byte("halted", want->halted, got->halted, verbose);
+    if (want->cycles != got->cycles || want->instructions != got->instructions) {
+        if (verbose) {
+            printf("  %-12s switch %" PRIu64 " cycles, %" PRIu64 " instructions; got %"
+                PRIu64 ", %" PRIu64 "\n", "time", want->cycles, want->instructions,
+                got->cycles, got->instructions);
+        }
+        diffs++;
+    }
+
+    if (memcmp(want->memory, got->memory, MEM_SIZE) != 0) {
+        int bytes = 0;
+        for (int addr = 0; addr < MEM_SIZE; addr++) {
+            char field[16];
+            snprintf(field, sizeof(field), "[0x%04x]", addr);
+            bytes += report_byte(field, want->memory[addr], got->memory[addr],
+                verbose && bytes < FUZZ_REPORT_BYTES);
+        }
+        if (verbose && bytes > FUZZ_REPORT_BYTES) {
+            printf("  and %d more bytes of memory\n", bytes - FUZZ_REPORT_BYTES);
+        }
+        diffs += bytes;
+    }
+    if (memcmp(fuzz->ref.io.out_value, fuzz->test.io.out_value, NUM_PORTS) != 0) {
+        for (int port = 0; port < NUM_PORTS; port++) {
+            char field[16];
+            snprintf(field, sizeof(field), "OUT 0x%02x", port);
+            diffs += report_byte(field, fuzz->ref.io.out_value[port],
+                fuzz->test.io.out_value[port], verbose);
+        }
+    }
+    return diffs;
+}
+
+
+/*
+ * Returns which of the FUZZ_BUCKETS ranges a nonzero count is in
+ */
+static int bucket(uint64_t count) {
+    static const uint8_t small[8] = { 0, 0, 1, 2, 3, 3, 3, 3 };
+    return count < 8 ? small[count] : count < 16 ? 4 : count < 32 ? 5 : count < 128 ? 6 : 7;
+}
+
+
+/*
+ * Marks what the reference reached as features, clearing
+ * its counters for the next input (those for PCs outside the
+ * code are never read, so they can pile up). Returns how
+ * many were new.
+ */
+static int collect_features(Fuzzer *fuzz) {
+    Profile *profile = fuzz->profile;
+    int added = 0;
+    for (int i = 0; i < 256 + FUZZ_MAX_CODE; i++) {
+        uint64_t *count = i < 256
+            ? &profile->op_count[i] : &profile->pc_count[FUZZ_ORIGIN + i - 256];
+        if (*count == 0) {
+            continue;
+        }
+        int feature = i * FUZZ_BUCKETS + bucket(*count);
+        *count = 0;
+        if (fuzz->counters) {
+            fuzz->counters[feature] = 1;
+        }
+        if (!(fuzz->seen[feature >> 3] & (1 << (feature & 7)))) {
+            fuzz->seen[feature >> 3] |= 1 << (feature & 7);
+            added++;
+        }
+    }
+    memset(profile->op_cycles, 0, sizeof(profile->op_cycles));
+    profile->samples = 0;
+    profile->timing = 0;
+    fuzz->features += added;
+    return added;
+}
+
+
+int fuzz_run(Fuzzer *fuzz, const uint8_t *data, size_t size) {
+    uint8_t header[FUZZ_HEADER] = {0};
+    memcpy(header, data, size < FUZZ_HEADER ? size : FUZZ_HEADER);
+    const uint8_t *code = data + (size < FUZZ_HEADER ? size : FUZZ_HEADER);
+    size_t len = size - (code - data);
+    if (len > FUZZ_MAX_CODE) {
+        len = FUZZ_MAX_CODE;
+    }
+    uint64_t burst = 16 + (header[13] | (header[14] << 8));
+
+    reset_machine(&fuzz->ref, fuzz, header, code, len);
+    reset_machine(&fuzz->test, fuzz, header, code, len);
+
+    // no events: sched_run only takes the latched interrupt
+    Scheduler sched;
+    sched_init(&sched);
+    RunStop ref_stop = sched_run(&sched, &fuzz->ref.state, burst);
+    RunStop test_stop = sched_run(&sched, &fuzz->test.state, burst);
+    fuzz->runs++;
+
+    int added = collect_features(fuzz);
+    if (compare(fuzz, ref_stop, test_stop, 0) == 0) {
+        return added;
+    }
+    printf("Divergence: %s against switch after a %" PRIu64 "-cycle burst\n",
+        engine_name(fuzz->engine), burst);
+    compare(fuzz, ref_stop, test_stop, 1);
+    return -1;
+}
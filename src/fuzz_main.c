@@ -0,0 +1,337 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fuzz.h"
+#include "jit.h"
+
+#ifdef FUZZ_LIBFUZZER
+
+// the engine checked against switch, picked at build time
+#ifndef FUZZ_ENGINE
+#ifdef HAVE_JIT
+#define FUZZ_ENGINE     ENGINE_JIT
+#else
+#define FUZZ_ENGINE     ENGINE_BLOCK
+#endif
+#endif
+
+// libFuzzer reads these as extra coverage alongside its own
+__attribute__((section("__libfuzzer_extra_counters")))
+static uint8_t extra_counters[FUZZ_FEATURES];
+
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static Fuzzer fuzz;
+    static int ready = 0;
+    if (!ready) {
+        if (fuzz_init(&fuzz, FUZZ_ENGINE, 1) < 0) {
+            abort();
+        }
+        fuzz.counters = extra_counters;
+        ready = 1;
+    }
+    if (fuzz_run(&fuzz, data, size) < 0) {
+        // libFuzzer saves the input
+        abort();
+    }
+    return 0;
+}
+
+#else
+
+#define FUZZ_RUNS       100000
+#define FUZZ_CORPUS     4096
+#define FUZZ_START_CODE 64
+#define STATUS_INTERVAL (1 << 16)
+
+typedef struct input_t {
+    uint8_t             bytes[FUZZ_HEADER + FUZZ_MAX_CODE];
+    size_t              size;
+} Input;
+
+// opcodes worth planting: the ones that change the flow of
+// control, touch memory through a pair, or modify the flags
+static const uint8_t interesting[] = {
+    0x02, 0x0a, 0x12, 0x1a, 0x22, 0x27, 0x2a, 0x32, 0x34, 0x35, 0x36, 0x3a,
+    0x76, 0x77, 0xc0, 0xc2, 0xc3, 0xc4, 0xc7, 0xc9, 0xcd, 0xd3, 0xdb, 0xe3,
+    0xe9, 0xeb, 0xf1, 0xf3, 0xf5, 0xf9, 0xfb, 0xfe,
+};
+
+
+static uint64_t next_random(uint64_t *x) {
+    *x ^= *x >> 12;
+    *x ^= *x << 25;
+    *x ^= *x >> 27;
+    return *x * 0x2545f4914f6cdd1dULL;
+}
+
+
+static void random_input(Input *in, uint64_t *rng) {
+    in->size = FUZZ_HEADER + FUZZ_START_CODE;
+    for (size_t i = 0; i < in->size; i++) {
+        in->bytes[i] = next_random(rng) >> 56;
+    }
+    // bursts long enough to get somewhere
+    in->bytes[14] &= 0x0f;
+}
+
+
+/*
+ * Changes `in` in one to four places, sometimes splicing
+ * in code from `other`
+ */
+static void mutate(Input *in, const Input *other, uint64_t *rng) {
+    int changes = 1 + (next_random(rng) >> 62);
+    for (int n = 0; n < changes; n++) {
+        uint64_t r = next_random(rng);
+        size_t at = (r >> 32) % in->size;
+        switch ((r >> 8) % 6) {
+            case 0:
+                in->bytes[at] ^= 1 << (r & 7);
+                break;
+            case 1:
+                in->bytes[at] = r >> 56;
+                break;
+            case 2:
+                in->bytes[at] = interesting[(r >> 56) % sizeof(interesting)];
+                break;
+            case 3:
+                // insert a byte of code
+                if (at >= FUZZ_HEADER && in->size < sizeof(in->bytes)) {
+                    memmove(in->bytes + at + 1, in->bytes + at, in->size - at);
+                    in->bytes[at] = r >> 56;
+                    in->size++;
+                }
+                break;
+            case 4:
+                // drop a byte of code
+                if (at >= FUZZ_HEADER && in->size > FUZZ_HEADER + 1) {
+                    memmove(in->bytes + at, in->bytes + at + 1, in->size - at - 1);
+                    in->size--;
+                }
+                break;
+            case 5:
+                if (other && other->size > FUZZ_HEADER && at >= FUZZ_HEADER) {
+                    size_t from = FUZZ_HEADER + (r >> 16) % (other->size - FUZZ_HEADER);
+                    size_t len = other->size - from;
+                    if (len > in->size - at) {
+                        len = in->size - at;
+                    }
+                    memcpy(in->bytes + at, other->bytes + from, len);
+                }
+                break;
+        }
+    }
+}
+
+
+static int write_input(const Input *in, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL || fwrite(in->bytes, 1, in->size, f) != in->size) {
+        fprintf(stderr, "Error: couldn't write %s\n", path);
+        if (f) {
+            fclose(f);
+        }
+        return -1;
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+
+static int read_input(Input *in, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return -1;
+    }
+    in->size = fread(in->bytes, 1, sizeof(in->bytes), f);
+    fclose(f);
+    return 0;
+}
+
+
+static double elapsed_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+static void print_status(const Fuzzer *fuzz, size_t corpus, const struct timespec *start) {
+    int ops = 0;
+    for (int op = 0; op < 256; op++) {
+        ops += fuzz->seen[op * FUZZ_BUCKETS / 8] != 0;
+    }
+    double secs = elapsed_since(start);
+    printf("%-8s %10" PRIu64 " runs, %5zu inputs kept, %6" PRIu64 " features "
+        "(%d/256 opcodes), %.0f runs/s\n", engine_name(fuzz->engine), fuzz->runs,
+        corpus, fuzz->features, ops, secs > 0 ? fuzz->runs / secs : 0);
+}
+
+
+/*
+ * Fuzzes `engine` for `runs` inputs (0 for no limit). Returns 0
+ * if it never diverged, or 1 after writing the input that did
+ * to `crash_path`.
+ */
+static int fuzz_engine(Engine engine, uint64_t runs, uint64_t seed, const char *crash_path) {
+    Fuzzer fuzz;
+    Input *corpus = malloc(FUZZ_CORPUS * sizeof(Input));
+    if (corpus == NULL || fuzz_init(&fuzz, engine, seed) < 0) {
+        fprintf(stderr, "Error: couldn't set up %s\n", engine_name(engine));
+        free(corpus);
+        return -1;
+    }
+
+    uint64_t rng = seed ^ 0x5851f42d4c957f2dULL;
+    size_t count = 0;
+    int status = 0;
+    Input in;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (runs == 0 || fuzz.runs < runs) {
+        // mostly mutations of what got somewhere new,
+        // with a fresh input now and then
+        uint64_t r = next_random(&rng);
+        if (count == 0 || r % 16 == 0) {
+            random_input(&in, &rng);
+        } else {
+            in = corpus[(r >> 8) % count];
+            mutate(&in, &corpus[(r >> 32) % count], &rng);
+        }
+
+        int added = fuzz_run(&fuzz, in.bytes, in.size);
+        if (added < 0) {
+            status = 1;
+            if (write_input(&in, crash_path) == 0) {
+                printf("Input written to %s (replay it with --seed %" PRIu64 ")\n",
+                    crash_path, seed);
+            }
+            break;
+        }
+        if (added > 0) {
+            // a full corpus replaces a random entry
+            corpus[count < FUZZ_CORPUS ? count++ : (r >> 40) % FUZZ_CORPUS] = in;
+        }
+        if (fuzz.runs % STATUS_INTERVAL == 0) {
+            print_status(&fuzz, count, &start);
+        }
+    }
+    print_status(&fuzz, count, &start);
+
+    fuzz_free(&fuzz);
+    free(corpus);
+    return status;
+}
+
+
+static void usage(char *prog) {
+    printf("Usage: %s [options] [input...]\n", prog);
+    printf("Runs generated inputs (random registers, flags, memory and code) on\n");
+    printf("the switch engine and another engine side by side, keeping those that\n");
+    printf("reach new opcodes or PCs, and stops at the first divergence. With\n");
+    printf("inputs, runs each of them once instead.\n");
+    printf("  -e, --engines LIST    comma-separated engines to check (default: all\n");
+    printf("                        the others built for this host)\n");
+    printf("  -n, --runs N          inputs to run on each engine (default %d,\n", FUZZ_RUNS);
+    printf("                        0 for no limit)\n");
+    printf("  -s, --seed N          seed for the inputs and memory (default: the time)\n");
+    printf("  -o, --crash FILE      where to write an input that diverges\n");
+    printf("                        (default fuzz-crash.bin)\n");
+    printf("  -h, --help            show this message\n");
+}
+
+
+int main(int argc, char **argv) {
+    static struct option long_opts[] = {
+        {"engines",     required_argument, NULL, 'e'},
+        {"runs",        required_argument, NULL, 'n'},
+        {"seed",        required_argument, NULL, 's'},
+        {"crash",       required_argument, NULL, 'o'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    char *engines = NULL;
+    uint64_t runs = FUZZ_RUNS;
+    uint64_t seed = (uint64_t) time(NULL);
+    char *crash_path = "fuzz-crash.bin";
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "e:n:s:o:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'e':
+                engines = optarg;
+                break;
+            case 'n':
+                runs = strtoull(optarg, NULL, 0);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'o':
+                crash_path = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    Engine list[ENGINE_COUNT];
+    int count = 0;
+    if (engines) {
+        for (const char *p = engines; p; p = strchr(p, ',') ? strchr(p, ',') + 1 : NULL) {
+            char name[32];
+            snprintf(name, sizeof(name), "%.*s", (int) strcspn(p, ","), p);
+            if (count == ENGINE_COUNT || engine_from_name(name, &list[count]) < 0) {
+                fprintf(stderr, "Error: engine %s isn't available\n", name);
+                return 1;
+            }
+            count++;
+        }
+    } else {
+        for (int e = ENGINE_SWITCH + 1; e < ENGINE_COUNT; e++) {
+            if (engine_available(e)) {
+                list[count++] = e;
+            }
+        }
+    }
+
+    int status = 0;
+    if (optind < argc) {
+        // replay: seeded the same way as the run that found them
+        for (int i = 0; i < count; i++) {
+            Fuzzer fuzz;
+            if (fuzz_init(&fuzz, list[i], seed) < 0) {
+                return 1;
+            }
+            for (int arg = optind; arg < argc; arg++) {
+                Input in;
+                if (read_input(&in, argv[arg]) < 0) {
+                    status = 1;
+                } else if (fuzz_run(&fuzz, in.bytes, in.size) < 0) {
+                    printf("  (%s)\n", argv[arg]);
+                    status = 1;
+                }
+            }
+            fuzz_free(&fuzz);
+        }
+        return status;
+    }
+
+    printf("Seed: %" PRIu64 "\n", seed);
+    for (int i = 0; i < count && status == 0; i++) {
+        status = fuzz_engine(list[i], runs, seed, crash_path) != 0;
+    }
+    return status;
+}
+
+#endif // FUZZ_LIBFUZZER
@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "block.h"
+#include "core.h"
+#include "intel8080.h"
+#include "io.h"
+#include "jit.h"
+#include "memory.h"
+#include "profile.h"
+#include "rom.h"
+#include "scheduler.h"
+#include "snapshot.h"
+
+/*
+ * Everything one machine needs, in a single mapping. The block
+ * cache is big, but lives in fresh zero pages, so only the
+ * slots that get used are ever committed (and none at all
+ * on the interpreters).
+ */
+struct i8080_t {
+    State8080           state;
+    MemoryMap           mem_map;
+    IoMap               io;
+    Scheduler           sched;
+    BlockCache          blocks;
+
+    // guest memory and its guard bytes
+    uint8_t             memory[MEM_SIZE + MEM_GUARD];
+
+    // size of the mapping, with the profile after it
+    size_t              size;
+    Profile             *profile;
+};
+
+
+int i8080_version(void) {
+    return I8080_API_VERSION;
+}
+
+
+I8080* i8080_create(I8080Engine engine, unsigned flags) {
+    // the values match Engine
+    if (!engine_available((Engine) engine)) {
+        return NULL;
+    }
+    size_t base = (sizeof(I8080) + _Alignof(Profile) - 1) & ~(_Alignof(Profile) - 1);
+    size_t size = base + (flags & I8080_PROFILE ? sizeof(Profile) : 0);
+    I8080 *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) {
+        return NULL;
+    }
+    m->size = size;
+
+    // all else starts out zero
+    State8080 *state = &m->state;
+    state->cc.psw = FLAG_ONE;
+    state->engine = (Engine) engine;
+    state->memory = m->memory;
+    state->mem_map = &m->mem_map;
+    state->io = &m->io;
+
+    Engine resolved = engine == I8080_ENGINE_DEFAULT ? CORE_ENGINE : (Engine) engine;
+    if (resolved == ENGINE_BLOCK || resolved == ENGINE_JIT) {
+        state->blocks = &m->blocks;
+    }
+    if (flags & I8080_PROFILE) {
+        m->profile = (Profile *) ((uint8_t *) m + base);
+        m->profile->period = 1;
+        m->profile->countdown = 1;
+        state->profile = m->profile;
+    }
+
+    sched_init(&m->sched);
+    if (flags & I8080_INVADERS) {
+        mem_map_invaders(&m->mem_map);
+        io_map_invaders(&m->io);
+        invaders_schedule_interrupts(&m->sched, 0);
+    } else {
+        mem_map_init(&m->mem_map);
+        io_map_init(&m->io);
+    }
+    return m;
+}
+
+
+void i8080_destroy(I8080 *m) {
+    if (m) {
+        jit_free(m->blocks.jit);
+        munmap(m, m->size);
+    }
+}
+
+
+/*
+ * Memory changed behind mem_write's back: drops
+ * whatever was decoded from it
+ */
+static void forget_code(I8080 *m) {
+    if (m->state.blocks) {
+        block_cache_flush(m->state.blocks);
+    }
+    for (int page = 0; page < NUM_PAGES; page++) {
+        m->mem_map.attr[page] &= ~PAGE_CODE;
+    }
+}
+
+
+int i8080_load(I8080 *m, uint16_t addr, const void *data, size_t size, int rom) {
+    if (size > (size_t) MEM_SIZE - addr) {
+        return -1;
+    }
+    memcpy(m->memory + addr, data, size);
+    forget_code(m);
+    if (rom && size) {
+        mem_protect(&m->mem_map, addr, size);
+    }
+    return 0;
+}
+
+
+int i8080_load_file(I8080 *m, const char *path) {
+    RomImage rom;
+    size_t len = strlen(path);
+    int loaded = len > 9 && strcmp(path + len - 9, ".manifest") == 0
+        ? rom_image_load_manifest(&rom, path)
+        : rom_image_load_file(&rom, path);
+    if (loaded < 0) {
+        return -1;
+    }
+    uint8_t *image = rom_image_map(&rom);
+    if (image == NULL) {
+        fprintf(stderr, "Error: couldn't map %s\n", path);
+        rom_image_free(&rom);
+        return -1;
+    }
+    memcpy(m->memory, image, MEM_SIZE);
+    mem_free(image);
+    forget_code(m);
+    rom_image_protect(&rom, &m->mem_map);
+    rom_image_free(&rom);
+    return 0;
+}
+
+
+int i8080_step(I8080 *m) {
+    State8080 *state = &m->state;
+    int cycles = service_interrupt(state);
+    if (cycles == 0 && state->halted) {
+        // idles as long as a NOP, so scheduled
+        // interrupts can still come round
+        cycles = 4;
+        state->cycles += cycles;
+    } else if (cycles == 0) {
+        cycles = emulate_op(state);
+    }
+    sched_fire_due(&m->sched, &m->state);
+    return cycles;
+}
+
+
+I8080Stop i8080_run(I8080 *m, uint64_t cycles) {
+    // the values match RunStop
+    return (I8080Stop) sched_run(&m->sched, &m->state, cycles);
+}
+
+
+void i8080_interrupt(I8080 *m, int rst) {
+    generate_interrupt(&m->state, rst & 7);
+}
+
+
+void i8080_get_regs(const I8080 *m, I8080Regs *regs) {
+    const State8080 *state = &m->state;
+    regs->a = state->a;
+    regs->b = state->b;
+    regs->c = state->c;
+    regs->d = state->d;
+    regs->e = state->e;
+    regs->h = state->h;
+    regs->l = state->l;
+    regs->psw = flags_psw(state);
+    regs->sp = state->sp;
+    regs->pc = state->pc;
+    regs->int_enable = state->int_enable;
+    regs->halted = state->halted;
+    regs->cycles = state->cycles;
+    regs->instructions = state->instructions;
+}
+
+
+void i8080_set_regs(I8080 *m, const I8080Regs *regs) {
+    State8080 *state = &m->state;
+    state->a = regs->a;
+    state->b = regs->b;
+    state->c = regs->c;
+    state->d = regs->d;
+    state->e = regs->e;
+    state->h = regs->h;
+    state->l = regs->l;
+    state->cc.psw = (regs->psw & FLAG_ALL) | FLAG_ONE;
+    state->lazy_mask = 0;
+    state->sp = regs->sp;
+    state->pc = regs->pc;
+    state->int_enable = regs->int_enable;
+    state->halted = regs->halted;
+    state->cycles = regs->cycles;
+    state->instructions = regs->instructions;
+    state->ei_shadow = 0;
+}
+
+
+uint8_t i8080_read(const I8080 *m, uint16_t addr) {
+    return m->memory[addr];
+}
+
+
+void i8080_write(I8080 *m, uint16_t addr, uint8_t val) {
+    mem_write(&m->state, addr, val);
+}
+
+
+const uint8_t* i8080_memory(const I8080 *m) {
+    return m->memory;
+}
+
+
+void i8080_set_input(I8080 *m, uint8_t port, uint8_t val) {
+    m->io.in_value[port] = val;
+    if (m->io.in_kind[port] == PORT_NONE) {
+        m->io.in_kind[port] = PORT_VALUE;
+    }
+}
+
+
+uint8_t i8080_output(const I8080 *m, uint8_t port) {
+    return m->io.out_value[port];
+}
+
+
+void i8080_attach_port(I8080 *m, uint8_t port, I8080PortIn in, I8080PortOut out, void *ctx) {
+    io_attach(&m->io, port, in, out, ctx);
+}
+
+
+uint64_t i8080_port_cycles(const I8080 *m) {
+    return m->io.cycles;
+}
+
+
+size_t i8080_snapshot_size(void) {
+    return sizeof(Snapshot);
+}
+
+
+void i8080_snapshot(const I8080 *m, void *snap) {
+    snapshot_save(snap, &m->state, &m->sched);
+}
+
+
+int i8080_restore(I8080 *m, const void *snap) {
+    const Snapshot *s = snap;
+    if (s->magic != SNAPSHOT_MAGIC || s->version != SNAPSHOT_VERSION
+            || s->size != sizeof(Snapshot)) {
+        return -1;
+    }
+    snapshot_load(&m->state, &m->sched, s);
+    return 0;
+}
+
+
+int i8080_profile(const I8080 *m, uint64_t *op_counts, uint64_t *op_cycles,
+        uint64_t *pc_counts) {
+    const Profile *profile = m->profile;
+    if (profile == NULL) {
+        return -1;
+    }
+    if (op_counts) {
+        memcpy(op_counts, profile->op_count, sizeof(profile->op_count));
+    }
+    if (op_cycles) {
+        memcpy(op_cycles, profile->op_cycles, sizeof(profile->op_cycles));
+    }
+    if (pc_counts) {
+        memcpy(pc_counts, profile->pc_count, sizeof(profile->pc_count));
+    }
+    return 0;
+}
+
+
+void i8080_profile_reset(I8080 *m) {
+    Profile *profile = m->profile;
+    if (profile) {
+        memset(profile, 0, sizeof(*profile));
+        profile->period = 1;
+        profile->countdown = 1;
+    }
+}
@@ -0,0 +1,53 @@
+#include <string.h>
+
+#include "io.h"
+
+
+void io_map_init(IoMap *io) {
+    memset(io, 0, sizeof(*io));
+}
+
+
+void io_map_invaders(IoMap *io) {
+    io_map_init(io);
+
+    io->in_kind[0] = PORT_VALUE;
+    io->in_kind[1] = PORT_VALUE;
+    io->in_kind[2] = PORT_VALUE;
+    io->in_kind[3] = PORT_SHIFT;
+
+    // port 0 isn't used by the game, but reads these
+    // bits as set on the real board
+    io->in_value[0] = 0x0e;
+    io->in_value[1] = INV1_ALWAYS;
+    io->in_value[2] = 0;
+
+    io->out_kind[2] = PORT_SHIFT_OFFSET;
+    io->out_kind[3] = PORT_VALUE;   // sound
+    io->out_kind[4] = PORT_SHIFT;
+    io->out_kind[5] = PORT_VALUE;   // sound
+    io->out_kind[6] = PORT_VALUE;   // watchdog
+}
+
+
+void io_attach(IoMap *io, uint8_t port, PortIn in, PortOut out, void *ctx) {
+    IoDevice *device = &io->devices[port];
+    device->ctx = ctx;
+    if (in) {
+        device->in = in;
+        io->in_kind[port] = PORT_DEVICE;
+    }
+    if (out) {
+        device->out = out;
+        io->out_kind[port] = PORT_DEVICE;
+    }
+}
+
+
+void io_set_input(IoMap *io, uint8_t port, uint8_t mask, int pressed) {
+    if (pressed) {
+        io->in_value[port] |= mask;
+    } else {
+        io->in_value[port] &= ~mask;
+    }
+}
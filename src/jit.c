@@ -0,0 +1,1145 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "jit.h"
+#include "memory.h"
+
+#ifdef HAVE_JIT
+
+// x86-64 host registers
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// While compiled code runs the guest registers live in
+// callee-saved host registers, so calls into C keep them.
+// A holds 8 bits; the pairs hold 16-bit values with the
+// first register of the pair in the high byte.
+#define REG_STATE   RBX
+#define REG_A       RBP
+#define REG_BC      R12
+#define REG_DE      R13
+#define REG_HL      R14
+#define REG_MEM     R15
+
+// jit_enter's stack frame
+#define SLOT_END    0   // cycle count a chained block has to fit before
+#define SLOT_GEN    8   // cache generation when the block was entered
+#define FRAME_SIZE  24  // keeps calls 16-byte aligned
+
+// x86 condition codes for jcc
+#define CC_E        0x4
+#define CC_NE       0x5
+#define CC_A        0x7
+
+#define STATE_OFF(field)    ((int32_t) offsetof(State8080, field))
+#define BLOCK_OFF(field)    ((int32_t) offsetof(Block, field))
+
+typedef struct emitter_t {
+    uint8_t             *p;
+    uint8_t             *end;
+    int                 overflow;
+} Emitter;
+
+
+// Encoding ------------------------------
+
+static void emit8(Emitter *e, uint8_t b) {
+    if (e->p < e->end) {
+        *e->p++ = b;
+    } else {
+        e->overflow = 1;
+    }
+}
+
+
+static void emit16(Emitter *e, uint16_t v) {
+    emit8(e, v & 0xff);
+    emit8(e, v >> 8);
+}
+
+
+static void emit32(Emitter *e, uint32_t v) {
+    emit16(e, v & 0xffff);
+    emit16(e, v >> 16);
+}
+
+
+static void emit64(Emitter *e, uint64_t v) {
+    emit32(e, v & 0xffffffff);
+    emit32(e, v >> 32);
+}
+
+
+/*
+ * REX prefix for a 64-bit operation (`w`) on `reg`, `index` and
+ * `base`, if one is needed. `byte_reg` forces it for SPL-DIL.
+ */
+static void rex(Emitter *e, int w, int reg, int index, int base, int byte_reg) {
+    uint8_t prefix = 0x40 | (w << 3) | ((reg >> 3) << 2)
+        | ((index >> 3) << 1) | (base >> 3);
+    if (prefix != 0x40 || byte_reg) {
+        emit8(e, prefix);
+    }
+}
+
+
+// 1 if the byte form of `reg` needs a REX prefix
+#define BYTE_REX(reg)   ((reg) >= RSP && (reg) <= RDI)
+
+
+static void modrm_reg(Emitter *e, int reg, int rm) {
+    emit8(e, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+/*
+ * [base + disp32]
+ */
+static void modrm_mem(Emitter *e, int reg, int base, int32_t disp) {
+    emit8(e, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) {
+        emit8(e, 0x24);
+    }
+    emit32(e, disp);
+}
+
+
+/*
+ * [base + index] (as [base + index + 0], so RBP and R13 work as a base)
+ */
+static void modrm_sib(Emitter *e, int reg, int base, int index) {
+    emit8(e, 0x44 | ((reg & 7) << 3));
+    emit8(e, ((index & 7) << 3) | (base & 7));
+    emit8(e, 0);
+}
+
+
+static void mov_rr32(Emitter *e, int dst, int src) {
+    rex(e, 0, src, 0, dst, 0);
+    emit8(e, 0x89);
+    modrm_reg(e, src, dst);
+}
+
+
+static void mov_rr64(Emitter *e, int dst, int src) {
+    rex(e, 1, src, 0, dst, 0);
+    emit8(e, 0x89);
+    modrm_reg(e, src, dst);
+}
+
+
+static void mov_ri32(Emitter *e, int dst, uint32_t imm) {
+    rex(e, 0, 0, 0, dst, 0);
+    emit8(e, 0xb8 + (dst & 7));
+    emit32(e, imm);
+}
+
+
+static void mov_ri64(Emitter *e, int dst, const void *imm) {
+    rex(e, 1, 0, 0, dst, 0);
+    emit8(e, 0xb8 + (dst & 7));
+    emit64(e, (uint64_t) (uintptr_t) imm);
+}
+
+
+static void mov_rm64(Emitter *e, int dst, int base, int32_t disp) {
+    rex(e, 1, dst, 0, base, 0);
+    emit8(e, 0x8b);
+    modrm_mem(e, dst, base, disp);
+}
+
+
+static void mov_mr64(Emitter *e, int base, int32_t disp, int src) {
+    rex(e, 1, src, 0, base, 0);
+    emit8(e, 0x89);
+    modrm_mem(e, src, base, disp);
+}
+
+
+static void movzx8_rm(Emitter *e, int dst, int base, int32_t disp) {
+    rex(e, 0, dst, 0, base, 0);
+    emit8(e, 0x0f);
+    emit8(e, 0xb6);
+    modrm_mem(e, dst, base, disp);
+}
+
+
+static void movzx8_rsib(Emitter *e, int dst, int base, int index) {
+    rex(e, 0, dst, index, base, 0);
+    emit8(e, 0x0f);
+    emit8(e, 0xb6);
+    modrm_sib(e, dst, base, index);
+}
+
+
+static void movzx8_rr(Emitter *e, int dst, int src) {
+    rex(e, 0, dst, 0, src, BYTE_REX(src));
+    emit8(e, 0x0f);
+    emit8(e, 0xb6);
+    modrm_reg(e, dst, src);
+}
+
+
+static void movzx16_rm(Emitter *e, int dst, int base, int32_t disp) {
+    rex(e, 0, dst, 0, base, 0);
+    emit8(e, 0x0f);
+    emit8(e, 0xb7);
+    modrm_mem(e, dst, base, disp);
+}
+
+
+static void mov_mr8(Emitter *e, int base, int32_t disp, int src) {
+    rex(e, 0, src, 0, base, BYTE_REX(src));
+    emit8(e, 0x88);
+    modrm_mem(e, src, base, disp);
+}
+
+
+static void mov_sibr8(Emitter *e, int base, int index, int src) {
+    rex(e, 0, src, index, base, BYTE_REX(src));
+    emit8(e, 0x88);
+    modrm_sib(e, src, base, index);
+}
+
+
+static void mov_rr8(Emitter *e, int dst, int src) {
+    rex(e, 0, src, 0, dst, BYTE_REX(src) || BYTE_REX(dst));
+    emit8(e, 0x88);
+    modrm_reg(e, src, dst);
+}
+
+
+static void mov_mr16(Emitter *e, int base, int32_t disp, int src) {
+    emit8(e, 0x66);
+    rex(e, 0, src, 0, base, 0);
+    emit8(e, 0x89);
+    modrm_mem(e, src, base, disp);
+}
+
+
+static void mov_mi16(Emitter *e, int base, int32_t disp, uint16_t imm) {
+    emit8(e, 0x66);
+    rex(e, 0, 0, 0, base, 0);
+    emit8(e, 0xc7);
+    modrm_mem(e, 0, base, disp);
+    emit16(e, imm);
+}
+
+
+// group 2 shift by an immediate: /4 SHL, /5 SHR
+static void shift_ri32(Emitter *e, int ext, int reg, uint8_t count) {
+    rex(e, 0, 0, 0, reg, 0);
+    emit8(e, 0xc1);
+    modrm_reg(e, ext, reg);
+    emit8(e, count);
+}
+#define SHL 4
+#define SHR 5
+
+
+static void and_ri32(Emitter *e, int reg, uint32_t imm) {
+    rex(e, 0, 0, 0, reg, 0);
+    emit8(e, 0x81);
+    modrm_reg(e, 4, reg);
+    emit32(e, imm);
+}
+
+
+static void or_rr32(Emitter *e, int dst, int src) {
+    rex(e, 0, src, 0, dst, 0);
+    emit8(e, 0x09);
+    modrm_reg(e, src, dst);
+}
+
+
+static void xchg_rr32(Emitter *e, int a, int b) {
+    rex(e, 0, a, 0, b, 0);
+    emit8(e, 0x87);
+    modrm_reg(e, a, b);
+}
+
+
+// 16-bit add of a sign-extended byte; the upper half of
+// the 32-bit register is left alone
+static void add_ri16(Emitter *e, int reg, int8_t imm) {
+    emit8(e, 0x66);
+    rex(e, 0, 0, 0, reg, 0);
+    emit8(e, 0x83);
+    modrm_reg(e, 0, reg);
+    emit8(e, (uint8_t) imm);
+}
+
+
+static void add_mi16(Emitter *e, int base, int32_t disp, int8_t imm) {
+    emit8(e, 0x66);
+    rex(e, 0, 0, 0, base, 0);
+    emit8(e, 0x83);
+    modrm_mem(e, 0, base, disp);
+    emit8(e, (uint8_t) imm);
+}
+
+
+// group 1 on a 64-bit memory operand: /0 ADD, /5 SUB
+static void alu_mi64(Emitter *e, int ext, int base, int32_t disp, int32_t imm) {
+    rex(e, 1, 0, 0, base, 0);
+    emit8(e, 0x81);
+    modrm_mem(e, ext, base, disp);
+    emit32(e, (uint32_t) imm);
+}
+#define ADD 0
+#define SUB 5
+
+
+static void alu_ri64(Emitter *e, int ext, int reg, int32_t imm) {
+    rex(e, 1, 0, 0, reg, 0);
+    emit8(e, 0x81);
+    modrm_reg(e, ext, reg);
+    emit32(e, (uint32_t) imm);
+}
+
+
+static void add_rm64(Emitter *e, int dst, int base, int32_t disp) {
+    rex(e, 1, dst, 0, base, 0);
+    emit8(e, 0x03);
+    modrm_mem(e, dst, base, disp);
+}
+
+
+static void add_rr64(Emitter *e, int dst, int src) {
+    rex(e, 1, src, 0, dst, 0);
+    emit8(e, 0x01);
+    modrm_reg(e, src, dst);
+}
+
+
+static void cmp_rm64(Emitter *e, int reg, int base, int32_t disp) {
+    rex(e, 1, reg, 0, base, 0);
+    emit8(e, 0x3b);
+    modrm_mem(e, reg, base, disp);
+}
+
+
+static void cmp_mi8(Emitter *e, int base, int32_t disp, uint8_t imm) {
+    rex(e, 0, 0, 0, base, 0);
+    emit8(e, 0x80);
+    modrm_mem(e, 7, base, disp);
+    emit8(e, imm);
+}
+
+
+static void cmp_sibi8(Emitter *e, int base, int index, uint8_t imm) {
+    rex(e, 0, 0, index, base, 0);
+    emit8(e, 0x80);
+    modrm_sib(e, 7, base, index);
+    emit8(e, imm);
+}
+
+
+static void cmp_mi16(Emitter *e, int base, int32_t disp, uint16_t imm) {
+    emit8(e, 0x66);
+    rex(e, 0, 0, 0, base, 0);
+    emit8(e, 0x81);
+    modrm_mem(e, 7, base, disp);
+    emit16(e, imm);
+}
+
+
+static void cmp_mr16(Emitter *e, int base, int32_t disp, int src) {
+    emit8(e, 0x66);
+    rex(e, 0, src, 0, base, 0);
+    emit8(e, 0x39);
+    modrm_mem(e, src, base, disp);
+}
+
+
+static void test_mi8(Emitter *e, int base, int32_t disp, uint8_t imm) {
+    rex(e, 0, 0, 0, base, 0);
+    emit8(e, 0xf6);
+    modrm_mem(e, 0, base, disp);
+    emit8(e, imm);
+}
+
+
+static void test_rr64(Emitter *e, int a, int b) {
+    rex(e, 1, b, 0, a, 0);
+    emit8(e, 0x85);
+    modrm_reg(e, b, a);
+}
+
+
+static void imul_rri64(Emitter *e, int dst, int src, int32_t imm) {
+    rex(e, 1, dst, 0, src, 0);
+    emit8(e, 0x69);
+    modrm_reg(e, dst, src);
+    emit32(e, (uint32_t) imm);
+}
+
+
+// group 1 extensions for the 8-bit ALU ops; the
+// register forms are the extension shifted left 3
+#define ALU_ADD     0
+#define ALU_OR      1
+#define ALU_AND     4
+#define ALU_SUB     5
+#define ALU_XOR     6
+
+static void alu_rr8(Emitter *e, int ext, int dst, int src) {
+    rex(e, 0, src, 0, dst, BYTE_REX(src) || BYTE_REX(dst));
+    emit8(e, ext << 3);
+    modrm_reg(e, src, dst);
+}
+
+
+static void alu_ri8(Emitter *e, int ext, int dst, uint8_t imm) {
+    rex(e, 0, 0, 0, dst, BYTE_REX(dst));
+    emit8(e, 0x80);
+    modrm_reg(e, ext, dst);
+    emit8(e, imm);
+}
+
+
+static void push_r(Emitter *e, int reg) {
+    rex(e, 0, 0, 0, reg, 0);
+    emit8(e, 0x50 + (reg & 7));
+}
+
+
+static void pop_r(Emitter *e, int reg) {
+    rex(e, 0, 0, 0, reg, 0);
+    emit8(e, 0x58 + (reg & 7));
+}
+
+
+static void call_r(Emitter *e, int reg) {
+    rex(e, 0, 0, 0, reg, 0);
+    emit8(e, 0xff);
+    modrm_reg(e, 2, reg);
+}
+
+
+static void jmp_r(Emitter *e, int reg) {
+    rex(e, 0, 0, 0, reg, 0);
+    emit8(e, 0xff);
+    modrm_reg(e, 4, reg);
+}
+
+
+/*
+ * Emits a jump to `target`, or leaves it to patch()
+ * if NULL. Returns where the displacement goes.
+ */
+static uint8_t* jmp_rel32(Emitter *e, const uint8_t *target) {
+    emit8(e, 0xe9);
+    uint8_t *disp = e->p;
+    emit32(e, target ? (uint32_t) (target - (e->p + 4)) : 0);
+    return disp;
+}
+
+
+static uint8_t* jcc_rel32(Emitter *e, uint8_t cc, const uint8_t *target) {
+    emit8(e, 0x0f);
+    emit8(e, 0x80 | cc);
+    uint8_t *disp = e->p;
+    emit32(e, target ? (uint32_t) (target - (e->p + 4)) : 0);
+    return disp;
+}
+
+
+/*
+ * Points the jump whose displacement is at
+ * `disp` at the current position
+ */
+static void patch(Emitter *e, uint8_t *disp) {
+    if (!e->overflow) {
+        uint32_t rel = (uint32_t) (e->p - (disp + 4));
+        memcpy(disp, &rel, sizeof(rel));
+    }
+}
+
+
+// Guest state ------------------------------
+
+static const int pair_regs[3] = { REG_BC, REG_DE, REG_HL };
+static const int32_t pair_off[3] = { STATE_OFF(bc), STATE_OFF(de), STATE_OFF(hl) };
+
+
+/*
+ * Loads every guest register from the state
+ */
+static void fill(Emitter *e) {
+    movzx8_rm(e, REG_A, REG_STATE, STATE_OFF(a));
+    for (int i = 0; i < 3; i++) {
+        movzx16_rm(e, pair_regs[i], REG_STATE, pair_off[i]);
+    }
+}
+
+
+/*
+ * Stores every guest register back into the state
+ */
+static void spill(Emitter *e) {
+    mov_mr8(e, REG_STATE, STATE_OFF(a), REG_A);
+    for (int i = 0; i < 3; i++) {
+        mov_mr16(e, REG_STATE, pair_off[i], pair_regs[i]);
+    }
+}
+
+
+/*
+ * Loads 8080 register `r` (the 3-bit code: B C D E H L M A)
+ * into EAX, zero-extended
+ */
+static void get_reg(Emitter *e, int r) {
+    if (r == 7) {
+        mov_rr32(e, RAX, REG_A);
+    } else if (r == 6) {
+        movzx8_rsib(e, RAX, REG_MEM, REG_HL);
+    } else if (r & 1) {
+        movzx8_rr(e, RAX, pair_regs[r >> 1]);
+    } else {
+        mov_rr32(e, RAX, pair_regs[r >> 1]);
+        shift_ri32(e, SHR, RAX, 8);
+    }
+}
+
+
+static void emit_write(Emitter *e, const BlockCache *cache, int32_t pending,
+    int32_t pending_instrs, uint16_t next);
+
+/*
+ * Stores EAX (8 bits, zero-extended) in 8080 register `r`
+ */
+static void put_reg(Emitter *e, const BlockCache *cache, int r,
+        int32_t pending, int32_t pending_instrs, uint16_t next) {
+    if (r == 7) {
+        mov_rr32(e, REG_A, RAX);
+    } else if (r == 6) {
+        mov_rr32(e, RDX, RAX);
+        mov_rr32(e, RCX, REG_HL);
+        emit_write(e, cache, pending, pending_instrs, next);
+    } else if (r & 1) {
+        mov_rr8(e, pair_regs[r >> 1], RAX);
+    } else {
+        int pair = pair_regs[r >> 1];
+        and_ri32(e, pair, 0xff);
+        shift_ri32(e, SHL, RAX, 8);
+        or_rr32(e, pair, RAX);
+    }
+}
+
+
+/*
+ * Adds the cycles and instructions run since the last
+ * flush to the state
+ */
+static void flush(Emitter *e, int32_t *pending, int32_t *pending_instrs) {
+    if (*pending) {
+        alu_mi64(e, ADD, REG_STATE, STATE_OFF(cycles), *pending);
+        *pending = 0;
+    }
+    if (*pending_instrs) {
+        alu_mi64(e, ADD, REG_STATE, STATE_OFF(instructions), *pending_instrs);
+        *pending_instrs = 0;
+    }
+}
+
+
+/*
+ * Jumps to the exit stub if a block has been
+ * dropped since this one was entered
+ */
+static void check_generation(Emitter *e, const BlockCache *cache, const Jit *jit) {
+    mov_ri64(e, RAX, &cache->generation);
+    mov_rm64(e, RAX, RAX, 0);
+    cmp_rm64(e, RAX, RSP, SLOT_GEN);
+    jcc_rel32(e, CC_NE, jit->exit);
+}
+
+
+/*
+ * Writes DL to the guest address in ECX the way mem_write
+ * does: plain RAM inline, everything else through
+ * mem_write_slow. If that drops a block, exits with PC
+ * at `next`. `pending` cycles are charged around the call so
+ * MMIO sees the same count as in the interpreter.
+ */
+static void emit_write(Emitter *e, const BlockCache *cache, int32_t pending,
+        int32_t pending_instrs, uint16_t next) {
+    const Jit *jit = cache->jit;
+
+    mov_rm64(e, RAX, REG_STATE, STATE_OFF(mem_map));
+    if (offsetof(MemoryMap, attr)) {
+        alu_ri64(e, ADD, RAX, (int32_t) offsetof(MemoryMap, attr));
+    }
+    mov_rr32(e, RSI, RCX);
+    shift_ri32(e, SHR, RSI, PAGE_SHIFT);
+    cmp_sibi8(e, RAX, RSI, PAGE_RAM);
+    uint8_t *slow = jcc_rel32(e, CC_NE, NULL);
+    mov_sibr8(e, REG_MEM, RCX, RDX);
+    uint8_t *done = jmp_rel32(e, NULL);
+
+    patch(e, slow);
+    if (pending) {
+        alu_mi64(e, ADD, REG_STATE, STATE_OFF(cycles), pending);
+    }
+    mov_rr32(e, RSI, RCX);
+    mov_rr64(e, RDI, REG_STATE);
+    mov_ri64(e, RAX, (const void *) mem_write_slow);
+    call_r(e, RAX);
+
+    mov_ri64(e, RAX, &cache->generation);
+    mov_rm64(e, RAX, RAX, 0);
+    cmp_rm64(e, RAX, RSP, SLOT_GEN);
+    uint8_t *same = jcc_rel32(e, CC_E, NULL);
+    if (pending_instrs) {
+        alu_mi64(e, ADD, REG_STATE, STATE_OFF(instructions), pending_instrs);
+    }
+    mov_mi16(e, REG_STATE, STATE_OFF(pc), next);
+    jmp_rel32(e, jit->exit);
+
+    patch(e, same);
+    if (pending) {
+        alu_mi64(e, SUB, REG_STATE, STATE_OFF(cycles), pending);
+    }
+    patch(e, done);
+}
+
+
+// Compilation ------------------------------
+
+// how an opcode treats the flags, for dropping the flag
+// updates that nothing reads
+#define FLAGS_KEEP  0   // leaves them alone
+#define FLAGS_SET   1   // overwrites all five without reading any
+#define FLAGS_READ  2   // anything else
+
+/*
+ * Returns 1 if the opcode is compiled to host code
+ * that doesn't touch the flags
+ */
+static int is_data_op(uint8_t op) {
+    switch (op) {
+        case 0x00:                                  // NOP
+        case 0x01: case 0x11: case 0x21: case 0x31: // LXI
+        case 0x02: case 0x12:                       // STAX
+        case 0x0a: case 0x1a:                       // LDAX
+        case 0x03: case 0x13: case 0x23: case 0x33: // INX
+        case 0x0b: case 0x1b: case 0x2b: case 0x3b: // DCX
+        case 0x06: case 0x0e: case 0x16: case 0x1e: // MVI
+        case 0x26: case 0x2e: case 0x36: case 0x3e:
+        case 0x2a: case 0x32: case 0x3a:            // LHLD STA LDA
+        case 0xeb: case 0xf9:                       // XCHG SPHL
+            return 1;
+    }
+    // MOV, except HLT in the middle of it
+    return op >= 0x40 && op < 0x80 && op != 0x76;
+}
+
+
+static int flag_effect(uint8_t op) {
+    if (is_data_op(op)) {
+        return FLAGS_KEEP;
+    }
+    // ADD, SUB, ANA, XRA, ORA and CMP on a register or an
+    // immediate always write all five flags (see ops.inc)
+    switch (op >> 3) {
+        case 0x80 >> 3: case 0x90 >> 3:
+        case 0xa0 >> 3: case 0xa8 >> 3:
+        case 0xb0 >> 3: case 0xb8 >> 3:
+            return FLAGS_SET;
+    }
+    switch (op) {
+        case 0xc6: case 0xd6: case 0xe6: case 0xee: case 0xf6: case 0xfe:
+            return FLAGS_SET;
+    }
+    return FLAGS_READ;
+}
+
+
+typedef struct compiler_t {
+    Emitter             e;
+    BlockCache          *cache;
+    Jit                 *jit;
+
+    // cycles and instructions not yet added to the state
+    int32_t             pending;
+    int32_t             pending_instrs;
+} Compiler;
+
+
+/*
+ * Sets PC to the constant `target` and enters its block
+ * through the chain stub, or exits if its slot holds
+ * some other block
+ */
+static void chain_to(Compiler *c, uint16_t target) {
+    Emitter *e = &c->e;
+    mov_mi16(e, REG_STATE, STATE_OFF(pc), target);
+    mov_ri64(e, RCX, &c->cache->slots[target & (BLOCK_SLOTS - 1)]);
+    cmp_mi16(e, RCX, BLOCK_OFF(start), target);
+    jcc_rel32(e, CC_NE, c->jit->exit);
+    jmp_rel32(e, c->jit->chain);
+}
+
+
+/*
+ * Same as chain_to for whatever PC a handler left behind
+ */
+static void chain_dynamic(Compiler *c) {
+    Emitter *e = &c->e;
+    movzx16_rm(e, RAX, REG_STATE, STATE_OFF(pc));
+    mov_rr32(e, RCX, RAX);
+    and_ri32(e, RCX, BLOCK_SLOTS - 1);
+    imul_rri64(e, RCX, RCX, (int32_t) sizeof(Block));
+    mov_ri64(e, RDX, c->cache->slots);
+    add_rr64(e, RCX, RDX);
+    cmp_mr16(e, RCX, BLOCK_OFF(start), RAX);
+    jcc_rel32(e, CC_NE, c->jit->exit);
+    jmp_rel32(e, c->jit->chain);
+}
+
+
+/*
+ * Calls the interpreter's handler for `instr` at `addr`,
+ * with the guest registers in the state around it
+ */
+static void call_handler(Compiler *c, BlockInstr *instr, uint16_t addr) {
+    Emitter *e = &c->e;
+    flush(e, &c->pending, &c->pending_instrs);
+    spill(e);
+    mov_mi16(e, REG_STATE, STATE_OFF(pc), addr + 1);
+    mov_rr64(e, RDI, REG_STATE);
+    mov_ri64(e, RSI, instr->op);
+    mov_ri64(e, RAX, (const void *) instr->handler);
+    call_r(e, RAX);
+    fill(e);
+}
+
+
+/*
+ * Conditional jump taken if the flag selected by bits
+ * 3-5 of `op` is set (odd) or clear (even) in the PSW
+ */
+static void emit_jcc(Compiler *c, uint8_t op, uint16_t target, uint16_t next) {
+    static const uint8_t flag_masks[4] = { FLAG_Z, FLAG_CY, FLAG_P, FLAG_S };
+    Emitter *e = &c->e;
+    int cond = (op >> 3) & 7;
+
+#ifdef LAZY_FLAGS
+    // the flag may only be in a pending lazy update
+    cmp_mi8(e, REG_STATE, STATE_OFF(lazy_mask), 0);
+    uint8_t *resolved = jcc_rel32(e, CC_E, NULL);
+    mov_rr64(e, RDI, REG_STATE);
+    mov_ri64(e, RAX, (const void *) flags_resolve);
+    call_r(e, RAX);
+    patch(e, resolved);
+#endif
+
+    test_mi8(e, REG_STATE, STATE_OFF(cc), flag_masks[cond >> 1]);
+    uint8_t *taken = jcc_rel32(e, (cond & 1) ? CC_NE : CC_E, NULL);
+    chain_to(c, next);
+    patch(e, taken);
+    chain_to(c, target);
+}
+
+
+/*
+ * Emits host code for `instr`, an opcode for which
+ * is_data_op() holds or a FLAGS_SET one whose flags
+ * are never read
+ */
+static void emit_native(Compiler *c, BlockInstr *instr, uint16_t next) {
+    Emitter *e = &c->e;
+    uint8_t op = instr->op[0];
+    uint16_t imm = instr->op[1] | (instr->op[2] << 8);
+    int pair = pair_regs[(op >> 4) & 3];
+
+    if (op >= 0x40 && op < 0x80) {
+        // MOV dst,src
+        get_reg(e, op & 7);
+        put_reg(e, c->cache, (op >> 3) & 7, c->pending, c->pending_instrs, next);
+        return;
+    }
+    if (op >= 0x80 && op < 0xc0) {
+        // register ALU op with unread flags; CMP only sets flags
+        int group = (op >> 3) & 7;
+        if (group != 7) {
+            static const int ext[8] = { ALU_ADD, 0, ALU_SUB, 0, ALU_AND, ALU_XOR, ALU_OR, 0 };
+            get_reg(e, op & 7);
+            alu_rr8(e, ext[group], REG_A, RAX);
+        }
+        return;
+    }
+
+    switch (op) {
+        case 0x00:
+            break;
+        case 0x01: case 0x11: case 0x21:
+            mov_ri32(e, pair, imm);
+            break;
+        case 0x31:
+            mov_mi16(e, REG_STATE, STATE_OFF(sp), imm);
+            break;
+        case 0x02: case 0x12:
+            mov_rr32(e, RCX, pair);
+            mov_rr32(e, RDX, REG_A);
+            emit_write(e, c->cache, c->pending, c->pending_instrs, next);
+            break;
+        case 0x0a: case 0x1a:
+            movzx8_rsib(e, REG_A, REG_MEM, pair);
+            break;
+        case 0x03: case 0x13: case 0x23:
+            add_ri16(e, pair, 1);
+            break;
+        case 0x0b: case 0x1b: case 0x2b:
+            add_ri16(e, pair, -1);
+            break;
+        case 0x33:
+            add_mi16(e, REG_STATE, STATE_OFF(sp), 1);
+            break;
+        case 0x3b:
+            add_mi16(e, REG_STATE, STATE_OFF(sp), -1);
+            break;
+        case 0x06: case 0x0e: case 0x16: case 0x1e:
+        case 0x26: case 0x2e: case 0x36: case 0x3e:
+            mov_ri32(e, RAX, instr->op[1]);
+            put_reg(e, c->cache, (op >> 3) & 7, c->pending, c->pending_instrs, next);
+            break;
+        case 0x2a:
+            movzx8_rm(e, REG_HL, REG_MEM, imm);
+            movzx8_rm(e, RAX, REG_MEM, (uint16_t) (imm + 1));
+            shift_ri32(e, SHL, RAX, 8);
+            or_rr32(e, REG_HL, RAX);
+            break;
+        case 0x32:
+            mov_ri32(e, RCX, imm);
+            mov_rr32(e, RDX, REG_A);
+            emit_write(e, c->cache, c->pending, c->pending_instrs, next);
+            break;
+        case 0x3a:
+            movzx8_rm(e, REG_A, REG_MEM, imm);
+            break;
+        case 0xeb:
+            xchg_rr32(e, REG_DE, REG_HL);
+            break;
+        case 0xf9:
+            mov_mr16(e, REG_STATE, STATE_OFF(sp), REG_HL);
+            break;
+        case 0xc6:
+            alu_ri8(e, ALU_ADD, REG_A, instr->op[1]);
+            break;
+        case 0xd6:
+            alu_ri8(e, ALU_SUB, REG_A, instr->op[1]);
+            break;
+        case 0xe6:
+            alu_ri8(e, ALU_AND, REG_A, instr->op[1]);
+            break;
+        case 0xee:
+            alu_ri8(e, ALU_XOR, REG_A, instr->op[1]);
+            break;
+        case 0xf6:
+            alu_ri8(e, ALU_OR, REG_A, instr->op[1]);
+            break;
+        case 0xfe:
+            // CPI only sets flags
+            break;
+    }
+}
+
+
+/*
+ * 1 for JMP and the conditional jumps, which
+ * are compiled to chained exits
+ */
+static int is_jump(uint8_t op) {
+    return op == 0xc3 || (op >= 0xc0 && (op & 7) == 2);
+}
+
+
+/*
+ * Writes the entry, exit and chain stubs at the start of the buffer
+ */
+static void emit_stubs(Jit *jit) {
+    Emitter e = { jit->code, jit->code + JIT_CODE_SIZE, 0 };
+
+    // enter(state, code, end)
+    jit->enter = (void (*)(State8080 *, void *, uint64_t)) (void *) e.p;
+    push_r(&e, RBX);
+    push_r(&e, RBP);
+    push_r(&e, R12);
+    push_r(&e, R13);
+    push_r(&e, R14);
+    push_r(&e, R15);
+    alu_ri64(&e, SUB, RSP, FRAME_SIZE);
+    mov_mr64(&e, RSP, SLOT_END, RDX);
+    mov_rr64(&e, REG_STATE, RDI);
+    mov_rm64(&e, REG_MEM, REG_STATE, STATE_OFF(memory));
+    fill(&e);
+    jmp_r(&e, RSI);
+
+    // PC and the counters are already up to date
+    jit->exit = e.p;
+    spill(&e);
+    alu_ri64(&e, ADD, RSP, FRAME_SIZE);
+    pop_r(&e, R15);
+    pop_r(&e, R14);
+    pop_r(&e, R13);
+    pop_r(&e, R12);
+    pop_r(&e, RBP);
+    pop_r(&e, RBX);
+    emit8(&e, 0xc3);
+
+    // RCX points at the slot for PC: go straight on to its
+    // block if it is compiled, no interrupt can be taken,
+    // and it fits the budget, the same test run_jit makes
+    jit->chain = e.p;
+    cmp_mi8(&e, RCX, BLOCK_OFF(count), 0);
+    jcc_rel32(&e, CC_E, jit->exit);
+    mov_rm64(&e, RAX, RCX, BLOCK_OFF(code));
+    test_rr64(&e, RAX, RAX);
+    jcc_rel32(&e, CC_E, jit->exit);
+    cmp_mi8(&e, REG_STATE, STATE_OFF(int_pending), 0);
+    uint8_t *quiet = jcc_rel32(&e, CC_E, NULL);
+    cmp_mi8(&e, REG_STATE, STATE_OFF(int_enable), 0);
+    jcc_rel32(&e, CC_NE, jit->exit);
+    patch(&e, quiet);
+    movzx16_rm(&e, RDX, RCX, BLOCK_OFF(cycles));
+    add_rm64(&e, RDX, REG_STATE, STATE_OFF(cycles));
+    cmp_rm64(&e, RDX, RSP, SLOT_END);
+    jcc_rel32(&e, CC_A, jit->exit);
+    jmp_r(&e, RAX);
+
+    jit->stubs_end = e.p - jit->code;
+    jit->used = jit->stubs_end;
+}
+
+
+static Jit* jit_new(void) {
+    Jit *jit = calloc(1, sizeof(*jit));
+    if (jit == NULL) {
+        return NULL;
+    }
+    void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    jit->code = code;
+    jit->page = sysconf(_SC_PAGESIZE);
+    emit_stubs(jit);
+    // never writable and executable at once
+    if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC) < 0) {
+        jit_free(jit);
+        return NULL;
+    }
+    return jit;
+}
+
+
+/*
+ * Drops all compiled code, keeping the stubs
+ */
+static void jit_reset(BlockCache *cache) {
+    for (int i = 0; i < BLOCK_SLOTS; i++) {
+        cache->slots[i].code = NULL;
+        cache->slots[i].execs = 0;
+    }
+    cache->jit->used = cache->jit->stubs_end;
+    cache->jit->resets++;
+}
+
+
+/*
+ * Claims the code emitted from `entry`. Returns
+ * NULL if it ran past the end of the buffer.
+ */
+static void* finish(Compiler *c, uint8_t *entry) {
+    if (c->e.overflow) {
+        return NULL;
+    }
+    c->jit->used = c->e.p - c->jit->code;
+    return entry;
+}
+
+
+/*
+ * Emits `block` at the end of the buffer, before `limit`.
+ * Returns its entry point, or NULL if it didn't fit.
+ */
+static void* emit_block(BlockCache *cache, Block *block, size_t limit) {
+    Jit *jit = cache->jit;
+    Compiler c = {
+        { jit->code + jit->used, jit->code + limit, 0 },
+        cache, jit, 0, 0
+    };
+    Emitter *e = &c.e;
+    uint8_t *entry = e->p;
+
+    // flags written by an instruction are dead if a later
+    // one overwrites them all before anything reads them;
+    // they are always live at the end of the block
+    uint8_t flags_dead[BLOCK_MAX_INSTRS];
+    int live = 1;
+    for (int i = block->count - 1; i >= 0; i--) {
+        flags_dead[i] = !live;
+        int effect = flag_effect(block->instrs[i].op[0]);
+        if (effect == FLAGS_SET) {
+            live = 0;
+        } else if (effect == FLAGS_READ) {
+            live = 1;
+        }
+    }
+
+    // remember the generation so that a write which drops
+    // blocks (maybe this one) ends the run
+    mov_ri64(e, RAX, &cache->generation);
+    mov_rm64(e, RAX, RAX, 0);
+    mov_mr64(e, RSP, SLOT_GEN, RAX);
+
+    uint16_t addr = block->start;
+    for (int i = 0; i < block->count; i++) {
+        BlockInstr *instr = &block->instrs[i];
+        uint8_t op = instr->op[0];
+        uint16_t next = addr + instr->len;
+        int last = i == block->count - 1;
+
+        c.pending += instr->cycles;
+        c.pending_instrs++;
+
+        if (is_data_op(op) || (flags_dead[i] && flag_effect(op) == FLAGS_SET)) {
+            emit_native(&c, instr, next);
+        } else if (last && is_jump(op)) {
+            uint16_t target = instr->op[1] | (instr->op[2] << 8);
+            flush(e, &c.pending, &c.pending_instrs);
+            if (op == 0xc3) {
+                chain_to(&c, target);
+            } else {
+                emit_jcc(&c, op, target, next);
+            }
+            return finish(&c, entry);
+        } else {
+            call_handler(&c, instr, addr);
+            if (last) {
+                // CALL, RET, RST, PCHL and their conditional forms
+                // leave PC wherever they went
+                chain_dynamic(&c);
+                return finish(&c, entry);
+            }
+            check_generation(e, cache, jit);
+        }
+        addr = next;
+    }
+
+    // ran into BLOCK_MAX_INSTRS or the end of memory
+    flush(e, &c.pending, &c.pending_instrs);
+    chain_to(&c, addr);
+    return finish(&c, entry);
+}
+
+
+/*
+ * Makes the pages the next block is emitted into writable:
+ * from the one holding `used` to JIT_BLOCK_ROOM past it, or
+ * the end of the buffer. Sets [`from`, `limit`) to them and
+ * returns 0, or -1 if mprotect fails.
+ */
+static int open_room(Jit *jit, size_t *from, size_t *limit) {
+    *from = jit->used & ~(jit->page - 1);
+    *limit = (jit->used + JIT_BLOCK_ROOM + jit->page - 1) & ~(jit->page - 1);
+    if (*limit > JIT_CODE_SIZE) {
+        *limit = JIT_CODE_SIZE;
+    }
+    return mprotect(jit->code + *from, *limit - *from, PROT_READ | PROT_WRITE);
+}
+
+
+int jit_compile(BlockCache *cache, Block *block) {
+    uint8_t last = block->instrs[block->count - 1].op[0];
+    if (last == 0x76 || last == 0xf3 || last == 0xfb) {
+        return -1;
+    }
+    if (cache->jit == NULL) {
+        cache->jit = jit_new();
+        if (cache->jit == NULL) {
+            return -1;
+        }
+    }
+    Jit *jit = cache->jit;
+
+    size_t from, limit;
+    if (open_room(jit, &from, &limit) < 0) {
+        return -1;
+    }
+    void *code = emit_block(cache, block, limit);
+    if (code == NULL && limit == JIT_CODE_SIZE) {
+        // out of room: start over with an empty buffer
+        mprotect(jit->code + from, limit - from, PROT_READ | PROT_EXEC);
+        jit_reset(cache);
+        if (open_room(jit, &from, &limit) < 0) {
+            return -1;
+        }
+        code = emit_block(cache, block, limit);
+    }
+    if (code) {
+        block->code = code;
+        jit->compiled++;
+    }
+    mprotect(jit->code + from, limit - from, PROT_READ | PROT_EXEC);
+    return code ? 0 : -1;
+}
+
+
+void jit_run(State8080 *state, Block *block, uint64_t end) {
+    state->blocks->jit->enter(state, block->code, end);
+}
+
+
+void jit_free(Jit *jit) {
+    if (jit) {
+        munmap(jit->code, JIT_CODE_SIZE);
+        free(jit);
+    }
+}
+
+#else
+
+/*
+ * Makes the pages the next block is emitted into writable:
+ * from the one holding `used` to JIT_BLOCK_ROOM past it, or
+ * the end of the buffer. Sets [`from`, `limit`) to them and
+ * returns 0, or -1 if mprotect fails.
+ */
+static int open_room(Jit *jit, size_t *from, size_t *limit) {
+    *from = jit->used & ~(jit->page - 1);
+    *limit = (jit->used + JIT_BLOCK_ROOM + jit->page - 1) & ~(jit->page - 1);
+    if (*limit > JIT_CODE_SIZE) {
+        *limit = JIT_CODE_SIZE;
+    }
+    return mprotect(jit->code + *from, *limit - *from, PROT_READ | PROT_WRITE);
+}
+
+
+int jit_compile(BlockCache *cache, Block *block) {
+    (void) cache;
+    (void) block;
+    return -1;
+}
+
+
+void jit_run(State8080 *state, Block *block, uint64_t end) {
+    (void) state;
+    (void) block;
+    (void) end;
+}
+
+
+void jit_free(Jit *jit) {
+    (void) jit;
+}
+
+#endif // HAVE_JIT
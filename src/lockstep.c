@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "emu.h"
+#include "lockstep.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "trace.h"
+
+// instructions between full memory comparisons
+#define MEMORY_CHECK_INTERVAL 65536
+
+
+/*
+ * Runs one instruction and delivers any interrupts that
+ * came due, the same way sched_run does in a batch
+ */
+static void step(State8080 *state, Scheduler *sched) {
+    if (state->halted) {
+        // idle until the next interrupt
+        state->cycles = sched->next_deadline;
+    } else if (run_instructions(state, 1) == STOP_INTERRUPT) {
+        service_interrupt(state);
+    }
+    sched_fire_due(sched, state);
+    service_interrupt(state);
+}
+
+
+static void report_byte(const char *field, uint8_t want, uint8_t got) {
+    if (want != got) {
+        printf("  %-6s expected 0x%02x, got 0x%02x\n", field, want, got);
+    }
+}
+
+
+static void report_word(const char *field, uint16_t want, uint16_t got) {
+    if (want != got) {
+        printf("  %-6s expected 0x%04x, got 0x%04x\n", field, want, got);
+    }
+}
+
+
+/*
+ * Prints every field that differs between two records
+ */
+static void report_fields(const TraceRecord *want, const TraceRecord *got) {
+    static const struct { const char *name; uint8_t mask; } flags[] = {
+        { "Z", FLAG_Z }, { "S", FLAG_S }, { "P", FLAG_P },
+        { "CY", FLAG_CY }, { "AC", FLAG_AC },
+    };
+
+    report_word("PC", want->pc, got->pc);
+    report_word("SP", want->sp, got->sp);
+    report_byte("opcode", want->op[0], got->op[0]);
+    report_byte("A", want->a, got->a);
+    report_byte("B", want->b, got->b);
+    report_byte("C", want->c, got->c);
+    report_byte("D", want->d, got->d);
+    report_byte("E", want->e, got->e);
+    report_byte("H", want->h, got->h);
+    report_byte("L", want->l, got->l);
+    for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        int w = (want->psw & flags[i].mask) != 0;
+        int g = (got->psw & flags[i].mask) != 0;
+        if (w != g) {
+            printf("  flag %-2s expected %d, got %d\n", flags[i].name, w, g);
+        }
+    }
+    if (want->cycles != got->cycles) {
+        printf("  cycles expected %" PRIu64 ", got %" PRIu64 "\n",
+            want->cycles, got->cycles);
+    }
+}
+
+
+/*
+ * Prints the last state both sides agreed on (`prev_label`,
+ * `prev`) and the two states they went on to
+ */
+static void report_divergence(uint64_t index, const char *prev_label,
+        const TraceRecord *prev, const TraceRecord *want, const TraceRecord *got) {
+    printf("Divergence before instruction %" PRIu64 "\n", index);
+    if (prev) {
+        printf("%s:\n  ", prev_label);
+        trace_print_record(prev);
+    }
+    printf("expected:\n  ");
+    trace_print_record(want);
+    printf("got:\n  ");
+    trace_print_record(got);
+    report_fields(want, got);
+}
+
+
+int lockstep_trace(const RomImage *rom, Engine engine,
+        const char *trace_path, uint64_t max_instrs) {
+    size_t count;
+    const TraceRecord *records = trace_map(trace_path, &count);
+    if (records == NULL) {
+        return -1;
+    }
+    if (max_instrs && max_instrs < count) {
+        count = max_instrs;
+    }
+
+    State8080 state;
+    if (emu_load(&state, rom) < 0) {
+        trace_unmap(records, count);
+        return -1;
+    }
+    state.engine = engine;
+
+    Scheduler sched;
+    sched_init(&sched);
+    invaders_schedule_interrupts(&sched, state.cycles);
+
+    int result = 0;
+    TraceRecord got;
+    for (size_t i = 0; i < count; i++) {
+        trace_capture(&got, &state);
+        if (memcmp(&records[i], &got, sizeof(got)) != 0) {
+            report_divergence(i, "after executing", i ? &records[i - 1] : NULL,
+                &records[i], &got);
+            result = 1;
+            break;
+        }
+        step(&state, &sched);
+    }
+    if (result == 0) {
+        printf("%s matched all %zu instructions of %s\n",
+            engine_name(engine), count, trace_path);
+    }
+
+    emu_unload(&state);
+    trace_unmap(records, count);
+    return result;
+}
+
+
+/*
+ * Compares all of guest memory, printing the first
+ * differing address. Returns 1 if they differ.
+ */
+static int compare_memory(const State8080 *a, const State8080 *b) {
+    if (memcmp(a->memory, b->memory, MEM_SIZE) == 0) {
+        return 0;
+    }
+    for (int addr = 0; addr < MEM_SIZE; addr++) {
+        if (a->memory[addr] != b->memory[addr]) {
+            printf("  memory at 0x%04x: 0x%02x vs 0x%02x\n",
+                addr, a->memory[addr], b->memory[addr]);
+            break;
+        }
+    }
+    return 1;
+}
+
+
+int lockstep_engines(const RomImage *rom, Engine a, Engine b,
+        uint64_t max_instrs, uint64_t batch) {
+    State8080 state[2];
+    Scheduler sched[2];
+    Engine engines[2] = { a, b };
+    for (int i = 0; i < 2; i++) {
+        if (emu_load(&state[i], rom) < 0) {
+            if (i) {
+                emu_unload(&state[0]);
+            }
+            return -1;
+        }
+        state[i].engine = engines[i];
+        sched_init(&sched[i]);
+        invaders_schedule_interrupts(&sched[i], state[i].cycles);
+    }
+
+    int result = 0;
+    TraceRecord prev, want, got;
+    trace_capture(&want, &state[0]);
+    for (uint64_t n = 1; max_instrs == 0 || state[0].instructions < max_instrs; n++) {
+        if (state[0].halted && !state[0].int_enable) {
+            break;
+        }
+        prev = want;
+        for (int i = 0; i < 2; i++) {
+            if (batch) {
+                sched_run(&sched[i], &state[i], batch);
+            } else {
+                step(&state[i], &sched[i]);
+            }
+        }
+
+        trace_capture(&want, &state[0]);
+        trace_capture(&got, &state[1]);
+        if (memcmp(&want, &got, sizeof(got)) != 0) {
+            report_divergence(state[0].instructions, "last matching state", &prev, &want, &got);
+            result = 1;
+            break;
+        }
+        if ((batch || n % MEMORY_CHECK_INTERVAL == 0)
+                && compare_memory(&state[0], &state[1])) {
+            printf("Memory diverged by instruction %" PRIu64 "\n",
+                state[0].instructions);
+            result = 1;
+            break;
+        }
+    }
+    if (result == 0 && compare_memory(&state[0], &state[1])) {
+        printf("Memory diverged by the end of the run\n");
+        result = 1;
+    }
+    if (result == 0) {
+        printf("%s and %s matched for %" PRIu64 " instructions\n",
+            engine_name(a), engine_name(b), state[0].instructions);
+    }
+
+    emu_unload(&state[0]);
+    emu_unload(&state[1]);
+    return result;
+}
@@ -1,13 +1,427 @@
+#include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "cpm.h"
+#include "debugger.h"
 #include "disassembler.h"
 #include "emu.h"
+#include "lockstep.h"
+#include "rom.h"
+#include "trace.h"
 
-int main(int argc, char **argv) {
-    if (argv) {
-        // disassemble8080file(argv[1]);
-        load_and_run(argv[1]);
+
+// long options with no short form
+enum {
+    OPT_TRACE_LAST = 256,
+    OPT_DECODE_TRACE,
+    OPT_ENGINE,
+    OPT_LOCKSTEP,
+    OPT_LOCKSTEP_ENGINES,
+    OPT_LOCKSTEP_CYCLES,
+    OPT_LOAD_SNAPSHOT,
+    OPT_SAVE_SNAPSHOT,
+    OPT_REWIND,
+    OPT_REWIND_BACK,
+    OPT_SCREENSHOT,
+    OPT_SOUND,
+    OPT_SOUND_SAMPLES,
+    OPT_RECORD_MOVIE,
+    OPT_INPUT_SCRIPT,
+    OPT_MOVIE_CHECKS,
+    OPT_PLAY_MOVIE,
+    OPT_PROFILE,
+    OPT_PROFILE_SAMPLE,
+    OPT_PROFILE_SYMBOLS,
+    OPT_CPM,
+    OPT_CPM_ENGINES,
+    OPT_CPM_EXPECT,
+    OPT_RECURSIVE,
+    OPT_ENTRY,
+    OPT_BREAK,
+    OPT_REALTIME,
+    OPT_WATCH,
+};
+
+
+static void usage(char *prog) {
+    printf("Usage: %s [options] <rom>\n", prog);
+    printf("       %s [options] --manifest <file>\n", prog);
+    printf("  -H, --headless        run with no per-instruction I/O and\n");
+    printf("                        report instructions/sec at exit\n");
+    printf("  -n, --max-instrs N    stop a headless run once N instructions\n");
+    printf("                        have run (checked once per frame)\n");
+    printf("  -m, --manifest FILE   load a ROM set listed as \"<file> <address>\"\n");
+    printf("                        lines, instead of one ROM at 0x0000\n");
+    printf("  -t, --trace FILE      write a binary trace of a headless run to FILE\n");
+    printf("      --trace-last N    only keep the last N instructions in an\n");
+    printf("                        in-memory ring, written to FILE at exit\n");
+    printf("      --decode-trace FILE\n");
+    printf("                        print a binary trace as text and exit\n");
+    printf("      --engine NAME     run on the switch, table, threaded, block or jit engine\n");
+    printf("      --lockstep FILE   check a run against the trace in FILE, stopping\n");
+    printf("                        at the first instruction where they diverge\n");
+    printf("      --lockstep-engines A,B\n");
+    printf("                        run on engines A and B side by side, stopping\n");
+    printf("                        at the first instruction where they diverge\n");
+    printf("      --lockstep-cycles N\n");
+    printf("                        with --lockstep-engines, run and compare N cycles\n");
+    printf("                        at a time rather than single instructions\n");
+    printf("      --load-snapshot FILE\n");
+    printf("                        start a headless run from the snapshot in FILE\n");
+    printf("      --save-snapshot FILE\n");
+    printf("                        save the state at the end of a headless run to FILE\n");
+    printf("      --rewind N        keep the last N frames of a headless run\n");
+    printf("                        as a rewind history\n");
+    printf("      --rewind-back N   step back N frames through the history\n");
+    printf("                        before exiting (and saving a snapshot)\n");
+    printf("      --screenshot FILE convert the screen every frame of a headless run\n");
+    printf("                        and write the last one to FILE (PGM or PPM)\n");
+    printf("      --sound FILE      mix the sound of a headless run into the WAV FILE\n");
+    printf("      --sound-samples DIR\n");
+    printf("                        play the samples DIR/0.wav to 8.wav rather\n");
+    printf("                        than plain tones\n");
+    printf("      --record-movie FILE\n");
+    printf("                        record the input ports of a headless run to FILE,\n");
+    printf("                        with RAM hashes to check a replay against\n");
+    printf("      --input-script FILE\n");
+    printf("                        press the buttons listed in FILE as\n");
+    printf("                        \"<frame> press|release <button>\" lines\n");
+    printf("      --movie-checks N  hash RAM every N frames of a recording (default 60)\n");
+    printf("      --play-movie FILE replay the movie in FILE headless, stopping at\n");
+    printf("                        its end or at the first hash that doesn't match\n");
+    printf("      --profile FILE    count opcodes and PCs during a headless run, print\n");
+    printf("                        the hot spots and write the counts to FILE\n");
+    printf("                        (JSON if it ends in .json, CSV otherwise)\n");
+    printf("      --profile-sample N\n");
+    printf("                        sample the PC every N instructions (default 1: all)\n");
+    printf("      --profile-symbols FILE\n");
+    printf("                        name hot spots after \"<address> <name>\" lines in FILE\n");
+    printf("      --cpm             run the file as a CP/M program at 0x0100, such as a\n");
+    printf("                        CPU exerciser, printing its console until it exits\n");
+    printf("      --cpm-engines LIST\n");
+    printf("                        with --cpm, run on each of the comma-separated\n");
+    printf("                        engines (or all) and check they print the same\n");
+    printf("      --cpm-expect TEXT with --cpm, fail unless the program prints TEXT\n");
+    printf("      --realtime        pace a headless run at 2 MHz and 60 frames a\n");
+    printf("                        second, drawing every frame, and report the\n");
+    printf("                        frame timing\n");
+    printf("      --break ADDR[:COND]\n");
+    printf("                        stop when PC reaches ADDR (and COND, such as\n");
+    printf("                        a==0x20, hl>=0x2400 or [0x20c0]!=0, holds)\n");
+    printf("      --watch ADDR[+LEN][:r|w|rw]\n");
+    printf("                        stop when the LEN bytes at ADDR are read or\n");
+    printf("                        written (default: written)\n");
+    printf("  -d, --disassemble     disassemble the ROM and exit\n");
+    printf("      --recursive       with -d, only disassemble code reached from the\n");
+    printf("                        entry points, listing the rest as data\n");
+    printf("      --entry ADDR      with --recursive, start from ADDR (repeatable;\n");
+    printf("                        default 0x0000, 0x0008 and 0x0010)\n");
+    printf("  -h, --help            show this message\n");
+}
+
+
+/*
+ * --cpm: runs the CP/M program `path` on `engine`, or on each
+ * engine in the comma-separated `list` ("all" for every one
+ * built for this host). Returns the exit status.
+ */
+static int run_cpm(const char *path, Engine engine, char *list,
+        uint64_t max_instrs, const char *expect) {
+    Engine engines[ENGINE_COUNT];
+    int count = 0;
+    if (list == NULL) {
+        engines[count++] = engine;
+    } else if (strcmp(list, "all") == 0) {
+        for (Engine e = ENGINE_DEFAULT + 1; e < ENGINE_COUNT; e++) {
+            if (engine_available(e)) {
+                engines[count++] = e;
+            }
+        }
+    } else {
+        for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+            if (count == ENGINE_COUNT || engine_from_name(name, &engines[count]) < 0) {
+                fprintf(stderr, "Error: unknown engine %s\n", name);
+                return 1;
+            }
+            count++;
+        }
     }
-    return 0;
+
+    RomImage program;
+    if (cpm_load(&program, path) < 0) {
+        return 1;
+    }
+    int status = cpm_run_engines(&program, engines, count, max_instrs, expect);
+    rom_image_free(&program);
+    return status;
 }
 
+
+int main(int argc, char **argv) {
+    static struct option long_opts[] = {
+        {"headless",    no_argument,       NULL, 'H'},
+        {"max-instrs",  required_argument, NULL, 'n'},
+        {"manifest",    required_argument, NULL, 'm'},
+        {"trace",       required_argument, NULL, 't'},
+        {"trace-last",  required_argument, NULL, OPT_TRACE_LAST},
+        {"decode-trace", required_argument, NULL, OPT_DECODE_TRACE},
+        {"engine",      required_argument, NULL, OPT_ENGINE},
+        {"lockstep",    required_argument, NULL, OPT_LOCKSTEP},
+        {"lockstep-engines", required_argument, NULL, OPT_LOCKSTEP_ENGINES},
+        {"lockstep-cycles", required_argument, NULL, OPT_LOCKSTEP_CYCLES},
+        {"load-snapshot", required_argument, NULL, OPT_LOAD_SNAPSHOT},
+        {"save-snapshot", required_argument, NULL, OPT_SAVE_SNAPSHOT},
+        {"rewind",      required_argument, NULL, OPT_REWIND},
+        {"rewind-back", required_argument, NULL, OPT_REWIND_BACK},
+        {"screenshot",  required_argument, NULL, OPT_SCREENSHOT},
+        {"sound",       required_argument, NULL, OPT_SOUND},
+        {"sound-samples", required_argument, NULL, OPT_SOUND_SAMPLES},
+        {"record-movie", required_argument, NULL, OPT_RECORD_MOVIE},
+        {"input-script", required_argument, NULL, OPT_INPUT_SCRIPT},
+        {"movie-checks", required_argument, NULL, OPT_MOVIE_CHECKS},
+        {"play-movie",  required_argument, NULL, OPT_PLAY_MOVIE},
+        {"profile",     required_argument, NULL, OPT_PROFILE},
+        {"profile-sample", required_argument, NULL, OPT_PROFILE_SAMPLE},
+        {"profile-symbols", required_argument, NULL, OPT_PROFILE_SYMBOLS},
+        {"cpm",         no_argument,       NULL, OPT_CPM},
+        {"cpm-engines", required_argument, NULL, OPT_CPM_ENGINES},
+        {"cpm-expect",  required_argument, NULL, OPT_CPM_EXPECT},
+        {"disassemble", no_argument,       NULL, 'd'},
+        {"realtime",    no_argument,       NULL, OPT_REALTIME},
+        {"break",       required_argument, NULL, OPT_BREAK},
+        {"watch",       required_argument, NULL, OPT_WATCH},
+        {"recursive",   no_argument,       NULL, OPT_RECURSIVE},
+        {"entry",       required_argument, NULL, OPT_ENTRY},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int headless = 0;
+    int disassemble = 0;
+    int recursive = 0;
+    uint16_t entries[64];
+    int entry_count = 0;
+    size_t max_instrs = 0;
+    char *manifest = NULL;
+    char *trace_path = NULL;
+    size_t trace_last = 0;
+    Engine engine = ENGINE_DEFAULT;
+    char *load_snapshot = NULL;
+    char *save_snapshot = NULL;
+    size_t rewind_frames = 0;
+    size_t rewind_back = 0;
+    char *screenshot = NULL;
+    char *sound = NULL;
+    char *sound_samples = NULL;
+    char *record_movie = NULL;
+    char *input_script = NULL;
+    uint32_t movie_checks = 0;
+    char *play_movie = NULL;
+    char *profile = NULL;
+    uint32_t profile_sample = 0;
+    char *profile_symbols = NULL;
+    int cpm = 0;
+    char *cpm_engines = NULL;
+    char *cpm_expect = NULL;
+    int realtime = 0;
+    Debugger *debug = NULL;
+    char *lockstep = NULL;
+    int lockstep_pair = 0;
+    Engine lockstep_with = ENGINE_DEFAULT;
+    uint64_t lockstep_cycles = 0;
+    char *comma;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "Hn:m:t:dh", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'H':
+                headless = 1;
+                break;
+            case 'n':
+                max_instrs = strtoull(optarg, NULL, 0);
+                break;
+            case 'm':
+                manifest = optarg;
+                break;
+            case 't':
+                trace_path = optarg;
+                break;
+            case OPT_TRACE_LAST:
+                trace_last = strtoull(optarg, NULL, 0);
+                break;
+            case OPT_DECODE_TRACE:
+                return trace_decode(optarg) < 0 ? 1 : 0;
+            case OPT_ENGINE:
+                if (engine_from_name(optarg, &engine) < 0) {
+                    fprintf(stderr, "Error: unknown engine %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_LOCKSTEP:
+                lockstep = optarg;
+                break;
+            case OPT_LOCKSTEP_ENGINES:
+                comma = strchr(optarg, ',');
+                if (comma == NULL) {
+                    fprintf(stderr, "Error: expected two engines, e.g. switch,table\n");
+                    return 1;
+                }
+                *comma = '\0';
+                if (engine_from_name(optarg, &engine) < 0
+                        || engine_from_name(comma + 1, &lockstep_with) < 0) {
+                    fprintf(stderr, "Error: unknown engine in %s,%s\n", optarg, comma + 1);
+                    return 1;
+                }
+                lockstep_pair = 1;
+                break;
+            case OPT_LOCKSTEP_CYCLES:
+                lockstep_cycles = strtoull(optarg, NULL, 0);
+                break;
+            case OPT_LOAD_SNAPSHOT:
+                load_snapshot = optarg;
+                break;
+            case OPT_SAVE_SNAPSHOT:
+                save_snapshot = optarg;
+                break;
+            case OPT_REWIND:
+                rewind_frames = strtoull(optarg, NULL, 0);
+                break;
+            case OPT_REWIND_BACK:
+                rewind_back = strtoull(optarg, NULL, 0);
+                break;
+            case OPT_SCREENSHOT:
+                screenshot = optarg;
+                break;
+            case OPT_SOUND:
+                sound = optarg;
+                break;
+            case OPT_SOUND_SAMPLES:
+                sound_samples = optarg;
+                break;
+            case OPT_RECORD_MOVIE:
+                record_movie = optarg;
+                break;
+            case OPT_INPUT_SCRIPT:
+                input_script = optarg;
+                break;
+            case OPT_MOVIE_CHECKS:
+                movie_checks = strtoul(optarg, NULL, 0);
+                break;
+            case OPT_PLAY_MOVIE:
+                play_movie = optarg;
+                break;
+            case OPT_PROFILE:
+                profile = optarg;
+                break;
+            case OPT_PROFILE_SAMPLE:
+                profile_sample = strtoul(optarg, NULL, 0);
+                break;
+            case OPT_PROFILE_SYMBOLS:
+                profile_symbols = optarg;
+                break;
+            case OPT_CPM:
+                cpm = 1;
+                break;
+            case OPT_CPM_ENGINES:
+                cpm_engines = optarg;
+                break;
+            case OPT_CPM_EXPECT:
+                cpm_expect = optarg;
+                break;
+            case OPT_REALTIME:
+                realtime = 1;
+                break;
+            case OPT_BREAK:
+            case OPT_WATCH:
+                if (debug == NULL && (debug = debug_new()) == NULL) {
+                    return 1;
+                }
+                if ((opt == OPT_BREAK ? debug_add_break(debug, optarg)
+                        : debug_add_watch(debug, optarg)) < 0) {
+                    debug_free(debug);
+                    return 1;
+                }
+                break;
+            case 'd':
+                disassemble = 1;
+                break;
+            case OPT_RECURSIVE:
+                recursive = 1;
+                break;
+            case OPT_ENTRY:
+                if (entry_count == (int) (sizeof(entries) / sizeof(entries[0]))) {
+                    fprintf(stderr, "Error: too many entry points\n");
+                    return 1;
+                }
+                entries[entry_count++] = strtoul(optarg, NULL, 0);
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    char *filename = optind < argc ? argv[optind] : NULL;
+    if (filename == NULL && (manifest == NULL || disassemble)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (disassemble) {
+        return disassemble8080file(filename, recursive, entries, entry_count);
+    }
+
+    if (cpm) {
+        return run_cpm(filename, engine, cpm_engines, max_instrs, cpm_expect);
+    }
+
+    RomImage rom;
+    int loaded = manifest
+        ? rom_image_load_manifest(&rom, manifest)
+        : rom_image_load_file(&rom, filename);
+    if (loaded < 0) {
+        return 1;
+    }
+
+    int status = 0;
+    if (lockstep) {
+        status = lockstep_trace(&rom, engine, lockstep, max_instrs) != 0;
+    } else if (lockstep_pair) {
+        status = lockstep_engines(&rom, engine, lockstep_with, max_instrs,
+            lockstep_cycles) != 0;
+    } else if (headless) {
+        HeadlessOpts opts = {
+            .engine = engine,
+            .max_instrs = max_instrs,
+            .trace_path = trace_path,
+            .trace_last = trace_last,
+            .load_snapshot = load_snapshot,
+            .save_snapshot = save_snapshot,
+            .rewind_frames = rewind_frames,
+            .rewind_back = rewind_back,
+            .screenshot = screenshot,
+            .sound = sound,
+            .sound_samples = sound_samples,
+            .record_movie = record_movie,
+            .input_script = input_script,
+            .movie_checks = movie_checks,
+            .play_movie = play_movie,
+            .profile = profile,
+            .profile_period = profile_sample,
+            .profile_symbols = profile_symbols,
+            .realtime = realtime,
+            .debug = debug,
+        };
+        status = run_headless(&rom, &opts) != 0;
+    } else {
+        load_and_run(&rom, engine, debug);
+    }
+    debug_free(debug);
+    rom_image_free(&rom);
+    return status;
+}
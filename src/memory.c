@@ -0,0 +1,167 @@
+#include <string.h>
+#include <sys/mman.h>
+
+#include "block.h"
+#include "debugger.h"
+#include "memory.h"
+
+
+uint8_t* mem_alloc(void) {
+    // mapped rather than malloc'd so it can be released the
+    // same way as a copy-on-write ROM image mapping
+    void *memory = mmap(NULL, MEM_SIZE + MEM_GUARD, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+
+void mem_free(uint8_t *memory) {
+    if (memory) {
+        munmap(memory, MEM_SIZE + MEM_GUARD);
+    }
+}
+
+
+uint64_t mem_hash(const uint8_t *memory) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < MEM_SIZE; i++) {
+        hash ^= memory[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
+void mem_map_init(MemoryMap *map) {
+    memset(map, 0, sizeof(*map));
+    for (int page = 0; page < NUM_PAGES; page++) {
+        map->mirror_next[page] = page;
+    }
+}
+
+
+void mem_set_attr(MemoryMap *map, uint16_t start, size_t len, uint8_t attr) {
+    size_t first = start >> PAGE_SHIFT;
+    size_t last = (start + len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    for (size_t page = first; page < last && page < NUM_PAGES; page++) {
+        // keep the mirror bit, it describes the ring not the page
+        map->attr[page] = attr | (map->attr[page] & PAGE_MIRROR);
+    }
+}
+
+
+void mem_protect(MemoryMap *map, uint16_t start, size_t len) {
+    size_t first = ((size_t) start + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    size_t last = (start + len) >> PAGE_SHIFT;
+    if (last > first) {
+        mem_set_attr(map, first << PAGE_SHIFT, (last - first) << PAGE_SHIFT, PAGE_ROM);
+    }
+}
+
+
+void mem_mirror(MemoryMap *map, uint16_t src, uint16_t dst, size_t len) {
+    size_t pages = (len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    for (size_t i = 0; i < pages; i++) {
+        uint8_t s = (src >> PAGE_SHIFT) + i;
+        uint8_t d = (dst >> PAGE_SHIFT) + i;
+
+        // splice d into the ring after s
+        map->mirror_next[d] = map->mirror_next[s];
+        map->mirror_next[s] = d;
+        map->attr[d] = map->attr[s] | PAGE_MIRROR;
+        map->attr[s] |= PAGE_MIRROR;
+    }
+}
+
+
+void mem_map_invaders(MemoryMap *map) {
+    mem_map_init(map);
+    mem_mirror(map, 0x2000, 0x4000, 0x2000);
+}
+
+
+uint8_t mem_canonical_page(const MemoryMap *map, uint8_t page) {
+    uint8_t lowest = page;
+    if (map->attr[page] & PAGE_MIRROR) {
+        for (uint8_t p = map->mirror_next[page]; p != page; p = map->mirror_next[p]) {
+            if (p < lowest) {
+                lowest = p;
+            }
+        }
+    }
+    return lowest;
+}
+
+
+void mem_track_reset(MemoryMap *map) {
+    memset(map->dirty, 0, sizeof(map->dirty));
+    for (int page = 0; page < NUM_PAGES; page++) {
+        if (!(map->attr[page] & (PAGE_ROM | PAGE_MMIO))) {
+            map->attr[page] |= PAGE_TRACK;
+        }
+    }
+}
+
+
+void mem_track_stop(MemoryMap *map) {
+    for (int page = 0; page < NUM_PAGES; page++) {
+        map->attr[page] &= ~PAGE_TRACK;
+    }
+}
+
+
+/*
+ * Records the first write to `page` since the last
+ * mem_track_reset. One dirty page covers a whole
+ * mirror ring, so the rest of the ring is disarmed too.
+ */
+static void mark_dirty(MemoryMap *map, uint8_t page) {
+    map->dirty[mem_canonical_page(map, page)] = 1;
+    map->attr[page] &= ~PAGE_TRACK;
+    if (map->attr[page] & PAGE_MIRROR) {
+        for (uint8_t p = map->mirror_next[page]; p != page; p = map->mirror_next[p]) {
+            map->attr[p] &= ~PAGE_TRACK;
+        }
+    }
+}
+
+
+void mem_write_slow(State8080 *state, uint16_t addr, uint8_t val) {
+    MemoryMap *map = state->mem_map;
+    uint8_t page = addr >> PAGE_SHIFT;
+    uint8_t attr = map->attr[page];
+
+    if (attr & PAGE_WATCH) {
+        debug_check_write(state, addr, val);
+    }
+    if (attr & PAGE_ROM) {
+        return;
+    }
+    if (attr & PAGE_MMIO) {
+        if (map->mmio_write) {
+            map->mmio_write(map->mmio_ctx, addr, val);
+        }
+        return;
+    }
+
+    if (attr & PAGE_TRACK) {
+        mark_dirty(map, page);
+    }
+
+    state->memory[addr] = val;
+    if (attr & PAGE_CODE) {
+        block_invalidate(state, addr);
+    }
+    if (attr & PAGE_MIRROR) {
+        uint8_t offset = addr & (PAGE_SIZE - 1);
+        for (uint8_t p = map->mirror_next[page]; p != page; p = map->mirror_next[p]) {
+            if (map->attr[p] & PAGE_WATCH) {
+                debug_check_write(state, (p << PAGE_SHIFT) | offset, val);
+            }
+            state->memory[(p << PAGE_SHIFT) | offset] = val;
+            if (map->attr[p] & PAGE_CODE) {
+                block_invalidate(state, (p << PAGE_SHIFT) | offset);
+            }
+        }
+    }
+}
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "movie.h"
+
+// the Invaders buttons an input script can name
+static const struct {
+    const char          *name;
+    uint8_t             port;
+    uint8_t             mask;
+} buttons[] = {
+    {"coin",        1, INV1_COIN},
+    {"p1start",     1, INV1_P1_START},
+    {"p1shot",      1, INV1_P1_SHOT},
+    {"p1left",      1, INV1_P1_LEFT},
+    {"p1right",     1, INV1_P1_RIGHT},
+    {"p2start",     1, INV1_P2_START},
+    {"p2shot",      2, INV2_P2_SHOT},
+    {"p2left",      2, INV2_P2_LEFT},
+    {"p2right",     2, INV2_P2_RIGHT},
+    {"tilt",        2, INV2_TILT},
+};
+
+
+Movie* movie_new(const IoMap *io) {
+    Movie *movie = calloc(1, sizeof(*movie));
+    if (movie && io) {
+        memcpy(movie->last, io->in_value, NUM_PORTS);
+    }
+    return movie;
+}
+
+
+void movie_free(Movie *movie) {
+    if (movie) {
+        free(movie->inputs);
+        free(movie->checks);
+        free(movie);
+    }
+}
+
+
+/*
+ * Makes room for one more element in `*array`.
+ * Returns 0 on success and -1 if out of memory.
+ */
+static int grow(void **array, size_t *capacity, size_t count, size_t size) {
+    if (count < *capacity) {
+        return 0;
+    }
+    size_t bigger = *capacity ? 2 * *capacity : 256;
+    void *grown = realloc(*array, bigger * size);
+    if (grown == NULL) {
+        return -1;
+    }
+    *array = grown;
+    *capacity = bigger;
+    return 0;
+}
+
+
+int movie_record_inputs(Movie *movie, uint32_t frame, const IoMap *io) {
+    if (memcmp(movie->last, io->in_value, NUM_PORTS) == 0) {
+        return 0;
+    }
+    for (int port = 0; port < NUM_PORTS; port++) {
+        if (io->in_value[port] == movie->last[port]) {
+            continue;
+        }
+        if (grow((void **) &movie->inputs, &movie->input_capacity,
+                movie->input_count, sizeof(MovieInput)) < 0) {
+            return -1;
+        }
+        MovieInput *input = &movie->inputs[movie->input_count++];
+        input->frame = frame;
+        input->port = port;
+        input->value = io->in_value[port];
+        input->pad = 0;
+        movie->last[port] = io->in_value[port];
+    }
+    return 0;
+}
+
+
+int movie_record_check(Movie *movie, uint32_t frame, const uint8_t *memory) {
+    if (grow((void **) &movie->checks, &movie->check_capacity,
+            movie->check_count, sizeof(MovieCheck)) < 0) {
+        return -1;
+    }
+    MovieCheck *check = &movie->checks[movie->check_count++];
+    check->frame = frame;
+    check->pad = 0;
+    check->ram_hash = mem_hash(memory);
+    return 0;
+}
+
+
+void movie_apply(Movie *movie, uint32_t frame, IoMap *io) {
+    while (movie->next_input < movie->input_count
+            && movie->inputs[movie->next_input].frame <= frame) {
+        MovieInput *input = &movie->inputs[movie->next_input++];
+        io->in_value[input->port] = input->value;
+    }
+}
+
+
+int movie_check(Movie *movie, uint32_t frame, const uint8_t *memory,
+        uint64_t *expected) {
+    while (movie->next_check < movie->check_count
+            && movie->checks[movie->next_check].frame < frame) {
+        movie->next_check++;
+    }
+    if (movie->next_check == movie->check_count
+            || movie->checks[movie->next_check].frame != frame) {
+        return 0;
+    }
+
+    MovieCheck *check = &movie->checks[movie->next_check++];
+    if (mem_hash(memory) != check->ram_hash) {
+        *expected = check->ram_hash;
+        return -1;
+    }
+    return 0;
+}
+
+
+int movie_write(const Movie *movie, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return -1;
+    }
+
+    MovieHeader header = {
+        .magic = MOVIE_MAGIC,
+        .version = MOVIE_VERSION,
+        .frames = movie->frames,
+        .input_count = movie->input_count,
+        .check_count = movie->check_count,
+    };
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && fwrite(movie->inputs, sizeof(MovieInput), movie->input_count, f)
+            == movie->input_count
+        && fwrite(movie->checks, sizeof(MovieCheck), movie->check_count, f)
+            == movie->check_count;
+    if (fclose(f) != 0 || !ok) {
+        fprintf(stderr, "Error: couldn't write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+
+Movie* movie_read(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return NULL;
+    }
+
+    MovieHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != MOVIE_MAGIC) {
+        fprintf(stderr, "Error: %s is not a movie\n", path);
+        fclose(f);
+        return NULL;
+    }
+    if (header.version != MOVIE_VERSION) {
+        fprintf(stderr, "Error: %s is a version %u movie, expected version %u\n",
+            path, header.version, MOVIE_VERSION);
+        fclose(f);
+        return NULL;
+    }
+
+    // the counts have to fit what the file holds
+    // before anything is allocated for them
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, sizeof(header), SEEK_SET);
+    uint64_t need = sizeof(header) + (uint64_t) header.input_count * sizeof(MovieInput)
+        + (uint64_t) header.check_count * sizeof(MovieCheck);
+    if (size < 0 || need > (uint64_t) size) {
+        fprintf(stderr, "Error: %s is truncated\n", path);
+        fclose(f);
+        return NULL;
+    }
+
+    Movie *movie = movie_new(NULL);
+    int ok = movie != NULL;
+    if (ok) {
+        movie->frames = header.frames;
+        movie->input_count = movie->input_capacity = header.input_count;
+        movie->check_count = movie->check_capacity = header.check_count;
+        movie->inputs = malloc(((size_t) header.input_count + 1) * sizeof(MovieInput));
+        movie->checks = malloc(((size_t) header.check_count + 1) * sizeof(MovieCheck));
+        ok = movie->inputs && movie->checks
+            && fread(movie->inputs, sizeof(MovieInput), header.input_count, f)
+                == header.input_count
+            && fread(movie->checks, sizeof(MovieCheck), header.check_count, f)
+                == header.check_count;
+    }
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "Error: couldn't read %s\n", path);
+        movie_free(movie);
+        return NULL;
+    }
+    return movie;
+}
+
+
+int movie_script_read(MovieScript *script, const char *path) {
+    memset(script, 0, sizeof(*script));
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return -1;
+    }
+
+    size_t capacity = 0;
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+
+        unsigned long frame;
+        char action[16], name[16];
+        int fields = sscanf(line, "%lu %15s %15s", &frame, action, name);
+        if (fields <= 0) {
+            continue;
+        }
+
+        MoviePress press = {.frame = frame};
+        int known = 0;
+        for (size_t i = 0; fields == 3 && i < sizeof(buttons) / sizeof(buttons[0]); i++) {
+            if (strcmp(name, buttons[i].name) == 0) {
+                press.port = buttons[i].port;
+                press.mask = buttons[i].mask;
+                known = 1;
+            }
+        }
+        press.pressed = fields == 3 && strcmp(action, "press") == 0;
+        int ordered = script->count == 0
+            || script->presses[script->count - 1].frame <= press.frame;
+        if (!known || !ordered
+                || !(press.pressed || strcmp(action, "release") == 0)) {
+            fprintf(stderr, "Error: %s:%d: expected <frame> press|release <button>, "
+                "in frame order\n", path, lineno);
+            fclose(f);
+            movie_script_free(script);
+            return -1;
+        }
+
+        if (grow((void **) &script->presses, &capacity, script->count,
+                sizeof(MoviePress)) < 0) {
+            fclose(f);
+            movie_script_free(script);
+            return -1;
+        }
+        script->presses[script->count++] = press;
+    }
+    fclose(f);
+    return 0;
+}
+
+
+void movie_script_free(MovieScript *script) {
+    free(script->presses);
+    memset(script, 0, sizeof(*script));
+}
+
+
+void movie_script_apply(MovieScript *script, uint32_t frame, IoMap *io) {
+    while (script->next < script->count && script->presses[script->next].frame <= frame) {
+        MoviePress *press = &script->presses[script->next++];
+        io_set_input(io, press->port, press->mask, press->pressed);
+    }
+}
@@ -0,0 +1,104 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+
+#include "pacer.h"
+
+#define NS_PER_SEC  1000000000ULL
+
+
+static uint64_t ns_between(const struct timespec *from, const struct timespec *to) {
+    int64_t ns = (int64_t) (to->tv_sec - from->tv_sec) * (int64_t) NS_PER_SEC
+        + (to->tv_nsec - from->tv_nsec);
+    return ns > 0 ? (uint64_t) ns : 0;
+}
+
+
+static struct timespec add_ns(struct timespec t, uint64_t ns) {
+    t.tv_sec += ns / NS_PER_SEC;
+    t.tv_nsec += ns % NS_PER_SEC;
+    if (t.tv_nsec >= (long) NS_PER_SEC) {
+        t.tv_sec++;
+        t.tv_nsec -= NS_PER_SEC;
+    }
+    return t;
+}
+
+
+void pacer_init(Pacer *pacer, uint64_t hz, uint64_t cycles, uint64_t resync_ns) {
+    *pacer = (Pacer) {0};
+    pacer->hz = hz;
+    pacer->start_cycles = cycles;
+    pacer->resync_ns = resync_ns;
+    clock_gettime(CLOCK_MONOTONIC, &pacer->start);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &pacer->began_cpu);
+    pacer->began = pacer->woke = pacer->start;
+}
+
+
+void pacer_wait(Pacer *pacer, uint64_t cycles) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t busy = ns_between(&pacer->woke, &now);
+    pacer->busy_sum += busy;
+    if (busy > pacer->busy_max) {
+        pacer->busy_max = busy;
+    }
+    pacer->frames++;
+
+    // split up so that hours of cycles don't overflow
+    uint64_t ran = cycles - pacer->start_cycles;
+    uint64_t due = ran / pacer->hz * NS_PER_SEC + ran % pacer->hz * NS_PER_SEC / pacer->hz;
+    uint64_t elapsed = ns_between(&pacer->start, &now);
+    pacer->woke = now;
+
+    if (elapsed >= due) {
+        pacer->overruns++;
+        if (elapsed - due > pacer->resync_ns) {
+            pacer->resyncs++;
+            pacer->start = now;
+            pacer->start_cycles = cycles;
+        }
+        return;
+    }
+
+    struct timespec deadline = add_ns(pacer->start, due);
+    if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) {
+        // EINTR: let the caller see the signal
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &pacer->woke);
+    uint64_t late = ns_between(&deadline, &pacer->woke);
+    pacer->sleeps++;
+    pacer->late_sum += late;
+    pacer->late_sq_sum += (double) late * late;
+    if (late > pacer->late_max) {
+        pacer->late_max = late;
+    }
+}
+
+
+void pacer_report(const Pacer *pacer) {
+    if (pacer->frames == 0) {
+        return;
+    }
+    struct timespec now, cpu;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    double wall = ns_between(&pacer->began, &now) / 1e9;
+    double used = ns_between(&pacer->began_cpu, &cpu) / 1e9;
+
+    printf("Pacing: %" PRIu64 " frames at %.2f Hz, %" PRIu64 " overruns, %" PRIu64 " resyncs\n",
+        pacer->frames, wall > 0 ? pacer->frames / wall : 0, pacer->overruns, pacer->resyncs);
+    if (pacer->sleeps) {
+        double mean = pacer->late_sum / pacer->sleeps;
+        double var = pacer->late_sq_sum / pacer->sleeps - mean * mean;
+        printf("Wake-up jitter: mean %.1f us, stddev %.1f us, max %.1f us\n",
+            mean / 1e3, var > 0 ? sqrt(var) / 1e3 : 0, pacer->late_max / 1e3);
+    }
+    printf("Busy per frame: mean %.3f ms, max %.3f ms\n",
+        pacer->busy_sum / pacer->frames / 1e6, pacer->busy_max / 1e6);
+    if (wall > 0) {
+        printf("CPU use: %.1f%% of one core\n", 100 * used / wall);
+    }
+}
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disassembler.h"
+#include "profile.h"
+
+
+Profile* profile_new(uint32_t period) {
+    Profile *profile = calloc(1, sizeof(*profile));
+    if (profile) {
+        profile->period = period ? period : 1;
+        profile->countdown = profile->period;
+    }
+    return profile;
+}
+
+
+void profile_free(Profile *profile) {
+    free(profile);
+}
+
+
+/*
+ * Returns 1 if `path` ends in `ext`
+ */
+static int ends_with(const char *path, const char *ext) {
+    size_t len = strlen(path), n = strlen(ext);
+    return len >= n && strcmp(path + len - n, ext) == 0;
+}
+
+
+int profile_write(const Profile *profile, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return -1;
+    }
+
+    if (ends_with(path, ".json")) {
+        fprintf(f, "{\n  \"pc_period\": %" PRIu32 ",\n  \"pc_samples\": %" PRIu64 ",\n",
+            profile->period, profile->samples);
+        fprintf(f, "  \"opcodes\": [");
+        const char *sep = "\n";
+        for (int op = 0; op < 256; op++) {
+            if (profile->op_count[op]) {
+                fprintf(f, "%s    {\"op\": %d, \"count\": %" PRIu64 ", \"cycles\": %" PRIu64 "}",
+                    sep, op, profile->op_count[op], profile->op_cycles[op]);
+                sep = ",\n";
+            }
+        }
+        fprintf(f, "\n  ],\n  \"pcs\": [");
+        sep = "\n";
+        for (int pc = 0; pc < MEM_SIZE; pc++) {
+            if (profile->pc_count[pc]) {
+                fprintf(f, "%s    {\"pc\": %d, \"count\": %" PRIu64 "}",
+                    sep, pc, profile->pc_count[pc]);
+                sep = ",\n";
+            }
+        }
+        fprintf(f, "\n  ]\n}\n");
+    } else {
+        // one table: cycles are only kept per opcode
+        fprintf(f, "kind,address,count,cycles\n");
+        for (int op = 0; op < 256; op++) {
+            if (profile->op_count[op]) {
+                fprintf(f, "op,0x%02x,%" PRIu64 ",%" PRIu64 "\n",
+                    op, profile->op_count[op], profile->op_cycles[op]);
+            }
+        }
+        for (int pc = 0; pc < MEM_SIZE; pc++) {
+            if (profile->pc_count[pc]) {
+                fprintf(f, "pc,0x%04x,%" PRIu64 ",\n", pc, profile->pc_count[pc]);
+            }
+        }
+    }
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Error: couldn't write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+
+static int compare_symbols(const void *a, const void *b) {
+    return (int) ((const ProfileSymbol *) a)->addr - (int) ((const ProfileSymbol *) b)->addr;
+}
+
+
+int profile_symbols_read(ProfileSymbols *syms, const char *path) {
+    memset(syms, 0, sizeof(*syms));
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return -1;
+    }
+
+    size_t capacity = 0;
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+
+        unsigned addr;
+        char name[sizeof(syms->syms->name)];
+        int fields = sscanf(line, "%x %31s", &addr, name);
+        if (fields <= 0) {
+            continue;
+        }
+        if (fields != 2 || addr >= MEM_SIZE) {
+            fprintf(stderr, "Error: %s:%d: expected <address> <name>\n", path, lineno);
+            fclose(f);
+            profile_symbols_free(syms);
+            return -1;
+        }
+
+        if (syms->count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            ProfileSymbol *grown = realloc(syms->syms, capacity * sizeof(ProfileSymbol));
+            if (grown == NULL) {
+                fclose(f);
+                profile_symbols_free(syms);
+                return -1;
+            }
+            syms->syms = grown;
+        }
+        ProfileSymbol *sym = &syms->syms[syms->count++];
+        sym->addr = addr;
+        strcpy(sym->name, name);
+    }
+    fclose(f);
+
+    qsort(syms->syms, syms->count, sizeof(ProfileSymbol), compare_symbols);
+    return 0;
+}
+
+
+void profile_symbols_free(ProfileSymbols *syms) {
+    free(syms->syms);
+    memset(syms, 0, sizeof(*syms));
+}
+
+
+/*
+ * Returns the index of the last symbol at or below
+ * `addr`, or -1 if there is none
+ */
+static long symbol_at(const ProfileSymbols *syms, uint16_t addr) {
+    long lo = 0, hi = syms ? (long) syms->count - 1 : -1, found = -1;
+    while (lo <= hi) {
+        long mid = (lo + hi) / 2;
+        if (syms->syms[mid].addr <= addr) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+
+/*
+ * Fills `order` with the indices of the `n` largest
+ * `counts`, biggest first, and returns how many are
+ * non-zero (at most `n`)
+ */
+static int top_counts(const uint64_t *counts, size_t size, int *order, int n) {
+    int found = 0;
+    for (size_t i = 0; n > 0 && i < size; i++) {
+        if (counts[i] == 0 || (found == n && counts[i] <= counts[order[n - 1]])) {
+            continue;
+        }
+        int at = found < n ? found++ : n - 1;
+        while (at > 0 && counts[order[at - 1]] < counts[i]) {
+            order[at] = order[at - 1];
+            at--;
+        }
+        order[at] = (int) i;
+    }
+    return found;
+}
+
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0;
+}
+
+
+void profile_report(const Profile *profile, uint8_t *memory,
+        const ProfileSymbols *syms, int top) {
+    uint64_t instrs = 0, cycles = 0;
+    for (int op = 0; op < 256; op++) {
+        instrs += profile->op_count[op];
+        cycles += profile->op_cycles[op];
+    }
+    int *order = malloc((top > 0 ? top : 1) * sizeof(int));
+    if (order == NULL) {
+        return;
+    }
+
+    printf("Profile: %" PRIu64 " instructions, %" PRIu64 " cycles, "
+        "%" PRIu64 " PC samples (1 in %" PRIu32 ")\n",
+        instrs, cycles, profile->samples, profile->period);
+
+    printf("\nOpcodes by cycles:\n");
+    printf("  op %12s %7s %12s %7s %7s\n", "count", "%", "cycles", "%", "cyc/op");
+    int n = top_counts(profile->op_cycles, 256, order, top);
+    for (int i = 0; i < n; i++) {
+        int op = order[i];
+        printf("  %02x %12" PRIu64 " %6.2f%% %12" PRIu64 " %6.2f%% %7.2f\n",
+            op, profile->op_count[op], percent(profile->op_count[op], instrs),
+            profile->op_cycles[op], percent(profile->op_cycles[op], cycles),
+            (double) profile->op_cycles[op] / profile->op_count[op]);
+    }
+
+    printf("\nHot spots by PC samples:\n");
+    printf("  %12s %7s  %-24s %s\n", "samples", "%", "symbol", "instruction");
+    n = top_counts(profile->pc_count, MEM_SIZE, order, top);
+    for (int i = 0; i < n; i++) {
+        uint16_t pc = order[i];
+        char where[48] = "";
+        long sym = symbol_at(syms, pc);
+        if (sym >= 0) {
+            snprintf(where, sizeof(where), "%s+0x%x",
+                syms->syms[sym].name, pc - syms->syms[sym].addr);
+        }
+        DisInstr instr;
+        char text[DIS_TEXT_MAX];
+        dis_decode(memory + pc, pc, &instr);
+        dis_format(&instr, text);
+        printf("  %12" PRIu64 " %6.2f%%  %-24s %04x %s\n",
+            profile->pc_count[pc], percent(profile->pc_count[pc], profile->samples),
+            where, pc, text);
+    }
+
+    if (syms && syms->count) {
+        // every sample goes to the closest symbol at or below it
+        uint64_t *by_symbol = calloc(syms->count + 1, sizeof(uint64_t));
+        if (by_symbol) {
+            for (int pc = 0; pc < MEM_SIZE; pc++) {
+                by_symbol[symbol_at(syms, pc) + 1] += profile->pc_count[pc];
+            }
+            printf("\nPC samples by symbol:\n");
+            printf("  %12s %7s  %s\n", "samples", "%", "symbol");
+            n = top_counts(by_symbol + 1, syms->count, order, top);
+            for (int i = 0; i < n; i++) {
+                int s = order[i];
+                printf("  %12" PRIu64 " %6.2f%%  %s\n", by_symbol[s + 1],
+                    percent(by_symbol[s + 1], profile->samples), syms->syms[s].name);
+            }
+            if (by_symbol[0]) {
+                printf("  %12" PRIu64 " %6.2f%%  (below the first symbol)\n",
+                    by_symbol[0], percent(by_symbol[0], profile->samples));
+            }
+            free(by_symbol);
+        }
+    }
+    free(order);
+}
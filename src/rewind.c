@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "block.h"
+#include "rewind.h"
+
+
+Rewind* rewind_new(size_t frames, int keyframe_interval) {
+    if (frames == 0) {
+        return NULL;
+    }
+    Rewind *rewind = calloc(1, sizeof(*rewind));
+    if (rewind == NULL) {
+        return NULL;
+    }
+    rewind->frames = calloc(frames, sizeof(RewindFrame));
+    if (rewind->frames == NULL) {
+        free(rewind);
+        return NULL;
+    }
+    rewind->capacity = frames;
+    rewind->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+    return rewind;
+}
+
+
+void rewind_free(Rewind *rewind) {
+    if (rewind) {
+        rewind_clear(rewind);
+        free(rewind->frames);
+        free(rewind);
+    }
+}
+
+
+/*
+ * Returns frame `i`, counting from the oldest
+ */
+static RewindFrame* frame_at(Rewind *rewind, size_t i) {
+    return &rewind->frames[(rewind->first + i) % rewind->capacity];
+}
+
+
+/*
+ * Releases a frame's pages
+ */
+static void drop_frame(Rewind *rewind, RewindFrame *frame) {
+    rewind->bytes -= (size_t) frame->page_count * PAGE_SIZE;
+    if (frame->keyframe) {
+        rewind->keyframes--;
+    }
+    free(frame->data);
+    frame->data = NULL;
+    frame->page_count = 0;
+    frame->keyframe = 0;
+}
+
+
+/*
+ * Returns 1 if a keyframe stores `page`: a writable page
+ * that stands for its mirror ring
+ */
+static int keyframe_page(const MemoryMap *map, int page) {
+    return !(map->attr[page] & (PAGE_ROM | PAGE_MMIO))
+        && mem_canonical_page(map, page) == page;
+}
+
+
+/*
+ * Fills in `frame` from the machine: every keyframe
+ * page, or just the dirty ones. Returns 0 on success.
+ */
+static int capture(RewindFrame *frame, const State8080 *state,
+        const Scheduler *sched, int keyframe) {
+    const MemoryMap *map = state->mem_map;
+    int count = 0;
+    for (int page = 0; page < NUM_PAGES; page++) {
+        if (keyframe ? keyframe_page(map, page) : map->dirty[page]) {
+            frame->pages[count++] = page;
+        }
+    }
+
+    frame->data = NULL;
+    if (count) {
+        frame->data = malloc((size_t) count * PAGE_SIZE);
+        if (frame->data == NULL) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        memcpy(&frame->data[i * PAGE_SIZE],
+            &state->memory[frame->pages[i] << PAGE_SHIFT], PAGE_SIZE);
+    }
+    frame->page_count = count;
+    frame->keyframe = keyframe;
+
+    snapshot_save_cpu(&frame->cpu, state);
+    if (state->io) {
+        snapshot_save_io(&frame->io, state->io);
+    } else {
+        memset(&frame->io, 0, sizeof(frame->io));
+    }
+    for (int i = 0; i < MAX_EVENTS; i++) {
+        frame->deadlines[i] = UINT64_MAX;
+        if (sched && i < sched->count && sched->events[i].fire) {
+            frame->deadlines[i] = sched->events[i].deadline;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Copies a frame's pages back into memory, each one
+ * to every page of its mirror ring
+ */
+static void apply_pages(State8080 *state, const RewindFrame *frame) {
+    const MemoryMap *map = state->mem_map;
+    for (int i = 0; i < frame->page_count; i++) {
+        uint8_t page = frame->pages[i];
+        const uint8_t *data = &frame->data[i * PAGE_SIZE];
+        uint8_t p = page;
+        do {
+            memcpy(&state->memory[p << PAGE_SHIFT], data, PAGE_SIZE);
+            p = (map->attr[p] & PAGE_MIRROR) ? map->mirror_next[p] : page;
+        } while (p != page);
+    }
+}
+
+
+/*
+ * Drops the oldest frame, which is always a keyframe. If the
+ * next one is a delta, the keyframe's pages are folded into it
+ * so it can stand on its own.
+ */
+static void evict_oldest(Rewind *rewind) {
+    RewindFrame *oldest = frame_at(rewind, 0);
+    RewindFrame *next = rewind->count > 1 ? frame_at(rewind, 1) : NULL;
+
+    if (next && !next->keyframe) {
+        // where each page sits in the keyframe; a delta only
+        // ever holds pages a keyframe has
+        int slot[NUM_PAGES];
+        for (int i = 0; i < oldest->page_count; i++) {
+            slot[oldest->pages[i]] = i;
+        }
+        for (int i = 0; i < next->page_count; i++) {
+            memcpy(&oldest->data[slot[next->pages[i]] * PAGE_SIZE],
+                &next->data[i * PAGE_SIZE], PAGE_SIZE);
+        }
+
+        rewind->bytes -= (size_t) next->page_count * PAGE_SIZE;
+        free(next->data);
+        next->data = oldest->data;
+        next->page_count = oldest->page_count;
+        memcpy(next->pages, oldest->pages, oldest->page_count);
+        next->keyframe = 1;
+        if (rewind->keyframes == 1) {
+            // it took over from the newest keyframe
+            rewind->since_keyframe--;
+        }
+
+        oldest->data = NULL;
+        oldest->page_count = 0;
+        oldest->keyframe = 0;
+    } else {
+        drop_frame(rewind, oldest);
+    }
+
+    rewind->first = (rewind->first + 1) % rewind->capacity;
+    rewind->count--;
+}
+
+
+int rewind_push(Rewind *rewind, State8080 *state, const Scheduler *sched) {
+    if (rewind->count == rewind->capacity) {
+        evict_oldest(rewind);
+    }
+
+    int keyframe = rewind->count == 0
+        || rewind->since_keyframe + 1 >= rewind->keyframe_interval;
+    RewindFrame *frame = frame_at(rewind, rewind->count);
+    if (capture(frame, state, sched, keyframe) < 0) {
+        return -1;
+    }
+
+    rewind->count++;
+    rewind->bytes += (size_t) frame->page_count * PAGE_SIZE;
+    if (keyframe) {
+        rewind->keyframes++;
+        rewind->since_keyframe = 0;
+    } else {
+        rewind->since_keyframe++;
+    }
+    mem_track_reset(state->mem_map);
+    return 0;
+}
+
+
+int rewind_back(Rewind *rewind, State8080 *state, Scheduler *sched, size_t frames) {
+    if (frames >= rewind->count) {
+        return -1;
+    }
+    size_t target = rewind->count - 1 - frames;
+
+    // rebuild memory from the last keyframe up to the target
+    size_t key = target;
+    while (!frame_at(rewind, key)->keyframe) {
+        key--;
+    }
+    for (size_t i = key; i <= target; i++) {
+        apply_pages(state, frame_at(rewind, i));
+    }
+
+    RewindFrame *frame = frame_at(rewind, target);
+    snapshot_load_cpu(state, &frame->cpu);
+    if (state->io) {
+        snapshot_load_io(state->io, &frame->io);
+    }
+    if (sched) {
+        for (int i = 0; i < sched->count; i++) {
+            sched_set_deadline(sched, i, frame->deadlines[i]);
+        }
+    }
+
+    for (size_t i = target + 1; i < rewind->count; i++) {
+        drop_frame(rewind, frame_at(rewind, i));
+    }
+    rewind->count = target + 1;
+    rewind->since_keyframe = target - key;
+
+    // memory now matches the target frame, so the next
+    // push only needs what is written from here on
+    mem_track_reset(state->mem_map);
+    if (state->blocks) {
+        block_cache_flush(state->blocks);
+    }
+    return 0;
+}
+
+
+void rewind_clear(Rewind *rewind) {
+    for (size_t i = 0; i < rewind->count; i++) {
+        drop_frame(rewind, frame_at(rewind, i));
+    }
+    rewind->first = 0;
+    rewind->count = 0;
+    rewind->since_keyframe = 0;
+}
@@ -0,0 +1,255 @@
+#define _GNU_SOURCE  // memfd_create
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rom.h"
+
+#define IMAGE_SIZE (MEM_SIZE + MEM_GUARD)
+
+
+const uint8_t* rom_map_file(const char *filename, size_t *size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: couldn't open %s\n", filename);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: %s is empty or unreadable\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error: couldn't map %s\n", filename);
+        return NULL;
+    }
+    *size = st.st_size;
+    return data;
+}
+
+
+void rom_unmap_file(const uint8_t *data, size_t size) {
+    if (data) {
+        munmap((void *) data, size);
+    }
+}
+
+
+/*
+ * Returns an anonymous shared memory object, or -1
+ */
+static int create_shared_fd(void) {
+#if defined(__linux__)
+    return memfd_create("intel8080-rom", MFD_CLOEXEC);
+#else
+    char name[64];
+    snprintf(name, sizeof(name), "/intel8080-rom-%ld", (long) getpid());
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        shm_unlink(name);
+    }
+    return fd;
+#endif
+}
+
+
+int rom_image_load(RomImage *img, const RomPart *parts, int count) {
+    memset(img, 0, sizeof(*img));
+    img->fd = -1;
+
+    if (count > ROM_MAX_PARTS) {
+        fprintf(stderr, "Error: at most %d ROM files are supported\n", ROM_MAX_PARTS);
+        return -1;
+    }
+
+    int fd = create_shared_fd();
+    if (fd < 0 || ftruncate(fd, IMAGE_SIZE) < 0) {
+        fprintf(stderr, "Error: couldn't create the ROM image\n");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    uint8_t *image = mmap(NULL, IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (image == MAP_FAILED) {
+        fprintf(stderr, "Error: couldn't map the ROM image\n");
+        close(fd);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        size_t size;
+        const uint8_t *data = rom_map_file(parts[i].filename, &size);
+        if (data == NULL) {
+            munmap(image, IMAGE_SIZE);
+            close(fd);
+            return -1;
+        }
+        if (parts[i].addr + size > MEM_SIZE) {
+            fprintf(stderr, "Error: %s doesn't fit at 0x%04x\n",
+                parts[i].filename, parts[i].addr);
+            rom_unmap_file(data, size);
+            munmap(image, IMAGE_SIZE);
+            close(fd);
+            return -1;
+        }
+
+        memcpy(&image[parts[i].addr], data, size);
+        rom_unmap_file(data, size);
+
+        img->ranges[i].addr = parts[i].addr;
+        img->ranges[i].size = size;
+        if (parts[i].addr + size > img->end) {
+            img->end = parts[i].addr + size;
+        }
+    }
+    img->count = count;
+
+    munmap(image, IMAGE_SIZE);
+    img->fd = fd;
+    return 0;
+}
+
+
+int rom_image_from_memory(RomImage *img, const RomImage *rom, const uint8_t *memory) {
+    memset(img, 0, sizeof(*img));
+    img->fd = -1;
+
+    int fd = create_shared_fd();
+    if (fd < 0 || ftruncate(fd, IMAGE_SIZE) < 0) {
+        fprintf(stderr, "Error: couldn't create the memory image\n");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    if (pwrite(fd, memory, MEM_SIZE, 0) != MEM_SIZE) {
+        fprintf(stderr, "Error: couldn't fill the memory image\n");
+        close(fd);
+        return -1;
+    }
+
+    memcpy(img->ranges, rom->ranges, sizeof(img->ranges));
+    img->count = rom->count;
+    img->end = rom->end;
+    img->fd = fd;
+    return 0;
+}
+
+
+int rom_image_load_file(RomImage *img, const char *filename) {
+    RomPart part = { (char *) filename, 0x0000 };
+    return rom_image_load(img, &part, 1);
+}
+
+
+int rom_image_load_manifest(RomImage *img, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return -1;
+    }
+
+    // file names in the manifest are relative to its directory
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash) {
+        slash[1] = '\0';
+    } else {
+        dir[0] = '\0';
+    }
+
+    static const int name_len = PATH_MAX;
+    char *names = malloc(ROM_MAX_PARTS * name_len);
+    if (names == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        fclose(f);
+        return -1;
+    }
+    RomPart parts[ROM_MAX_PARTS];
+    int count = 0;
+    int line_no = 0;
+    char line[PATH_MAX + 32];
+
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        char file[PATH_MAX];
+        int addr;
+        int fields = sscanf(line, "%4095s %i", file, &addr);
+        if (fields <= 0) {
+            continue;  // blank line
+        }
+        if (fields != 2 || addr < 0 || addr > 0xffff) {
+            fprintf(stderr, "Error: %s:%d: expected \"<file> <address>\"\n", path, line_no);
+            count = -1;
+            break;
+        }
+        if (count == ROM_MAX_PARTS) {
+            fprintf(stderr, "Error: %s: more than %d ROM files\n", path, ROM_MAX_PARTS);
+            count = -1;
+            break;
+        }
+
+        char *name = &names[count * name_len];
+        int len = file[0] == '/'
+            ? snprintf(name, name_len, "%s", file)
+            : snprintf(name, name_len, "%s%s", dir, file);
+        if (len >= name_len) {
+            fprintf(stderr, "Error: %s:%d: path too long\n", path, line_no);
+            count = -1;
+            break;
+        }
+        parts[count].filename = name;
+        parts[count].addr = addr;
+        count++;
+    }
+    fclose(f);
+
+    int result = -1;
+    if (count == 0) {
+        fprintf(stderr, "Error: %s lists no ROM files\n", path);
+    } else if (count > 0) {
+        result = rom_image_load(img, parts, count);
+    }
+    free(names);
+    return result;
+}
+
+
+uint8_t* rom_image_map(const RomImage *img) {
+    void *memory = mmap(NULL, IMAGE_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE, img->fd, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+
+void rom_image_protect(const RomImage *img, MemoryMap *map) {
+    for (int i = 0; i < img->count; i++) {
+        mem_protect(map, img->ranges[i].addr, img->ranges[i].size);
+    }
+}
+
+
+void rom_image_free(RomImage *img) {
+    if (img->fd >= 0) {
+        close(img->fd);
+        img->fd = -1;
+    }
+}
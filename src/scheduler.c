@@ -0,0 +1,139 @@
+#include <string.h>
+
+#include "debugger.h"
+#include "emu.h"
+#include "scheduler.h"
+
+
+/*
+ * Recomputes the earliest deadline
+ */
+static void update_next_deadline(Scheduler *sched) {
+    uint64_t next = UINT64_MAX;
+    for (int i = 0; i < sched->count; i++) {
+        if (sched->events[i].fire && sched->events[i].deadline < next) {
+            next = sched->events[i].deadline;
+        }
+    }
+    sched->next_deadline = next;
+}
+
+
+void sched_init(Scheduler *sched) {
+    memset(sched, 0, sizeof(*sched));
+    sched->next_deadline = UINT64_MAX;
+}
+
+
+int sched_add(Scheduler *sched, uint64_t deadline, uint64_t period,
+        EventHandler fire, void *ctx) {
+    if (sched->count == MAX_EVENTS) {
+        return -1;
+    }
+    Event *event = &sched->events[sched->count];
+    event->deadline = deadline;
+    event->period = period;
+    event->fire = fire;
+    event->ctx = ctx;
+    update_next_deadline(sched);
+    return sched->count++;
+}
+
+
+void sched_set_deadline(Scheduler *sched, int index, uint64_t deadline) {
+    sched->events[index].deadline = deadline;
+    update_next_deadline(sched);
+}
+
+
+void sched_fire_due(Scheduler *sched, State8080 *state) {
+    if (state->cycles < sched->next_deadline) {
+        return;
+    }
+    for (int i = 0; i < sched->count; i++) {
+        Event *event = &sched->events[i];
+        if (!event->fire || state->cycles < event->deadline) {
+            continue;
+        }
+        EventHandler fire = event->fire;
+        void *ctx = event->ctx;
+        if (event->period) {
+            // step from the deadline rather than from now,
+            // so overshooting it doesn't make the event drift
+            event->deadline += event->period;
+        } else {
+            event->fire = NULL;
+        }
+        fire(state, ctx);
+    }
+    update_next_deadline(sched);
+}
+
+
+/*
+ * Returns 1 if an interrupt taken outside a run, which moved
+ * PC on from `pc`, stops a debugged run: it went to a
+ * breakpoint or its push hit a watchpoint
+ */
+static int interrupt_stops(State8080 *state, uint16_t pc) {
+    Debugger *debug = state->debug;
+    return debug && (debug->pending || state->pc != pc)
+        && debug_at_stop(debug, state->pc) && debug_stop(debug, state);
+}
+
+
+RunStop sched_run(Scheduler *sched, State8080 *state, uint64_t cycles) {
+    uint64_t end = state->cycles + cycles;
+
+    // one latched since the last run
+    uint16_t pc = state->pc;
+    if (service_interrupt(state) && interrupt_stops(state, pc)) {
+        return STOP_BREAKPOINT;
+    }
+
+    while (state->cycles < end) {
+        uint64_t until = sched->next_deadline < end ? sched->next_deadline : end;
+        RunStop stop = STOP_BUDGET;
+        if (until > state->cycles) {
+            stop = run_cycles(state, until - state->cycles);
+        }
+
+        pc = state->pc;
+        if (stop == STOP_INTERRUPT) {
+            service_interrupt(state);
+            if (interrupt_stops(state, pc)) {
+                return STOP_BREAKPOINT;
+            }
+        } else if (stop == STOP_BREAKPOINT
+                && (state->debug == NULL || debug_stop(state->debug, state))) {
+            // a breakpoint whose condition doesn't hold is stepped over
+            return stop;
+        } else if (stop == STOP_HALT && !state->int_enable) {
+            // nothing can wake the CPU up again
+            return stop;
+        }
+
+        // events only latch interrupts, which are taken
+        // here unless the run ended straight after EI
+        pc = state->pc;
+        sched_fire_due(sched, state);
+        service_interrupt(state);
+        if (interrupt_stops(state, pc)) {
+            return STOP_BREAKPOINT;
+        }
+    }
+    return state->halted ? STOP_HALT : STOP_BUDGET;
+}
+
+
+static void fire_rst(State8080 *state, void *ctx) {
+    generate_interrupt(state, (int) (intptr_t) ctx);
+}
+
+
+void invaders_schedule_interrupts(Scheduler *sched, uint64_t now) {
+    sched_add(sched, now + CYCLES_PER_FRAME / 2, CYCLES_PER_FRAME,
+        fire_rst, (void *) (intptr_t) 1);
+    sched_add(sched, now + CYCLES_PER_FRAME, CYCLES_PER_FRAME,
+        fire_rst, (void *) (intptr_t) 2);
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "block.h"
+#include "emu.h"
+#include "snapshot.h"
+
+
+void snapshot_save_cpu(SnapshotCpu *cpu, const State8080 *state) {
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->cycles = state->cycles;
+    cpu->instructions = state->instructions;
+    cpu->ei_shadow = state->ei_shadow;
+    cpu->sp = state->sp;
+    cpu->pc = state->pc;
+    cpu->a = state->a;
+    cpu->b = state->b;
+    cpu->c = state->c;
+    cpu->d = state->d;
+    cpu->e = state->e;
+    cpu->h = state->h;
+    cpu->l = state->l;
+    cpu->psw = flags_psw(state);
+    cpu->int_enable = state->int_enable;
+    cpu->halted = state->halted;
+    cpu->int_pending = state->int_pending;
+    cpu->int_rst = state->int_rst;
+}
+
+
+void snapshot_load_cpu(State8080 *state, const SnapshotCpu *cpu) {
+    state->cycles = cpu->cycles;
+    state->instructions = cpu->instructions;
+    state->ei_shadow = cpu->ei_shadow;
+    state->sp = cpu->sp;
+    state->pc = cpu->pc;
+    state->a = cpu->a;
+    state->b = cpu->b;
+    state->c = cpu->c;
+    state->d = cpu->d;
+    state->e = cpu->e;
+    state->h = cpu->h;
+    state->l = cpu->l;
+    state->cc.psw = (cpu->psw & FLAG_ALL) | FLAG_ONE;
+    state->lazy_mask = 0;
+    state->int_enable = cpu->int_enable;
+    state->halted = cpu->halted;
+    state->int_pending = cpu->int_pending;
+    state->int_rst = cpu->int_rst;
+}
+
+
+void snapshot_save_io(SnapshotIo *snap_io, const IoMap *io) {
+    memset(snap_io, 0, sizeof(*snap_io));
+    memcpy(snap_io->in_value, io->in_value, NUM_PORTS);
+    memcpy(snap_io->out_value, io->out_value, NUM_PORTS);
+    snap_io->shift = io->shift;
+    snap_io->shift_offset = io->shift_offset;
+}
+
+
+void snapshot_load_io(IoMap *io, const SnapshotIo *snap_io) {
+    memcpy(io->in_value, snap_io->in_value, NUM_PORTS);
+    memcpy(io->out_value, snap_io->out_value, NUM_PORTS);
+    io->shift = snap_io->shift;
+    io->shift_offset = snap_io->shift_offset;
+}
+
+
+void snapshot_save(Snapshot *snap, const State8080 *state, const Scheduler *sched) {
+    snap->magic = SNAPSHOT_MAGIC;
+    snap->version = SNAPSHOT_VERSION;
+    snap->size = sizeof(Snapshot);
+    snap->pad = 0;
+    snapshot_save_cpu(&snap->cpu, state);
+    if (state->io) {
+        snapshot_save_io(&snap->io, state->io);
+    } else {
+        memset(&snap->io, 0, sizeof(snap->io));
+    }
+
+    snap->event_count = sched ? sched->count : 0;
+    for (int i = 0; i < MAX_EVENTS; i++) {
+        snap->deadlines[i] = UINT64_MAX;
+        if (i < snap->event_count && sched->events[i].fire) {
+            snap->deadlines[i] = sched->events[i].deadline;
+        }
+    }
+
+    memcpy(snap->memory, state->memory, MEM_SIZE);
+}
+
+
+/*
+ * Restores everything but memory
+ */
+static void restore_cpu(State8080 *state, Scheduler *sched, const Snapshot *snap) {
+    snapshot_load_cpu(state, &snap->cpu);
+    if (state->io) {
+        snapshot_load_io(state->io, &snap->io);
+    }
+
+    if (sched) {
+        for (int i = 0; i < sched->count && i < snap->event_count; i++) {
+            sched_set_deadline(sched, i, snap->deadlines[i]);
+        }
+    }
+}
+
+
+void snapshot_load(State8080 *state, Scheduler *sched, const Snapshot *snap) {
+    restore_cpu(state, sched, snap);
+
+    // ROM is the same ROM, and writing a page that hasn't
+    // changed would still unshare it from a copy-on-write
+    // image, so only the RAM pages that differ are copied
+    int changed = 0;
+    for (int page = 0; page < NUM_PAGES; page++) {
+        size_t at = (size_t) page << PAGE_SHIFT;
+        if ((state->mem_map && (state->mem_map->attr[page] & PAGE_ROM))
+                || memcmp(state->memory + at, snap->memory + at, PAGE_SIZE) == 0) {
+            continue;
+        }
+        memcpy(state->memory + at, snap->memory + at, PAGE_SIZE);
+        changed = 1;
+    }
+
+    // memory changed behind mem_write's back, so
+    // nothing decoded from the old contents can stay
+    if (changed && state->blocks) {
+        block_cache_flush(state->blocks);
+    }
+}
+
+
+int snapshot_share(RomImage *img, const Snapshot *snap, const RomImage *rom) {
+    return rom_image_from_memory(img, rom, snap->memory);
+}
+
+
+int snapshot_fork(State8080 *state, Scheduler *sched, const Snapshot *snap,
+        const RomImage *img) {
+    if (emu_load(state, img) < 0) {
+        return -1;
+    }
+    restore_cpu(state, sched, snap);
+    return 0;
+}
+
+
+int snapshot_write(const Snapshot *snap, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return -1;
+    }
+    int ok = fwrite(snap, sizeof(*snap), 1, f) == 1;
+    if (fclose(f) != 0 || !ok) {
+        fprintf(stderr, "Error: couldn't write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+
+int snapshot_read(Snapshot *snap, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return -1;
+    }
+    size_t got = fread(snap, 1, sizeof(*snap), f);
+    fclose(f);
+
+    if (got < sizeof(snap->magic) || snap->magic != SNAPSHOT_MAGIC) {
+        fprintf(stderr, "Error: %s is not a snapshot\n", path);
+        return -1;
+    }
+    if (snap->version != SNAPSHOT_VERSION || snap->size != sizeof(*snap)
+            || got != sizeof(*snap) || snap->event_count > MAX_EVENTS) {
+        fprintf(stderr, "Error: %s is a version %u snapshot of %u bytes, "
+            "expected version %u of %zu\n", path, snap->version, snap->size,
+            SNAPSHOT_VERSION, sizeof(*snap));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,409 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sound.h"
+
+// the audio thread's nap when the CPU has sent nothing new
+#define SOUND_IDLE_NS   1000000
+
+// samples mixed at a time, at most
+#define SOUND_CHUNK     512
+
+// plain tones for missing samples: pitch in Hz and length in ms
+static const struct {
+    uint16_t            hz;
+    uint16_t            ms;
+} tones[SOUND_COUNT] = {
+    { 440, 120 },   // UFO, repeated while it flies
+    { 900, 150 },   // shot
+    { 120, 800 },   // player hit
+    { 300, 200 },   // invader hit
+    { 110, 60 },    // fleet step 1
+    { 100, 60 },    // fleet step 2
+    { 90, 60 },     // fleet step 3
+    { 80, 60 },     // fleet step 4
+    { 600, 400 },   // UFO hit
+};
+
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+
+/*
+ * Reads a PCM WAV file into `sample`, at SOUND_RATE and with
+ * only its first channel. Returns 0 on success and -1 if
+ * there is no such file or it isn't one this can read.
+ */
+static int read_wav(SoundSample *sample, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+    uint8_t *file = size > 12 ? malloc(size) : NULL;
+    if (file == NULL || fread(file, 1, size, f) != (size_t) size
+            || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "Error: %s isn't a WAV file\n", path);
+        free(file);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    const uint8_t *fmt = NULL, *data = NULL;
+    uint32_t data_len = 0;
+    for (long at = 12; at + 8 <= size; ) {
+        uint32_t len = get32(file + at + 4);
+        if (len > (uint32_t) (size - at - 8)) {
+            len = size - at - 8;
+        }
+        if (memcmp(file + at, "fmt ", 4) == 0 && len >= 16) {
+            fmt = file + at + 8;
+        } else if (memcmp(file + at, "data", 4) == 0) {
+            data = file + at + 8;
+            data_len = len;
+        }
+        at += 8 + len + (len & 1);
+    }
+
+    int channels = fmt ? get16(fmt + 2) : 0;
+    uint32_t rate = fmt ? get32(fmt + 4) : 0;
+    int bits = fmt ? get16(fmt + 14) : 0;
+    if (fmt == NULL || data == NULL || get16(fmt) != 1 || channels == 0 || rate == 0
+            || (bits != 8 && bits != 16)) {
+        fprintf(stderr, "Error: %s isn't 8 or 16-bit PCM\n", path);
+        free(file);
+        return -1;
+    }
+
+    // nearest neighbour is plenty for these
+    int frame = channels * bits / 8;
+    uint32_t frames = data_len / frame;
+    sample->len = (uint64_t) frames * SOUND_RATE / rate;
+    sample->data = malloc((sample->len ? sample->len : 1) * sizeof(int16_t));
+    if (sample->data == NULL) {
+        free(file);
+        return -1;
+    }
+    for (uint32_t i = 0; i < sample->len; i++) {
+        const uint8_t *p = data + (uint64_t) i * rate / SOUND_RATE * frame;
+        sample->data[i] = bits == 8 ? (int16_t) ((p[0] - 128) << 8) : (int16_t) get16(p);
+    }
+    free(file);
+    return 0;
+}
+
+
+/*
+ * Fills `sample` with a square wave
+ */
+static int make_tone(SoundSample *sample, unsigned hz, unsigned ms) {
+    sample->len = SOUND_RATE * ms / 1000;
+    sample->data = malloc(sample->len * sizeof(int16_t));
+    if (sample->data == NULL) {
+        return -1;
+    }
+    unsigned half = SOUND_RATE / hz / 2;
+    for (uint32_t i = 0; i < sample->len; i++) {
+        sample->data[i] = (i / half) & 1 ? -4000 : 4000;
+    }
+    return 0;
+}
+
+
+/*
+ * Converts a cycle count to the number of samples
+ * since sample 0
+ */
+static uint64_t sample_at(const Sound *sound, uint64_t cycles) {
+    // split up so that hours of cycles don't overflow
+    uint64_t ran = cycles - sound->start_cycles;
+    return ran / sound->hz * SOUND_RATE + ran % sound->hz * SOUND_RATE / sound->hz;
+}
+
+
+/*
+ * Writes out the samples mixed but not yet played
+ */
+static void play_to_file(Sound *sound) {
+    uint64_t mixed = atomic_load_explicit(&sound->mixed, memory_order_acquire);
+    uint64_t played = atomic_load_explicit(&sound->played, memory_order_relaxed);
+    while (played < mixed) {
+        size_t at = played & (SOUND_RING_SIZE - 1);
+        size_t n = mixed - played;
+        if (n > SOUND_RING_SIZE - at) {
+            n = SOUND_RING_SIZE - at;
+        }
+        // stored little-endian, as is every host this runs on
+        fwrite(sound->ring + at, sizeof(int16_t), n, sound->wav);
+        played += n;
+    }
+    atomic_store_explicit(&sound->played, played, memory_order_release);
+}
+
+
+/*
+ * Mixes the voices playing into the ring up to sample `end`,
+ * waiting for room when the ring is full
+ */
+static void mix_until(Sound *sound, uint64_t end) {
+    uint64_t mixed = atomic_load_explicit(&sound->mixed, memory_order_relaxed);
+    while (mixed < end) {
+        uint64_t played = atomic_load_explicit(&sound->played, memory_order_acquire);
+        uint64_t room = SOUND_RING_SIZE - (mixed - played);
+        if (room == 0) {
+            if (atomic_load_explicit(&sound->closing, memory_order_relaxed)) {
+                // nobody is left to play it
+                return;
+            }
+            struct timespec nap = { 0, SOUND_IDLE_NS };
+            nanosleep(&nap, NULL);
+            continue;
+        }
+
+        uint64_t n = end - mixed;
+        if (n > room) {
+            n = room;
+        }
+        if (n > SOUND_CHUNK) {
+            n = SOUND_CHUNK;
+        }
+        for (uint64_t i = 0; i < n; i++) {
+            int32_t sum = 0;
+            for (int v = 0; v < SOUND_COUNT; v++) {
+                int64_t pos = sound->voices[v];
+                if (pos < 0) {
+                    continue;
+                }
+                const SoundSample *sample = &sound->samples[v];
+                sum += sample->data[pos];
+                if (++pos == sample->len) {
+                    // the UFO keeps going while its bit is set
+                    pos = v == 0 && (sound->latches[0] & 1) ? 0 : -1;
+                }
+                sound->voices[v] = pos;
+            }
+            sound->ring[(mixed + i) & (SOUND_RING_SIZE - 1)] =
+                sum > INT16_MAX ? INT16_MAX : sum < INT16_MIN ? INT16_MIN : sum;
+        }
+        mixed += n;
+        atomic_store_explicit(&sound->mixed, mixed, memory_order_release);
+        if (sound->wav) {
+            play_to_file(sound);
+        }
+    }
+}
+
+
+/*
+ * Starts the voices for the bits that went from 0 to 1:
+ * OUT 3 bits 0-3 are sounds 0-3 and OUT 5 bits 0-4 are 4-8
+ */
+static void apply_event(Sound *sound, const SoundEvent *event) {
+    int latch = event->port == 3 ? 0 : 1;
+    int first = event->port == 3 ? 0 : 4;
+    int bits = event->port == 3 ? 4 : 5;
+
+    uint8_t rising = event->value & ~sound->latches[latch];
+    sound->latches[latch] = event->value;
+    for (int bit = 0; bit < bits; bit++) {
+        if (rising & (1 << bit) && sound->samples[first + bit].len) {
+            sound->voices[first + bit] = 0;
+        }
+    }
+}
+
+
+static void* audio_thread(void *arg) {
+    Sound *sound = arg;
+    uint64_t tail = atomic_load_explicit(&sound->tail, memory_order_relaxed);
+    for (;;) {
+        // read before `head`, so nothing pushed before
+        // closing is missed
+        int closing = atomic_load_explicit(&sound->closing, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&sound->head, memory_order_acquire);
+        if (tail == head) {
+            if (closing) {
+                break;
+            }
+            struct timespec nap = { 0, SOUND_IDLE_NS };
+            nanosleep(&nap, NULL);
+            continue;
+        }
+        for (; tail != head; tail++) {
+            const SoundEvent *event = &sound->queue[tail & (SOUND_QUEUE_SIZE - 1)];
+            mix_until(sound, sample_at(sound, event->cycles));
+            if (event->port != SOUND_MARK) {
+                apply_event(sound, event);
+            }
+            atomic_store_explicit(&sound->tail, tail + 1, memory_order_release);
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * Queues an event, or drops it if the audio thread is a whole
+ * queue behind. Never waits.
+ */
+static void push_event(Sound *sound, uint64_t cycles, uint8_t port, uint8_t value) {
+    uint64_t head = atomic_load_explicit(&sound->head, memory_order_relaxed);
+    if (head - sound->tail_seen == SOUND_QUEUE_SIZE) {
+        sound->tail_seen = atomic_load_explicit(&sound->tail, memory_order_acquire);
+        if (head - sound->tail_seen == SOUND_QUEUE_SIZE) {
+            sound->dropped++;
+            return;
+        }
+    }
+    sound->queue[head & (SOUND_QUEUE_SIZE - 1)] = (SoundEvent) { cycles, port, value };
+    atomic_store_explicit(&sound->head, head + 1, memory_order_release);
+}
+
+
+static void sound_out(void *ctx, uint8_t port, uint8_t val) {
+    Sound *sound = ctx;
+    // still a latch, for snapshots and anything reading it
+    sound->io->out_value[port] = val;
+    sound->events++;
+    push_event(sound, sound->io->cycles, port, val);
+}
+
+
+Sound* sound_new(IoMap *io, uint64_t hz, uint64_t cycles,
+        const char *samples_dir, const char *wav_path) {
+    Sound *sound = aligned_alloc(SOUND_CACHE_LINE, sizeof(Sound));
+    if (sound == NULL) {
+        return NULL;
+    }
+    memset(sound, 0, sizeof(*sound));
+    sound->io = io;
+    sound->hz = hz;
+    sound->start_cycles = cycles;
+    sound->latches[0] = io->out_value[3];
+    sound->latches[1] = io->out_value[5];
+
+    for (int i = 0; i < SOUND_COUNT; i++) {
+        sound->voices[i] = -1;
+        char path[4096];
+        if (samples_dir) {
+            snprintf(path, sizeof(path), "%s/%d.wav", samples_dir, i);
+        }
+        if ((samples_dir == NULL || read_wav(&sound->samples[i], path) < 0)
+                && make_tone(&sound->samples[i], tones[i].hz, tones[i].ms) < 0) {
+            sound_free(sound);
+            return NULL;
+        }
+    }
+
+    if (wav_path) {
+        sound->wav = fopen(wav_path, "wb");
+        if (sound->wav == NULL) {
+            fprintf(stderr, "Error: couldn't open %s\n", wav_path);
+            sound_free(sound);
+            return NULL;
+        }
+        // sizes are filled in by sound_finish
+        uint8_t header[44] = "RIFF\0\0\0\0WAVEfmt ";
+        put32(header + 16, 16);
+        put16(header + 20, 1);
+        put16(header + 22, 1);
+        put32(header + 24, SOUND_RATE);
+        put32(header + 28, SOUND_RATE * 2);
+        put16(header + 32, 2);
+        put16(header + 34, 16);
+        memcpy(header + 36, "data", 4);
+        fwrite(header, 1, sizeof(header), sound->wav);
+    }
+
+    if (pthread_create(&sound->thread, NULL, audio_thread, sound) != 0) {
+        sound_free(sound);
+        return NULL;
+    }
+    sound->started = 1;
+    io_attach(io, 3, NULL, sound_out, sound);
+    io_attach(io, 5, NULL, sound_out, sound);
+    return sound;
+}
+
+
+void sound_frame(Sound *sound, uint64_t cycles) {
+    push_event(sound, cycles, SOUND_MARK, 0);
+}
+
+
+size_t sound_read(Sound *sound, int16_t *out, size_t max) {
+    uint64_t mixed = atomic_load_explicit(&sound->mixed, memory_order_acquire);
+    uint64_t played = atomic_load_explicit(&sound->played, memory_order_relaxed);
+    size_t n = 0;
+    for (; n < max && played < mixed; n++, played++) {
+        out[n] = sound->ring[played & (SOUND_RING_SIZE - 1)];
+    }
+    atomic_store_explicit(&sound->played, played, memory_order_release);
+    return n;
+}
+
+
+int sound_finish(Sound *sound) {
+    if (!sound->started || atomic_exchange(&sound->closing, 1)) {
+        return 0;
+    }
+    pthread_join(sound->thread, NULL);
+
+    // give the ports back to plain latches
+    sound->io->out_kind[3] = PORT_VALUE;
+    sound->io->out_kind[5] = PORT_VALUE;
+
+    if (sound->wav == NULL) {
+        return 0;
+    }
+    uint64_t bytes = atomic_load(&sound->mixed) * sizeof(int16_t);
+    uint8_t size[4];
+    put32(size, 36 + bytes);
+    fseek(sound->wav, 4, SEEK_SET);
+    fwrite(size, 1, 4, sound->wav);
+    put32(size, bytes);
+    fseek(sound->wav, 40, SEEK_SET);
+    fwrite(size, 1, 4, sound->wav);
+    int failed = ferror(sound->wav);
+    failed |= fclose(sound->wav);
+    sound->wav = NULL;
+    return failed ? -1 : 0;
+}
+
+
+void sound_free(Sound *sound) {
+    if (sound == NULL) {
+        return;
+    }
+    sound_finish(sound);
+    if (sound->wav) {
+        fclose(sound->wav);
+    }
+    for (int i = 0; i < SOUND_COUNT; i++) {
+        free(sound->samples[i].data);
+    }
+    free(sound);
+}
@@ -0,0 +1,307 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disassembler.h"
+#include "memory.h"
+#include "rom.h"
+#include "trace.h"
+
+// ring size for streaming: 16 chunks in flight
+#define STREAM_RECORDS (16 * TRACE_CHUNK)
+
+// a decoded record: up to 76 columns of cycles, registers and
+// address, then the instruction
+#define TRACE_LINE_MAX (80 + DIS_TEXT_MAX)
+
+// decoded text held before writing it out
+#define TRACE_FLUSH_BYTES (1 << 20)
+
+
+/*
+ * Allocates a tracer whose ring holds at least
+ * `count` records
+ */
+static Tracer* trace_alloc(size_t count) {
+    size_t capacity = TRACE_CHUNK;
+    while (capacity < count) {
+        capacity <<= 1;
+    }
+
+    Tracer *tracer = calloc(1, sizeof(*tracer));
+    if (tracer == NULL) {
+        return NULL;
+    }
+    tracer->ring = calloc(capacity, sizeof(TraceRecord));
+    if (tracer->ring == NULL) {
+        free(tracer);
+        return NULL;
+    }
+    tracer->mask = capacity - 1;
+    return tracer;
+}
+
+
+/*
+ * Writes the file header, returns 0 on success
+ */
+static int write_header(FILE *f) {
+    TraceHeader header = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord) };
+    return fwrite(&header, sizeof(header), 1, f) == 1 ? 0 : -1;
+}
+
+
+/*
+ * Writes records [from, to) of the ring to `f`,
+ * in at most two pieces either side of the wrap
+ */
+static void write_records(const Tracer *tracer, FILE *f, uint64_t from, uint64_t to) {
+    while (from < to) {
+        uint64_t start = from & tracer->mask;
+        uint64_t n = to - from;
+        if (start + n > tracer->mask + 1) {
+            n = tracer->mask + 1 - start;
+        }
+        fwrite(&tracer->ring[start], sizeof(TraceRecord), n, f);
+        from += n;
+    }
+}
+
+
+static void* flush_thread(void *arg) {
+    Tracer *tracer = arg;
+
+    pthread_mutex_lock(&tracer->lock);
+    for (;;) {
+        while (tracer->flushed == tracer->ready && !tracer->closing) {
+            pthread_cond_wait(&tracer->more, &tracer->lock);
+        }
+        uint64_t from = tracer->flushed;
+        uint64_t to = tracer->ready;
+        if (from == to) {
+            break;  // closing and everything is out
+        }
+
+        // the CPU doesn't touch [from, to) until we
+        // move `flushed` past it, so write unlocked
+        pthread_mutex_unlock(&tracer->lock);
+        write_records(tracer, tracer->file, from, to);
+        pthread_mutex_lock(&tracer->lock);
+
+        tracer->flushed = to;
+        pthread_cond_signal(&tracer->space);
+    }
+    pthread_mutex_unlock(&tracer->lock);
+    return NULL;
+}
+
+
+Tracer* trace_open_stream(const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return NULL;
+    }
+    Tracer *tracer = trace_alloc(STREAM_RECORDS);
+    if (tracer == NULL || write_header(f) < 0) {
+        fprintf(stderr, "Error: couldn't start the trace\n");
+        free(tracer ? tracer->ring : NULL);
+        free(tracer);
+        fclose(f);
+        return NULL;
+    }
+
+    tracer->file = f;
+    pthread_mutex_init(&tracer->lock, NULL);
+    pthread_cond_init(&tracer->more, NULL);
+    pthread_cond_init(&tracer->space, NULL);
+    pthread_create(&tracer->thread, NULL, flush_thread, tracer);
+    return tracer;
+}
+
+
+Tracer* trace_open_ring(size_t count) {
+    return trace_alloc(count);
+}
+
+
+void trace_chunk_done(Tracer *tracer) {
+    if (tracer->file == NULL) {
+        return;  // in-memory ring: old records are overwritten
+    }
+
+    pthread_mutex_lock(&tracer->lock);
+    tracer->ready = tracer->head;
+    pthread_cond_signal(&tracer->more);
+
+    // make sure the next chunk has been written out
+    // before the CPU starts overwriting it
+    while (tracer->head + TRACE_CHUNK - tracer->flushed > tracer->mask + 1) {
+        pthread_cond_wait(&tracer->space, &tracer->lock);
+    }
+    pthread_mutex_unlock(&tracer->lock);
+}
+
+
+int trace_dump(const Tracer *tracer, const char *path, size_t count) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return -1;
+    }
+
+    uint64_t held = tracer->head < tracer->mask + 1 ? tracer->head : tracer->mask + 1;
+    if (count > held) {
+        count = held;
+    }
+    int result = write_header(f);
+    write_records(tracer, f, tracer->head - count, tracer->head);
+    fclose(f);
+    return result;
+}
+
+
+void trace_close(Tracer *tracer) {
+    if (tracer == NULL) {
+        return;
+    }
+    if (tracer->file) {
+        pthread_mutex_lock(&tracer->lock);
+        tracer->ready = tracer->head;
+        tracer->closing = 1;
+        pthread_cond_signal(&tracer->more);
+        pthread_mutex_unlock(&tracer->lock);
+        pthread_join(tracer->thread, NULL);
+
+        fclose(tracer->file);
+        pthread_mutex_destroy(&tracer->lock);
+        pthread_cond_destroy(&tracer->more);
+        pthread_cond_destroy(&tracer->space);
+    }
+    free(tracer->ring);
+    free(tracer);
+}
+
+
+/*
+ * Checks the header at the start of a trace file
+ */
+static int check_header(const TraceHeader *header, const char *path) {
+    if (header->magic != TRACE_MAGIC
+            || header->version != TRACE_VERSION
+            || header->record_size != sizeof(TraceRecord)) {
+        fprintf(stderr, "Error: %s is not a version %d trace\n", path, TRACE_VERSION);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Writes `rec` as a line of text, without the newline,
+ * to `line`, which holds TRACE_LINE_MAX bytes. Returns
+ * its length.
+ */
+static int format_record(const TraceRecord *rec, char *line) {
+    // this runs for every record, so no printf
+    static const char names[] = "ABCDEHL";
+    const uint8_t values[] = { rec->a, rec->b, rec->c, rec->d, rec->e, rec->h, rec->l };
+
+    char digits[20];
+    int n = 0;
+    uint64_t cycles = rec->cycles;
+    do {
+        digits[n++] = '0' + cycles % 10;
+        cycles /= 10;
+    } while (cycles);
+    char *end = line;
+    for (int i = n; i < 12; i++) {
+        *end++ = ' ';
+    }
+    while (n) {
+        *end++ = digits[--n];
+    }
+
+    *end++ = ' ';
+    for (int i = 0; i < 7; i++) {
+        *end++ = ' ';
+        *end++ = names[i];
+        *end++ = '=';
+        end = dis_put_hex(end, values[i], 2);
+    }
+    memcpy(end, " SP=", 4);
+    end = dis_put_hex(end + 4, rec->sp, 4);
+    memcpy(end, " F=", 3);
+    end = dis_put_hex(end + 3, rec->psw, 2);
+    *end++ = ' ';
+    *end++ = ' ';
+    end = dis_put_hex(end, rec->pc, 4);
+    *end++ = ' ';
+
+    DisInstr instr;
+    dis_decode(rec->op, rec->pc, &instr);
+    end += dis_format(&instr, end);
+    return end - line;
+}
+
+
+void trace_print_record(const TraceRecord *rec) {
+    char line[TRACE_LINE_MAX];
+    format_record(rec, line);
+    puts(line);
+}
+
+
+int trace_decode(const char *path) {
+    size_t count;
+    const TraceRecord *records = trace_map(path, &count);
+    if (records == NULL) {
+        return -1;
+    }
+
+    // lines go out a buffer at a time rather than a printf each
+    DisBuffer out;
+    memset(&out, 0, sizeof(out));
+    int status = 0;
+    char line[TRACE_LINE_MAX];
+    for (size_t i = 0; i < count && status == 0; i++) {
+        int len = format_record(&records[i], line);
+        line[len++] = '\n';
+        if (dis_buffer_append(&out, line, len) < 0) {
+            fprintf(stderr, "Error: out of memory\n");
+            status = -1;
+        } else if (out.len >= TRACE_FLUSH_BYTES) {
+            status = dis_buffer_flush(&out, stdout);
+        }
+    }
+    if (status == 0) {
+        status = dis_buffer_flush(&out, stdout);
+    }
+    dis_buffer_free(&out);
+    trace_unmap(records, count);
+    return status;
+}
+
+
+const TraceRecord* trace_map(const char *path, size_t *count) {
+    size_t size;
+    const uint8_t *data = rom_map_file(path, &size);
+    if (data == NULL) {
+        return NULL;
+    }
+    if (size < sizeof(TraceHeader)
+            || check_header((const TraceHeader *) data, path) < 0) {
+        rom_unmap_file(data, size);
+        return NULL;
+    }
+    *count = (size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+    return (const TraceRecord *) (data + sizeof(TraceHeader));
+}
+
+
+void trace_unmap(const TraceRecord *records, size_t count) {
+    if (records) {
+        const uint8_t *data = (const uint8_t *) records - sizeof(TraceHeader);
+        rom_unmap_file(data, sizeof(TraceHeader) + count * sizeof(TraceRecord));
+    }
+}
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "video.h"
+
+#if defined(VIDEO_SCALAR)
+#define VIDEO_KERNEL    "scalar"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VIDEO_KERNEL    "sse2"
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VIDEO_KERNEL    "neon"
+#else
+#define VIDEO_KERNEL    "scalar"
+#endif
+
+
+/*
+ * Returns the 4 bytes as a pixel, in memory order
+ */
+static uint32_t rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    uint8_t bytes[4] = {r, g, b, a};
+    uint32_t pixel;
+    memcpy(&pixel, bytes, sizeof(pixel));
+    return pixel;
+}
+
+
+Video* video_new(VideoFormat format) {
+    Video *video = calloc(1, sizeof(*video));
+    if (video == NULL) {
+        return NULL;
+    }
+    size_t bpp = format == VIDEO_RGBA ? 4 : 1;
+    video->format = format;
+    video->pitch = VIDEO_WIDTH * bpp;
+    video->pixels = malloc(video->pitch * VIDEO_HEIGHT);
+    if (video->pixels == NULL) {
+        free(video);
+        return NULL;
+    }
+    if (format == VIDEO_RGBA) {
+        video->fg = rgba(0xff, 0xff, 0xff, 0xff);
+        video->bg = rgba(0x00, 0x00, 0x00, 0xff);
+    } else {
+        video->fg = 0xff;
+        video->bg = 0x00;
+    }
+    return video;
+}
+
+
+void video_free(Video *video) {
+    if (video) {
+        free(video->pixels);
+        free(video);
+    }
+}
+
+
+void video_invalidate(Video *video) {
+    video->valid = 0;
+}
+
+
+/*
+ * Bit expansion: the 8 bits of `bits`, lowest first, as 8 pixels
+ * at `dst`, fg for a set bit and bg for a clear one
+ */
+#if defined(VIDEO_SCALAR) || !(defined(__SSE2__) || defined(__ARM_NEON))
+
+static void expand_gray(uint8_t *dst, uint8_t bits, uint32_t fg, uint32_t bg) {
+    for (int i = 0; i < 8; i++) {
+        dst[i] = (bits >> i) & 1 ? fg : bg;
+    }
+}
+
+
+static void expand_rgba(uint8_t *dst, uint8_t bits, uint32_t fg, uint32_t bg) {
+    for (int i = 0; i < 8; i++) {
+        uint32_t pixel = (bits >> i) & 1 ? fg : bg;
+        memcpy(&dst[i * 4], &pixel, sizeof(pixel));
+    }
+}
+
+#elif defined(__SSE2__)
+
+// broadcast the byte, keep one bit per lane, and turn
+// each lane into all ones or zeros to pick fg or bg
+
+static void expand_gray(uint8_t *dst, uint8_t bits, uint32_t fg, uint32_t bg) {
+    const __m128i mask = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char) 128,
+        0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i lit = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8((char) bits), mask), mask);
+    __m128i bgv = _mm_set1_epi8((char) bg);
+    __m128i diff = _mm_set1_epi8((char) (fg ^ bg));
+    _mm_storel_epi64((__m128i *) dst, _mm_xor_si128(bgv, _mm_and_si128(diff, lit)));
+}
+
+
+static void expand_rgba(uint8_t *dst, uint8_t bits, uint32_t fg, uint32_t bg) {
+    const __m128i lo = _mm_setr_epi32(1, 2, 4, 8);
+    const __m128i hi = _mm_setr_epi32(16, 32, 64, 128);
+    __m128i b = _mm_set1_epi32(bits);
+    __m128i bgv = _mm_set1_epi32((int) bg);
+    __m128i diff = _mm_set1_epi32((int) (fg ^ bg));
+    __m128i lit_lo = _mm_cmpeq_epi32(_mm_and_si128(b, lo), lo);
+    __m128i lit_hi = _mm_cmpeq_epi32(_mm_and_si128(b, hi), hi);
+    _mm_storeu_si128((__m128i *) dst, _mm_xor_si128(bgv, _mm_and_si128(diff, lit_lo)));
+    _mm_storeu_si128((__m128i *) (dst + 16), _mm_xor_si128(bgv, _mm_and_si128(diff, lit_hi)));
+}
+
+#else // __ARM_NEON
+
+static void expand_gray(uint8_t *dst, uint8_t bits, uint32_t fg, uint32_t bg) {
+    static const uint8_t mask[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x8_t lit = vtst_u8(vdup_n_u8(bits), vld1_u8(mask));
+    vst1_u8(dst, vbsl_u8(lit, vdup_n_u8(fg), vdup_n_u8(bg)));
+}
+
+
+static void expand_rgba(uint8_t *dst, uint8_t bits, uint32_t fg, uint32_t bg) {
+    static const uint32_t lo[4] = {1, 2, 4, 8};
+    static const uint32_t hi[4] = {16, 32, 64, 128};
+    uint32x4_t b = vdupq_n_u32(bits);
+    uint32x4_t fgv = vdupq_n_u32(fg);
+    uint32x4_t bgv = vdupq_n_u32(bg);
+    vst1q_u8(dst, vreinterpretq_u8_u32(vbslq_u32(vtstq_u32(b, vld1q_u32(lo)), fgv, bgv)));
+    vst1q_u8(dst + 16, vreinterpretq_u8_u32(vbslq_u32(vtstq_u32(b, vld1q_u32(hi)), fgv, bgv)));
+}
+
+#endif
+
+
+/*
+ * Transposes an 8x8 bit matrix held as 8 bytes, one row each
+ * with its lowest bit in column 0: bit i of byte j moves to
+ * bit j of byte i
+ */
+static uint64_t transpose8(uint64_t x) {
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+    x ^= t ^ (t << 28);
+    return x;
+}
+
+
+/*
+ * The 8 bytes of a tile: column `col` of 8 VRAM rows, first row lowest
+ */
+static uint64_t gather_tile(const uint8_t *rows, int col) {
+    uint64_t x = 0;
+    for (int j = 0; j < VIDEO_TILE; j++) {
+        x |= (uint64_t) rows[j * VIDEO_ROW_BYTES + col] << (j * 8);
+    }
+    return x;
+}
+
+
+/*
+ * Draws one tile. VRAM rows run left to right up the screen, so
+ * the tile's transpose gives a row of 8 pixels per VRAM bit, and
+ * bit 0 of column `col` is the lowest of its 8 picture rows.
+ */
+static void draw_tile(Video *video, int strip, int col, uint64_t tile) {
+    uint64_t lines = transpose8(tile);
+    size_t bpp = video->format == VIDEO_RGBA ? 4 : 1;
+    uint8_t *dst = video->pixels + strip * VIDEO_TILE * bpp
+        + (size_t) (VIDEO_HEIGHT - 1 - col * 8) * video->pitch;
+
+    for (int bit = 0; bit < 8; bit++) {
+        uint8_t line = lines >> (bit * 8);
+        if (video->format == VIDEO_RGBA) {
+            expand_rgba(dst, line, video->fg, video->bg);
+        } else {
+            expand_gray(dst, line, video->fg, video->bg);
+        }
+        dst -= video->pitch;
+    }
+}
+
+
+int video_update(Video *video, const uint8_t *memory) {
+    const uint8_t *vram = memory + VIDEO_RAM;
+    int redrawn = 0;
+
+    for (int strip = 0; strip < VIDEO_STRIPS; strip++) {
+        size_t offset = (size_t) strip * VIDEO_TILE * VIDEO_ROW_BYTES;
+        const uint8_t *rows = vram + offset;
+        const uint8_t *old = video->shadow + offset;
+
+        // most of the screen stays the same from one frame to
+        // the next, so whole strips are checked first
+        if (video->valid && memcmp(rows, old, VIDEO_TILE * VIDEO_ROW_BYTES) == 0) {
+            continue;
+        }
+        for (int col = 0; col < VIDEO_ROW_BYTES; col++) {
+            uint64_t tile = gather_tile(rows, col);
+            if (video->valid && tile == gather_tile(old, col)) {
+                continue;
+            }
+            draw_tile(video, strip, col, tile);
+            redrawn++;
+        }
+        memcpy(video->shadow + offset, rows, VIDEO_TILE * VIDEO_ROW_BYTES);
+    }
+
+    video->valid = 1;
+    video->frames++;
+    video->tiles += redrawn;
+    return redrawn;
+}
+
+
+int video_write(const Video *video, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: couldn't open %s\n", path);
+        return -1;
+    }
+
+    int ok;
+    if (video->format == VIDEO_RGBA) {
+        fprintf(f, "P6\n%d %d\n255\n", VIDEO_WIDTH, VIDEO_HEIGHT);
+        uint8_t row[VIDEO_WIDTH * 3];
+        ok = 1;
+        for (int y = 0; y < VIDEO_HEIGHT && ok; y++) {
+            const uint8_t *src = video->pixels + y * video->pitch;
+            for (int x = 0; x < VIDEO_WIDTH; x++) {
+                memcpy(&row[x * 3], &src[x * 4], 3);
+            }
+            ok = fwrite(row, sizeof(row), 1, f) == 1;
+        }
+    } else {
+        fprintf(f, "P5\n%d %d\n255\n", VIDEO_WIDTH, VIDEO_HEIGHT);
+        ok = fwrite(video->pixels, video->pitch * VIDEO_HEIGHT, 1, f) == 1;
+    }
+
+    if (fclose(f) != 0 || !ok) {
+        fprintf(stderr, "Error: couldn't write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+
+const char* video_kernel_name(void) {
+    return VIDEO_KERNEL;
+}
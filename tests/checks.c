@@ -0,0 +1,712 @@
+/*
+ * Writes the CPU checks `make test` runs: small CP/M programs
+ * that print PASS, or FAIL and the number of the check that
+ * failed in hex, then warm boot. Each one is run on every
+ * engine with --cpm-engines all, which also fails if the
+ * engines disagree.
+ *
+ *   alu.com   A and the flags after immediate ALU ops, INR,
+ *             DCR, the rotates, CMA, STC and CMC
+ *   daa.com   DAA after every combination of AC and CY
+ *   flow.com  CALL, RET, RST and PCHL round trips, and every
+ *             condition of Jcc, Ccc and Rcc
+ *   int.com   interrupts raised on CPM_PORT_INT: latched while
+ *             disabled, taken after the instruction after EI,
+ *             disabled again on entry
+ *
+ * Usage: checks DIR
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// must match include/cpm.h
+#define CPM_TPA         0x0100
+#define CPM_PORT_INT    3
+
+// below the BDOS stub
+#define STACK_TOP       0xf000
+
+#define MAX_CODE        4096
+#define MAX_LABELS      512
+#define MAX_FIXUPS      1024
+
+// 8080 flags, as PUSH PSW stores them
+#define F_NONE          0x00
+#define F_CY            0x01
+#define F_ONE           0x02    // always set
+#define F_P             0x04
+#define F_AC            0x10
+#define F_Z             0x40
+#define F_S             0x80
+#define F_ALL           (F_S | F_Z | F_AC | F_P | F_CY)
+
+/*
+ * A program being assembled at CPM_TPA. Addresses are
+ * labels, filled in once the whole program is written.
+ */
+typedef struct program_t {
+    uint8_t             code[MAX_CODE];
+    int                 len;
+
+    // address of each label, -1 until it is placed
+    int                 labels[MAX_LABELS];
+    int                 label_count;
+
+    // 16-bit operands that take a label's address
+    struct {
+        int             at;
+        int             label;
+    } fixups[MAX_FIXUPS];
+    int                 fixup_count;
+
+    // check numbers handed out so far, and the
+    // routine a failed check jumps to
+    int                 checks;
+    int                 fail;
+} Program;
+
+/*
+ * One ALU op run from A and the flags `a`/`flags`, with
+ * what it must leave in them. `imm` goes after the opcode,
+ * so it is 0x00 (NOP) for the one-byte ops.
+ */
+typedef struct vector_t {
+    uint8_t             op;
+    uint8_t             imm;
+    uint8_t             a;
+    uint8_t             flags;
+    uint8_t             want_a;
+    uint8_t             want_flags;
+} Vector;
+
+
+static const Vector alu_vectors[] = {
+    { 0xc6, 0x00, 0x00, F_NONE, 0x00, F_Z | F_P },  // ADI
+    { 0xc6, 0xc6, 0x3a, F_ALL, 0x00, F_Z | F_AC | F_P | F_CY },  // ADI
+    { 0xc6, 0x01, 0x7f, F_NONE, 0x80, F_S | F_AC },  // ADI
+    { 0xc6, 0x80, 0x80, F_ALL, 0x00, F_Z | F_P | F_CY },  // ADI
+    { 0xc6, 0x01, 0x0f, F_NONE, 0x10, F_AC },  // ADI
+    { 0xc6, 0xff, 0xff, F_ALL, 0xfe, F_S | F_AC | F_CY },  // ADI
+    { 0xc6, 0x9e, 0x45, F_NONE, 0xe3, F_S | F_AC },  // ADI
+    { 0xc6, 0x20, 0x10, F_ALL, 0x30, F_P },  // ADI
+    { 0xce, 0x00, 0x00, F_NONE, 0x00, F_Z | F_P },  // ACI
+    { 0xce, 0xc6, 0x3a, F_CY, 0x01, F_AC | F_CY },  // ACI
+    { 0xce, 0x01, 0x7f, F_NONE, 0x80, F_S | F_AC },  // ACI
+    { 0xce, 0x80, 0x80, F_CY, 0x01, F_CY },  // ACI
+    { 0xce, 0x01, 0x0f, F_NONE, 0x10, F_AC },  // ACI
+    { 0xce, 0xff, 0xff, F_CY, 0xff, F_S | F_AC | F_P | F_CY },  // ACI
+    { 0xce, 0x9e, 0x45, F_NONE, 0xe3, F_S | F_AC },  // ACI
+    { 0xce, 0x20, 0x10, F_CY, 0x31, F_NONE },  // ACI
+    { 0xd6, 0x00, 0x00, F_NONE, 0x00, F_Z | F_AC | F_P },  // SUI
+    { 0xd6, 0xc6, 0x3a, F_ALL, 0x74, F_AC | F_P | F_CY },  // SUI
+    { 0xd6, 0x01, 0x7f, F_NONE, 0x7e, F_AC | F_P },  // SUI
+    { 0xd6, 0x80, 0x80, F_ALL, 0x00, F_Z | F_AC | F_P },  // SUI
+    { 0xd6, 0x01, 0x0f, F_NONE, 0x0e, F_AC },  // SUI
+    { 0xd6, 0xff, 0xff, F_ALL, 0x00, F_Z | F_AC | F_P },  // SUI
+    { 0xd6, 0x9e, 0x45, F_NONE, 0xa7, F_S | F_CY },  // SUI
+    { 0xd6, 0x20, 0x10, F_ALL, 0xf0, F_S | F_AC | F_P | F_CY },  // SUI
+    { 0xde, 0x00, 0x00, F_NONE, 0x00, F_Z | F_AC | F_P },  // SBI
+    { 0xde, 0xc6, 0x3a, F_CY, 0x73, F_AC | F_CY },  // SBI
+    { 0xde, 0x01, 0x7f, F_NONE, 0x7e, F_AC | F_P },  // SBI
+    { 0xde, 0x80, 0x80, F_CY, 0xff, F_S | F_P | F_CY },  // SBI
+    { 0xde, 0x01, 0x0f, F_NONE, 0x0e, F_AC },  // SBI
+    { 0xde, 0xff, 0xff, F_CY, 0xff, F_S | F_P | F_CY },  // SBI
+    { 0xde, 0x9e, 0x45, F_NONE, 0xa7, F_S | F_CY },  // SBI
+    { 0xde, 0x20, 0x10, F_CY, 0xef, F_S | F_CY },  // SBI
+    { 0xe6, 0x00, 0x00, F_NONE, 0x00, F_Z | F_P },  // ANI
+    { 0xe6, 0xc6, 0x3a, F_ALL, 0x02, F_AC },  // ANI
+    { 0xe6, 0x01, 0x7f, F_NONE, 0x01, F_AC },  // ANI
+    { 0xe6, 0x80, 0x80, F_ALL, 0x80, F_S },  // ANI
+    { 0xe6, 0x01, 0x0f, F_NONE, 0x01, F_AC },  // ANI
+    { 0xe6, 0xff, 0xff, F_ALL, 0xff, F_S | F_AC | F_P },  // ANI
+    { 0xe6, 0x9e, 0x45, F_NONE, 0x04, F_AC },  // ANI
+    { 0xe6, 0x20, 0x10, F_ALL, 0x00, F_Z | F_P },  // ANI
+    { 0xee, 0x00, 0x00, F_NONE, 0x00, F_Z | F_P },  // XRI
+    { 0xee, 0xc6, 0x3a, F_ALL, 0xfc, F_S | F_P },  // XRI
+    { 0xee, 0x01, 0x7f, F_NONE, 0x7e, F_P },  // XRI
+    { 0xee, 0x80, 0x80, F_ALL, 0x00, F_Z | F_P },  // XRI
+    { 0xee, 0x01, 0x0f, F_NONE, 0x0e, F_NONE },  // XRI
+    { 0xee, 0xff, 0xff, F_ALL, 0x00, F_Z | F_P },  // XRI
+    { 0xee, 0x9e, 0x45, F_NONE, 0xdb, F_S | F_P },  // XRI
+    { 0xee, 0x20, 0x10, F_ALL, 0x30, F_P },  // XRI
+    { 0xf6, 0x00, 0x00, F_NONE, 0x00, F_Z | F_P },  // ORI
+    { 0xf6, 0xc6, 0x3a, F_ALL, 0xfe, F_S },  // ORI
+    { 0xf6, 0x01, 0x7f, F_NONE, 0x7f, F_NONE },  // ORI
+    { 0xf6, 0x80, 0x80, F_ALL, 0x80, F_S },  // ORI
+    { 0xf6, 0x01, 0x0f, F_NONE, 0x0f, F_P },  // ORI
+    { 0xf6, 0xff, 0xff, F_ALL, 0xff, F_S | F_P },  // ORI
+    { 0xf6, 0x9e, 0x45, F_NONE, 0xdf, F_S },  // ORI
+    { 0xf6, 0x20, 0x10, F_ALL, 0x30, F_P },  // ORI
+    { 0xfe, 0x00, 0x00, F_NONE, 0x00, F_Z | F_AC | F_P },  // CPI
+    { 0xfe, 0xc6, 0x3a, F_ALL, 0x3a, F_AC | F_P | F_CY },  // CPI
+    { 0xfe, 0x01, 0x7f, F_NONE, 0x7f, F_AC | F_P },  // CPI
+    { 0xfe, 0x80, 0x80, F_ALL, 0x80, F_Z | F_AC | F_P },  // CPI
+    { 0xfe, 0x01, 0x0f, F_NONE, 0x0f, F_AC },  // CPI
+    { 0xfe, 0xff, 0xff, F_ALL, 0xff, F_Z | F_AC | F_P },  // CPI
+    { 0xfe, 0x9e, 0x45, F_NONE, 0x45, F_S | F_CY },  // CPI
+    { 0xfe, 0x20, 0x10, F_ALL, 0x10, F_S | F_AC | F_P | F_CY },  // CPI
+    { 0x3c, 0x00, 0x00, F_NONE, 0x01, F_NONE },  // INR A
+    { 0x3c, 0x00, 0x0f, F_CY, 0x10, F_AC | F_CY },  // INR A
+    { 0x3c, 0x00, 0x7f, F_NONE, 0x80, F_S | F_AC },  // INR A
+    { 0x3c, 0x00, 0xff, F_CY, 0x00, F_Z | F_AC | F_P | F_CY },  // INR A
+    { 0x3c, 0x00, 0x10, F_NONE, 0x11, F_P },  // INR A
+    { 0x3c, 0x00, 0x80, F_CY, 0x81, F_S | F_P | F_CY },  // INR A
+    { 0x3d, 0x00, 0x00, F_NONE, 0xff, F_S | F_P },  // DCR A
+    { 0x3d, 0x00, 0x0f, F_CY, 0x0e, F_AC | F_CY },  // DCR A
+    { 0x3d, 0x00, 0x7f, F_NONE, 0x7e, F_AC | F_P },  // DCR A
+    { 0x3d, 0x00, 0xff, F_CY, 0xfe, F_S | F_AC | F_CY },  // DCR A
+    { 0x3d, 0x00, 0x10, F_NONE, 0x0f, F_P },  // DCR A
+    { 0x3d, 0x00, 0x80, F_CY, 0x7f, F_CY },  // DCR A
+    { 0x07, 0x00, 0x81, F_NONE, 0x03, F_CY },  // RLC
+    { 0x07, 0x00, 0x81, F_ALL, 0x03, F_ALL },  // RLC
+    { 0x07, 0x00, 0x7e, F_NONE, 0xfc, F_NONE },  // RLC
+    { 0x07, 0x00, 0x7e, F_ALL, 0xfc, F_S | F_Z | F_AC | F_P },  // RLC
+    { 0x0f, 0x00, 0x81, F_NONE, 0xc0, F_CY },  // RRC
+    { 0x0f, 0x00, 0x81, F_ALL, 0xc0, F_ALL },  // RRC
+    { 0x0f, 0x00, 0x7e, F_NONE, 0x3f, F_NONE },  // RRC
+    { 0x0f, 0x00, 0x7e, F_ALL, 0x3f, F_S | F_Z | F_AC | F_P },  // RRC
+    { 0x17, 0x00, 0x81, F_NONE, 0x02, F_CY },  // RAL
+    { 0x17, 0x00, 0x81, F_ALL, 0x03, F_ALL },  // RAL
+    { 0x17, 0x00, 0x7e, F_NONE, 0xfc, F_NONE },  // RAL
+    { 0x17, 0x00, 0x7e, F_ALL, 0xfd, F_S | F_Z | F_AC | F_P },  // RAL
+    { 0x1f, 0x00, 0x81, F_NONE, 0x40, F_CY },  // RAR
+    { 0x1f, 0x00, 0x81, F_ALL, 0xc0, F_ALL },  // RAR
+    { 0x1f, 0x00, 0x7e, F_NONE, 0x3f, F_NONE },  // RAR
+    { 0x1f, 0x00, 0x7e, F_ALL, 0xbf, F_S | F_Z | F_AC | F_P },  // RAR
+    { 0x2f, 0x00, 0x5a, F_NONE, 0xa5, F_NONE },  // CMA
+    { 0x37, 0x00, 0x5a, F_NONE, 0x5a, F_CY },  // STC
+    { 0x3f, 0x00, 0x5a, F_NONE, 0x5a, F_CY },  // CMC
+    { 0x2f, 0x00, 0x5a, F_ALL, 0xa5, F_ALL },  // CMA
+    { 0x37, 0x00, 0x5a, F_ALL, 0x5a, F_ALL },  // STC
+    { 0x3f, 0x00, 0x5a, F_ALL, 0x5a, F_S | F_Z | F_AC | F_P },  // CMC
+};
+
+static const Vector daa_vectors[] = {
+    { 0x27, 0x00, 0x00, F_NONE, 0x00, F_Z | F_P },  // DAA
+    { 0x27, 0x00, 0x00, F_AC, 0x06, F_P },  // DAA
+    { 0x27, 0x00, 0x00, F_CY, 0x60, F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x00, F_AC | F_CY, 0x66, F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x09, F_NONE, 0x09, F_P },  // DAA
+    { 0x27, 0x00, 0x09, F_AC, 0x0f, F_P },  // DAA
+    { 0x27, 0x00, 0x09, F_CY, 0x69, F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x09, F_AC | F_CY, 0x6f, F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x0a, F_NONE, 0x10, F_AC },  // DAA
+    { 0x27, 0x00, 0x0a, F_AC, 0x10, F_AC },  // DAA
+    { 0x27, 0x00, 0x0a, F_CY, 0x70, F_AC | F_CY },  // DAA
+    { 0x27, 0x00, 0x0a, F_AC | F_CY, 0x70, F_AC | F_CY },  // DAA
+    { 0x27, 0x00, 0x19, F_NONE, 0x19, F_NONE },  // DAA
+    { 0x27, 0x00, 0x19, F_AC, 0x1f, F_NONE },  // DAA
+    { 0x27, 0x00, 0x19, F_CY, 0x79, F_CY },  // DAA
+    { 0x27, 0x00, 0x19, F_AC | F_CY, 0x7f, F_CY },  // DAA
+    { 0x27, 0x00, 0x1a, F_NONE, 0x20, F_AC },  // DAA
+    { 0x27, 0x00, 0x1a, F_AC, 0x20, F_AC },  // DAA
+    { 0x27, 0x00, 0x1a, F_CY, 0x80, F_S | F_AC | F_CY },  // DAA
+    { 0x27, 0x00, 0x1a, F_AC | F_CY, 0x80, F_S | F_AC | F_CY },  // DAA
+    { 0x27, 0x00, 0x99, F_NONE, 0x99, F_S | F_P },  // DAA
+    { 0x27, 0x00, 0x99, F_AC, 0x9f, F_S | F_P },  // DAA
+    { 0x27, 0x00, 0x99, F_CY, 0xf9, F_S | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x99, F_AC | F_CY, 0xff, F_S | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x9a, F_NONE, 0x00, F_Z | F_AC | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x9a, F_AC, 0x00, F_Z | F_AC | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x9a, F_CY, 0x00, F_Z | F_AC | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x9a, F_AC | F_CY, 0x00, F_Z | F_AC | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0xa0, F_NONE, 0x00, F_Z | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0xa0, F_AC, 0x06, F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0xa0, F_CY, 0x00, F_Z | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0xa0, F_AC | F_CY, 0x06, F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0xff, F_NONE, 0x65, F_AC | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0xff, F_AC, 0x65, F_AC | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0xff, F_CY, 0x65, F_AC | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0xff, F_AC | F_CY, 0x65, F_AC | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x66, F_NONE, 0x66, F_P },  // DAA
+    { 0x27, 0x00, 0x66, F_AC, 0x6c, F_P },  // DAA
+    { 0x27, 0x00, 0x66, F_CY, 0xc6, F_S | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x66, F_AC | F_CY, 0xcc, F_S | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x42, F_NONE, 0x42, F_P },  // DAA
+    { 0x27, 0x00, 0x42, F_AC, 0x48, F_P },  // DAA
+    { 0x27, 0x00, 0x42, F_CY, 0xa2, F_S | F_CY },  // DAA
+    { 0x27, 0x00, 0x42, F_AC | F_CY, 0xa8, F_S | F_CY },  // DAA
+    { 0x27, 0x00, 0x15, F_NONE, 0x15, F_NONE },  // DAA
+    { 0x27, 0x00, 0x15, F_AC, 0x1b, F_P },  // DAA
+    { 0x27, 0x00, 0x15, F_CY, 0x75, F_CY },  // DAA
+    { 0x27, 0x00, 0x15, F_AC | F_CY, 0x7b, F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x90, F_NONE, 0x90, F_S | F_P },  // DAA
+    { 0x27, 0x00, 0x90, F_AC, 0x96, F_S | F_P },  // DAA
+    { 0x27, 0x00, 0x90, F_CY, 0xf0, F_S | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0x90, F_AC | F_CY, 0xf6, F_S | F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0xf9, F_NONE, 0x59, F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0xf9, F_AC, 0x5f, F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0xf9, F_CY, 0x59, F_P | F_CY },  // DAA
+    { 0x27, 0x00, 0xf9, F_AC | F_CY, 0x5f, F_P | F_CY },  // DAA
+};
+
+
+static void emit(Program *p, const void *bytes, int n) {
+    if (p->len + n > MAX_CODE) {
+        fprintf(stderr, "checks: program too big\n");
+        exit(1);
+    }
+    memcpy(p->code + p->len, bytes, n);
+    p->len += n;
+}
+
+// EMIT(p, 0x3e, 7) emits MVI A,7
+#define EMIT(p, ...) emit((p), (const uint8_t[]) { __VA_ARGS__ }, \
+    sizeof((const uint8_t[]) { __VA_ARGS__ }))
+
+
+/*
+ * Returns a new label, placed later with place()
+ */
+static int label(Program *p) {
+    if (p->label_count == MAX_LABELS) {
+        fprintf(stderr, "checks: too many labels\n");
+        exit(1);
+    }
+    p->labels[p->label_count] = -1;
+    return p->label_count++;
+}
+
+
+static void place(Program *p, int l) {
+    p->labels[l] = CPM_TPA + p->len;
+}
+
+
+/*
+ * Emits `op` with the address of label `l` as its operand
+ */
+static void emit_to(Program *p, uint8_t op, int l) {
+    if (p->fixup_count == MAX_FIXUPS) {
+        fprintf(stderr, "checks: too many fixups\n");
+        exit(1);
+    }
+    EMIT(p, op);
+    p->fixups[p->fixup_count].at = p->len;
+    p->fixups[p->fixup_count].label = l;
+    p->fixup_count++;
+    EMIT(p, 0x00, 0x00);
+}
+
+
+static void begin(Program *p) {
+    memset(p, 0, sizeof(*p));
+    p->fail = label(p);
+    EMIT(p, 0x31, STACK_TOP & 0xff, STACK_TOP >> 8);    // LXI SP,STACK_TOP
+}
+
+
+/*
+ * Prints `text` with BDOS function 9
+ */
+static void print(Program *p, const char *text) {
+    int str = label(p);
+    int over = label(p);
+    emit_to(p, 0x11, str);                  // LXI D,str
+    EMIT(p, 0x0e, 9, 0xcd, 0x05, 0x00);     // MVI C,9; CALL 5
+    emit_to(p, 0xc3, over);                 // JMP over
+    place(p, str);
+    emit(p, text, strlen(text));
+    EMIT(p, '$');
+    place(p, over);
+}
+
+
+/*
+ * Ends a check: Z set means it passed, otherwise
+ * the program fails with the check's number
+ */
+static void check(Program *p) {
+    int ok = label(p);
+    emit_to(p, 0xca, ok);                   // JZ ok
+    EMIT(p, 0x3e, ++p->checks);             // MVI A,n
+    emit_to(p, 0xc3, p->fail);              // JMP fail
+    place(p, ok);
+}
+
+
+/*
+ * Checks A is `want`
+ */
+static void check_a(Program *p, uint8_t want) {
+    EMIT(p, 0xfe, want);                    // CPI want
+    check(p);
+}
+
+
+/*
+ * Checks HL is the address of label `l`
+ */
+static void check_hl(Program *p, int l) {
+    emit_to(p, 0x11, l);                    // LXI D,l
+    EMIT(p, 0x7c, 0xba);                    // MOV A,H; CMP D
+    check(p);
+    EMIT(p, 0x7d, 0xbb);                    // MOV A,L; CMP E
+    check(p);
+}
+
+
+/*
+ * Copies `len` bytes from label `from` to `to` when the
+ * program runs, to put handlers on the RST vectors
+ */
+static void install(Program *p, uint16_t to, int from, uint8_t len) {
+    int loop = label(p);
+    emit_to(p, 0x21, from);                 // LXI H,from
+    EMIT(p, 0x11, to & 0xff, to >> 8);      // LXI D,to
+    EMIT(p, 0x0e, len);                     // MVI C,len
+    place(p, loop);
+    EMIT(p, 0x7e, 0x12, 0x23, 0x13, 0x0d);  // MOV A,M; STAX D; INX H; INX D; DCR C
+    emit_to(p, 0xc2, loop);                 // JNZ loop
+}
+
+
+/*
+ * Prints PASS and warm boots, adds the failure routine,
+ * resolves the labels and writes the program to `path`.
+ * Returns 0 on success and -1 on failure.
+ */
+static int finish(Program *p, const char *path) {
+    print(p, "PASS\r\n");
+    EMIT(p, 0xc3, 0x00, 0x00);              // JMP 0
+
+    // the check number in A, as two hex digits
+    int hex = label(p);
+    int digit = label(p);
+    place(p, p->fail);
+    EMIT(p, 0x47);                          // MOV B,A
+    print(p, "FAIL ");
+    EMIT(p, 0x78, 0x0f, 0x0f, 0x0f, 0x0f);  // MOV A,B; RRC x4
+    emit_to(p, 0xcd, hex);                  // CALL hex
+    EMIT(p, 0x78);                          // MOV A,B
+    emit_to(p, 0xcd, hex);                  // CALL hex
+    print(p, "\r\n");
+    EMIT(p, 0xc3, 0x00, 0x00);              // JMP 0
+
+    place(p, hex);
+    EMIT(p, 0xe6, 0x0f, 0xfe, 10);          // ANI 0x0f; CPI 10
+    emit_to(p, 0xda, digit);                // JC digit
+    EMIT(p, 0xc6, 'A' - '0' - 10);          // ADI 'A' - '0' - 10
+    place(p, digit);
+    EMIT(p, 0xc6, '0', 0x5f);               // ADI '0'; MOV E,A
+    EMIT(p, 0x0e, 2, 0xcd, 0x05, 0x00);     // MVI C,2; CALL 5
+    EMIT(p, 0xc9);                          // RET
+
+    for (int i = 0; i < p->fixup_count; i++) {
+        int addr = p->labels[p->fixups[i].label];
+        if (addr < 0) {
+            fprintf(stderr, "checks: %s: label %d never placed\n", path, p->fixups[i].label);
+            return -1;
+        }
+        p->code[p->fixups[i].at] = addr & 0xff;
+        p->code[p->fixups[i].at + 1] = addr >> 8;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    int ok = fwrite(p->code, 1, p->len, f) == (size_t) p->len;
+    if (fclose(f) != 0 || !ok) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Runs each vector through a stub in RAM that the program
+ * patches with the op, comparing A and the flags through
+ * PUSH PSW. A failure is numbered by its vector, from 1.
+ */
+static void vector_checks(Program *p, const Vector *vectors, int count) {
+    int table = label(p);
+    int loop = label(p);
+    int bad = label(p);
+    int stub = label(p);
+    int stub_imm = label(p);
+    int done = label(p);
+
+    EMIT(p, 0x06, 0x00);                    // MVI B,0
+    emit_to(p, 0x21, table);                // LXI H,table
+    place(p, loop);
+    EMIT(p, 0x7e, 0xb7);                    // MOV A,M; ORA A
+    emit_to(p, 0xca, done);                 // JZ done
+    emit_to(p, 0x32, stub);                 // STA stub
+    EMIT(p, 0x23, 0x7e);                    // INX H; MOV A,M
+    emit_to(p, 0x32, stub_imm);             // STA stub_imm
+    EMIT(p, 0x23, 0x56, 0x23, 0x5e, 0x23);  // INX H; MOV D,M; INX H; MOV E,M; INX H
+    EMIT(p, 0xe5, 0xd5, 0xf1);              // PUSH H; PUSH D; POP PSW
+    emit_to(p, 0xcd, stub);                 // CALL stub
+    EMIT(p, 0xf5, 0xd1, 0xe1);              // PUSH PSW; POP D; POP H
+    EMIT(p, 0x7e, 0xba);                    // MOV A,M; CMP D
+    emit_to(p, 0xc2, bad);                  // JNZ bad
+    EMIT(p, 0x23, 0x7e, 0xbb);              // INX H; MOV A,M; CMP E
+    emit_to(p, 0xc2, bad);                  // JNZ bad
+    EMIT(p, 0x23, 0x04);                    // INX H; INR B
+    emit_to(p, 0xc3, loop);                 // JMP loop
+
+    place(p, bad);
+    EMIT(p, 0x78, 0x3c);                    // MOV A,B; INR A
+    emit_to(p, 0xc3, p->fail);              // JMP fail
+
+    place(p, stub);
+    EMIT(p, 0x00);
+    place(p, stub_imm);
+    EMIT(p, 0x00, 0xc9);                    // RET
+
+    place(p, table);
+    for (int i = 0; i < count; i++) {
+        const Vector *v = &vectors[i];
+        EMIT(p, v->op, v->imm, v->a, v->flags, v->want_a, v->want_flags | F_ONE);
+    }
+    EMIT(p, 0x00);
+    place(p, done);
+    p->checks = count;
+}
+
+
+/*
+ * Returns 1 if the condition in bits 3-5 of a Jcc, Ccc
+ * or Rcc opcode holds with `flags`
+ */
+static int condition_holds(uint8_t op, uint8_t flags) {
+    static const uint8_t flag[] = { F_Z, F_CY, F_P, F_S };
+    int cc = (op >> 3) & 7;
+    int set = (flags & flag[cc >> 1]) != 0;
+    return (cc & 1) ? set : !set;
+}
+
+
+static void flow_checks(Program *p) {
+    // CALL pushes the address after it
+    int over = label(p);
+    int sub = label(p);
+    emit_to(p, 0xc3, over);                 // JMP over
+    place(p, sub);
+    EMIT(p, 0xe1, 0xe5, 0xc9);              // POP H; PUSH H; RET
+    place(p, over);
+    int ret = label(p);
+    emit_to(p, 0xcd, sub);                  // CALL sub
+    place(p, ret);
+    check_hl(p, ret);
+
+    // RST n pushes the address after it (not 2 on) and goes to 8 * n;
+    // RST 0 is the warm boot
+    int handler = label(p);
+    over = label(p);
+    emit_to(p, 0xc3, over);                 // JMP over
+    place(p, handler);
+    EMIT(p, 0xe1, 0xe5, 0x04, 0xc9);        // POP H; PUSH H; INR B; RET
+    place(p, over);
+    for (int n = 1; n < 8; n++) {
+        install(p, 8 * n, handler, 4);
+        ret = label(p);
+        EMIT(p, 0x06, 0x00, 0xc7 | (n << 3));   // MVI B,0; RST n
+        place(p, ret);
+        check_hl(p, ret);
+        EMIT(p, 0x78);                      // MOV A,B
+        check_a(p, 1);
+    }
+
+    // PCHL
+    int target = label(p);
+    EMIT(p, 0x06, 0x00);                    // MVI B,0
+    emit_to(p, 0x21, target);               // LXI H,target
+    EMIT(p, 0xe9, 0x04);                    // PCHL; INR B
+    place(p, target);
+    EMIT(p, 0x78);                          // MOV A,B
+    check_a(p, 0);
+
+    // every condition, with flags from each setup; B counts
+    // the INR Bs run when a Jcc or Rcc isn't taken, or a
+    // Ccc is
+    static const struct {
+        uint8_t         code[4];
+        int             len;
+        uint8_t         flags;
+    } setups[] = {
+        { { 0xaf }, 1, F_Z | F_P },                     // XRA A
+        { { 0x3e, 0x80, 0xb7 }, 3, F_S },               // MVI A,0x80; ORA A
+        { { 0x3e, 0x80, 0xb7, 0x37 }, 4, F_S | F_CY },  // ... STC
+        { { 0x3e, 0x03, 0xb7, 0x37 }, 4, F_P | F_CY },  // MVI A,0x03; ORA A; STC
+    };
+    int inr_b = label(p);
+    over = label(p);
+    emit_to(p, 0xc3, over);                 // JMP over
+    place(p, inr_b);
+    EMIT(p, 0x04, 0xc9);                    // INR B; RET
+    place(p, over);
+    for (size_t s = 0; s < sizeof(setups) / sizeof(setups[0]); s++) {
+        for (int cc = 0; cc < 8; cc++) {
+            uint8_t jcc = 0xc2 | (cc << 3), ccc = 0xc4 | (cc << 3), rcc = 0xc0 | (cc << 3);
+            int taken = condition_holds(jcc, setups[s].flags);
+
+            // Jcc
+            target = label(p);
+            EMIT(p, 0x06, 0x00);            // MVI B,0
+            emit(p, setups[s].code, setups[s].len);
+            emit_to(p, jcc, target);
+            EMIT(p, 0x04);                  // INR B
+            place(p, target);
+            EMIT(p, 0x78);                  // MOV A,B
+            check_a(p, !taken);
+
+            // Ccc
+            EMIT(p, 0x06, 0x00);            // MVI B,0
+            emit(p, setups[s].code, setups[s].len);
+            emit_to(p, ccc, inr_b);
+            EMIT(p, 0x78);                  // MOV A,B
+            check_a(p, taken);
+
+            // Rcc, from a subroutine
+            sub = label(p);
+            over = label(p);
+            emit_to(p, 0xc3, over);         // JMP over
+            place(p, sub);
+            EMIT(p, rcc, 0x04, 0xc9);       // Rcc; INR B; RET
+            place(p, over);
+            EMIT(p, 0x06, 0x00);            // MVI B,0
+            emit(p, setups[s].code, setups[s].len);
+            emit_to(p, 0xcd, sub);          // CALL sub
+            EMIT(p, 0x78);                  // MOV A,B
+            check_a(p, !taken);
+        }
+    }
+
+    // everything returned
+    EMIT(p, 0x21, 0x00, 0x00, 0x39);        // LXI H,0; DAD SP
+    EMIT(p, 0x7c);                          // MOV A,H
+    check_a(p, STACK_TOP >> 8);
+    EMIT(p, 0x7d);                          // MOV A,L
+    check_a(p, STACK_TOP & 0xff);
+}
+
+
+/*
+ * Raises RST 7 with OUT CPM_PORT_INT
+ */
+static void raise(Program *p) {
+    EMIT(p, 0x3e, 7, 0xd3, CPM_PORT_INT);   // MVI A,7; OUT CPM_PORT_INT
+}
+
+
+static void interrupt_checks(Program *p) {
+    // the RST 7 handler counts itself and saves B
+    // and where it was taken
+    int handler = label(p);
+    int count = label(p);
+    int saved_b = label(p);
+    int saved_ret = label(p);
+    int over = label(p);
+    emit_to(p, 0xc3, over);                 // JMP over
+    place(p, handler);
+    int start = p->len;
+    emit_to(p, 0x21, count);                // LXI H,count
+    EMIT(p, 0x34, 0x78);                    // INR M; MOV A,B
+    emit_to(p, 0x32, saved_b);              // STA saved_b
+    EMIT(p, 0xe1, 0xe5);                    // POP H; PUSH H
+    emit_to(p, 0x22, saved_ret);            // SHLD saved_ret
+    EMIT(p, 0xc9);                          // RET
+    uint8_t len = p->len - start;
+    place(p, count);
+    EMIT(p, 0x00);
+    place(p, saved_b);
+    EMIT(p, 0x00);
+    place(p, saved_ret);
+    EMIT(p, 0x00, 0x00);
+    place(p, over);
+    install(p, 0x38, handler, len);
+
+    // latched while disabled, and not taken
+    EMIT(p, 0xf3);                          // DI
+    raise(p);
+    EMIT(p, 0x00, 0x00);                    // NOP; NOP
+    emit_to(p, 0x3a, count);                // LDA count
+    check_a(p, 0);
+
+    // EI lets one more instruction run first
+    int ret = label(p);
+    EMIT(p, 0x06, 0x00, 0xfb, 0x04);        // MVI B,0; EI; INR B
+    place(p, ret);
+    EMIT(p, 0x04);                          // INR B
+    emit_to(p, 0x3a, count);                // LDA count
+    check_a(p, 1);
+    emit_to(p, 0x3a, saved_b);              // LDA saved_b
+    check_a(p, 1);
+    emit_to(p, 0x2a, saved_ret);            // LHLD saved_ret
+    check_hl(p, ret);
+    EMIT(p, 0x78);                          // MOV A,B
+    check_a(p, 2);
+
+    // taking it disabled interrupts, so the next one waits
+    raise(p);
+    EMIT(p, 0x00, 0x00);                    // NOP; NOP
+    emit_to(p, 0x3a, count);                // LDA count
+    check_a(p, 1);
+    ret = label(p);
+    EMIT(p, 0x06, 0x00, 0xfb, 0x04);        // MVI B,0; EI; INR B
+    place(p, ret);
+    emit_to(p, 0x3a, count);                // LDA count
+    check_a(p, 2);
+    emit_to(p, 0x2a, saved_ret);            // LHLD saved_ret
+    check_hl(p, ret);
+
+    // raised while enabled: taken straight after the OUT
+    ret = label(p);
+    EMIT(p, 0xfb, 0x00, 0x06, 0x55);        // EI; NOP; MVI B,0x55
+    raise(p);
+    place(p, ret);
+    EMIT(p, 0x06, 0x66);                    // MVI B,0x66
+    emit_to(p, 0x3a, count);                // LDA count
+    check_a(p, 3);
+    emit_to(p, 0x3a, saved_b);              // LDA saved_b
+    check_a(p, 0x55);
+    emit_to(p, 0x2a, saved_ret);            // LHLD saved_ret
+    check_hl(p, ret);
+
+    // DI straight after EI keeps it out
+    EMIT(p, 0xf3);                          // DI
+    raise(p);
+    EMIT(p, 0xfb, 0xf3, 0x00);              // EI; DI; NOP
+    emit_to(p, 0x3a, count);                // LDA count
+    check_a(p, 3);
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s DIR\n", argv[0]);
+        return 1;
+    }
+
+    static Program p;
+    char path[4096];
+    int status = 0;
+
+    begin(&p);
+    vector_checks(&p, alu_vectors, sizeof(alu_vectors) / sizeof(alu_vectors[0]));
+    snprintf(path, sizeof(path), "%s/alu.com", argv[1]);
+    status |= finish(&p, path);
+
+    begin(&p);
+    vector_checks(&p, daa_vectors, sizeof(daa_vectors) / sizeof(daa_vectors[0]));
+    snprintf(path, sizeof(path), "%s/daa.com", argv[1]);
+    status |= finish(&p, path);
+
+    begin(&p);
+    flow_checks(&p);
+    snprintf(path, sizeof(path), "%s/flow.com", argv[1]);
+    status |= finish(&p, path);
+
+    begin(&p);
+    interrupt_checks(&p);
+    snprintf(path, sizeof(path), "%s/int.com", argv[1]);
+    status |= finish(&p, path);
+
+    return status ? 1 : 0;
+}